@@ -0,0 +1,333 @@
+#version 450 core
+
+// Linear BVH build of the triangles of a model (Karras, "Maximizing
+// Parallelism in the Construction of BVHs, Octrees, and k-d Trees"), run by
+// GPU_BVHBuilder one stage per dispatch:
+// - the bounds of the triangle centroids
+// - a 30-bit Morton code per triangle, in those bounds
+// - a radix sort of the codes, 4 bits per pass, each pass counting the digits
+//   of the blocks, scanning the counts, then scattering the blocks
+// - the internal nodes, from the sorted codes, each writing its leaf children
+// - the bounds, from the leaves up to the root
+// The nodes are written in the BVH_Node layout of RaytracingCommon.glsl,
+// children next to each other: internal node i of the Karras tree, whose
+// children split at gamma, has them at 2 * gamma + 1 and 2 * gamma + 2, the
+// root being at 0. A leaf holds one triangle.
+
+#include "GeometryCommon.glsl"
+
+#define BLOCK_SIZE 256
+#define RADIX_BITS 4
+#define RADIX (1 << RADIX_BITS)
+
+#define STAGE_CENTROID_BOUNDS 0
+#define STAGE_MORTON_CODES 1
+#define STAGE_COUNT_DIGITS 2
+#define STAGE_SCAN_COUNTS 3
+#define STAGE_SCATTER 4
+#define STAGE_HIERARCHY 5
+#define STAGE_REFIT 6
+
+layout(local_size_x = BLOCK_SIZE) in;
+
+struct BVH_Node {
+    vec3 min;
+    int triangle_count;
+    vec3 max;
+    int offset;
+};
+
+// The bounds are written by other work groups during the refit
+layout(binding = 2, std430) coherent buffer BVHBuffer {
+    BVH_Node nodes[];
+};
+
+// Morton code and triangle, sorted from the source into the destination
+layout(binding = 3, std430) buffer SourceBuffer {
+    uvec2 elements[];
+};
+layout(binding = 4, std430) buffer DestinationBuffer {
+    uvec2 sorted_elements[];
+};
+
+// Digit count of each block, all the blocks of a digit after each other,
+// then the first position of each in the destination after the scan
+layout(binding = 5, std430) buffer CountBuffer {
+    uint counts[];
+};
+
+// Parent of each node, and the number of children of each internal node that
+// reached it during the refit
+layout(binding = 6, std430) coherent buffer LinkBuffer {
+    int parents[];
+};
+layout(binding = 7, std430) coherent buffer VisitBuffer {
+    uint visits[];
+};
+
+// Order preserving integers of the floats, see orderedBits()
+layout(binding = 8, std430) buffer CentroidBoundsBuffer {
+    uint centroid_min[3];
+    uint centroid_max[3];
+};
+
+uniform int stage;
+uniform int numOfTriangles;
+// Of the model in the geometry arena, see Model in RaytracingCommon.glsl
+uniform int triangleOffset;
+uniform int vertexOffset;
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+// Of the root in the nodes
+uniform int nodeOffset;
+// Of the digit sorted by this pass
+uniform int shift;
+
+shared uint shared_min[3];
+shared uint shared_max[3];
+shared uint shared_counts[RADIX];
+// Inclusive scan of the digits of the block, 16-bit counts packed by two
+shared uvec4 shared_scan[2][BLOCK_SIZE];
+
+Triangle triangleAt(int index) {
+    uvec3 triangle_indices = getTriangleIndices(triangleOffset + index) + uint(vertexOffset);
+    return getTriangle(triangle_indices, positionOffset, positionScale);
+}
+
+// The unsigned integers compare as the floats do
+uint orderedBits(float f) {
+    uint bits = floatBitsToUint(f);
+    return (bits & 0x80000000u) != 0u ? ~bits : bits | 0x80000000u;
+}
+
+float fromOrderedBits(uint bits) {
+    return uintBitsToFloat((bits & 0x80000000u) != 0u ? bits & 0x7FFFFFFFu : ~bits);
+}
+
+// 10 bits spread over 30, two zeros between each
+uint expandBits(uint v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+void centroidBounds(int index) {
+    if(gl_LocalInvocationIndex < 3) {
+        shared_min[gl_LocalInvocationIndex] = 0xFFFFFFFFu;
+        shared_max[gl_LocalInvocationIndex] = 0u;
+    }
+    barrier();
+    if(index < numOfTriangles) {
+        Triangle triangle = triangleAt(index);
+        vec3 center = (triangle.a + triangle.b + triangle.c) / 3.0;
+        for(int axis = 0; axis < 3; axis++) {
+            atomicMin(shared_min[axis], orderedBits(center[axis]));
+            atomicMax(shared_max[axis], orderedBits(center[axis]));
+        }
+    }
+    barrier();
+    if(gl_LocalInvocationIndex < 3) {
+        atomicMin(centroid_min[gl_LocalInvocationIndex], shared_min[gl_LocalInvocationIndex]);
+        atomicMax(centroid_max[gl_LocalInvocationIndex], shared_max[gl_LocalInvocationIndex]);
+    }
+}
+
+void mortonCode(int index) {
+    if(index >= numOfTriangles)
+        return;
+    vec3 minp = vec3(fromOrderedBits(centroid_min[0]), fromOrderedBits(centroid_min[1]), fromOrderedBits(centroid_min[2]));
+    vec3 maxp = vec3(fromOrderedBits(centroid_max[0]), fromOrderedBits(centroid_max[1]), fromOrderedBits(centroid_max[2]));
+    Triangle triangle = triangleAt(index);
+    vec3 center = (triangle.a + triangle.b + triangle.c) / 3.0;
+    vec3 extent = maxp - minp;
+    vec3 position = clamp((center - minp) / max(extent, vec3(1e-30)), 0.0, 1.0);
+    uvec3 cell = uvec3(min(position * 1024.0, vec3(1023.0)));
+    uint code = (expandBits(cell.x) << 2) | (expandBits(cell.y) << 1) | expandBits(cell.z);
+    elements[index] = uvec2(code, uint(index));
+}
+
+uint digitOf(uint code) {
+    return (code >> uint(shift)) & uint(RADIX - 1);
+}
+
+void countDigits(int index) {
+    if(gl_LocalInvocationIndex < RADIX)
+        shared_counts[gl_LocalInvocationIndex] = 0u;
+    barrier();
+    if(index < numOfTriangles)
+        atomicAdd(shared_counts[digitOf(elements[index].x)], 1u);
+    barrier();
+    uint numOfBlocks = gl_NumWorkGroups.x;
+    if(gl_LocalInvocationIndex < RADIX)
+        counts[gl_LocalInvocationIndex * numOfBlocks + gl_WorkGroupID.x] = shared_counts[gl_LocalInvocationIndex];
+}
+
+// Exclusive scan of the counts by a single work group, each invocation
+// summing a contiguous chunk of them
+void scanCounts(int numOfCounts) {
+    uint invocation = gl_LocalInvocationIndex;
+    int chunk = (numOfCounts + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int first = int(invocation) * chunk;
+    int last = min(first + chunk, numOfCounts);
+    uint sum = 0u;
+    for(int i = first; i < last; i++)
+        sum += counts[i];
+
+    int source = 0;
+    shared_scan[0][invocation] = uvec4(sum, 0u, 0u, 0u);
+    barrier();
+    for(uint offset = 1u; offset < BLOCK_SIZE; offset *= 2u) {
+        uint value = shared_scan[source][invocation].x;
+        if(invocation >= offset)
+            value += shared_scan[source][invocation - offset].x;
+        shared_scan[1 - source][invocation].x = value;
+        source = 1 - source;
+        barrier();
+    }
+
+    uint position = shared_scan[source][invocation].x - sum;
+    for(int i = first; i < last; i++) {
+        uint count = counts[i];
+        counts[i] = position;
+        position += count;
+    }
+}
+
+// Stable: the elements of a digit keep their order in the block, after those
+// of the previous blocks
+void scatter(int index) {
+    uint invocation = gl_LocalInvocationIndex;
+    bool valid = index < numOfTriangles;
+    uvec2 element = valid ? elements[index] : uvec2(0u);
+    uint digit = digitOf(element.x);
+
+    uvec4 own[2] = uvec4[2](uvec4(0u), uvec4(0u));
+    if(valid)
+        own[digit / 8u][(digit / 2u) % 4u] = 1u << (16u * (digit % 2u));
+
+    shared_scan[0][invocation] = own[0];
+    shared_scan[1][invocation] = own[1];
+    barrier();
+    // Both halves of the packed counts, in place, reading before writing
+    for(uint offset = 1u; offset < BLOCK_SIZE; offset *= 2u) {
+        uvec4 low = shared_scan[0][invocation];
+        uvec4 high = shared_scan[1][invocation];
+        if(invocation >= offset) {
+            low += shared_scan[0][invocation - offset];
+            high += shared_scan[1][invocation - offset];
+        }
+        barrier();
+        shared_scan[0][invocation] = low;
+        shared_scan[1][invocation] = high;
+        barrier();
+    }
+
+    if(valid) {
+        uint inclusive = shared_scan[digit / 8u][invocation][(digit / 2u) % 4u];
+        uint rank = ((inclusive >> (16u * (digit % 2u))) & 0xFFFFu) - 1u;
+        uint numOfBlocks = gl_NumWorkGroups.x;
+        sorted_elements[counts[digit * numOfBlocks + gl_WorkGroupID.x] + rank] = element;
+    }
+}
+
+// Length of the common prefix of the codes of the sorted elements, the
+// indices breaking the ties, -1 out of range
+int commonPrefix(int i, int j) {
+    if(j < 0 || j >= numOfTriangles)
+        return -1;
+    uint a = elements[i].x;
+    uint b = elements[j].x;
+    if(a == b)
+        return 32 + 31 - findMSB(uint(i ^ j));
+    return 31 - findMSB(a ^ b);
+}
+
+void writeLeaf(int slot, int element) {
+    int triangle_index = int(elements[element].y);
+    Triangle triangle = triangleAt(triangle_index);
+    nodes[nodeOffset + slot] = BVH_Node(
+        min(triangle.a, min(triangle.b, triangle.c)), 1,
+        max(triangle.a, max(triangle.b, triangle.c)), triangle_index);
+}
+
+void hierarchy(int i) {
+    if(numOfTriangles == 1 && i == 0) {
+        writeLeaf(0, 0);
+        parents[0] = -1;
+        return;
+    }
+    if(i >= numOfTriangles - 1)
+        return;
+
+    // Direction of the range of the node from i, the other end at j
+    int d = commonPrefix(i, i + 1) > commonPrefix(i, i - 1) ? 1 : -1;
+    int min_prefix = commonPrefix(i, i - d);
+    int max_length = 2;
+    while(commonPrefix(i, i + max_length * d) > min_prefix)
+        max_length *= 2;
+    int length = 0;
+    for(int t = max_length / 2; t >= 1; t /= 2) {
+        if(commonPrefix(i, i + (length + t) * d) > min_prefix)
+            length += t;
+    }
+    int j = i + length * d;
+
+    // Where the codes of the range split
+    int node_prefix = commonPrefix(i, j);
+    int split = 0;
+    for(int t = (length + 1) / 2; ; t = (t + 1) / 2) {
+        if(commonPrefix(i, i + (split + t) * d) > node_prefix)
+            split += t;
+        if(t == 1)
+            break;
+    }
+    int gamma = i + split * d + min(d, 0);
+
+    // A left child ends at its index, a right child starts at it
+    int slot = i == 0 ? 0 : (d > 0 ? 2 * i : 2 * i + 1);
+    int first_child = 2 * gamma + 1;
+    nodes[nodeOffset + slot].triangle_count = 0;
+    nodes[nodeOffset + slot].offset = first_child;
+    if(i == 0)
+        parents[0] = -1;
+    parents[first_child] = slot;
+    parents[first_child + 1] = slot;
+    if(min(i, j) == gamma)
+        writeLeaf(first_child, gamma);
+    if(max(i, j) == gamma + 1)
+        writeLeaf(first_child + 1, gamma + 1);
+}
+
+// From each leaf up, the second child to reach a node computing its bounds
+void refit(int slot) {
+    if(slot >= 2 * numOfTriangles - 1 || nodes[nodeOffset + slot].triangle_count == 0)
+        return;
+    int current = slot;
+    while(current != 0) {
+        int parent = parents[current];
+        memoryBarrierBuffer();
+        if(atomicAdd(visits[parent], 1u) == 0u)
+            return;
+        int first_child = nodes[nodeOffset + parent].offset;
+        BVH_Node left = nodes[nodeOffset + first_child];
+        BVH_Node right = nodes[nodeOffset + first_child + 1];
+        nodes[nodeOffset + parent].min = min(left.min, right.min);
+        nodes[nodeOffset + parent].max = max(left.max, right.max);
+        current = parent;
+    }
+}
+
+void main() {
+    int index = int(gl_GlobalInvocationID.x);
+    switch(stage) {
+        case STAGE_CENTROID_BOUNDS: centroidBounds(index); break;
+        case STAGE_MORTON_CODES: mortonCode(index); break;
+        case STAGE_COUNT_DIGITS: countDigits(index); break;
+        case STAGE_SCAN_COUNTS: scanCounts(RADIX * ((numOfTriangles + BLOCK_SIZE - 1) / BLOCK_SIZE)); break;
+        case STAGE_SCATTER: scatter(index); break;
+        case STAGE_HIERARCHY: hierarchy(index); break;
+        case STAGE_REFIT: refit(index); break;
+    }
+}
@@ -0,0 +1,182 @@
+#version 450 core
+
+// Builds the draw command of every model for the multi-draw of the
+// rasterizer: frustum culling, then level of detail selection. The command of
+// model i is always at index i, with no instance when the model is culled, so
+// that gl_DrawID is the index of the model.
+
+layout(local_size_x = 64) in;
+
+// Mesh::MAX_LODS, checked by a static_assert next to DrawBlock
+#define MAX_LODS 6
+
+layout(std140, binding = 0) uniform CameraBlock {
+    mat4 viewMat;
+    mat4 projectionMat;
+    mat4 invViewMat;
+    mat4 invProjectionMat;
+    vec3 eye;
+    float zNear;
+    vec2 resolution;
+    float zFar;
+};
+
+struct Material {
+    vec3 albedo;
+    float roughness;
+    vec3 F0;
+    float metalness;
+    bool transparent;
+    float base_reflectance;
+    float ior;
+    float absorption;
+    int albedoTex;
+    int roughnessTex;
+    int aoTex;
+    int metalnessTex;
+    int normalTex;
+    int heightTex;
+    float heightMult;
+};
+
+// See ModelBlock in core/UniformBlocks.h
+struct Model {
+    mat4 modelMat;
+    mat4 normalMat;
+    vec4 positionOffset;
+    vec4 positionScale;
+    Material material;
+};
+
+// See DrawBlock in core/UniformBlocks.h
+struct Draw {
+    vec4 boundsMin;
+    vec4 boundsMax;
+    vec4 boundingSphere;
+    uint firstVertex;
+    uint numOfLODs;
+    uint occluded;
+    uint padding;
+    // First index, number of indices, error
+    uvec4 lods[MAX_LODS + 1];
+};
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(binding = 5, std430) readonly buffer ModelTable {
+    Model models[];
+};
+
+layout(binding = 6, std430) readonly buffer DrawTable {
+    Draw draws[];
+};
+
+layout(binding = 7, std430) writeonly buffer DrawCommands {
+    DrawCommand commands[];
+};
+
+// Level of detail of each model at the last frame it was drawn
+layout(binding = 8, std430) buffer LODStates {
+    uint lodStates[];
+};
+
+layout(binding = 9, std430) buffer DrawStats {
+    uint drawnModels;
+    uint drawnTriangles;
+    uint culledModels;
+};
+
+uniform int numOfModels;
+uniform bool frustumCulling;
+uniform bool useLODs;
+// Whether to keep the levels selected into LODStates
+uniform bool updateLODStates;
+uniform float lodPixelError;
+// Whether to count into DrawStats
+uniform bool drawStats;
+
+// Same planes as primitives/Frustum.h
+bool inFrustum(vec3 boundsMin, vec3 boundsMax) {
+    mat4 rows = transpose(projectionMat * viewMat);
+    for (int i = 0; i < 6; i++) {
+        int axis = i / 2;
+        vec4 plane = (i % 2 == 0) ? rows[3] + rows[axis] : rows[3] - rows[axis];
+        // Corner of the box the furthest along the normal
+        vec3 front = mix(boundsMin, boundsMax, greaterThan(plane.xyz, vec3(0.0)));
+        if (dot(plane.xyz, front) + plane.w < 0.0) return false;
+    }
+    return true;
+}
+
+// Radius of the bounding sphere on screen in pixels, negative when the camera
+// is inside of it
+float projectedRadius(Draw draw, mat4 modelViewMat) {
+    mat3 linear = mat3(modelViewMat);
+    float scale = max(length(linear[0]), max(length(linear[1]), length(linear[2])));
+    vec3 center = (modelViewMat * vec4(draw.boundingSphere.xyz, 1.0)).xyz;
+    float radius = scale * draw.boundingSphere.w;
+    float distance = length(center);
+    if (distance <= radius) return -1.0;
+    // projectionMat[1][1] is 1 / tan(fov / 2)
+    return radius * 0.5 * resolution.y * projectionMat[1][1] / distance;
+}
+
+float pixelError(Draw draw, uint level, float radius) {
+    if (level == 0) return 0.0;
+    return uintBitsToFloat(draw.lods[level].z) / draw.boundingSphere.w * radius;
+}
+
+// Port of Rasterizer::selectLOD, with the same hysteresis
+uint selectLOD(uint index, Draw draw) {
+    if (!useLODs || draw.numOfLODs == 0 || draw.boundingSphere.w <= 0.0) return 0;
+    float radius = projectedRadius(draw, viewMat * models[index].modelMat);
+    if (radius < 0.0) return 0;
+
+    const float HYSTERESIS = 0.25;
+    uint lod = min(lodStates[index], draw.numOfLODs);
+    if (pixelError(draw, lod, radius) > lodPixelError) {
+        while (lod > 0 && pixelError(draw, lod, radius) > lodPixelError) lod--;
+    } else {
+        while (lod < draw.numOfLODs &&
+               pixelError(draw, lod + 1, radius) <= lodPixelError / (1.0 + HYSTERESIS))
+            lod++;
+    }
+    return lod;
+}
+
+void main() {
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= uint(numOfModels)) return;
+
+    Draw draw = draws[index];
+    DrawCommand command;
+    command.instanceCount = 0;
+    command.baseVertex = int(draw.firstVertex);
+    command.baseInstance = 0;
+    command.firstIndex = draw.lods[0].x;
+    command.count = draw.lods[0].y;
+
+    bool visible = draw.occluded == 0;
+    if (visible && frustumCulling && !inFrustum(draw.boundsMin.xyz, draw.boundsMax.xyz)) {
+        visible = false;
+        if (drawStats) atomicAdd(culledModels, 1);
+    }
+    if (visible) {
+        uint lod = selectLOD(index, draw);
+        if (updateLODStates) lodStates[index] = lod;
+        command.instanceCount = 1;
+        command.firstIndex = draw.lods[lod].x;
+        command.count = draw.lods[lod].y;
+        if (drawStats) {
+            atomicAdd(drawnModels, 1);
+            atomicAdd(drawnTriangles, command.count / 3);
+        }
+    }
+    commands[index] = command;
+}
@@ -1,6 +1,6 @@
-#version 410 core
+#version 420 core
 
-uniform sampler2D imageTex;
+layout(binding = 0) uniform sampler2D imageTex;
 
 in vec2 fTexCoord;
 
@@ -0,0 +1,80 @@
+// Triangles of the scene geometry arena, shared by the ray tracing and the
+// BVH build shaders
+
+struct Triangle {
+    vec3 a;
+    vec3 b;
+    vec3 c;
+};
+
+// Scene geometry arena, the layout depends on GeometryArena::VERTEX_FORMAT:
+// 0: position, u, normal, v, tangent, handedness as floats (12 words)
+// 1: position as floats, octahedral normal, octahedral tangent with the
+//    handedness in its lowest bit, half-float UV (6 words)
+// 2: same as 1 with the position on 3x16 bits in the mesh bounds (5 words)
+layout(binding = 0, std430) readonly buffer VertexBuffer {
+    uint vertex_data[];
+};
+
+uniform int vertexFormat;
+
+uint vertexBase(uint index) {
+    return index * (vertexFormat == 0 ? 12u : (vertexFormat == 1 ? 6u : 5u));
+}
+
+vec3 octDecode(uint encoded) {
+    vec2 e = unpackSnorm2x16(encoded);
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+// Still has to be scaled and offset for quantized positions
+vec3 vertexPosition(uint index) {
+    uint base = vertexBase(index);
+    if(vertexFormat == 2)
+        return vec3(unpackUnorm2x16(vertex_data[base]), unpackUnorm2x16(vertex_data[base + 1]).x);
+    return uintBitsToFloat(uvec3(vertex_data[base], vertex_data[base + 1], vertex_data[base + 2]));
+}
+
+vec3 vertexNormal(uint index) {
+    uint base = vertexBase(index);
+    if(vertexFormat == 0)
+        return uintBitsToFloat(uvec3(vertex_data[base + 4], vertex_data[base + 5], vertex_data[base + 6]));
+    return octDecode(vertex_data[base + (vertexFormat == 1 ? 3u : 2u)]);
+}
+
+// w is the handedness of the bitangent
+vec4 vertexTangent(uint index) {
+    uint base = vertexBase(index);
+    if(vertexFormat == 0)
+        return uintBitsToFloat(uvec4(vertex_data[base + 8], vertex_data[base + 9], vertex_data[base + 10], vertex_data[base + 11]));
+    uint encoded = vertex_data[base + (vertexFormat == 1 ? 4u : 3u)];
+    return vec4(octDecode(encoded), (encoded & 1u) != 0u ? -1.0 : 1.0);
+}
+
+vec2 vertexUV(uint index) {
+    uint base = vertexBase(index);
+    if(vertexFormat == 0)
+        return uintBitsToFloat(uvec2(vertex_data[base + 3], vertex_data[base + 7]));
+    return unpackHalf2x16(vertex_data[base + (vertexFormat == 1 ? 5u : 4u)]);
+}
+
+// Index buffer shared with the rasterizer, 3 indices per triangle
+layout(binding = 1, std430) readonly buffer IndexBuffer {
+    uint indices[];
+};
+
+uvec3 getTriangleIndices(int triangle) {
+    return uvec3(indices[3 * triangle], indices[3 * triangle + 1], indices[3 * triangle + 2]);
+}
+
+Triangle getTriangle(uvec3 triangle_indices, vec3 offset, vec3 scale) {
+    return Triangle(
+        offset + scale * vertexPosition(triangle_indices.x),
+        offset + scale * vertexPosition(triangle_indices.y),
+        offset + scale * vertexPosition(triangle_indices.z)
+    );
+}
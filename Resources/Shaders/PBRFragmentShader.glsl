@@ -25,8 +25,10 @@ struct LightSource {
     float aq;
 };
 
-uniform LightSource lights[MAX_LIGHTS];
-uniform int numOfLights;
+layout(std140, binding = 2) uniform LightsBlock {
+    LightSource lights[MAX_LIGHTS];
+    int numOfLights;
+};
 
 struct Material {
     vec3 albedo;
@@ -50,21 +52,50 @@ struct Material {
     int padding2;
 };
 
-uniform Material material;
-
 struct ImageParameters {
     bool colorCorrect;
     bool useSRGB;
     bool useToneMapping;
     bool useExposure;
     float exposure;
+    bool raytracedShadows;
+    bool raytracedReflections;
+    int numRefractions;
 };
 
-uniform ImageParameters imageParameters;
+layout(std140, binding = 1) uniform ImageBlock {
+    ImageParameters imageParameters;
+    vec3 backgroundColor;
+};
+
+// Uniform blocks, see core/UniformBlocks.h
+layout(std140, binding = 0) uniform CameraBlock {
+    mat4 viewMat;
+    mat4 projectionMat;
+    mat4 invViewMat;
+    mat4 invProjectionMat;
+    vec3 eye;
+    float zNear;
+    vec2 resolution;
+    float zFar;
+};
+
+// Model table, see ModelBlock in core/UniformBlocks.h
+struct Model {
+    mat4 modelMat;
+    mat4 normalMat;
+    vec4 positionOffset;
+    vec4 positionScale;
+    Material material;
+};
+
+layout(binding = 5, std430) readonly buffer ModelTable {
+    Model models[];
+};
 
-uniform vec3 eye;
+flat in int fModel;
 
-uniform sampler2D textures[MAX_TEXTURES];
+layout(binding = 0) uniform sampler2D textures[MAX_TEXTURES];
 
 vec4 sampleTex(in vec2 uv, in int index, in vec4 fallback) {
     if(index < 0) return fallback;
@@ -192,6 +223,7 @@ vec3 evaluateRadiance(Material mat, LightSource source, vec3 normal, vec3 pos) {
 }
 
 void main() {
+    Material material = models[fModel].material;
     vec3 radiance;
 
     vec3 normal = normalize(fNormal);
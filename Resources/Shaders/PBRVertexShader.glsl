@@ -1,12 +1,62 @@
-#version 410 core // Minimal GL version support expected from the GPU
+#version 450 core // Storage buffers for vertex pulling
+#extension GL_ARB_shader_draw_parameters : require
 
-layout(location=0) in vec3 vPosition; // The 1st input attribute is the position (CPU side: glVertexAttrib 0)
-layout(location=1) in vec3 vNormal;
-layout(location=2) in vec2 vUV;
-layout(location=3) in vec3 vTangent;
-layout(location=4) in vec3 vBitangent;
+// Scene geometry arena, the same buffer the GPU ray tracer reads. gl_VertexID
+// already includes the base vertex of the mesh. The layout depends on
+// GeometryArena::VERTEX_FORMAT:
+// 0: position, u, normal, v, tangent, handedness as floats (12 words)
+// 1: position as floats, octahedral normal, octahedral tangent with the
+//    handedness in its lowest bit, half-float UV (6 words)
+// 2: same as 1 with the position on 3x16 bits in the mesh bounds (5 words)
+layout(binding = 0, std430) readonly buffer VertexBuffer {
+    uint vertex_data[];
+};
+
+uniform int vertexFormat;
+
+uint vertexBase(uint index) {
+    return index * (vertexFormat == 0 ? 12u : (vertexFormat == 1 ? 6u : 5u));
+}
+
+vec3 octDecode(uint encoded) {
+    vec2 e = unpackSnorm2x16(encoded);
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
 
-uniform mat4 projectionMat, modelViewMat, normalMat, modelMat; // Uniform variables, set from the CPU-side main program
+// Still has to be scaled and offset for quantized positions
+vec3 vertexPosition(uint index) {
+    uint base = vertexBase(index);
+    if(vertexFormat == 2)
+        return vec3(unpackUnorm2x16(vertex_data[base]), unpackUnorm2x16(vertex_data[base + 1]).x);
+    return uintBitsToFloat(uvec3(vertex_data[base], vertex_data[base + 1], vertex_data[base + 2]));
+}
+
+vec3 vertexNormal(uint index) {
+    uint base = vertexBase(index);
+    if(vertexFormat == 0)
+        return uintBitsToFloat(uvec3(vertex_data[base + 4], vertex_data[base + 5], vertex_data[base + 6]));
+    return octDecode(vertex_data[base + (vertexFormat == 1 ? 3u : 2u)]);
+}
+
+// w is the handedness of the bitangent
+vec4 vertexTangent(uint index) {
+    uint base = vertexBase(index);
+    if(vertexFormat == 0)
+        return uintBitsToFloat(uvec4(vertex_data[base + 8], vertex_data[base + 9], vertex_data[base + 10], vertex_data[base + 11]));
+    uint encoded = vertex_data[base + (vertexFormat == 1 ? 4u : 3u)];
+    return vec4(octDecode(encoded), (encoded & 1u) != 0u ? -1.0 : 1.0);
+}
+
+vec2 vertexUV(uint index) {
+    uint base = vertexBase(index);
+    if(vertexFormat == 0)
+        return uintBitsToFloat(uvec2(vertex_data[base + 3], vertex_data[base + 7]));
+    return unpackHalf2x16(vertex_data[base + (vertexFormat == 1 ? 5u : 4u)]);
+}
 
 struct Material {
     vec3 albedo;
@@ -30,27 +80,67 @@ struct Material {
     int padding2;
 };
 
-uniform Material material;
+// Uniform blocks, see core/UniformBlocks.h
+layout(std140, binding = 0) uniform CameraBlock {
+    mat4 viewMat;
+    mat4 projectionMat;
+    mat4 invViewMat;
+    mat4 invProjectionMat;
+    vec3 eye;
+    float zNear;
+    vec2 resolution;
+    float zFar;
+};
+
+// Model table, see ModelBlock in core/UniformBlocks.h
+struct Model {
+    mat4 modelMat;
+    mat4 normalMat;
+    // Decode quantized positions: offset + scale * stored position
+    vec4 positionOffset;
+    vec4 positionScale;
+    Material material;
+};
+
+layout(binding = 5, std430) readonly buffer ModelTable {
+    Model models[];
+};
+
+// Model of the draw, or -1 in the multi-draw whose draws are the models
+uniform int modelIndex;
 
 #define MAX_TEXTURES 16
-uniform sampler2D textures[MAX_TEXTURES];
+layout(binding = 0) uniform sampler2D textures[MAX_TEXTURES];
 
 out vec3 fNormal;
 out vec3 fPos;
 out vec2 fUV;
 out vec3 fTangent;
 out vec3 fBitangent;
+flat out int fModel;
 
 void main() {
+    int model = modelIndex >= 0 ? modelIndex : gl_DrawIDARB;
+    mat4 modelMat = models[model].modelMat;
+    mat4 normalMat = models[model].normalMat;
+    Material material = models[model].material;
+
+    uint index = uint(gl_VertexID);
+    vec3 vPosition = models[model].positionOffset.xyz + models[model].positionScale.xyz * vertexPosition(index);
+    vec3 vNormal = vertexNormal(index);
+    vec2 vUV = vertexUV(index);
+    vec4 tangent = vertexTangent(index);
+    vec3 vTangent = tangent.xyz;
+    vec3 vBitangent = tangent.w * cross(vNormal, vTangent);
+
     vec3 pos = vPosition;
     if(material.heightTex != -1) {
         pos += normalize(vNormal) * ((texture(textures[material.heightTex], vUV).r - 0.5) * material.heightMult);
     }
-	vec4 p = modelViewMat * vec4 (pos, 1.0);
     vec4 world_p = modelMat * vec4 (pos, 1.0);
-    gl_Position =  projectionMat * p; // mandatory to fire rasterization properly
+    gl_Position =  projectionMat * viewMat * world_p; // mandatory to fire rasterization properly
     fPos = world_p.xyz;
-    mat4 normalMat = transpose(inverse(modelMat));
+    fModel = model;
     fNormal = (normalMat * vec4 (normalize (vNormal), 0.0)).xyz;
     fUV = vUV;
     fTangent = (normalMat * vec4 (normalize (vTangent), 0.0)).xyz;
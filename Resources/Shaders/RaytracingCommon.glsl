@@ -0,0 +1,846 @@
+// Ray tracing of the scene, shared by the fragment and compute shader paths
+// of GPU_Raytracer: include it after the #version line, then call
+// tracePixel(), accumulateSample() and colorCorrect() for each pixel
+
+const float PI = 3.14159265358979323846;
+#define MAX_LIGHTS 10
+#define MAX_TEXTURES 16
+
+struct ImageParameters {
+    bool colorCorrect;
+    bool useSRGB;
+    bool useToneMapping;
+    bool useExposure;
+    float exposure;
+    bool raytracedShadows;
+    bool raytracedReflections;
+    int numRefractions;
+};
+
+struct LightSource {
+    int type; // 0: directional, 1: point
+    vec3 direction; // Directional light: direction, Point light: position
+    vec3 color;
+    float intensity;
+
+    // For point lights
+    float ac;
+    float al;
+    float aq;
+};
+
+struct Ray {
+    vec3 origin;
+    vec3 direction;
+    vec3 inv_direction;
+};
+
+struct Material {
+    vec3 albedo;
+    float roughness;
+    vec3 F0;
+    float metalness;
+    
+    bool transparent;
+    float base_reflectance;
+    float ior;
+    float absorption;
+
+    int albedoTex;
+    int roughnessTex;
+    int aoTex;
+    int metalnessTex;
+
+    int normalTex;
+    int heightTex;
+    float heightMult;
+    int padding2;
+};
+
+struct Hit {
+    bool hit;
+    float t;
+    vec3 position;
+    vec3 normal;
+    vec3 tangent;
+    vec3 bitangent;
+    vec2 uv;
+    int triangle_index;
+    int model_index;
+    bool backface;
+};
+
+struct Model {
+    int bvh_root;
+    int triangle_offset;
+    int triangle_count;
+    int vertex_offset;
+
+    Material material;
+    
+    mat4 transform;
+    mat4 inv_transform;
+
+    // Decode quantized positions: offset + scale * stored position
+    vec4 position_offset;
+    vec4 position_scale;
+};
+
+struct BVH_Node {
+    vec3 min;
+    int triangle_count;
+    vec3 max;
+    int offset;
+};
+
+// See CompressedBVH_Node on the CPU side: the bounds of both children are
+// quantized to 8 bits in the box of the node, with a power of two step
+struct CompressedBVH_Node {
+    float origin_x;
+    float origin_y;
+    float origin_z;
+    uint exponents;
+    uint bounds_x;
+    uint bounds_y;
+    uint bounds_z;
+    int child0;
+    int child1;
+    uint counts;
+};
+
+// See ThreadedBVH_Node on the CPU side: the nodes are visited depth first,
+// nearest child first along the ray octant, and link to the next node to
+// visit in each octant
+struct ThreadedBVH_Node {
+    vec3 min;
+    int offset;
+    vec3 max;
+    uint flags;
+    int skip[8];
+};
+
+// Uniform blocks, see core/UniformBlocks.h
+layout(std140, binding = 0) uniform CameraBlock {
+    mat4 viewMat;
+    mat4 projectionMat;
+    mat4 invViewMat;
+    mat4 invProjectionMat;
+    vec3 eye;
+    float zNear;
+    vec2 resolution;
+    float zFar;
+};
+
+layout(std140, binding = 1) uniform ImageBlock {
+    ImageParameters imageParameters;
+    vec3 backgroundColor;
+};
+
+layout(std140, binding = 2) uniform LightsBlock {
+    LightSource lights[MAX_LIGHTS];
+    int numOfLights;
+};
+
+layout(binding = 0) uniform sampler2D textures[MAX_TEXTURES];
+
+#include "GeometryCommon.glsl"
+
+layout(binding = 2, std430) readonly buffer ModelBuffer {
+    Model models[];
+};
+// The buffer is bound with room to spare, see PersistentBuffer
+uniform int numOfModels;
+
+layout(binding = 3, std430) buffer BVHBuffer {
+    BVH_Node bvh_nodes[];
+};
+
+// Used instead of the nodes above when BVH::USE_COMPRESSED_NODES is set
+layout(binding = 4, std430) readonly buffer CompressedBVHBuffer {
+    CompressedBVH_Node compressed_bvh_nodes[];
+};
+uniform bool compressedBVH;
+
+// Used instead of both with GPU_Raytracer::STACKLESS_TRAVERSAL
+layout(binding = 6, std430) readonly buffer ThreadedBVHBuffer {
+    ThreadedBVH_Node threaded_bvh_nodes[];
+};
+uniform bool stacklessBVH;
+
+// Counted with GPU_Raytracer::COUNT_TRAVERSED_NODES
+layout(binding = 7, std430) buffer TraversalStats {
+    uint traced_rays;
+    uint fetched_nodes;
+};
+uniform bool traversalStats;
+
+// Exact decoding, the steps are powers of two
+void compressedChildBounds(in CompressedBVH_Node node, int k, out vec3 minp, out vec3 maxp) {
+    vec3 origin = vec3(node.origin_x, node.origin_y, node.origin_z);
+    uvec3 exponents = (uvec3(node.exponents) >> uvec3(0, 8, 16)) & 0xFFu;
+    vec3 step = uintBitsToFloat(exponents << 23);
+    uvec3 bounds = uvec3(node.bounds_x, node.bounds_y, node.bounds_z) >> uint(16 * k);
+    minp = origin + vec3(bounds & 0xFFu) * step;
+    maxp = origin + vec3((bounds >> 8) & 0xFFu) * step;
+}
+
+vec4 sampleTex(in vec2 uv, in int index, in vec4 fallback) {
+    if(index < 0) return fallback;
+    else return texture(textures[index], uv);
+}
+
+float sqr(float x) {
+    return x * x;
+}
+
+vec3 pow3(vec3 v, int p) {
+    return vec3(pow(v.x, p), pow(v.y, p), pow(v.z, p));
+}
+
+// From https://blog.demofox.org/2020/06/06/casual-shadertoy-path-tracing-2-image-improvement-and-glossy-reflections/
+vec3 LessThan(vec3 f, float value) {
+    return vec3(
+        f.x < value ? 1.0 : 0.0,
+        f.y < value ? 1.0 : 0.0,
+        f.z < value ? 1.0 : 0.0
+    );
+}
+
+vec3 LinearToSRGB(vec3 rgb) {
+    rgb = clamp(rgb, 0.0, 1.0);
+ 
+    return mix(
+        pow(rgb, vec3(1.0 / 2.4)) * 1.055 - 0.055,
+        rgb * 12.92,
+        LessThan(rgb, 0.0031308)
+    );
+}
+ 
+vec3 SRGBToLinear(vec3 rgb) {
+    rgb = clamp(rgb, 0.0, 1.0);
+ 
+    return mix(
+        pow(((rgb + 0.055) / 1.055), vec3(2.4)),
+        rgb / 12.92,
+        LessThan(rgb, 0.04045)
+    );
+}
+
+// ACES tone mapping curve fit to go from HDR to LDR
+//https://knarkowicz.wordpress.com/2016/01/06/aces-filmic-tone-mapping-curve/
+vec3 ACESFilm(vec3 x) {
+    float a = 2.51f;
+    float b = 0.03f;
+    float c = 2.43f;
+    float d = 0.59f;
+    float e = 0.14f;
+    return clamp((x*(a*x + b)) / (x*(c*x + d) + e), 0.0f, 1.0f);
+}
+
+// Trowbridge-Reitz Normal Distribution
+float NormalDistributionGGX(vec3 n, vec3 wh, float alpha) {
+    float nom = sqr(alpha);
+    float denom = PI * sqr(1 + (sqr(alpha) - 1.0) * sqr(dot(n, wh)));
+
+    return nom / denom;
+}
+
+// Schlick approx for Fresnel term
+vec3 Fresnel(vec3 wi, vec3 wh, vec3 F0) {
+    return F0 + (1-F0) * pow(1 - max(0, dot(wi, wh)), 5);
+}
+
+// Schlick approximation for geometric term
+float G_Schlick(vec3 n, vec3 w, float alpha) {
+    float k = alpha * sqrt(2.0 / PI);
+    float dotNW = dot(n, w);
+    return dotNW / (dotNW * (1-k) + k);
+}
+
+float G_GGX(vec3 n, vec3 wi, vec3 wo, float alpha) {
+    return G_Schlick(n, wi, alpha) * G_Schlick(n, wo, alpha);
+}
+
+// F = Fs (specular) + Fd (diffuse)
+
+// Fs(wi, wo) = D*F*G / (4*dot(wi, n)*dot(wo, n))
+
+vec3 F_Specular(vec3 n, vec3 wi, vec3 wo, vec3 wh, vec3 F0, float alpha) {
+    float D = NormalDistributionGGX(n, wh, alpha);
+    vec3 F = Fresnel(wi, wh, F0);
+    float G = G_GGX(n, wi, wo, alpha);
+
+    return D * F * G / (4*dot(wi, n)*dot(wo, n));
+}
+
+vec3 evaluateRadianceDirectional(Material mat, LightSource source, vec3 n, vec3 pos, Ray ray, vec2 uv) {
+    vec3 albedo = sampleTex(uv, mat.albedoTex, vec4(mat.albedo, 1.0)).rgb;
+    vec3 fd = albedo * source.color * source.intensity / PI;
+
+    vec3 wi = -normalize(source.direction); // Light dir
+    vec3 wo = normalize(ray.origin - pos);       // Eye dir
+
+    vec3 wh = normalize(wi + wo);
+
+    float alpha = sqr(sampleTex(uv, mat.roughnessTex, vec4(mat.roughness)).x);
+
+    vec3 fs = F_Specular(n, wi, wo, wh, mat.F0, alpha) * source.color * source.intensity;
+
+    float metalness = sampleTex(uv, mat.metalnessTex, vec4(mat.metalness)).x;
+
+    return (fd * (1.0 - metalness) + metalness * fs) * max(dot(wi, n), 0.0);
+}
+
+vec3 evaluateRadiancePointLight(Material mat, LightSource source, vec3 normal, vec3 pos, Ray ray, vec2 uv) {
+    float dist = length(source.direction - pos);
+    float attenuation = 1.0 / (source.ac + dist * source.al + dist * dist * source.aq);
+    vec3 lightDir = -normalize(source.direction - pos);
+
+    LightSource new_source = LightSource(1, lightDir, source.color, source.intensity * attenuation, 0.0, 0.0, 0.0);
+
+    return evaluateRadianceDirectional(mat, new_source, normal, pos, ray, uv);
+}
+
+vec3 evaluateRadiance(Material mat, LightSource source, vec3 normal, vec3 pos, Ray ray, vec2 uv) {
+    if (source.type == 0) {
+        return evaluateRadianceDirectional(mat, source, normal, pos, ray, uv);
+    } else {
+        return evaluateRadiancePointLight(mat, source, normal, pos, ray, uv);
+    }
+}
+
+vec3 getBarycentric(in vec3 p, in Triangle t) {
+    vec3 v0 = t.b - t.a, v1 = t.c - t.a, v2 = p - t.a;
+    float d00 = dot(v0, v0);
+    float d01 = dot(v0, v1);
+    float d11 = dot(v1, v1);
+    float d20 = dot(v2, v0);
+    float d21 = dot(v2, v1);
+
+    float denom_inv = 1.0 / (d00 * d11 - d01 * d01);
+
+    float v = (d11 * d20 - d01 * d21) * denom_inv;
+    float w = (d00 * d21 - d01 * d20) * denom_inv;
+    float u = 1.0 - v - w;
+
+    return vec3(u, v, w);
+}
+
+bool triangleIntersection(in Ray ray, in Triangle triangle, inout Hit hit) {
+    float epsilon = 0.0000001;
+
+    vec3 edge1 = triangle.b - triangle.a;
+    vec3 edge2 = triangle.c - triangle.a;
+    vec3 ray_cross_e2 = cross(ray.direction, edge2);
+    float det = dot(edge1, ray_cross_e2);
+
+    if (det > -epsilon && det < epsilon)
+        return false;    // This ray is parallel to this triangle.
+
+    float inv_det = 1.0 / det;
+    vec3 s = ray.origin - triangle.a;
+    float u = inv_det * dot(s, ray_cross_e2);
+
+    if ((u < 0 && abs(u) > epsilon) || (u > 1 && abs(u - 1) > epsilon))
+        return false;
+
+    vec3 s_cross_e1 = cross(s, edge1);
+    float v = inv_det * dot(ray.direction, s_cross_e1);
+
+    if ((v < 0 && abs(v) > epsilon) || (u + v > 1 && abs(u + v - 1) > epsilon))
+        return false;
+
+    // At this stage we can compute t to find out where the intersection point is on the line.
+    float t = inv_det * dot(edge2, s_cross_e1);
+
+    if (t > epsilon) {
+        if (!hit.hit || t < hit.t) {
+            hit.hit = true;
+            hit.t = t;
+            hit.position = ray.origin + ray.direction * t;
+            hit.normal = normalize(cross(edge1, edge2));
+            // if (dot(hit.normal, ray.direction) > 0) {
+            //     hit.normal = -hit.normal;
+            //     hit.backface = true;
+            // }
+
+            return true;
+        }
+
+    }
+    return false;
+}
+
+float AABBIntersection(in Ray ray, vec3 minp, vec3 maxp) {
+    if (ray.origin.x >= minp.x && ray.origin.x <= maxp.x &&
+        ray.origin.y >= minp.y && ray.origin.y <= maxp.y &&
+        ray.origin.z >= minp.z && ray.origin.z <= maxp.z) {
+        return 0.0;
+    }
+
+
+    float tx1 = (minp.x - ray.origin.x) * ray.inv_direction.x;
+    float tx2 = (maxp.x - ray.origin.x) * ray.inv_direction.x;
+
+    float tmin = min(tx1, tx2);
+    float tmax = max(tx1, tx2);
+
+    float ty1 = (minp.y - ray.origin.y) * ray.inv_direction.y;
+    float ty2 = (maxp.y - ray.origin.y) * ray.inv_direction.y;
+
+    tmin = max(tmin, min(ty1, ty2));
+    tmax = min(tmax, max(ty1, ty2));
+
+    float tz1 = (minp.z - ray.origin.z) * ray.inv_direction.z;
+    float tz2 = (maxp.z - ray.origin.z) * ray.inv_direction.z;
+
+    tmin = max(tmin, min(tz1, tz2));
+    tmax = min(tmax, max(tz1, tz2));
+
+    if (tmax >= tmin && tmin >= 0) {
+        return tmin;
+    }
+
+    return -1.0;
+}
+
+Hit noHit() {
+    return Hit(false, 1000000.0, vec3(0.0), vec3(0.0), vec3(0.0), vec3(0.0), vec2(0.0), -1, -1, false);
+}
+
+// Interpolates the vertex attributes at the hit, whose position is still in
+// the space of its model, and moves it to world space
+void completeHit(inout Hit hit, in Ray ray) {
+    Model model = models[hit.model_index];
+    // Compute normal with barycentric coordinates
+    uvec3 triangle_indices = getTriangleIndices(model.triangle_offset + hit.triangle_index) + model.vertex_offset;
+    Triangle triangle = getTriangle(triangle_indices, model.position_offset.xyz, model.position_scale.xyz);
+
+    vec3 barycentric = getBarycentric(hit.position, triangle);
+    hit.normal = normalize(
+        barycentric.x * vertexNormal(triangle_indices.x) +
+        barycentric.y * vertexNormal(triangle_indices.y) +
+        barycentric.z * vertexNormal(triangle_indices.z)
+    );
+
+    vec4 tangent_a = vertexTangent(triangle_indices.x);
+    hit.tangent = normalize(
+        barycentric.x * tangent_a.xyz +
+        barycentric.y * vertexTangent(triangle_indices.y).xyz +
+        barycentric.z * vertexTangent(triangle_indices.z).xyz
+    );
+
+    hit.bitangent = tangent_a.w * cross(hit.normal, hit.tangent);
+
+    hit.uv = (
+        barycentric.x * vertexUV(triangle_indices.x) +
+        barycentric.y * vertexUV(triangle_indices.y) +
+        barycentric.z * vertexUV(triangle_indices.z));
+
+    // Transform hit info to world space
+
+    hit.position = vec3(model.transform * vec4(hit.position, 1.0));
+    hit.normal = normalize(vec3(transpose(model.inv_transform) * vec4(hit.normal, 0.0)));
+    hit.t = length(hit.position - ray.origin);
+
+    if(dot(hit.normal, ray.direction) > 0) {
+        hit.normal = -hit.normal;
+        hit.backface = true;
+    }
+}
+
+Ray transformRay(in Ray ray, in Model model) {
+    Ray transformed_ray;
+    transformed_ray.origin = vec3(model.inv_transform * vec4(ray.origin, 1.0));
+    transformed_ray.direction = vec3(model.inv_transform * vec4(ray.direction, 0.0));
+    transformed_ray.inv_direction = 1.0 / transformed_ray.direction;
+    return transformed_ray;
+}
+
+// Tests the triangles of a leaf against the ray, in the space of the model
+void intersectLeaf(in Ray transformed_ray, in Model model, int model_index,
+                   int first, int count, inout Hit transformed_hit, inout Hit hit) {
+    for(int j = first; j < first + count; j++) {
+        uvec3 triangle_indices = getTriangleIndices(model.triangle_offset + j) + model.vertex_offset;
+        Triangle triangle = getTriangle(triangle_indices, model.position_offset.xyz, model.position_scale.xyz);
+        if(triangleIntersection(transformed_ray, triangle, transformed_hit)) {
+            hit = transformed_hit;
+            hit.triangle_index = j;
+            hit.model_index = model_index;
+        }
+    }
+}
+
+Hit traceRayBVH(in Ray ray) {
+    Hit hit = noHit();
+    
+    int node_stack[64];
+    int num_fetched_nodes = 0;
+
+    for(int i=0; i<numOfModels; i++) {
+        
+        Model model = models[i];
+        Ray transformed_ray = transformRay(ray, model);
+
+        Hit transformed_hit = hit;
+        if(hit.hit) {
+            transformed_hit.position = vec3(model.inv_transform * (models[hit.model_index].transform * vec4(hit.position, 1.0)));
+            transformed_hit.t = length(transformed_hit.position - transformed_ray.origin) / length(transformed_ray.direction); // The normal is not normalized in object space
+        }
+
+        // Quantized vertices can move out of the bounds by a rounding step
+        vec3 margin = vertexFormat == 2 ? model.position_scale.xyz / 65535.0 : vec3(0.0);
+
+        if(stacklessBVH) {
+            int octant = (transformed_ray.direction.x < 0.0 ? 1 : 0) |
+                         (transformed_ray.direction.y < 0.0 ? 2 : 0) |
+                         (transformed_ray.direction.z < 0.0 ? 4 : 0);
+            int node_index = 0;
+            while(node_index >= 0) {
+                ThreadedBVH_Node node = threaded_bvh_nodes[model.bvh_root + node_index];
+                num_fetched_nodes++;
+                float t = AABBIntersection(transformed_ray, node.min - margin, node.max + margin);
+                int count = int(node.flags & 0xFFFFu);
+                if(t >= 0.0 && t <= hit.t) {
+                    if(count == 0) {
+                        node_index = node.offset + int((node.flags >> (16 + octant)) & 1u);
+                        continue;
+                    }
+                    intersectLeaf(transformed_ray, model, i, node.offset, count, transformed_hit, hit);
+                }
+                node_index = node.skip[octant];
+            }
+            continue;
+        }
+
+        int stack_pointer = 0;
+        node_stack[stack_pointer++] = model.bvh_root;
+
+        // The boxes of both children are tested from their parent, leaves are
+        // intersected right away and only internal children are pushed
+        while(stack_pointer > 0) {
+            int node_index = node_stack[--stack_pointer];
+
+            // Children relative to the root (internal) or first triangles
+            // (leaves), -1 when missing, and their triangle counts (0 when
+            // internal). Scalars rather than arrays, which would be indexed
+            // dynamically
+            vec3 min0, max0, min1, max1;
+            int child0, child1, count0, count1;
+            if(compressedBVH) {
+                CompressedBVH_Node node = compressed_bvh_nodes[node_index];
+                num_fetched_nodes++;
+                child0 = node.child0;
+                child1 = node.child1;
+                count0 = int(node.counts & 0xFFFFu);
+                count1 = int(node.counts >> 16);
+                compressedChildBounds(node, 0, min0, max0);
+                compressedChildBounds(node, 1, min1, max1);
+            } else {
+                BVH_Node node = bvh_nodes[node_index];
+                num_fetched_nodes++;
+                if(node.triangle_count > 0) {
+                    // Only the root can be a leaf here
+                    child0 = node.offset;
+                    count0 = node.triangle_count;
+                    min0 = node.min;
+                    max0 = node.max;
+                    child1 = -1;
+                    count1 = 0;
+                } else {
+                    BVH_Node left = bvh_nodes[model.bvh_root + node.offset];
+                    BVH_Node right = bvh_nodes[model.bvh_root + node.offset + 1];
+                    num_fetched_nodes += 2;
+                    child0 = left.triangle_count > 0 ? left.offset : node.offset;
+                    child1 = right.triangle_count > 0 ? right.offset : node.offset + 1;
+                    count0 = left.triangle_count;
+                    count1 = right.triangle_count;
+                    min0 = left.min;
+                    max0 = left.max;
+                    min1 = right.min;
+                    max1 = right.max;
+                }
+            }
+
+            float t0 = child0 < 0 ? -1.0 : AABBIntersection(transformed_ray, min0 - margin, max0 + margin);
+            float t1 = child1 < 0 ? -1.0 : AABBIntersection(transformed_ray, min1 - margin, max1 + margin);
+            if(t0 > hit.t) t0 = -1.0;
+            if(t1 > hit.t) t1 = -1.0;
+
+            for(int k = 0; k < 2; k++) {
+                int first = k == 0 ? child0 : child1;
+                int count = (k == 0 ? t0 : t1) < 0.0 ? 0 : (k == 0 ? count0 : count1);
+                intersectLeaf(transformed_ray, model, i, first, count, transformed_hit, hit);
+            }
+
+            // The nearest internal child on top of the stack
+            bool visit0 = t0 >= 0.0 && count0 == 0;
+            bool visit1 = t1 >= 0.0 && count1 == 0;
+            if(visit0 && visit1) {
+                bool near_first = t0 <= t1;
+                node_stack[stack_pointer++] = model.bvh_root + (near_first ? child1 : child0);
+                node_stack[stack_pointer++] = model.bvh_root + (near_first ? child0 : child1);
+            } else if(visit0) {
+                node_stack[stack_pointer++] = model.bvh_root + child0;
+            } else if(visit1) {
+                node_stack[stack_pointer++] = model.bvh_root + child1;
+            }
+        }
+    }
+
+    if(traversalStats) {
+        atomicAdd(traced_rays, 1u);
+        atomicAdd(fetched_nodes, uint(num_fetched_nodes));
+    }
+
+    if(hit.hit)
+        completeHit(hit, ray);
+
+    return hit;    
+}
+
+void rayAt(out Ray ray, vec2 uv) {
+    vec4 clip = vec4(uv, -1.0, 1.0);
+    vec4 eye = vec4(vec2(invProjectionMat * clip), -1.0, 0.0);
+    ray.direction = normalize(vec3(invViewMat * eye));
+    ray.origin = vec3(invViewMat[3]);
+    ray.inv_direction = 1.0 / ray.direction;
+}
+
+float normalizeDepth(float depth) {
+    return (1.0 / depth - 1.0 / zNear) / (1.0 / zFar - 1.0 / zNear);
+}
+
+vec3 shade(vec3 normal, Hit hit, Material material, Ray ray, vec2 uv, bool shadows = false) {
+    vec3 radiance = vec3(0.0);
+
+    for (int i = 0; i < numOfLights; i++) {
+        bool contribute = true; // Shadow ray
+
+        if(imageParameters.raytracedShadows && shadows) {
+            LightSource light = lights[i];
+            Ray shadow_ray;
+            shadow_ray.origin = hit.position + 0.001 * normal;
+            if(light.type == 0)
+                shadow_ray.direction = -normalize(light.direction);
+            else
+                shadow_ray.direction = normalize(light.direction - hit.position);
+            shadow_ray.inv_direction = 1.0 / shadow_ray.direction;
+
+            if(dot(shadow_ray.direction, normal) > 0) {
+                Hit shadow_hit = traceRayBVH(shadow_ray);
+                if (shadow_hit.hit){
+                    if(light.type == 0) {
+                        contribute = false;
+                    } else {
+                        if(shadow_hit.t < length(light.direction - hit.position))
+                            contribute = false;
+                    }
+                }
+            } else
+                contribute = false;
+        }
+        
+        if(contribute)
+            radiance += evaluateRadiance(material, lights[i], normal, hit.position, ray, uv);
+    }
+    return radiance;
+}
+
+float FresnelReflectAmount (float n1, float n2, vec3 normal, vec3 incident, float reflectance = 0.0) {
+    // Schlick aproximation
+    float r0 = (n1-n2) / (n1+n2);
+    r0 *= r0;
+    float cosX = -dot(normal, incident);
+    if (n1 > n2) {
+        float n = n1/n2;
+        float sinT2 = n*n*(1.0-cosX*cosX);
+        // Total internal reflection
+        if (sinT2 > 1.0)
+            return 1.0;
+        cosX = sqrt(1.0-sinT2);
+    }
+    float x = 1.0-cosX;
+    float ret = r0+(1.0-r0)*x*x*x*x*x;
+
+    // adjust reflect multiplier for object reflectivity
+    ret = (reflectance + (1.0-reflectance) * ret);
+    return ret;
+}
+
+vec3 dirToSun = -normalize(lights[0].direction);
+
+vec3 SampleSky(vec3 dir) {
+    const vec3 colGround = vec3(0.35, 0.3, 0.35) * 0.53;
+    const vec3 colSkyHorizon = vec3(1, 1, 1);
+    const vec3 colSkyZenith = vec3(0.08, 0.37, 0.73);
+
+    float sun = pow(max(0, dot(dir, dirToSun)), 500) * 10;
+    float skyGradientT = pow(smoothstep(0.0, 0.4, dir.y), 0.35);
+    float groundToSkyT = smoothstep(-0.01, 0.0, dir.y);
+    vec3 skyGradient = mix(colSkyHorizon, colSkyZenith, skyGradientT);
+
+    return mix(colGround, skyGradient, groundToSkyT) + sun * (groundToSkyT >= 1 ? 1.0 : 0.0);
+}
+Ray getReflectionRay(vec3 normal, vec3 incident, vec3 position) {
+    Ray reflection_ray;
+    reflection_ray.origin = position + 0.001 * normal;
+    reflection_ray.direction = reflect(incident, normal);
+    reflection_ray.inv_direction = 1.0 / reflection_ray.direction;
+    return reflection_ray;
+}
+
+Ray getRefractionRay(vec3 normal, vec3 incident, vec3 position, float ior, bool backface = false) {
+    Ray refraction_ray;
+    refraction_ray.origin = position - 0.001 * normal;
+    float eta = ior;
+    if(!backface)
+        eta = 1.0 / eta;
+    refraction_ray.direction = normalize(refract(incident, normal, eta));
+    refraction_ray.inv_direction = 1.0 / refraction_ray.direction;
+    return refraction_ray;
+}
+
+// Offset of the sample in the pixel, in pixels
+uniform vec2 jitter;
+
+// Hybrid rendering: the model and the triangle rasterized at each pixel, -1
+// for the background, see VisibilityFragmentShader.glsl
+layout(rg32i, binding = 4) uniform readonly iimage2D visibilityImage;
+uniform bool hybrid;
+// Whether the background of the visibility buffer may hide geometry, the ray
+// being jittered off the pixel center. The frustum culling is conservative.
+uniform bool traceBackground;
+
+// First hit of the camera ray through the pixel. In hybrid rendering, only the
+// rasterized triangle is intersected, the BVH being traversed when the ray
+// misses it, at its edges.
+Hit primaryHit(ivec2 pixel, in Ray ray) {
+    if(!hybrid)
+        return traceRayBVH(ray);
+
+    ivec2 visible = imageLoad(visibilityImage, pixel).xy;
+    if(visible.x < 0)
+        return traceBackground ? traceRayBVH(ray) : noHit();
+
+    Model model = models[visible.x];
+    uvec3 triangle_indices = getTriangleIndices(model.triangle_offset + visible.y) + model.vertex_offset;
+    Triangle triangle = getTriangle(triangle_indices, model.position_offset.xyz, model.position_scale.xyz);
+    Hit hit = noHit();
+    if(!triangleIntersection(transformRay(ray, model), triangle, hit))
+        return traceRayBVH(ray);
+    hit.model_index = visible.x;
+    hit.triangle_index = visible.y;
+    completeHit(hit, ray);
+    return hit;
+}
+
+// Radiance of the camera ray through the pixel, and depth of its first hit
+vec3 tracePixel(ivec2 pixel, out float depth) {
+    vec2 ndc = (vec2(pixel) + 0.5 + jitter) / resolution * 2.0 - 1.0;
+    Ray ray;
+    rayAt(ray, ndc);
+    
+    Hit hit = primaryHit(pixel, ray);
+
+    Hit first_hit = hit;
+
+    vec3 radiance = vec3(0.0);
+
+    if (hit.hit) {
+        Model model = models[hit.model_index];
+
+        float energy = 1.0;
+        
+        for(int i=0; i<imageParameters.numRefractions+1; i++) {
+            model = models[hit.model_index];
+
+            if(model.material.normalTex != -1) {
+            vec3 normalMap = sampleTex(hit.uv, model.material.normalTex, vec4(0.5, 0.5, 1.0, 1.0)).xyz * 2.0 - 1.0;
+            hit.normal = normalize(hit.tangent * normalMap.x + hit.bitangent * normalMap.y + hit.normal * normalMap.z);
+        }
+
+            if(model.material.transparent) {
+                float reflectance = FresnelReflectAmount(1.0, 1.3, hit.normal, ray.direction, model.material.base_reflectance);
+                float transmittance = 1.0 - reflectance;
+                
+                Ray reflection_ray = getReflectionRay(hit.normal, ray.direction, hit.position);
+                vec3 reflectedColor = SampleSky(reflection_ray.direction);
+
+                Ray refraction_ray = getRefractionRay(hit.normal, ray.direction, hit.position, model.material.ior, hit.backface);
+                vec3 refractedColor = SampleSky(refraction_ray.direction);
+
+                bool is_refracted = transmittance > reflectance;
+
+                if(is_refracted) {
+                    radiance += energy * reflectance * reflectedColor;
+                    energy *= transmittance;
+                    Hit refraction_hit = traceRayBVH(refraction_ray);
+                    if(refraction_hit.hit) {
+                        ray = refraction_ray;
+                        hit = refraction_hit;
+                    } else {
+                        radiance += energy * transmittance * refractedColor;
+                        break;
+                    }
+                } else {
+                    radiance += energy * transmittance * refractedColor;
+                    energy *= reflectance;
+                    Hit reflection_hit = traceRayBVH(reflection_ray);
+                    if(reflection_hit.hit) {
+                        ray = reflection_ray;
+                        hit = reflection_hit;
+                    } else {
+                        radiance += energy * reflectance * reflectedColor;
+                        break;
+                    }
+                }
+            } else {
+                radiance += energy * shade(hit.normal, hit, model.material, ray, hit.uv, true);
+                break;
+            }
+        }
+        
+    } else
+        radiance = SampleSky(ray.direction);
+
+    if(first_hit.hit) {
+        vec4 projected = projectionMat * viewMat * vec4(first_hit.position, 1.0);    
+        depth = (projected.z/projected.w + 1.0) * 0.5;
+    }
+    else
+        depth = 1.0;
+
+    return radiance;
+}
+
+// Sum of the samples of each pixel since the view last changed
+layout(rgba32f, binding = 2) uniform image2D accumulationImage;
+uniform bool accumulate;
+// Samples already in the accumulation image
+uniform int numOfAccumulatedSamples;
+
+// Average of the samples of the pixel, with this one
+vec3 accumulateSample(ivec2 pixel, vec3 radiance) {
+    if(!accumulate)
+        return radiance;
+    vec3 sum = radiance;
+    if(numOfAccumulatedSamples > 0)
+        sum += imageLoad(accumulationImage, pixel).rgb;
+    imageStore(accumulationImage, pixel, vec4(sum, 1.0));
+    return sum / float(numOfAccumulatedSamples + 1);
+}
+
+vec3 colorCorrect(vec3 radiance) {
+    if(imageParameters.colorCorrect) {
+        if(imageParameters.useExposure)
+            radiance *= imageParameters.exposure;
+        
+        if(imageParameters.useToneMapping)
+            radiance = ACESFilm(radiance);
+        
+        if(imageParameters.useSRGB)
+            radiance = LinearToSRGB(radiance);
+    }
+    return radiance;
+}
@@ -0,0 +1,53 @@
+#version 450 core
+
+// Compute shader path of GPU_Raytracer. A fixed number of work groups stay
+// resident and fetch 8x8 tiles of pixels from an atomic counter until the
+// image is done, so that the groups finishing early take the remaining work.
+// Each group fetches at most maxTilesPerGroup tiles, with enough groups to
+// cover the image. The image is the resolution of the camera block, smaller
+// than the images with dynamic resolution.
+
+#include "RaytracingCommon.glsl"
+
+#define TILE_SIZE 8
+
+layout(local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;
+
+layout(rgba8, binding = 0) uniform writeonly image2D colorImage;
+layout(r32f, binding = 1) uniform writeonly image2D depthImage;
+
+// Reset to 0 before each dispatch
+layout(binding = 5, std430) buffer TileCounter {
+    uint nextTile;
+};
+
+uniform int maxTilesPerGroup;
+
+shared uint tile;
+
+void main() {
+    ivec2 size = ivec2(resolution);
+    uvec2 numOfTiles = (uvec2(size) + TILE_SIZE - 1) / TILE_SIZE;
+    uint totalTiles = numOfTiles.x * numOfTiles.y;
+
+    for(int n = 0; n < maxTilesPerGroup; n++) {
+        if(gl_LocalInvocationIndex == 0)
+            tile = atomicAdd(nextTile, 1);
+        barrier();
+        uint current = tile;
+        // Everyone read the tile before it is fetched again
+        barrier();
+        if(current >= totalTiles)
+            return;
+
+        ivec2 pixel = ivec2(current % numOfTiles.x, current / numOfTiles.x) * TILE_SIZE +
+                      ivec2(gl_LocalInvocationID.xy);
+        if(any(greaterThanEqual(pixel, size)))
+            continue;
+
+        float depth;
+        vec3 radiance = accumulateSample(pixel, tracePixel(pixel, depth));
+        imageStore(colorImage, pixel, vec4(colorCorrect(radiance), 1.0));
+        imageStore(depthImage, pixel, vec4(depth));
+    }
+}
@@ -0,0 +1,15 @@
+#version 450 core
+
+// Displays the images written by the compute shader path, with their depth so
+// that the debug drawings are hidden by the scene
+
+layout(binding = 0) uniform sampler2D colorTex;
+layout(binding = 1) uniform sampler2D depthTex;
+
+out vec4 colorResponse;
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    colorResponse = vec4(texelFetch(colorTex, pixel, 0).rgb, 1.0);
+    gl_FragDepth = texelFetch(depthTex, pixel, 0).r;
+}
@@ -0,0 +1,68 @@
+#version 450 core
+
+// Temporal upscaling of GPU_Raytracer with dynamic resolution. The image is
+// traced at renderSize into the corner of the textures, with a jitter that
+// changes every frame. The history of the previous frames, at the output
+// resolution, is reprojected with the camera motion, clamped to the colors
+// of the new samples around the pixel so that what moved or got uncovered
+// does not ghost, then blended with them.
+
+layout(binding = 0) uniform sampler2D colorTex;
+layout(binding = 1) uniform sampler2D depthTex;
+layout(binding = 2) uniform sampler2D historyTex;
+layout(rgba16f, binding = 3) uniform writeonly image2D nextHistoryImage;
+
+uniform vec2 renderSize;
+uniform vec2 outputSize;
+// Offset of the samples in their pixel, in traced pixels
+uniform vec2 jitter;
+uniform mat4 invViewProjectionMat;
+uniform mat4 previousViewProjectionMat;
+uniform bool historyValid;
+// Weight of the new samples
+uniform float blendFactor;
+
+out vec4 colorResponse;
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec2 uv = gl_FragCoord.xy / outputSize;
+
+    // Position in the traced image, the samples being at the pixel centers
+    vec2 renderPosition = uv * renderSize - jitter;
+    ivec2 last = ivec2(renderSize) - 1;
+    ivec2 center = clamp(ivec2(renderPosition), ivec2(0), last);
+
+    vec3 minColor = vec3(1.0);
+    vec3 maxColor = vec3(0.0);
+    for(int y = -1; y <= 1; y++) {
+        for(int x = -1; x <= 1; x++) {
+            ivec2 neighbour = clamp(center + ivec2(x, y), ivec2(0), last);
+            vec3 color = texelFetch(colorTex, neighbour, 0).rgb;
+            minColor = min(minColor, color);
+            maxColor = max(maxColor, color);
+        }
+    }
+
+    // Interpolated between the samples, never past the traced corner
+    vec2 coords = clamp(renderPosition, vec2(0.5), renderSize - 0.5) /
+                  vec2(textureSize(colorTex, 0));
+    vec3 color = textureLod(colorTex, coords, 0.0).rgb;
+    float depth = texelFetch(depthTex, center, 0).r;
+
+    // Where the surface was on the previous frame, the scene being static
+    vec4 position = invViewProjectionMat * vec4(uv * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 previous = previousViewProjectionMat * vec4(position.xyz / position.w, 1.0);
+    vec2 previousUV = previous.xy / previous.w * 0.5 + 0.5;
+
+    if(historyValid && previous.w > 0.0 &&
+       all(greaterThanEqual(previousUV, vec2(0.0))) &&
+       all(lessThanEqual(previousUV, vec2(1.0)))) {
+        vec3 history = textureLod(historyTex, previousUV, 0.0).rgb;
+        color = mix(clamp(history, minColor, maxColor), color, blendFactor);
+    }
+
+    imageStore(nextHistoryImage, pixel, vec4(color, 1.0));
+    colorResponse = vec4(color, 1.0);
+    gl_FragDepth = depth;
+}
@@ -0,0 +1,14 @@
+#version 450 core
+
+// Visibility buffer of the hybrid rendering of GPU_Raytracer: the model and
+// the triangle of the model seen at the pixel. The draws are the whole meshes,
+// whose triangles are in the order of the BVHs, so that gl_PrimitiveID is the
+// index the ray tracer uses.
+
+flat in int fModel;
+
+layout(location = 0) out ivec2 visibility;
+
+void main() {
+    visibility = ivec2(fModel, gl_PrimitiveID);
+}
@@ -6,6 +6,9 @@
 #include <chrono>
 
 #include <glm/glm.hpp>
+#include <stdint.h>
+
+#include "utils/Version.h"
 
 class Mesh;
 class Scene;
@@ -25,34 +28,86 @@ struct BVH_Node {
 	size_t child_index = 0;
 
 	size_t first_triangle = 0;	// The triangle list is sorted so that each node
-	size_t num_triangles = 0;	// have contiguous triangles
+	size_t num_triangles = 0;	// have contiguous triangles (only the leaves
+								// after BVH::reorderTriangles)
 
 	void recomputeAABB();
 };
 
+/**
+ * @brief Binary BVH node with the bounds of its two children quantized to 8
+ * bits in its own box, 40 bytes (std430 layout of the shader). The bounds of
+ * a child are origin + q * step per axis, step being a power of two so that
+ * the decoding is exact, and q is rounded outwards.
+ */
+struct CompressedBVH_Node {
+	float origin[3];
+
+	/// @brief Biased float exponent of the step, one byte per axis
+	uint32_t exponents;
+
+	/// @brief Per axis, one byte each: child 0 min, child 0 max, child 1 min,
+	/// child 1 max
+	uint32_t bounds[3];
+
+	/// @brief Internal child: index of its node, leaf: first triangle, -1: no
+	/// child
+	int32_t child[2];
+
+	/// @brief Triangles of each leaf child on 16 bits, 0 for internal children
+	uint32_t counts;
+
+	inline uint32_t count(int k) const { return (counts >> (16 * k)) & 0xFFFF; }
+
+	inline void childBounds(int k, glm::vec3& min, glm::vec3& max) const {
+		for (int axis = 0; axis < 3; axis++) {
+			float step = glm::uintBitsToFloat(
+				((exponents >> (8 * axis)) & 0xFF) << 23);
+			uint32_t b = bounds[axis] >> (16 * k);
+			min[axis] = origin[axis] + float(b & 0xFF) * step;
+			max[axis] = origin[axis] + float((b >> 8) & 0xFF) * step;
+		}
+	}
+};
+
 class BVH {
    private:
 	std::vector<std::shared_ptr<BVH_Node>> m_nodes;
 	std::shared_ptr<Mesh> m_parent_mesh;
-	std::vector<glm::uvec3> m_triangles;
 	std::shared_ptr<BVH_Node> m_root;
+	std::vector<CompressedBVH_Node> m_compressedNodes;
 	int m_depth = 0;
+	size_t m_version = nextVersion();
 
    private:
 	/// @brief Splits the node into two children, and builds the children
 	/// recursively
 	void build(std::shared_ptr<BVH_Node> node, int depth = 0);
 
+	/// @brief Builds the whole tree from the triangles sorted by the Morton
+	/// codes of their centroids (LBVH), the top levels with the surface area
+	/// heuristic if SAH_TOP_LEVELS is set (HLBVH)
+	void buildLinear();
+
+	/// @brief Builds the compressed nodes from the tree
+	void compress();
+
    public:
 	BVH(std::shared_ptr<Mesh> meshPtr);
 
-	/// @brief Builds the BVH using median split or surface area heuristic
+	/// @brief Builds the BVH using median split, surface area heuristic or
+	/// Morton codes, see BUILD_TYPE
 	void build() {
 		std::chrono::high_resolution_clock clock;
 		std::chrono::time_point<std::chrono::high_resolution_clock> before =
 			clock.now();
 
-		build(m_root);
+		if (BUILD_TYPE == 2)
+			buildLinear();
+		else
+			build(m_root);
+		compress();
+		m_version = nextVersion();
 
 		std::chrono::time_point<std::chrono::high_resolution_clock> after =
 			clock.now();
@@ -65,12 +120,22 @@ class BVH {
 		std::cout << "Depth: " << m_depth << std::endl;
 	}
 
+	/// @brief Restructures treelets of the tree bottom-up to lower its SAH
+	/// cost (TRBVH), in the same nodes, then sorts the triangles again for the
+	/// new leaves. Much slower than the builds, for meshes built once.
+	void optimize();
+
+	/// @brief Moves the triangles as close as possible to the given order
+	/// (order[i] is the triangle to put at i), the triangles of each leaf
+	/// staying together: the leaves are sorted by their first triangle in the
+	/// order. The ranges of the internal nodes are not kept.
+	void reorderTriangles(const std::vector<unsigned int>& order);
+
 	// Getters
 
-	/// @brief Triangles sorted in a specific order to minimize storage
-	inline const std::vector<glm::uvec3>& triangles() const {
-		return m_triangles;
-	}
+	/// @brief Triangles of the mesh, which the build sorts in place so that
+	/// each node has contiguous triangles
+	const std::vector<glm::uvec3>& triangles() const;
 
 	/// @brief root node of the tree
 	inline const std::shared_ptr<BVH_Node> getRoot() const { return m_root; }
@@ -78,14 +143,34 @@ class BVH {
 	/// @brief max depth of a node in the tree
 	inline int depth() const { return m_depth; }
 
+	/// @brief Changes whenever the nodes change
+	inline size_t version() const { return m_version; }
+
 	inline const std::vector<std::shared_ptr<BVH_Node>>& nodes() const {
 		return m_nodes;
 	}
 
+	/// @brief The same tree in the compressed format, in depth-first order
+	/// from the root. Leaves have no node of their own, so there are about
+	/// half as many nodes.
+	inline const std::vector<CompressedBVH_Node>& compressedNodes() const {
+		return m_compressedNodes;
+	}
+
    public:
-	/// @brief 0 = median split, 1 = surface area heuristic
+	/// @brief 0 = median split, 1 = surface area heuristic, 2 = linear
+	/// (Morton codes)
 	static int BUILD_TYPE;
 
 	/// @brief Number of split candidates for SAH
 	static int NUM_SPLIT_CANDIDATES;
+
+	/// @brief With the linear build, splits the clusters of triangles whose
+	/// Morton codes share their first bits with the surface area heuristic,
+	/// instead of at their first differing bit
+	static bool SAH_TOP_LEVELS;
+
+	/// @brief Traverse the compressed nodes instead of the full precision
+	/// ones, in the CPU and GPU ray tracers
+	static bool USE_COMPRESSED_NODES;
 };
\ No newline at end of file
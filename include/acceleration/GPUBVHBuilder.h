@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstddef>
+
+#include "core/GeometryArena.h"
+
+class ShaderProgram;
+
+/**
+ * @brief Linear BVH build of the models of the scene geometry arena in
+ * compute shaders, see BVHBuildComputeShader.glsl. The nodes are written
+ * straight into the buffer the ray tracing shader reads, in its full
+ * precision layout, with one triangle per leaf.
+ */
+class GPU_BVHBuilder {
+   public:
+	GPU_BVHBuilder() {}
+	~GPU_BVHBuilder();
+
+	GPU_BVHBuilder(const GPU_BVHBuilder&) = delete;
+	GPU_BVHBuilder& operator=(const GPU_BVHBuilder&) = delete;
+
+	/// @brief Nodes of the BVH of that many triangles
+	static inline size_t numOfNodes(size_t numOfTriangles) {
+		return numOfTriangles > 0 ? 2 * numOfTriangles - 1 : 1;
+	}
+
+	/// @brief Issues the build of the BVH of the triangles of the range,
+	/// into the nodes of the buffer from nodeOffset on. The nodes can be read
+	/// after a shader storage barrier.
+	void build(ShaderProgram& program, const GeometryArena& geometry,
+			   const GeometryArena::Range& range, GLuint nodeBuffer,
+			   size_t nodeOffset);
+
+   private:
+	/// @brief Grows the scratch buffers to hold that many triangles
+	void reserve(size_t numOfTriangles);
+	void dispatch(ShaderProgram& program, int stage, GLuint numOfGroups);
+
+	/// @brief Morton codes and triangles, sorted from one to the other
+	GLuint m_elementBuffers[2] = {};
+	GLuint m_countBuffer = 0;
+	GLuint m_parentBuffer = 0;
+	GLuint m_visitBuffer = 0;
+	GLuint m_centroidBoundsBuffer = 0;
+	size_t m_capacity = 0;
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "primitives/AABB.h"
+
+class Mesh;
+
+/**
+ * @brief Software occlusion culling in a small depth buffer, in the spirit of
+ * Masked Occlusion Culling (Hasselgren et al.). A few large occluders are
+ * rasterized with coarse proxies of their meshes, then the world space boxes
+ * of the other models are tested against the farthest depth of the tiles
+ * they cover. Only the pixels an occluder covers entirely get its depth, so
+ * that a box is culled only if it is hidden everywhere. It all runs on a
+ * worker thread between begin() and wait(), with an OpenMP team of its own,
+ * while the caller submits the occluders to the GPU.
+ */
+class OcclusionCuller {
+   public:
+	static constexpr int WIDTH = 256;
+	static constexpr int HEIGHT = 128;
+	static constexpr int TILE_SIZE = 8;
+	/// @brief Horizontal bands of the buffer rasterized in parallel
+	static constexpr int NUM_BANDS = HEIGHT / (2 * TILE_SIZE);
+
+	/// @brief Proxy of an occluder: its coarsest level of detail, or its
+	/// triangles when there are fewer than that
+	static constexpr size_t MAX_PROXY_TRIANGLES = 2048;
+
+	struct Occluder {
+		std::shared_ptr<const Mesh> mesh;
+		glm::mat4 modelMatrix;
+	};
+
+	OcclusionCuller();
+	~OcclusionCuller();
+
+	OcclusionCuller(const OcclusionCuller&) = delete;
+	OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+	/// @brief Starts rasterizing the occluders, then testing the boxes against
+	/// them. The meshes must not change until wait() returns.
+	void begin(const glm::mat4& viewProjectionMatrix,
+			   std::vector<Occluder> occluders, std::vector<AABB> boxes);
+
+	void wait();
+
+	/// @brief Whether boxes[index] of the last begin() is hidden, valid once
+	/// wait() returned
+	inline bool occluded(size_t index) const { return m_occluded[index]; }
+
+	/// @brief NDC depth of the nearest occluder per pixel, 1 where there is
+	/// none, the first row being the bottom of the screen
+	inline const std::vector<float>& depth() const { return m_depth; }
+
+   private:
+	void workerLoop();
+	void cull();
+
+	struct ScreenTriangle {
+		/// @brief x and y in pixels, z is the NDC depth
+		glm::vec3 vertices[3];
+	};
+
+	/// @brief Clips the proxy against the near plane and projects it
+	void setupOccluder(const Occluder& occluder,
+					   std::vector<ScreenTriangle>& triangles) const;
+
+	/// @brief Rasterizes all the occluders into rows [firstRow, endRow), then
+	/// computes the farthest depth of the tiles of the band
+	void rasterizeBand(int firstRow, int endRow);
+
+	bool isOccluded(const AABB& box) const;
+
+	std::thread m_worker;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	bool m_started = false;
+	bool m_done = true;
+	bool m_stop = false;
+
+	glm::mat4 m_viewProjectionMatrix;
+	std::vector<Occluder> m_occluders;
+	std::vector<AABB> m_boxes;
+	std::vector<std::vector<ScreenTriangle>> m_occluderTriangles;
+	std::vector<float> m_depth;
+	std::vector<float> m_tileMaxDepth;
+	std::vector<char> m_occluded;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+
+#include "primitives/AABB.h"
+
+class Scene;
+struct Frustum;
+
+/**
+ * @brief Hierarchy over the models of a scene for culling. The world space
+ * bounds of a model are the root of its BVH transformed by its model matrix.
+ * Each update only transforms the bounds of the models whose transform or BVH
+ * changed and refits their ancestors. The tree is rebuilt when models are
+ * added or when the refitted boxes have grown too much.
+ */
+class SceneBVH {
+   public:
+	struct Node {
+		AABB box;
+		/// @brief Leaves: index of the model, internal nodes: index of the
+		/// first child, the second one is next
+		size_t index = 0;
+		/// @brief The root is its own parent
+		size_t parent = 0;
+		bool leaf = true;
+	};
+
+	SceneBVH() {}
+
+	/// @brief Follows the models of the scene and their transforms
+	void update(Scene& scene);
+
+	/// @brief Indices of the models whose bounds are in the frustum, in no
+	/// particular order
+	void cull(const Frustum& frustum, std::vector<size_t>& visible) const;
+
+	inline const AABB& modelBounds(size_t index) const {
+		return m_modelBounds[index];
+	}
+
+	inline const std::vector<Node>& nodes() const { return m_nodes; }
+
+	void clear();
+
+   private:
+	/// @brief Node index over m_models[begin, end), split at the median along
+	/// the longest axis of their centers
+	void build(size_t index, size_t begin, size_t end);
+
+	/// @brief Recomputes the boxes of the internal nodes, returns the sum of
+	/// their surface areas
+	float refit();
+
+	/// @brief Sets the box of the leaf of the model to its bounds, then
+	/// refits the ancestors whose box changes
+	void refitAncestors(size_t model);
+
+	std::vector<Node> m_nodes;
+	std::vector<AABB> m_modelBounds;
+	/// @brief Transform and BVH versions the bounds of each model were
+	/// computed from
+	std::vector<size_t> m_transformVersions;
+	std::vector<size_t> m_bvhVersions;
+	/// @brief Models sorted by the build
+	std::vector<size_t> m_models;
+	/// @brief Leaf node of each model
+	std::vector<size_t> m_leaves;
+	/// @brief Sum of the areas of the internal nodes right after the build,
+	/// and now
+	float m_builtArea = 0.f;
+	float m_area = 0.f;
+};
@@ -4,7 +4,7 @@
 #include <glm/ext.hpp>
 #include <string>
 
-class ShaderProgram;
+#include "core/UniformBlocks.h"
 
 struct ImageParameters {
 	bool colorCorrect;
@@ -16,7 +16,7 @@ struct ImageParameters {
 	bool raytracedReflections;
 	int numRefractions;
 
-	void setUniforms(ShaderProgram& program, std::string name) const;
+	ImageParametersBlock uniformBlock() const;
 };
 
 // From
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+class Scene;
+class Mesh;
+
+/**
+ * @brief Interleaved vertex as stored on the GPU with the float vertex format.
+ * The bitangent is not stored: it is handedness * cross(normal, tangent).
+ */
+struct ArenaVertex {
+	glm::vec3 position;
+	float u;
+	glm::vec3 normal;
+	float v;
+	glm::vec3 tangent;
+	float handedness;
+};
+
+/**
+ * @brief Scene-wide geometry shared by the GPU renderers: a single vertex
+ * buffer and a single index buffer hold all the meshes, each mesh being a
+ * range of both. The indices are the BVH-ordered triangles of the meshes, so
+ * the GPU ray tracer reads them as they are and the rasterizer pulls its
+ * vertices from the same buffer.
+ */
+class GeometryArena {
+   public:
+	struct Range {
+		/// @brief Added to the indices of the mesh (base vertex)
+		size_t firstVertex = 0;
+		size_t numVertices = 0;
+		size_t firstIndex = 0;
+		size_t numIndices = 0;
+
+		/// @brief Object space position = offset + scale * stored position,
+		/// only differs from the identity with quantized positions
+		glm::vec3 positionOffset = glm::vec3(0.f);
+		glm::vec3 positionScale = glm::vec3(1.f);
+
+		/// @brief Indices of the levels of detail of the mesh (Mesh::
+		/// lodTriangles), after the ones above and on the same vertices
+		struct LOD {
+			size_t firstIndex = 0;
+			size_t numIndices = 0;
+			float error = 0.f;
+		};
+		std::vector<LOD> lods;
+
+		/// @brief Object space bounding sphere of the mesh
+		glm::vec3 boundingCenter = glm::vec3(0.f);
+		float boundingRadius = 0.f;
+	};
+
+	GeometryArena() {}
+	~GeometryArena();
+
+	GeometryArena(const GeometryArena&) = delete;
+	GeometryArena& operator=(const GeometryArena&) = delete;
+
+	/// @brief Appends the meshes of the models added to the scene since the
+	/// last call, and uploads again the meshes edited since (see
+	/// Mesh::geometryChanged), in place when their size did not change.
+	/// Needs the GL context.
+	void update(const Scene& scene);
+
+	/// @brief Every mesh is uploaded again on the next update. The buffers
+	/// are kept.
+	void invalidate();
+
+	/// @brief Changes whenever the meshes are laid out again. The ranges of
+	/// the meshes edited in place change without it.
+	inline size_t generation() const { return m_generation; }
+
+	/// @brief Format of the uploaded vertices, see VERTEX_FORMAT
+	inline int vertexFormat() const { return m_vertexFormat; }
+
+	/// @brief Size in bytes of a vertex in the given format
+	static size_t vertexSize(int format);
+
+	inline size_t numOfMeshes() const { return m_ranges.size(); }
+	inline const Range& range(size_t index) const { return m_ranges[index]; }
+
+	inline size_t numOfVertices() const { return m_numVertices; }
+	inline size_t numOfIndices() const { return m_numIndices; }
+
+	/// @brief Buffers are reallocated when they grow, do not keep the names
+	inline GLuint vertexBuffer() const { return m_vertexBuffer; }
+	inline GLuint indexBuffer() const { return m_indexBuffer; }
+
+	void clear();
+
+   public:
+	/// @brief 0 = floats (48 bytes per vertex), 1 = octahedral normals and
+	/// tangents and half UVs (24 bytes), 2 = same with 16-bit positions
+	/// quantized in the bounding box of each mesh (20 bytes). Changing it
+	/// uploads everything again on the next update.
+	static int VERTEX_FORMAT;
+
+   private:
+	/// @brief Range of the mesh at the given place, without uploading it
+	Range layoutMesh(const Mesh& mesh, size_t firstVertex,
+					 size_t firstIndex) const;
+	void uploadMesh(const Mesh& mesh, const Range& range,
+					std::vector<uint32_t>& vertices) const;
+
+	std::vector<Range> m_ranges;
+	/// @brief Mesh::geometryVersion() of the uploaded meshes
+	std::vector<size_t> m_meshVersions;
+	size_t m_numVertices = 0;
+	size_t m_numIndices = 0;
+	size_t m_generation = 0;
+	int m_vertexFormat = 0;
+
+	GLuint m_vertexBuffer = 0;
+	GLuint m_indexBuffer = 0;
+	/// @brief In bytes
+	size_t m_vertexCapacity = 0;
+	size_t m_indexCapacity = 0;
+};
@@ -6,15 +6,34 @@
 #include <glm/glm.hpp>
 
 class Mesh;
+class Scene;
 
 class IO {
    public:
+	/// @brief Memory-maps the file and parses its vertex and face sections
+	/// in parallel, fan-triangulating polygons. Falls back to loadOFFStream
+	/// when the file does not have one element per line.
 	static void loadOFF(const std::string& filename,
 						std::shared_ptr<Mesh> meshPtr);
 
+	/// @brief Reads the file one token at a time (triangles only)
+	static void loadOFFStream(const std::string& filename,
+							  std::shared_ptr<Mesh> meshPtr);
+
 	static void loadOBJ(const std::string& filename,
 						std::vector<std::shared_ptr<Mesh>>& meshes);
 
+	/// @brief Loads a binary little-endian PLY file: vertex x/y/z, optional
+	/// nx/ny/nz and u/v, and face vertex index lists (fan-triangulated)
+	static void loadPLY(const std::string& filename,
+						std::shared_ptr<Mesh> meshPtr);
+
+	/// @brief Adds the models, materials and textures of a glTF 2.0 scene
+	/// (.glb, or .gltf with external buffers) to the scene. Accessors are
+	/// read straight from the memory-mapped buffers.
+	static void loadGLTF(const std::string& filename,
+						 std::shared_ptr<Scene> scenePtr);
+
 	static std::string file2String(const std::string& filename);
 
 	static void savePPM(const std::string& filename, int width, int height,
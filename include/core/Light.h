@@ -5,10 +5,9 @@
 
 #include <string>
 
+#include "core/UniformBlocks.h"
 #include "utils/Transform.h"
 
-class ShaderProgram;
-
 class AbstractLight : public Transform {
    protected:
 	glm::vec3 _color;
@@ -18,8 +17,7 @@ class AbstractLight : public Transform {
    public:
 	AbstractLight(const glm::vec3& color, float intensity, int type)
 		: Transform(), _color(color), _intensity(intensity), _type(type) {}
-	virtual void setUniforms(ShaderProgram& program,
-							 std::string name) const = 0;
+	virtual LightBlock uniformBlock() const = 0;
 	// int getType() const { return type; }
 	const int getType() const { return _type; }
 
@@ -42,7 +40,7 @@ class DirectionalLight : public AbstractLight {
 		: AbstractLight(color, intensity, 0) {
 		_direction = glm::normalize(direction);
 	}
-	void setUniforms(ShaderProgram& program, std::string name) const override;
+	LightBlock uniformBlock() const override;
 
 	void setDirection(const glm::vec3& direction);
 	glm::vec3 getDirection() const { return _direction; }
@@ -68,7 +66,7 @@ class PointLight : public AbstractLight {
 		: AbstractLight(color, intensity, 1), ac(ac), al(al), aq(aq) {
 		setTranslation(origin);
 	}
-	void setUniforms(ShaderProgram& program, std::string name) const override;
+	LightBlock uniformBlock() const override;
 
 	float intensity(glm::vec3 pos) const override;
 
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <stddef.h>
+
+/**
+ * @brief Read-only memory mapping of a whole file. The mapping lives as long
+ * as the object, so pointers into data() must not outlive it.
+ */
+class MappedFile {
+   public:
+	MappedFile(const std::string& filename);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	inline const char* data() const { return m_data; }
+	inline size_t size() const { return m_size; }
+
+	inline const char* begin() const { return m_data; }
+	inline const char* end() const { return m_data + m_size; }
+
+   private:
+	const char* m_data = nullptr;
+	size_t m_size = 0;
+
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#else
+	int m_fd = -1;
+#endif
+};
\ No newline at end of file
@@ -5,7 +5,8 @@
 
 #include <string>
 
-class ShaderProgram;
+#include "core/UniformBlocks.h"
+#include "utils/Version.h"
 
 class Material {
    public:
@@ -30,7 +31,12 @@ class Material {
 		  _heightTex(-1),
 		  _heightMult(0.0f) {}
 
-	void setUniforms(ShaderProgram& program, std::string name) const;
+	MaterialBlock uniformBlock() const;
+
+	/// @brief The parameters are edited in place, whoever edits them calls
+	/// markChanged() so that the renderers upload them again
+	inline void markChanged() { _version = nextVersion(); }
+	inline size_t version() const { return _version; }
 
 	inline glm::vec3& albedo() { return _albedo; }
 	inline const glm::vec3& albedo() const { return _albedo; }
@@ -98,4 +104,6 @@ class Material {
 	float _heightMult;
 	;
 	GLint _padding2;
+
+	size_t _version = nextVersion();
 };
@@ -7,6 +7,7 @@
 #include <glm/ext.hpp>
 
 #include "utils/Transform.h"
+#include "utils/Version.h"
 
 class BVH;
 
@@ -45,21 +46,82 @@ class Mesh : public Transform {
 		return m_triangleIndices;
 	}
 
+	/// @brief Simplified versions of the triangles, coarser and coarser, on
+	/// the same vertices. Level 0 is triangleIndices(), lodTriangles(l) is
+	/// level l + 1.
+	inline size_t numOfLODs() const { return m_lodTriangles.size(); }
+	inline const std::vector<glm::uvec3>& lodTriangles(size_t index) const {
+		return m_lodTriangles[index];
+	}
+	/// @brief Object space distance between lodTriangles(index) and the
+	/// surface of the mesh, about
+	inline float lodError(size_t index) const { return m_lodErrors[index]; }
+
 	inline const std::shared_ptr<BVH> bvh() const { return m_bvh; }
 	inline std::shared_ptr<BVH> bvh() { return m_bvh; }
 
 	void computeBoundingSphere(glm::vec3& center, float& radius) const;
 
+	/// @brief Triangles around each vertex, in compressed sparse row form: the
+	/// triangles of vertex v are vertexTriangles()[vertexTriangleOffsets()[v]]
+	/// to vertexTriangles()[vertexTriangleOffsets()[v + 1] - 1]
+	inline const std::vector<unsigned int>& vertexTriangleOffsets() const {
+		return m_vertexTriangleOffsets;
+	}
+	inline const std::vector<unsigned int>& vertexTriangles() const {
+		return m_vertexTriangles;
+	}
+
+	/// @brief Rebuilds the vertex to triangle adjacency, done automatically
+	/// on the next use after geometryChanged()
+	void recomputeAdjacency();
+
+	/// @brief Gathers the normals of the triangles around each vertex,
+	/// weighted by their area, or by their angle at the vertex
 	void recomputePerVertexNormals(bool angleBased = false);
 
+	/// @brief Tangents follow the UVs when there are some (MikkTSpace-like:
+	/// per-triangle UV derivatives, angle-weighted and orthogonalized against
+	/// the normal), the bitangent carries the handedness
 	void recomputeTangentSpace();
 
 	void recomputeUVs(glm::vec2 scale);
 
+	/// @brief Also sorts triangleIndices() in the BVH order, optimizes the
+	/// BVH if OPTIMIZE_BVH is set, then the triangles for the rasterizer if
+	/// OPTIMIZE_FOR_RASTERIZATION is set
 	void recomputeBVH(std::shared_ptr<Mesh> meshPtr);
 
+	/// @brief Chain of quadric error metric simplifications, each with half
+	/// the triangles of the previous one, ordered for the vertex cache too
+	void recomputeLODs();
+
+	/// @brief Reorders the triangles for the post-transform vertex cache and
+	/// for overdraw, the leaves of the BVH staying valid, then the vertices in
+	/// the order they are first used. Needs the BVH.
+	void optimizeForRasterization();
+
 	void clear();
 
+	/// @brief To call after editing the vertices or the triangles, the
+	/// recompute functions call it. The scene geometry arena and the GPU ray
+	/// tracer then upload the mesh again.
+	inline void geometryChanged() {
+		m_geometryVersion = nextVersion();
+		m_adjacencyDirty = true;
+	}
+	inline size_t geometryVersion() const { return m_geometryVersion; }
+
+   public:
+	/// @brief Run BVH::optimize after each BVH build
+	static bool OPTIMIZE_BVH;
+
+	/// @brief Run optimizeForRasterization after each BVH build
+	static bool OPTIMIZE_FOR_RASTERIZATION;
+
+	/// @brief Levels of detail stop there
+	static constexpr size_t MAX_LODS = 6;
+
    private:
 	std::vector<glm::vec3> m_vertexPositions;
 	std::vector<glm::vec3> m_vertexNormals;
@@ -67,6 +129,15 @@ class Mesh : public Transform {
 	std::vector<glm::vec3> m_vertexBitangents;
 	std::vector<glm::vec2> m_vertexUVs;
 	std::vector<glm::uvec3> m_triangleIndices;
+	std::vector<std::vector<glm::uvec3>> m_lodTriangles;
+	std::vector<float> m_lodErrors;
+
+	std::vector<unsigned int> m_vertexTriangleOffsets;
+	std::vector<unsigned int> m_vertexTriangles;
+	bool m_adjacencyDirty = true;
 
 	std::shared_ptr<BVH> m_bvh;
+	size_t m_geometryVersion = nextVersion();
+
+	void updateAdjacency();
 };
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Shader storage buffer written through a persistent, coherent mapping.
+ * It holds NUM_REGIONS copies of the data: the CPU fills one while the GPU may
+ * still read the others, each copy being guarded by a fence. The data is kept
+ * in a CPU shadow, and only the ranges written since a copy was last used are
+ * copied into it. The GPU buffer is only reallocated when the data outgrows it.
+ */
+class PersistentBuffer {
+   public:
+	static constexpr size_t NUM_REGIONS = 3;
+
+	PersistentBuffer() {}
+	~PersistentBuffer();
+
+	PersistentBuffer(const PersistentBuffer&) = delete;
+	PersistentBuffer& operator=(const PersistentBuffer&) = delete;
+
+	/// @brief Size of the data in bytes, the content up to it is kept
+	void resize(size_t size);
+	inline size_t size() const { return m_data.size(); }
+
+	/// @brief Only written to the shadow, the regions are updated by flush()
+	void write(size_t offset, const void* data, size_t size);
+
+	template <typename T>
+	inline void write(size_t index, const T& element) {
+		write(index * sizeof(T), &element, sizeof(T));
+	}
+
+	/// @brief Moves to the next region, waiting for the GPU to be done with
+	/// it, and copies the ranges written since it was last used into it.
+	/// Returns the number of bytes copied.
+	size_t flush();
+
+	/// @brief Binds the current region
+	void bind(GLuint binding) const;
+
+	/// @brief Fences the current region, once the commands reading it are
+	/// issued
+	void fence();
+
+	void clear();
+
+   private:
+	void reallocate();
+	static void wait(GLsync& sync);
+
+	std::vector<unsigned char> m_data;
+	/// @brief Ranges [begin, end) of the data each region misses
+	std::vector<std::pair<size_t, size_t>> m_dirtyRanges[NUM_REGIONS];
+	GLsync m_fences[NUM_REGIONS] = {};
+	size_t m_region = 0;
+
+	GLuint m_buffer = 0;
+	unsigned char* m_mapped = nullptr;
+	/// @brief Size of a region, and distance between two regions rounded up
+	/// to the storage buffer offset alignment
+	size_t m_capacity = 0;
+	size_t m_stride = 0;
+};
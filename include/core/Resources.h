@@ -4,5 +4,7 @@
 
 static const std::string BASE_WINDOW_TITLE("Telo's Toy Renderer");
 static const std::string SHADER_PATH("Resources/Shaders/");
+static const std::string SHADER_CACHE_PATH("Resources/ShaderCache/");
 
-static const int MAX_LIGHTS = 10;
\ No newline at end of file
+static const int MAX_LIGHTS = 10;
+static const int MAX_TEXTURES = 16;  // Size of the shaders' texture arrays
\ No newline at end of file
@@ -7,12 +7,14 @@
 class Model;
 class AbstractLight;
 class Texture;
+class GeometryArena;
+class SceneBVH;
 
 class Camera;
 
 class Scene {
    public:
-	inline Scene() : m_backgroundColor(0.f, 0.f, 0.f) {}
+	Scene();
 	virtual ~Scene() {}
 
 	inline const glm::vec3& backgroundColor() const {
@@ -86,6 +88,12 @@ class Scene {
 		m_lights[index] = light;
 	}
 
+	/// @brief GPU geometry of all the models, see GeometryArena::update
+	inline std::shared_ptr<GeometryArena> geometry() { return m_geometry; }
+
+	/// @brief Hierarchy over the models for culling, see SceneBVH::update
+	inline std::shared_ptr<SceneBVH> hierarchy() { return m_hierarchy; }
+
 	// Image parameters
 
 	inline void set(const ImageParameters& imageParameters) {
@@ -98,11 +106,7 @@ class Scene {
 
 	inline ImageParameters& imageParameters() { return m_imageParameters; }
 
-	inline void clear() {
-		m_camera.reset();
-		m_models.clear();
-		m_lights.clear();
-	}
+	void clear();
 
 	void recomputeBVHs();
 
@@ -112,5 +116,7 @@ class Scene {
 	std::vector<std::shared_ptr<Model>> m_models;
 	std::vector<std::shared_ptr<AbstractLight>> m_lights;
 	std::vector<std::shared_ptr<Texture>> m_textures;
+	std::shared_ptr<GeometryArena> m_geometry;
+	std::shared_ptr<SceneBVH> m_hierarchy;
 	ImageParameters m_imageParameters;
 };
\ No newline at end of file
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <memory>
+
+#include "core/UniformBuffer.h"
+#include "core/UniformBlocks.h"
+
+class Scene;
+
+/**
+ * @brief Uniform blocks shared by all the draws of a frame: the camera, the
+ * image parameters and the lights, one upload each per frame
+ */
+class SceneUniforms {
+   public:
+	SceneUniforms();
+
+	/// @brief Only the blocks that changed since the last update are
+	/// uploaded, returns whether there was one
+	bool update(Scene& scene, const glm::vec2& resolution);
+
+	/// @brief Binds the blocks to their binding points, see UniformBlocks.h
+	void bind() const;
+
+   private:
+	template <typename Block>
+	bool upload(UniformBuffer& buffer, Block& uploaded, const Block& block);
+
+	UniformBuffer m_camera;
+	UniformBuffer m_image;
+	UniformBuffer m_lights;
+
+	/// @brief Content of the buffers
+	CameraBlock m_cameraBlock = {};
+	ImageBlock m_imageBlock = {};
+	LightsBlock m_lightsBlock = {};
+	bool m_uploaded = false;
+};
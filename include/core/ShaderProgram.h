@@ -3,6 +3,9 @@
 #include <glad/glad.h>
 #include <string>
 #include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
@@ -12,73 +15,125 @@ class ShaderProgram {
 
 	virtual ~ShaderProgram();
 
+	/// @brief With background set, the program may still be linking when
+	/// returned, see ready()
 	static std::shared_ptr<ShaderProgram> genBasicShaderProgram(
 		const std::string& vertexShaderFilename,
-		const std::string& fragmentShaderFilename);
+		const std::string& fragmentShaderFilename, bool background = false);
+
+	static std::shared_ptr<ShaderProgram> genComputeShaderProgram(
+		const std::string& computeShaderFilename, bool background = false);
+
+	/// @brief A program in use and the program replacing it
+	using Replacement =
+		std::pair<std::shared_ptr<ShaderProgram>*, std::shared_ptr<ShaderProgram>>;
+
+	/// @brief Swaps in the replacements that are linked, or all of them after
+	/// waiting with wait set. A replacement that fails is dropped and the old
+	/// program kept, which is a critical error when there is none.
+	static void replaceLinked(std::vector<Replacement>& replacements,
+							  bool wait = false);
 
 	inline GLuint id() { return m_id; }
 
 	inline const std::string& name() const { return m_name; }
 
+	/// @brief Reads the source, compiled by link(). Lines #include "file" are
+	/// replaced by the file, relative to the shader.
 	void loadShader(GLenum type, const std::string& shaderFilename);
 
-	void link();
+	/// @brief Loads the binary of the program from the cache, or compiles and
+	/// links the shaders, then caches the binary. With background set and
+	/// KHR_parallel_shader_compile, the driver does it on its own threads.
+	/// Throws when a shader does not compile or the program does not link.
+	void link(bool background = false);
+
+	/// @brief False while the program is linking in the background, throws
+	/// when the link failed
+	bool ready();
+
+	/// @brief Waits for the link, throws when it failed
+	void wait();
 
 	inline void use() { glUseProgram(m_id); }
 
 	inline static void stop() { glUseProgram(0); }
 
-	inline GLuint getLocation(const std::string& name) {
-		use();
-		return glGetUniformLocation(m_id, name.c_str());
+	/// @brief Locations are looked up once per link, -1 for the uniforms
+	/// the program does not use
+	inline GLint getLocation(const std::string& name) {
+		auto it = m_locations.find(name);
+		if (it != m_locations.end()) return it->second;
+		GLint location = glGetUniformLocation(m_id, name.c_str());
+		m_locations.emplace(name, location);
+		return location;
 	}
 
+	// The values go straight to the program, which does not need to be bound
+
 	inline void set(const std::string& name, bool value) {
-		use();
-		glUniform1i(getLocation(name.c_str()), value ? 1 : 0);
+		glProgramUniform1i(m_id, getLocation(name), value ? 1 : 0);
 	}
 
 	inline void set(const std::string& name, float value) {
-		use();
-		glUniform1f(getLocation(name.c_str()), value);
+		glProgramUniform1f(m_id, getLocation(name), value);
 	}
 
 	inline void set(const std::string& name, int value) {
-		use();
-		glUniform1i(getLocation(name.c_str()), value);
+		glProgramUniform1i(m_id, getLocation(name), value);
 	}
 
 	inline void set(const std::string& name, unsigned int value) {
-		use();
-		glUniform1i(getLocation(name.c_str()), int(value));
+		glProgramUniform1i(m_id, getLocation(name), int(value));
 	}
 
 	inline void set(const std::string& name, const glm::vec2& value) {
-		use();
-		glUniform2fv(getLocation(name.c_str()), 1, glm::value_ptr(value));
+		glProgramUniform2fv(m_id, getLocation(name), 1, glm::value_ptr(value));
 	}
 
 	inline void set(const std::string& name, const glm::vec3& value) {
-		use();
-		glUniform3fv(getLocation(name.c_str()), 1, glm::value_ptr(value));
+		glProgramUniform3fv(m_id, getLocation(name), 1, glm::value_ptr(value));
 	}
 
 	inline void set(const std::string& name, const glm::vec4& value) {
-		use();
-		glUniform4fv(getLocation(name.c_str()), 1, glm::value_ptr(value));
+		glProgramUniform4fv(m_id, getLocation(name), 1, glm::value_ptr(value));
 	}
 
 	inline void set(const std::string& name, const glm::mat4& value) {
-		use();
-		glUniformMatrix4fv(getLocation(name.c_str()), 1, GL_FALSE,
-						   glm::value_ptr(value));
+		glProgramUniformMatrix4fv(m_id, getLocation(name), 1, GL_FALSE,
+								  glm::value_ptr(value));
 	}
 
+   public:
+	/// @brief Directory of the cached program binaries, keyed by the sources
+	/// and the driver. Nothing is cached when empty.
+	static std::string BINARY_CACHE_PATH;
+
    private:
+	struct Source {
+		GLenum type;
+		std::string filename;
+		std::string text;
+	};
+
 	std::string shaderInfoLog(const std::string& shaderName, GLuint shaderId);
 
 	std::string infoLog();
 
+	/// @brief Cache file of the program, empty without cache
+	std::string binaryFilename() const;
+	bool loadBinary();
+	void saveBinary();
+	/// @brief Checks the shaders and the link, then caches the binary and the
+	/// uniform locations
+	void finishLink();
+	void cacheLocations();
+
 	GLuint m_id = 0;
 	std::string m_name;
+	std::vector<Source> m_sources;
+	/// @brief Shaders attached while the program links
+	std::vector<GLuint> m_shaders;
+	bool m_linking = false;
+	std::unordered_map<std::string, GLint> m_locations;
 };
@@ -2,6 +2,20 @@
 
 #include <glad/glad.h>
 #include <string>
+#include <vector>
+
+/**
+ * @brief Image decoded in CPU memory. Decoding does not need the GL context,
+ * so it can run on any thread before the Texture is created.
+ */
+struct TexturePixels {
+	std::vector<unsigned char> data;
+	int width = 0;
+	int height = 0;
+	int numComponents = 0;
+
+	bool load(const std::string& filename);
+};
 
 class Texture {
    public:
@@ -9,6 +23,17 @@ class Texture {
 		handle = loadTextureFromFileToGPU(source, sRGB);
 	}
 
+	/// @brief Uploads already decoded 8-bit pixels, 1 to 4 components each
+	Texture(const unsigned char* pixels, int width, int height,
+			int numComponents, bool sRGB = false) {
+		handle = uploadToGPU(pixels, width, height, numComponents, sRGB);
+	}
+
+	Texture(const TexturePixels& pixels, bool sRGB = false) {
+		handle = uploadToGPU(pixels.data.data(), pixels.width, pixels.height,
+							 pixels.numComponents, sRGB);
+	}
+
 	void bind() { glBindTexture(GL_TEXTURE_2D, handle); }
 
 	~Texture() { glDeleteTextures(1, &handle); }
@@ -17,4 +42,6 @@ class Texture {
 	GLuint handle;
 
 	GLuint loadTextureFromFileToGPU(const std::string& filename, bool sRGB);
+	GLuint uploadToGPU(const unsigned char* pixels, int width, int height,
+					   int numComponents, bool sRGB);
 };
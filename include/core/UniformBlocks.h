@@ -0,0 +1,149 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "core/Resources.h"
+#include "core/Mesh.h"
+
+// std140 mirrors of the uniform blocks of the shaders, and std430 mirrors of
+// their storage buffers, whose binding points are fixed in the shaders with
+// layout(binding = ...). GLSL bools are 4 bytes.
+
+enum UniformBlockBinding {
+	CAMERA_BLOCK_BINDING = 0,
+	IMAGE_BLOCK_BINDING = 1,
+	LIGHTS_BLOCK_BINDING = 2,
+};
+
+/// @brief Storage buffers of the rasterizer, after the ones of the scene
+/// geometry arena and of the GPU ray tracer
+enum RasterizerStorageBinding {
+	MODEL_TABLE_BINDING = 5,
+	DRAW_TABLE_BINDING = 6,
+	DRAW_COMMANDS_BINDING = 7,
+	LOD_STATES_BINDING = 8,
+	DRAW_STATS_BINDING = 9,
+};
+
+struct CameraBlock {
+	glm::mat4 viewMat;
+	glm::mat4 projectionMat;
+	glm::mat4 invViewMat;
+	glm::mat4 invProjectionMat;
+	glm::vec3 eye;
+	float zNear;
+	glm::vec2 resolution;
+	float zFar;
+	float padding;
+};
+
+struct ImageParametersBlock {
+	int colorCorrect;
+	int useSRGB;
+	int useToneMapping;
+	int useExposure;
+	float exposure;
+	int raytracedShadows;
+	int raytracedReflections;
+	int numRefractions;
+};
+
+struct ImageBlock {
+	ImageParametersBlock imageParameters;
+	glm::vec3 backgroundColor;
+	float padding;
+};
+
+struct LightBlock {
+	int type;
+	float padding0[3];
+	/// @brief Directional light: direction, point light: position
+	glm::vec3 direction;
+	float padding1;
+	glm::vec3 color;
+	float intensity;
+	float ac;
+	float al;
+	float aq;
+	float padding2;
+};
+
+struct LightsBlock {
+	LightBlock lights[MAX_LIGHTS];
+	int numOfLights;
+	int padding[3];
+};
+
+/// @brief Also the std430 layout of the materials of the ray tracer models
+struct MaterialBlock {
+	glm::vec3 albedo;
+	float roughness;
+	glm::vec3 F0;
+	float metalness;
+
+	int transparent;
+	float base_reflectance;
+	float ior;
+	float absorption;
+
+	int albedoTex;
+	int roughnessTex;
+	int aoTex;
+	int metalnessTex;
+
+	int normalTex;
+	int heightTex;
+	float heightMult;
+	int padding;
+};
+
+/// @brief Entry of the model table of the rasterizer, indexed by the index of
+/// the model in the scene, which is also the draw index of the multi-draw
+struct ModelBlock {
+	glm::mat4 modelMat;
+	glm::mat4 normalMat;
+	glm::vec4 positionOffset;
+	glm::vec4 positionScale;
+	MaterialBlock material;
+};
+
+/// @brief What the culling compute shader needs to build the draw command of
+/// a model
+struct DrawBlock {
+	/// @brief World space bounds
+	glm::vec4 boundsMin;
+	glm::vec4 boundsMax;
+	/// @brief Object space center and radius
+	glm::vec4 boundingSphere;
+	unsigned int firstVertex;
+	/// @brief Levels after the full mesh
+	unsigned int numOfLODs;
+	/// @brief Hidden according to the CPU occlusion culling
+	unsigned int occluded;
+	unsigned int padding;
+	/// @brief First index, number of indices and error (float bits) of each
+	/// level, the full mesh first
+	glm::uvec4 lods[Mesh::MAX_LODS + 1];
+};
+// Hardcoded in CullingComputeShader.glsl
+static_assert(Mesh::MAX_LODS == 6,
+			  "MAX_LODS of CullingComputeShader.glsl must be Mesh::MAX_LODS");
+static_assert(sizeof(DrawBlock) == 64 + 16 * (Mesh::MAX_LODS + 1),
+			  "DrawBlock must have the std430 layout of the shader");
+
+/// @brief Layout of glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+	unsigned int count;
+	unsigned int instanceCount;
+	unsigned int firstIndex;
+	int baseVertex;
+	unsigned int baseInstance;
+};
+
+/// @brief Counters of the culling compute shader
+struct DrawStatsBlock {
+	unsigned int drawnModels;
+	unsigned int drawnTriangles;
+	unsigned int culledModels;
+	unsigned int padding;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstddef>
+
+/**
+ * @brief GPU buffer holding std140 uniform blocks, see core/UniformBlocks.h.
+ * Updated with a single glBufferSubData per frame.
+ */
+class UniformBuffer {
+   public:
+	UniformBuffer(size_t size);
+	~UniformBuffer();
+
+	UniformBuffer(const UniformBuffer&) = delete;
+	UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+	inline GLuint id() const { return m_id; }
+	inline size_t size() const { return m_size; }
+
+	/// @brief Reallocates the buffer when it is too small, its content is
+	/// then lost
+	void reserve(size_t size);
+
+	void update(const void* data, size_t size, size_t offset = 0);
+
+	template <typename Block>
+	inline void update(const Block& block) {
+		update(&block, sizeof(Block));
+	}
+
+	void bind(GLuint binding) const;
+
+	/// @brief offset must be a multiple of offsetAlignment()
+	void bindRange(GLuint binding, size_t offset, size_t size) const;
+
+	/// @brief Alignment of the blocks of an array bound with bindRange
+	static size_t offsetAlignment();
+
+   private:
+	GLuint m_id = 0;
+	size_t m_size = 0;
+};
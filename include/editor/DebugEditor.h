@@ -12,21 +12,29 @@
 #include <memory>
 
 #include "core/Model.h"
+#include "core/Mesh.h"
 #include "core/Scene.h"
 #include "core/Material.h"
 #include "core/Resources.h"
 #include "utils/Transform.h"
 #include "acceleration/BVH.h"
+#include "core/GeometryArena.h"
 #include "renderers/Rasterizer.h"
+#include "renderers/GPURaytracer.h"
 
 class DebugEditor : public Editor {
 	std::shared_ptr<Scene> _scenePtr;
 	std::shared_ptr<Rasterizer> _rasterizerPtr;
+	std::shared_ptr<GPU_Raytracer> _gpuRaytracerPtr;
 
    public:
 	DebugEditor(std::shared_ptr<Scene> scenePtr,
-				std::shared_ptr<Rasterizer> rasterizerPtr)
-		: Editor("Debug"), _scenePtr(scenePtr), _rasterizerPtr(rasterizerPtr) {}
+				std::shared_ptr<Rasterizer> rasterizerPtr,
+				std::shared_ptr<GPU_Raytracer> gpuRaytracerPtr)
+		: Editor("Debug"),
+		  _scenePtr(scenePtr),
+		  _rasterizerPtr(rasterizerPtr),
+		  _gpuRaytracerPtr(gpuRaytracerPtr) {}
 
 	void renderUI() override {
 		ImGui::Checkbox("Show Lights", &_rasterizerPtr->debugLights());
@@ -34,14 +42,80 @@ class DebugEditor : public Editor {
 		ImGui::RadioButton("Median Split", &BVH::BUILD_TYPE, 0);
 		ImGui::SameLine();
 		ImGui::RadioButton("Surface Area Heuristic", &BVH::BUILD_TYPE, 1);
+		ImGui::SameLine();
+		ImGui::RadioButton("Linear (Morton codes)", &BVH::BUILD_TYPE, 2);
 		if (BVH::BUILD_TYPE == 1) {
 			ImGui::SliderInt("Split Candidates", &BVH::NUM_SPLIT_CANDIDATES, 1,
 							 20);
 		}
+		if (BVH::BUILD_TYPE == 2) {
+			ImGui::Checkbox("SAH top levels", &BVH::SAH_TOP_LEVELS);
+		}
+
+		ImGui::Checkbox("Optimize BVH (treelet restructuring)",
+						&Mesh::OPTIMIZE_BVH);
 
 		if (ImGui::Button("Rebuild BVH")) {
 			_scenePtr->recomputeBVHs();
 		}
+		ImGui::Checkbox("Compressed BVH nodes", &BVH::USE_COMPRESSED_NODES);
+		ImGui::Checkbox("Stackless GPU BVH traversal",
+						&GPU_Raytracer::STACKLESS_TRAVERSAL);
+		ImGui::Checkbox("Build GPU BVHs in compute shaders",
+						&GPU_Raytracer::BUILD_BVHS_ON_GPU);
+		ImGui::Checkbox("Count traversed BVH nodes",
+						&GPU_Raytracer::COUNT_TRAVERSED_NODES);
+		if (GPU_Raytracer::COUNT_TRAVERSED_NODES) {
+			ImGui::Text("Nodes per ray: %.1f",
+						_gpuRaytracerPtr->nodesPerRay());
+		}
+		ImGui::Checkbox("Compute shader ray tracing",
+						&GPU_Raytracer::USE_COMPUTE_SHADER);
+		ImGui::Checkbox("Accumulate ray traced samples",
+						&GPU_Raytracer::ACCUMULATE_SAMPLES);
+		ImGui::Checkbox("Hybrid rendering (rasterized primary rays)",
+						&GPU_Raytracer::HYBRID_RENDERING);
+		ImGui::Checkbox("Dynamic ray tracing resolution",
+						&GPU_Raytracer::DYNAMIC_RESOLUTION);
+		if (GPU_Raytracer::DYNAMIC_RESOLUTION) {
+			ImGui::SliderFloat("Target frame time (ms)",
+							   &GPU_Raytracer::TARGET_FRAME_TIME, 1.f, 100.f);
+		}
+		ImGui::Text("Frame: %.1f ms, ray traced at %.0f%%",
+					_gpuRaytracerPtr->frameTime(),
+					100.f * _gpuRaytracerPtr->renderScale());
+		ImGui::Checkbox("Optimize triangle order",
+						&Mesh::OPTIMIZE_FOR_RASTERIZATION);
+
+		ImGui::Checkbox("Mesh LODs", &_rasterizerPtr->useLODs());
+		if (_rasterizerPtr->useLODs()) {
+			ImGui::SliderFloat("LOD pixel error",
+							   &_rasterizerPtr->lodPixelError(), 0.1f, 10.f);
+		}
+
+		ImGui::Checkbox("GPU-driven draws", &_rasterizerPtr->gpuDriven());
+		ImGui::Checkbox("Frustum culling", &_rasterizerPtr->frustumCulling());
+		ImGui::Checkbox("Occlusion culling",
+						&_rasterizerPtr->occlusionCulling());
+		ImGui::Checkbox("Count drawn models", &_rasterizerPtr->drawStats());
+		if (_rasterizerPtr->drawStats()) {
+			ImGui::Text("Rasterized triangles: %zu",
+						_rasterizerPtr->numDrawnTriangles());
+			ImGui::Text("Models drawn: %zu, culled: %zu",
+						_rasterizerPtr->numDrawnModels(),
+						_rasterizerPtr->numCulledModels());
+		}
+		ImGui::Text("Models occluded: %zu",
+					_rasterizerPtr->numOccludedModels());
+		ImGui::Text("Occluders: %zu", _rasterizerPtr->numOccluders());
+
+		ImGui::Text("Vertex format");
+		ImGui::RadioButton("Float", &GeometryArena::VERTEX_FORMAT, 0);
+		ImGui::SameLine();
+		ImGui::RadioButton("Compact", &GeometryArena::VERTEX_FORMAT, 1);
+		ImGui::SameLine();
+		ImGui::RadioButton("Quantized positions", &GeometryArena::VERTEX_FORMAT,
+						   2);
 
 		ImGui::Checkbox("Show BVH", &_rasterizerPtr->debugBVH());
 		if (_rasterizerPtr->debugBVH()) {
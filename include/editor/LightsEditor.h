@@ -20,11 +20,13 @@
 
 class LightsEditor : public Editor {
 	std::shared_ptr<Scene> _scenePtr;
-	glm::vec3 _center{};
-	float _meshScale = 0;
+	// References, the scene layout is only known once its meshes are loaded
+	const glm::vec3& _center;
+	const float& _meshScale;
 
    public:
-	LightsEditor(std::shared_ptr<Scene> scenePtr, glm::vec3 center, float meshScale)
+	LightsEditor(std::shared_ptr<Scene> scenePtr, const glm::vec3& center,
+				 const float& meshScale)
 		: Editor("Lights"), _scenePtr(scenePtr), _center(center), _meshScale(meshScale) {}
 
 	std::shared_ptr<AbstractLight> getNewLight(int type, AbstractLight& prevLight) {
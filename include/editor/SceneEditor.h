@@ -9,6 +9,7 @@
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 
+#include <cstring>
 #include <memory>
 
 #include "core/Model.h"
@@ -142,7 +143,12 @@ class SceneEditor : public Editor {
 				if (ImGui::CollapsingHeader(
 						("Material##" + std::to_string(i)).c_str())) {
 					ImGui::Indent(10.0f);
+					// The renderers upload the material again if it changed
+					MaterialBlock before = model.material().uniformBlock();
 					renderMaterialUI(model.material(), i);
+					MaterialBlock after = model.material().uniformBlock();
+					if (std::memcmp(&before, &after, sizeof(MaterialBlock)))
+						model.material().markChanged();
 					ImGui::Indent(-10.0f);
 				}
 				ImGui::Indent(-10.0f);
@@ -6,8 +6,8 @@
 #include "primitives/Triangle.h"
 
 struct AABB {
-	glm::vec3 begin_corner;
-	glm::vec3 end_corner;
+	glm::vec3 begin_corner{0.f};
+	glm::vec3 end_corner{0.f};
 	int depth = 0;
 
 	AABB() = default;
@@ -44,6 +44,12 @@ struct AABB {
 		extend(triangle.c);
 	}
 
+	inline void extend(const AABB& box) {
+		if (!box.started) return;
+		extend(box.begin_corner);
+		extend(box.end_corner);
+	}
+
 	inline size_t longestAxis() const {
 		glm::vec3 diagonal = end_corner - begin_corner;
 		if (diagonal.x > diagonal.y && diagonal.x > diagonal.z) {
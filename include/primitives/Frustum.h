@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "primitives/AABB.h"
+
+/**
+ * @brief View frustum as six planes facing inwards, extracted from a
+ * projection * view matrix (Gribb and Hartmann). The planes are not
+ * normalized, only the side of a point matters.
+ */
+struct Frustum {
+	enum Intersection { OUTSIDE, INTERSECTING, INSIDE };
+
+	/// @brief Mask of all the planes for test()
+	static constexpr int ALL_PLANES = 0x3F;
+
+	glm::vec4 planes[6];
+
+	Frustum(const glm::mat4& viewProjection) {
+		glm::mat4 rows = glm::transpose(viewProjection);
+		for (int axis = 0; axis < 3; axis++) {
+			planes[2 * axis] = rows[3] + rows[axis];
+			planes[2 * axis + 1] = rows[3] - rows[axis];
+		}
+	}
+
+	/// @brief Only tests the planes of planeMask, and removes from it the
+	/// planes the box is entirely inside of: a box inside its parent's planes
+	/// does not test them again
+	inline Intersection test(const AABB& box, int& planeMask) const {
+		Intersection result = INSIDE;
+		for (int i = 0; i < 6; i++) {
+			if (!(planeMask & (1 << i))) continue;
+
+			glm::vec3 normal(planes[i]);
+			glm::bvec3 positive = glm::greaterThan(normal, glm::vec3(0.f));
+			// Corners of the box the furthest along the normal and against it
+			glm::vec3 front = glm::mix(box.begin_corner, box.end_corner, positive);
+			glm::vec3 back = glm::mix(box.end_corner, box.begin_corner, positive);
+
+			if (glm::dot(normal, front) + planes[i].w < 0.f) return OUTSIDE;
+			if (glm::dot(normal, back) + planes[i].w >= 0.f)
+				planeMask &= ~(1 << i);
+			else
+				result = INTERSECTING;
+		}
+		return result;
+	}
+};
@@ -1,31 +1,111 @@
 #pragma once
 
 #include <glad/glad.h>
+#include <chrono>
 #include <string>
 #include <memory>
+#include <vector>
 #include <glm/glm.hpp>
 
+#include "core/ShaderProgram.h"
+#include "core/PersistentBuffer.h"
+#include "acceleration/GPUBVHBuilder.h"
+
 class Scene;
 class Mesh;
-class ShaderProgram;
 class Image;
+class SceneUniforms;
+class BVH;
+class Rasterizer;
 
 class GPU_Raytracer {
    public:
 	inline GPU_Raytracer() {}
 
-	virtual ~GPU_Raytracer() {}
+	virtual ~GPU_Raytracer();
 
+	/// @brief The rasterizer draws the visibility buffer of the hybrid
+	/// rendering
 	void init(const std::string& basepath,
-			  const std::shared_ptr<Scene> scenePtr);
+			  const std::shared_ptr<Scene> scenePtr,
+			  std::shared_ptr<Rasterizer> rasterizerPtr);
 	void setResolution(int width, int height);
-	void loadShaderProgram(const std::string& basePath);
+	/// @brief In the background, the current program stays in use until the
+	/// new one links
+	void loadShaderProgram(const std::string& basePath,
+						   bool background = false);
 
 	void render(std::shared_ptr<Scene> scenePtr);
-	void createSSBOs(std::shared_ptr<Scene> scenePtr);
-	void updateSSBOs(std::shared_ptr<Scene> scenePtr);
+	/// @brief To call on the frames drawn by another renderer: the next
+	/// render neither times the gap nor reuses the stale history
+	void skipFrame();
+	/// @brief Uploads the models and BVHs that changed since the last call,
+	/// everything the first time. Returns whether there was any.
+	bool updateSSBOs(std::shared_ptr<Scene> scenePtr);
+
+   public:
+	/// @brief Trace in a compute shader, where resident work groups fetch
+	/// tiles of pixels, rather than in a fullscreen fragment shader
+	static bool USE_COMPUTE_SHADER;
+
+	/// @brief Average the jittered samples of the frames while the scene and
+	/// the camera stay the same, for a converged, antialiased image
+	static bool ACCUMULATE_SAMPLES;
+
+	/// @brief Trace fewer pixels while the frames take longer than
+	/// TARGET_FRAME_TIME, the image being upscaled with the previous ones.
+	/// Replaces the accumulation.
+	static bool DYNAMIC_RESOLUTION;
+	/// @brief In ms
+	static float TARGET_FRAME_TIME;
+
+	/// @brief The surfaces seen from the camera are rasterized rather than
+	/// traced, only the shadow, reflection and refraction rays are
+	static bool HYBRID_RENDERING;
+
+	/// @brief Traverse the BVHs without a stack, following the skip links of
+	/// the threaded node layout in the order of the ray octant. Uses the full
+	/// precision nodes, whatever BVH::USE_COMPRESSED_NODES.
+	static bool STACKLESS_TRAVERSAL;
+
+	/// @brief Build the BVHs of the models in compute shaders, in the full
+	/// precision layout, rather than upload the ones built on the CPU. They
+	/// are built again when the geometry of their mesh changes.
+	static bool BUILD_BVHS_ON_GPU;
+
+	/// @brief Count the BVH nodes the rays fetch, see nodesPerRay
+	static bool COUNT_TRAVERSED_NODES;
+
+	/// @brief Layouts of the BVH nodes in the shader
+	enum class NodeLayout { Full, Compressed, Threaded };
+
+	/// @brief Fraction of the resolution traced on each axis
+	inline float renderScale() const { return m_renderScale; }
+	/// @brief In ms, between the last two consecutive renders
+	inline float frameTime() const { return m_frameTime; }
+	/// @brief Average over the rays of the previous render, with
+	/// COUNT_TRAVERSED_NODES
+	inline float nodesPerRay() const { return m_nodesPerRay; }
 
    private:
+	/// @brief Visibility buffer of the hybrid rendering, at the render size
+	void renderVisibility(std::shared_ptr<Scene> scenePtr);
+	/// @brief Reads back the traversal counts of the previous render, and
+	/// clears them for this one
+	void updateTraversalStats();
+	/// @brief Compute shader path, writes the images
+	void traceTiles();
+	/// @brief Draws the images written by the compute shader path
+	void drawImages();
+	/// @brief Times the frame and sets the render size from it
+	void updateRenderScale();
+	/// @brief Draws the traced images upscaled to the resolution, blended
+	/// with the history
+	void upscale(const glm::mat4& viewProjection, const glm::vec2& jitter);
+	/// @brief (Re)allocates the images at the resolution, returns whether
+	/// they were
+	bool reserveImages();
+
 	GLuint genGPUBuffer(size_t elementSize, size_t numElements,
 						const void* data);
 	GLuint genGPUVertexArray(GLuint posVbo, GLuint ibo, bool hasNormals,
@@ -33,11 +113,75 @@ class GPU_Raytracer {
 	void initScreenQuad();
 
 	std::shared_ptr<ShaderProgram> m_raytracingShaderProgramPtr;
-	GLuint m_screenQuadVao;
+	std::shared_ptr<ShaderProgram> m_computeShaderProgramPtr;
+	std::shared_ptr<ShaderProgram> m_imageShaderProgramPtr;
+	std::shared_ptr<ShaderProgram> m_upscaleShaderProgramPtr;
+	std::shared_ptr<ShaderProgram> m_bvhBuildShaderProgramPtr;
+	std::vector<ShaderProgram::Replacement> m_pendingShaderPrograms;
+	std::shared_ptr<SceneUniforms> m_sceneUniformsPtr;
+	std::shared_ptr<Rasterizer> m_rasterizerPtr;
+	GLuint m_screenQuadVao = 0;
 	glm::vec2 m_resolution;
 
-	GLuint m_verticesSSBO;
-	GLuint m_trianglesSSBO;
-	GLuint m_modelsSSBO;
-	GLuint m_bvhSSBO;
+	/// @brief Written by the compute shader path, and by both paths with
+	/// dynamic resolution, in the corner of the render size
+	GLuint m_colorTexture = 0;
+	GLuint m_depthTexture = 0;
+	/// @brief Sum of the samples of each pixel
+	GLuint m_accumulationTexture = 0;
+	/// @brief Of the color and depth images
+	GLuint m_imagesFramebuffer = 0;
+	/// @brief Model and triangle at each pixel, see HYBRID_RENDERING
+	GLuint m_visibilityTexture = 0;
+	GLuint m_visibilityDepth = 0;
+	GLuint m_visibilityFramebuffer = 0;
+	int m_numOfAccumulatedSamples = 0;
+	/// @brief Program that filled the accumulation image
+	const ShaderProgram* m_accumulatingProgram = nullptr;
+	glm::ivec2 m_imageSize = glm::ivec2(0);
+	GLuint m_tileCounterBuffer = 0;
+	GLuint m_numOfResidentGroups = 0;
+
+	/// @brief Dynamic resolution. No last frame (the epoch) before the first
+	/// render and after skipped ones.
+	std::chrono::steady_clock::time_point m_lastFrame;
+	float m_frameTime = 0.f;
+	size_t m_frameIndex = 0;
+	float m_renderScale = 1.f;
+	glm::ivec2 m_renderSize = glm::ivec2(1);
+	/// @brief Upscaled images at the resolution, the last one and the one
+	/// written next
+	GLuint m_historyTextures[2] = {};
+	int m_history = 0;
+	bool m_historyValid = false;
+	glm::mat4 m_previousViewProjection = glm::mat4(1.f);
+
+	/// @brief Rays traced and nodes fetched, see COUNT_TRAVERSED_NODES
+	GLuint m_traversalStatsBuffer = 0;
+	/// @brief The buffer holds the counts of the last render
+	bool m_pendingTraversalStats = false;
+	float m_nodesPerRay = 0.f;
+
+	/// @brief What the uploaded data of a model was made from
+	struct UploadedModel {
+		size_t bvhVersion = 0;
+		size_t bvhOffset = 0;
+		size_t numOfNodes = 0;
+		size_t transformVersion = 0;
+		size_t materialVersion = 0;
+		size_t geometryVersion = 0;
+	};
+
+	PersistentBuffer m_modelsBuffer;
+	PersistentBuffer m_bvhBuffer;
+	std::vector<UploadedModel> m_uploadedModels;
+	size_t m_uploadedGeometryGeneration = 0;
+	NodeLayout m_uploadedLayout = NodeLayout::Full;
+
+	/// @brief Nodes of the BVHs, with BUILD_BVHS_ON_GPU, read instead of the
+	/// uploaded ones
+	GPU_BVHBuilder m_bvhBuilder;
+	GLuint m_builtBVHBuffer = 0;
+	size_t m_builtBVHCapacity = 0;
+	bool m_uploadedBuiltOnGPU = false;
 };
\ No newline at end of file
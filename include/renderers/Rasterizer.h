@@ -6,10 +6,16 @@
 #include <vector>
 #include <glm/glm.hpp>
 
+#include "core/GeometryArena.h"
+#include "core/PersistentBuffer.h"
+#include "core/UniformBlocks.h"
+#include "core/ShaderProgram.h"
+
 class Scene;
 class Image;
-class ShaderProgram;
 class Mesh;
+class OcclusionCuller;
+class SceneUniforms;
 
 class Rasterizer {
    public:
@@ -20,10 +26,20 @@ class Rasterizer {
 	void init(const std::string& basepath,
 			  const std::shared_ptr<Scene> scenePtr);
 	void setResolution(int width, int height);
+	/// @brief Uploads the models added to the scene since the last call to
+	/// the scene geometry arena
+	void uploadNewModels(const std::shared_ptr<Scene> scenePtr);
 	void updateDisplayedImageTexture(std::shared_ptr<Image> imagePtr);
 	void initDisplayedImage();
-	void loadShaderProgram(const std::string& basePath);
+	/// @brief In the background, the current programs stay in use until the
+	/// new ones link
+	void loadShaderProgram(const std::string& basePath,
+						   bool background = false);
 	void render(std::shared_ptr<Scene> scenePtr);
+	/// @brief Draws the index of the model and of the triangle at each pixel
+	/// into the bound framebuffer, at the finest level of detail. See
+	/// VisibilityFragmentShader.glsl.
+	void renderVisibility(std::shared_ptr<Scene> scenePtr);
 	void renderDebug(std::shared_ptr<Scene> scenePtr);
 	void display(std::shared_ptr<Image> imagePtr);
 	void clear();
@@ -37,6 +53,45 @@ class Rasterizer {
 	bool debugLights() const { return m_debugLights; }
 	bool& debugLights() { return m_debugLights; }
 
+	/// @brief Draw the meshes at the coarsest level of detail whose error
+	/// projects to at most lodPixelError() pixels
+	bool useLODs() const { return m_useLODs; }
+	bool& useLODs() { return m_useLODs; }
+
+	float lodPixelError() const { return m_lodPixelError; }
+	float& lodPixelError() { return m_lodPixelError; }
+
+	/// @brief Skip the models whose bounds are outside of the view frustum,
+	/// see SceneBVH
+	bool frustumCulling() const { return m_frustumCulling; }
+	bool& frustumCulling() { return m_frustumCulling; }
+
+	/// @brief Skip the models hidden behind the largest ones, see
+	/// OcclusionCuller
+	bool occlusionCulling() const { return m_occlusionCulling; }
+	bool& occlusionCulling() { return m_occlusionCulling; }
+
+	/// @brief Submit all the models with one multi-draw whose commands are
+	/// written by the culling compute shader, instead of one draw per model
+	/// after culling on the CPU
+	bool gpuDriven() const { return m_gpuDriven; }
+	bool& gpuDriven() { return m_gpuDriven; }
+
+	/// @brief Count the triangles and models drawn. GPU-driven, the counts
+	/// are read back a few renders late, once the GPU is done with them.
+	bool drawStats() const { return m_drawStats; }
+	bool& drawStats() { return m_drawStats; }
+
+	/// @brief Triangles drawn by the last render counted, see drawStats()
+	size_t numDrawnTriangles() const { return m_numDrawnTriangles; }
+
+	/// @brief Models drawn, outside of the frustum and occluded at the last
+	/// render, the first two counted with drawStats()
+	size_t numDrawnModels() const { return m_numDrawnModels; }
+	size_t numCulledModels() const { return m_numCulledModels; }
+	size_t numOccludedModels() const { return m_numOccludedModels; }
+	size_t numOccluders() const { return m_numOccluders; }
+
    private:
 	GLuint genGPUBuffer(size_t elementSize, size_t numElements,
 						const void* data);
@@ -44,29 +99,141 @@ class Rasterizer {
 							 GLuint normalVbo, bool hasUVs, GLuint uvVBO,
 							 bool tangentSpace, GLuint tangentVbo,
 							 GLuint bitangentVbo);
-	GLuint toGPU(std::shared_ptr<Mesh> meshPtr);
 	void initScreenQuad();
 	void initDebugCube();
-	void draw(size_t meshId, size_t triangleCount);
+	/// @brief Sets m_visibleModels, in the order of the scene. GPU-driven,
+	/// they are the models the occlusion culling considers.
+	void cullModels(std::shared_ptr<Scene> scenePtr,
+					const glm::mat4& viewProjectionMatrix);
+	/// @brief Splits m_visibleModels into the occluders and the models
+	/// tested against them, and starts testing them. All of them are tested
+	/// without occlusion culling.
+	void beginOcclusionCulling(std::shared_ptr<Scene> scenePtr,
+							   const glm::mat4& viewProjectionMatrix,
+							   const glm::mat4& viewMatrix, float fov,
+							   bool occlusionCulling);
+	/// @brief Waits for the test and removes the occluded models from
+	/// m_testedModels
+	void endOcclusionCulling();
+	/// @brief Reads the counts of the previous renders the GPU is done with,
+	/// then clears and binds the copy of the counters this render writes
+	void updateDrawStats();
+	/// @brief (Re)allocates the draw commands and the level of detail states
+	/// when the number of models changes
+	void reserveModelBuffers(size_t numOfModels);
+	/// @brief Model table of all the models, the entries of the models whose
+	/// transform, material or geometry changed written again
+	void uploadModelTable(std::shared_ptr<Scene> scenePtr);
+	/// @brief Draw table of all the models, the entries of the models whose
+	/// bounds, geometry or occlusion changed written again
+	void uploadDrawTable(std::shared_ptr<Scene> scenePtr);
+	/// @brief Culls and draws the models with the program, which takes the
+	/// vertex inputs of PBRVertexShader.glsl. The visibility pass draws the
+	/// full meshes without occlusion culling, and keeps the counts and the
+	/// levels of detail of the last render.
+	void drawScene(std::shared_ptr<Scene> scenePtr, ShaderProgram& program,
+				   bool visibility);
+	/// @brief One draw per model in m_occluderModels, then in m_testedModels
+	/// once the occlusion test is done. Returns the number of triangles drawn.
+	size_t drawModels(std::shared_ptr<Scene> scenePtr, ShaderProgram& program,
+					  bool visibility, const glm::mat4& viewMatrix, float fov);
+	/// @brief Culling and level of detail selection in a compute shader
+	/// writing the commands of a single multi-draw
+	void drawModelsIndirect(std::shared_ptr<Scene> scenePtr,
+							ShaderProgram& program, bool visibility);
+	size_t drawModel(std::shared_ptr<Scene> scenePtr, ShaderProgram& program,
+					 bool visibility, size_t index,
+					 const glm::mat4& viewMatrix, float fov);
+	/// @brief Radius of the bounding sphere of the model on screen in pixels,
+	/// infinite when the camera is inside of it
+	float projectedRadius(const GeometryArena::Range& range,
+						  const glm::mat4& modelViewMatrix, float fov) const;
+	/// @brief Level of detail of the model from the projected size of its
+	/// bounding sphere, updates the one kept for the model
+	size_t selectLOD(size_t modelIndex, const GeometryArena::Range& range,
+					 const glm::mat4& modelViewMatrix, float fov);
+	/// @brief Returns the number of triangles drawn
+	size_t draw(const GeometryArena::Range& range, size_t lod);
 
 	std::shared_ptr<ShaderProgram> m_pbrShaderProgramPtr;
+	std::shared_ptr<ShaderProgram> m_visibilityShaderProgramPtr;
 	std::shared_ptr<ShaderProgram> m_displayShaderProgramPtr;
 	std::shared_ptr<ShaderProgram> m_debugShaderProgramPtr;
+	std::shared_ptr<ShaderProgram> m_cullingShaderProgramPtr;
+	std::vector<ShaderProgram::Replacement> m_pendingShaderPrograms;
 	GLuint m_displayImageTex;
 	GLuint m_screenQuadVao;
 
+	std::shared_ptr<SceneUniforms> m_sceneUniformsPtr;
+	/// @brief CPU copies of the model and draw tables
+	std::vector<ModelBlock> m_modelBlocks;
+	std::vector<DrawBlock> m_drawBlocks;
+
+	/// @brief What the table entries of a model were made from
+	struct UploadedModel {
+		size_t transformVersion = 0;
+		size_t materialVersion = 0;
+		size_t geometryVersion = 0;
+		size_t bvhVersion = 0;
+	};
+	std::vector<UploadedModel> m_modelTableVersions;
+	std::vector<UploadedModel> m_drawTableVersions;
+	size_t m_uploadedGeometryGeneration = 0;
+
+	// Storage buffers of the model table and of the culling compute shader,
+	// see RasterizerStorageBinding
+	PersistentBuffer m_modelTable;
+	PersistentBuffer m_drawTable;
+	GLuint m_drawCommandsBuffer = 0;
+	GLuint m_lodStatesSSBO = 0;
+	GLuint m_drawStatsSSBO = 0;
+	size_t m_numAllocatedModels = 0;
+
+	/// @brief Copies of the draw counters in the draw stats buffer, so that
+	/// the GPU writes one while the others are read back
+	static constexpr size_t NUM_DRAW_STATS = 3;
+	bool m_drawStats = false;
+	/// @brief Persistent mapping of the draw stats buffer, each copy being
+	/// guarded by a fence until the GPU is done writing it
+	unsigned char* m_mappedDrawStats = nullptr;
+	size_t m_drawStatsStride = 0;
+	GLsync m_drawStatsFences[NUM_DRAW_STATS] = {};
+	size_t m_drawStatsIndex = 0;
+
 	GLuint m_debugCubeVao;
 	GLuint m_debugCubeFilledVao;
 
-	std::vector<GLuint> m_vaos;
-	std::vector<GLuint> m_posVbos;
-	std::vector<GLuint> m_normalVbos;
-	std::vector<GLuint> m_tangentVbos;
-	std::vector<GLuint> m_bitangentVbos;
-	std::vector<GLuint> m_uvVbos;
-	std::vector<GLuint> m_ibos;
+	/// @brief Only holds the index buffer of the scene geometry arena
+	GLuint m_meshVao = 0;
 
 	int m_BVH_debug_depth = 0;
 	bool m_debugBVH = false;
 	bool m_debugLights = false;
+
+	glm::vec2 m_resolution = glm::vec2(1.f);
+	bool m_useLODs = true;
+	float m_lodPixelError = 1.f;
+	/// @brief Level of detail of each model at the last render
+	std::vector<size_t> m_modelLODs;
+	bool m_gpuDriven = true;
+	size_t m_numDrawnTriangles = 0;
+	size_t m_numDrawnModels = 0;
+
+	bool m_frustumCulling = true;
+	/// @brief Models in the frustum at the last render
+	std::vector<size_t> m_visibleModels;
+	size_t m_numCulledModels = 0;
+
+	/// @brief Models projecting to a radius of at least this fraction of the
+	/// screen height occlude the others, the largest ones first
+	static constexpr float OCCLUDER_MIN_SIZE = 0.1f;
+	static constexpr size_t MAX_OCCLUDERS = 8;
+	bool m_occlusionCulling = true;
+	std::shared_ptr<OcclusionCuller> m_occlusionCullerPtr;
+	/// @brief Models of the last draw, the occluders first
+	std::vector<size_t> m_occluderModels;
+	std::vector<size_t> m_testedModels;
+	bool m_occlusionPending = false;
+	size_t m_numOccluders = 0;
+	size_t m_numOccludedModels = 0;
 };
\ No newline at end of file
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Dependency-aware job system. A job runs once all its dependencies are
+ * done: on a worker thread, or for main-thread jobs (GL uploads), whenever the
+ * thread owning the GL context calls runMainThreadJobs().
+ */
+class JobSystem {
+   public:
+	struct Job;
+	using JobHandle = std::shared_ptr<Job>;
+
+	/// @brief 0 workers means one per hardware thread besides the main one
+	JobSystem(size_t numWorkers = 0);
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	/// @brief If a dependency throws, the job and everything depending on it
+	/// are skipped
+	JobHandle submit(std::function<void()> task,
+					 const std::vector<JobHandle>& dependencies = {},
+					 bool onMainThread = false);
+
+	inline JobHandle submitOnMainThread(
+		std::function<void()> task,
+		const std::vector<JobHandle>& dependencies = {}) {
+		return submit(std::move(task), dependencies, true);
+	}
+
+	/// @brief Runs ready main-thread jobs until the queue is empty or the
+	/// budget is spent (at least one job runs). Returns the number of jobs run.
+	size_t runMainThreadJobs(
+		double budgetMs = std::numeric_limits<double>::infinity());
+
+	inline size_t numPendingJobs() const { return m_numPending; }
+	inline size_t numWorkers() const { return m_workers.size(); }
+
+   private:
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_mutex;
+	std::condition_variable m_workAvailable;
+	std::deque<JobHandle> m_queue;
+	std::deque<JobHandle> m_mainThreadQueue;
+	bool m_stop = false;
+	/// @brief Jobs running on the workers
+	size_t m_numRunning = 0;
+
+	std::atomic<size_t> m_numPending{0};
+
+	void workerLoop();
+	void enqueue(JobHandle job);
+	void execute(JobHandle job);
+};
+
+struct JobSystem::Job {
+	std::function<void()> task;
+	bool onMainThread = false;
+
+	std::atomic<int> numWaitingDependencies{1};
+	std::atomic<bool> failed{false};
+
+	std::mutex mutex;
+	bool done = false;
+	std::vector<JobHandle> dependents;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+
+/**
+ * @brief Minimal read-only JSON document, enough for scene description files.
+ * Missing keys and out of range indices give a null value, so that optional
+ * fields can be read with a fallback without checking them first.
+ */
+class Json {
+   public:
+	enum class Type { Null, Bool, Number, String, Array, Object };
+
+	/// @brief Parses [begin, end), throws std::runtime_error on malformed input
+	static Json parse(const char* begin, const char* end);
+
+	inline Type type() const { return m_type; }
+	inline bool isNull() const { return m_type == Type::Null; }
+	inline bool isArray() const { return m_type == Type::Array; }
+	inline bool isObject() const { return m_type == Type::Object; }
+
+	inline size_t size() const {
+		return m_type == Type::Array ? m_array.size() : m_object.size();
+	}
+
+	const Json& operator[](size_t index) const;
+	const Json& operator[](const std::string& key) const;
+	inline bool has(const std::string& key) const {
+		return !(*this)[key].isNull();
+	}
+
+	inline double number(double fallback = 0.0) const {
+		return m_type == Type::Number ? m_number : fallback;
+	}
+	inline int integer(int fallback = 0) const {
+		return m_type == Type::Number ? static_cast<int>(m_number) : fallback;
+	}
+	inline bool boolean(bool fallback = false) const {
+		return m_type == Type::Bool ? m_bool : fallback;
+	}
+	inline const std::string& string() const { return m_string; }
+
+	inline const std::vector<std::pair<std::string, Json>>& members() const {
+		return m_object;
+	}
+
+   private:
+	Type m_type = Type::Null;
+	bool m_bool = false;
+	double m_number = 0.0;
+	std::string m_string;
+	std::vector<Json> m_array;
+	std::vector<std::pair<std::string, Json>> m_object;
+
+	class Parser;
+};
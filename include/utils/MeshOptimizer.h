@@ -0,0 +1,36 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Triangle orders for the rasterizer, see Mesh::optimizeForRasterization
+
+/// @brief Average cache miss ratio: vertices transformed per triangle with a
+/// FIFO post-transform cache of the given size, from 0.5 (best) to 3
+float averageCacheMissRatio(const std::vector<glm::uvec3>& triangles,
+							size_t numVertices, size_t cacheSize = 16);
+
+/// @brief Order of the triangles for the post-transform vertex cache (Tom
+/// Forsyth's linear-speed vertex cache optimisation). When no triangle around
+/// the cache is left, the next one comes in the input order.
+std::vector<unsigned int> optimizeVertexCache(
+	const std::vector<glm::uvec3>& triangles, size_t numVertices);
+
+/// @brief Splits the order into clusters where the cache state allows it, the
+/// ACMR growing by threshold at most, then draws first the clusters facing
+/// away from the center of the mesh, which tend to occlude the others
+/// (Sander et al., Fast Triangle Reordering for Vertex Locality and Reduced
+/// Overdraw)
+void optimizeOverdraw(const std::vector<glm::uvec3>& triangles,
+					  const std::vector<glm::vec3>& positions,
+					  std::vector<unsigned int>& order,
+					  float threshold = 1.05f);
+
+/// @brief Quadric error metric simplification (Garland and Heckbert) down to
+/// about targetTriangles. Edges collapse onto one of their vertices, so the
+/// result uses the same vertices, and the vertices on borders (UV seams
+/// included) or non-manifold edges stay. error is set to the distance the
+/// collapses moved the surface by, in a least squares sense.
+std::vector<glm::uvec3> simplifyMesh(const std::vector<glm::uvec3>& triangles,
+									 const std::vector<glm::vec3>& positions,
+									 size_t targetTriangles, float& error);
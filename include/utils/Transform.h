@@ -1,8 +1,11 @@
 #pragma once
 
+#include <cstddef>
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
+#include "utils/Version.h"
+
 class Transform {
    public:
 	Transform() : m_translation(0.0), m_rotation(0.0), m_scale(1.0) {}
@@ -16,18 +19,21 @@ class Transform {
 		if (t != m_translation) {
 			m_translation = t;
 			changed = true;
+			m_transformVersion = nextVersion();
 		}
 	}
 	inline void setRotation(const glm::vec3& r) {
 		if (r != m_rotation) {
 			m_rotation = r;
 			changed = true;
+			m_transformVersion = nextVersion();
 		}
 	}
 	inline void setScale(const glm::vec3& s) {
 		if (s != m_scale) {
 			m_scale = s;
 			changed = true;
+			m_transformVersion = nextVersion();
 		}
 	}
 
@@ -36,9 +42,14 @@ class Transform {
 		if (s_ != m_scale) {
 			m_scale = s_;
 			changed = true;
+			m_transformVersion = nextVersion();
 		}
 	}
 
+	/// @brief Changes with the transform, so that each user of the matrices
+	/// can tell whether they changed since it last looked
+	inline size_t transformVersion() const { return m_transformVersion; }
+
 	inline glm::mat4 getTransformMatrix() {
 		if (changed) {
 			recomputeTransformMatrix();
@@ -63,6 +74,7 @@ class Transform {
 	glm::mat4 m_inv_matrix;
 
 	bool changed = false;  // For cached matrix computation
+	size_t m_transformVersion = nextVersion();
 
 	inline void recomputeTransformMatrix() {
 		glm::mat4 id(1.0);
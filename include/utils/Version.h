@@ -0,0 +1,13 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/// @brief Process-wide increasing counter for the versions of the transforms,
+/// meshes, BVHs and materials. A version is never given twice, so a new object
+/// cannot look unchanged to a user that saw another one, even at the same
+/// address or in the same slot.
+inline size_t nextVersion() {
+	static std::atomic<size_t> counter{0};
+	return ++counter;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+// Compact vertex attributes, the shaders decode them with the GLSL
+// unpackSnorm2x16 / unpackHalf2x16 / unpackUnorm2x16 built-ins
+
+/// @brief Octahedral encoding of a unit vector in two 16-bit snorms
+inline uint32_t packOctahedral(const glm::vec3& n) {
+	float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (!(l1 > 0.f)) return glm::packSnorm2x16(glm::vec2(0.f));
+
+	glm::vec2 p = glm::vec2(n) / l1;
+	if (n.z < 0.f) {
+		// Fold the lower hemisphere over the diagonals
+		glm::vec2 sign(p.x >= 0.f ? 1.f : -1.f, p.y >= 0.f ? 1.f : -1.f);
+		p = (1.f - glm::abs(glm::vec2(p.y, p.x))) * sign;
+	}
+	return glm::packSnorm2x16(p);
+}
+
+inline glm::vec3 unpackOctahedral(uint32_t packed) {
+	glm::vec2 e = glm::unpackSnorm2x16(packed);
+	glm::vec3 n(e, 1.f - std::abs(e.x) - std::abs(e.y));
+	float t = std::max(-n.z, 0.f);
+	n.x += n.x >= 0.f ? -t : t;
+	n.y += n.y >= 0.f ? -t : t;
+	return glm::normalize(n);
+}
+
+/// @brief Octahedral tangent, the lowest bit holds the handedness of the
+/// bitangent (set when negative)
+inline uint32_t packTangent(const glm::vec3& tangent, float handedness) {
+	return (packOctahedral(tangent) & ~1u) | (handedness < 0.f ? 1u : 0u);
+}
+
+inline glm::vec3 unpackTangent(uint32_t packed, float& handedness) {
+	handedness = (packed & 1u) ? -1.f : 1.f;
+	return unpackOctahedral(packed);
+}
+
+/// @brief Position in [0, 1]^3 (relative to the mesh bounds) on 3x16 bits,
+/// z is in the low half of the second word
+inline void packUnormPosition(const glm::vec3& p, uint32_t& xy, uint32_t& z) {
+	xy = glm::packUnorm2x16(glm::vec2(p.x, p.y));
+	z = glm::packUnorm2x16(glm::vec2(p.z, 0.f));
+}
+
+inline glm::vec3 unpackUnormPosition(uint32_t xy, uint32_t z) {
+	return glm::vec3(glm::unpackUnorm2x16(xy), glm::unpackUnorm2x16(z).x);
+}
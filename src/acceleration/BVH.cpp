@@ -7,9 +7,21 @@
 #include <glm/glm.hpp>
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include <omp.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 int BVH::BUILD_TYPE = 1;
 int BVH::NUM_SPLIT_CANDIDATES = 5;
+bool BVH::SAH_TOP_LEVELS = true;
+bool BVH::USE_COMPRESSED_NODES = true;
 
 Triangle getTriangle(glm::uvec3 tri_i,
 					 const std::vector<glm::vec3>& positions) {
@@ -40,9 +52,10 @@ BVH::BVH(std::shared_ptr<Mesh> meshPtr) {
 	m_root->num_triangles = meshPtr->triangleIndices().size();
 
 	m_nodes.push_back(m_root);
+}
 
-	m_triangles.assign(meshPtr->triangleIndices().begin(),
-					   meshPtr->triangleIndices().end());
+const std::vector<glm::uvec3>& BVH::triangles() const {
+	return m_parent_mesh->triangleIndices();
 }
 
 float evaluateSplit(std::shared_ptr<BVH_Node> node, size_t splitAxis,
@@ -88,6 +101,8 @@ void BVH::build(std::shared_ptr<BVH_Node> node, int depth) {
 
 	if (node->num_triangles <= 1) return;
 
+	std::vector<glm::uvec3>& triangles = m_parent_mesh->triangleIndices();
+
 	auto left = std::make_shared<BVH_Node>();
 	auto right = std::make_shared<BVH_Node>();
 
@@ -107,10 +122,10 @@ void BVH::build(std::shared_ptr<BVH_Node> node, int depth) {
 		std::sort(sorted_indices.begin(), sorted_indices.end(),
 				  [&](size_t a, size_t b) {
 					  Triangle tri_a = getTriangle(
-						  m_triangles[a], m_parent_mesh->vertexPositions());
+						  triangles[a], m_parent_mesh->vertexPositions());
 
 					  Triangle tri_b = getTriangle(
-						  m_triangles[b], m_parent_mesh->vertexPositions());
+						  triangles[b], m_parent_mesh->vertexPositions());
 
 					  return tri_a.centroid()[axis] < tri_b.centroid()[axis];
 				  });
@@ -119,10 +134,10 @@ void BVH::build(std::shared_ptr<BVH_Node> node, int depth) {
 
 		size_t half = sorted_indices.size() / 2;
 
-		Triangle tri_a = getTriangle(m_triangles[sorted_indices[half - 1]],
+		Triangle tri_a = getTriangle(triangles[sorted_indices[half - 1]],
 									 m_parent_mesh->vertexPositions());
 
-		Triangle tri_b = getTriangle(m_triangles[sorted_indices[half]],
+		Triangle tri_b = getTriangle(triangles[sorted_indices[half]],
 									 m_parent_mesh->vertexPositions());
 
 		split_axis = axis;
@@ -168,13 +183,13 @@ void BVH::build(std::shared_ptr<BVH_Node> node, int depth) {
 	for (size_t i = node->first_triangle;
 		 i < node->first_triangle + node->num_triangles; i++) {
 		Triangle tri =
-			getTriangle(m_triangles[i], m_parent_mesh->vertexPositions());
+			getTriangle(triangles[i], m_parent_mesh->vertexPositions());
 		if (tri.centroid()[split_axis] < split_position) {
 			// We make sure to insert triangles at the correct positions so that
 			// each triangle list is contiguous
 			left->num_triangles++;
 			size_t swap = left->first_triangle + left->num_triangles - 1;
-			std::swap(m_triangles[swap], m_triangles[i]);
+			std::swap(triangles[swap], triangles[i]);
 			right->first_triangle++;
 		} else {
 			right->num_triangles++;
@@ -194,4 +209,879 @@ void BVH::build(std::shared_ptr<BVH_Node> node, int depth) {
 
 	build(left, depth + 1);	 // Recursion magic
 	build(right, depth + 1);
-}
\ No newline at end of file
+}
+
+namespace {
+
+// Beyond, too many triangles share the cells of 30-bit Morton codes
+constexpr size_t MAX_30_BIT_CODES_TRIANGLES = 1 << 20;
+
+constexpr int RADIX_BITS = 8;
+constexpr int RADIX = 1 << RADIX_BITS;
+
+// The surface area heuristic splits the clusters of triangles whose codes
+// share their first 15 bits (5 per axis), in bins of their centers
+constexpr int CLUSTER_BITS = 15;
+constexpr int SAH_BINS = 16;
+// Smaller subtrees of the top levels are built by the task of their parent
+constexpr size_t MIN_TASK_CLUSTERS = 256;
+
+// Inserts two zero bits above each of the 21 low bits
+inline uint64_t spreadBits(uint64_t v) {
+	v &= 0x1FFFFF;
+	v = (v | (v << 32)) & 0x1F00000000FFFF;
+	v = (v | (v << 16)) & 0x1F0000FF0000FF;
+	v = (v | (v << 8)) & 0x100F00F00F00F00F;
+	v = (v | (v << 4)) & 0x10C30C30C30C30C3;
+	v = (v | (v << 2)) & 0x1249249249249249;
+	return v;
+}
+
+// Code of a point of the unit cube, in the high bits so that the codes
+// compare and share prefixes the same way whatever their number of bits
+uint64_t mortonCode(const glm::vec3& p, int bitsPerAxis) {
+	float cells = static_cast<float>(1 << bitsPerAxis);
+	uint64_t code = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		float cell = std::clamp(p[axis] * cells, 0.f, cells - 1.f);
+		code |= spreadBits(static_cast<uint64_t>(cell)) << (2 - axis);
+	}
+	return code << (64 - 3 * bitsPerAxis);
+}
+
+// The prefixes make the bits unpredictable, branching on them is slow
+inline int leadingZeros(uint64_t x) {
+	if (x == 0) return 64;
+#if defined(__GNUC__)
+	return __builtin_clzll(x);
+#elif defined(_MSC_VER) && defined(_WIN64)
+	unsigned long bit;
+	_BitScanReverse64(&bit, x);
+	return 63 - static_cast<int>(bit);
+#else
+	int n = 0;
+	for (int shift = 32; shift > 0; shift /= 2) {
+		if (!(x >> (64 - shift))) {
+			n += shift;
+			x <<= shift;
+		}
+	}
+	return n;
+#endif
+}
+
+// Stable LSD radix sort of the codes and their triangles on the bits from
+// firstBit. Each thread counts the digits of its own chunk, then scatters it
+// after the same digits of the previous chunks.
+void radixSort(std::vector<uint64_t>& codes, std::vector<uint32_t>& order,
+			   int firstBit) {
+	const size_t size = codes.size();
+	std::vector<uint64_t> sortedCodes(size);
+	std::vector<uint32_t> sortedOrder(size);
+	std::vector<size_t> offsets(RADIX * omp_get_max_threads());
+
+	for (int shift = firstBit; shift < 64; shift += RADIX_BITS) {
+#pragma omp parallel
+		{
+			const size_t numThreads = omp_get_num_threads();
+			const size_t thread = omp_get_thread_num();
+			const size_t begin = size * thread / numThreads;
+			const size_t end = size * (thread + 1) / numThreads;
+			size_t* offset = &offsets[RADIX * thread];
+
+			std::fill(offset, offset + RADIX, 0);
+			for (size_t i = begin; i < end; i++)
+				offset[(codes[i] >> shift) & (RADIX - 1)]++;
+#pragma omp barrier
+#pragma omp single
+			{
+				size_t sum = 0;
+				for (int digit = 0; digit < RADIX; digit++) {
+					for (size_t t = 0; t < numThreads; t++) {
+						size_t count = offsets[RADIX * t + digit];
+						offsets[RADIX * t + digit] = sum;
+						sum += count;
+					}
+				}
+			}
+			for (size_t i = begin; i < end; i++) {
+				size_t& position = offset[(codes[i] >> shift) & (RADIX - 1)];
+				sortedCodes[position] = codes[i];
+				sortedOrder[position] = order[i];
+				position++;
+			}
+		}
+		codes.swap(sortedCodes);
+		order.swap(sortedOrder);
+	}
+}
+
+// Triangles under a leaf of the top levels, the nodes of their subtree being
+// emitted from the sorted codes (Karras 2012). The internal node i of the
+// range takes the slot 2 i, or 2 i + 1 if its range ends at i, and the root
+// the slot 0, so that the children of a split after the triangle g are the
+// adjacent slots 2 g + 1 and 2 g + 2.
+struct Cluster {
+	size_t first = 0;
+	size_t count = 0;
+	AABB box;
+	glm::vec3 center;
+
+	size_t node = 0;  // Node of the slot 0
+	size_t base = 0;  // Node of the slot 1
+
+	inline size_t slotNode(int slot) const {
+		return slot == 0 ? node : base + slot - 1;
+	}
+};
+
+// Length of the prefix shared by the codes i and j of the range, their
+// positions breaking the ties, -1 out of the range
+int commonPrefix(const uint64_t* codes, int count, int i, int j) {
+	if (j < 0 || j >= count) return -1;
+	if (codes[i] != codes[j]) return leadingZeros(codes[i] ^ codes[j]);
+	return 64 + leadingZeros(static_cast<uint32_t>(i ^ j)) - 32;
+}
+
+// Writes the internal node i of the cluster and its leaf children
+void emitNode(const Cluster& cluster, const uint64_t* codes, int i,
+			  std::vector<std::shared_ptr<BVH_Node>>& nodes,
+			  std::vector<size_t>& parents) {
+	const int count = static_cast<int>(cluster.count);
+	auto prefix = [&](int j) { return commonPrefix(codes, count, i, j); };
+
+	// Direction of the range, then its other end
+	int d = prefix(i + 1) > prefix(i - 1) ? 1 : -1;
+	int minPrefix = prefix(i - d);
+	int maxLength = 2;
+	while (prefix(i + maxLength * d) > minPrefix) maxLength *= 2;
+	int length = 0;
+	for (int t = maxLength / 2; t >= 1; t /= 2) {
+		if (prefix(i + (length + t) * d) > minPrefix) length += t;
+	}
+	int j = i + length * d;
+
+	// Split at the first bit which differs in the range
+	int nodePrefix = prefix(j);
+	int split = 0;
+	int t = length;
+	do {
+		t = (t + 1) / 2;
+		if (prefix(i + (split + t) * d) > nodePrefix) split += t;
+	} while (t > 1);
+	int gamma = i + split * d + std::min(d, 0);
+	int first = std::min(i, j);
+	int last = std::max(i, j);
+
+	size_t index = cluster.slotNode(i == 0 ? 0 : 2 * i + (d < 0));
+	BVH_Node& node = *nodes[index];
+	node.first_triangle = cluster.first + first;
+	node.num_triangles = last - first + 1;
+	node.child_index = cluster.slotNode(2 * gamma + 1);
+	parents[node.child_index] = index;
+	parents[node.child_index + 1] = index;
+
+	// Leaves have no internal node of their own, their parent writes them
+	int leaves[2] = {first == gamma ? gamma : -1,
+					 last == gamma + 1 ? gamma + 1 : -1};
+	for (int k = 0; k < 2; k++) {
+		if (leaves[k] < 0) continue;
+		BVH_Node& leaf = *nodes[node.child_index + k];
+		leaf.first_triangle = cluster.first + leaves[k];
+		leaf.num_triangles = 1;
+		leaf.child_index = 0;
+	}
+}
+
+struct TopLevelContext {
+	std::vector<std::shared_ptr<BVH_Node>>& nodes;
+	std::vector<size_t>& parents;
+	std::vector<Cluster>& clusters;
+
+	// Clusters under each node of the top levels
+	std::vector<std::pair<size_t, size_t>> clusterRanges;
+};
+
+// scale: bins per unit of length
+inline int binOf(float center, float min, float scale) {
+	return std::min(SAH_BINS - 1, static_cast<int>((center - min) * scale));
+}
+
+// Splits the clusters [begin, end) under the node with the binned surface
+// area heuristic, the clusters of each side staying contiguous. Without a
+// valid split (same centers), splits them in the middle of the Morton order.
+// The subtree of n clusters takes the 2 n - 2 nodes from next, so that the
+// two sides can be built by different tasks.
+void buildTopLevels(TopLevelContext& context, size_t index, size_t begin,
+					size_t end, size_t next) {
+	std::vector<Cluster>& clusters = context.clusters;
+	context.clusterRanges[index] = {begin, end};
+	if (end - begin == 1) {
+		clusters[begin].node = index;
+		return;
+	}
+
+	AABB centers;
+	for (size_t c = begin; c < end; c++) centers.extend(clusters[c].center);
+
+	float bestCost = std::numeric_limits<float>::max();
+	int bestAxis = -1;
+	int bestBin = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		float min = centers.begin_corner[axis];
+		float extent = centers.end_corner[axis] - min;
+		if (extent <= 0.f) continue;
+		float scale = SAH_BINS / extent;
+
+		AABB boxes[SAH_BINS];
+		size_t counts[SAH_BINS] = {};
+		for (size_t c = begin; c < end; c++) {
+			int bin = binOf(clusters[c].center[axis], min, scale);
+			boxes[bin].extend(clusters[c].box);
+			counts[bin] += clusters[c].count;
+		}
+
+		// Left sides of the splits before each bin, then sweep the right ones
+		float leftCosts[SAH_BINS];
+		size_t leftCounts[SAH_BINS];
+		AABB left;
+		size_t leftCount = 0;
+		for (int bin = 1; bin < SAH_BINS; bin++) {
+			left.extend(boxes[bin - 1]);
+			leftCount += counts[bin - 1];
+			leftCounts[bin] = leftCount;
+			leftCosts[bin] = leftCount ? left.halfSurfaceArea() * leftCount : 0.f;
+		}
+		AABB right;
+		size_t rightCount = 0;
+		for (int bin = SAH_BINS - 1; bin > 0; bin--) {
+			right.extend(boxes[bin]);
+			rightCount += counts[bin];
+			if (leftCounts[bin] == 0 || rightCount == 0) continue;
+			float cost =
+				leftCosts[bin] + right.halfSurfaceArea() * rightCount;
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = bin;
+			}
+		}
+	}
+
+	size_t split = (begin + end) / 2;
+	if (bestAxis >= 0) {
+		float min = centers.begin_corner[bestAxis];
+		float scale = SAH_BINS / (centers.end_corner[bestAxis] - min);
+		auto middle = std::stable_partition(
+			clusters.begin() + begin, clusters.begin() + end,
+			[&](const Cluster& cluster) {
+				return binOf(cluster.center[bestAxis], min, scale) <
+					   bestBin;
+			});
+		split = middle - clusters.begin();
+	}
+
+	size_t child = next;
+	context.nodes[index]->child_index = child;
+	context.parents[child] = index;
+	context.parents[child + 1] = index;
+	size_t rightNext = child + 2 + 2 * (split - begin - 1);
+#pragma omp task shared(context) if (end - begin >= MIN_TASK_CLUSTERS)
+	buildTopLevels(context, child, begin, split, child + 2);
+	buildTopLevels(context, child + 1, split, end, rightNext);
+}
+
+}  // namespace
+
+void BVH::buildLinear() {
+	std::vector<glm::uvec3>& triangles = m_parent_mesh->triangleIndices();
+	const std::vector<glm::vec3>& positions = m_parent_mesh->vertexPositions();
+	const long long numTriangles = static_cast<long long>(triangles.size());
+	if (numTriangles <= 1) {
+		build(m_root);
+		return;
+	}
+
+	// Morton codes of the centroids in their bounds
+	std::vector<glm::vec3> centroids(numTriangles);
+	AABB bounds;
+#pragma omp parallel
+	{
+		AABB threadBounds;
+#pragma omp for nowait
+		for (long long i = 0; i < numTriangles; i++) {
+			centroids[i] = getTriangle(triangles[i], positions).centroid();
+			threadBounds.extend(centroids[i]);
+		}
+#pragma omp critical
+		bounds.extend(threadBounds);
+	}
+	glm::vec3 extent = bounds.end_corner - bounds.begin_corner;
+	glm::vec3 scale(0.f);
+	for (int axis = 0; axis < 3; axis++) {
+		if (extent[axis] > 0.f) scale[axis] = 1.f / extent[axis];
+	}
+	int bitsPerAxis =
+		triangles.size() <= MAX_30_BIT_CODES_TRIANGLES ? 10 : 21;
+
+	std::vector<uint64_t> codes(numTriangles);
+	std::vector<uint32_t> order(numTriangles);
+#pragma omp parallel for
+	for (long long i = 0; i < numTriangles; i++) {
+		codes[i] = mortonCode((centroids[i] - bounds.begin_corner) * scale,
+							  bitsPerAxis);
+		order[i] = static_cast<uint32_t>(i);
+	}
+	radixSort(codes, order, 64 - 3 * bitsPerAxis);
+
+	// Without the surface area heuristic, the whole mesh is one cluster
+	std::vector<Cluster> clusters(1);
+	if (SAH_TOP_LEVELS) {
+		for (long long i = 1; i < numTriangles; i++) {
+			if ((codes[i] ^ codes[i - 1]) >> (64 - CLUSTER_BITS)) {
+				clusters.back().count = i - clusters.back().first;
+				clusters.emplace_back().first = i;
+			}
+		}
+	}
+	clusters.back().count = numTriangles - clusters.back().first;
+	const long long numClusters = static_cast<long long>(clusters.size());
+	if (numClusters > 1) {
+#pragma omp parallel for
+		for (long long c = 0; c < numClusters; c++) {
+			Cluster& cluster = clusters[c];
+			for (size_t i = cluster.first; i < cluster.first + cluster.count;
+				 i++)
+				cluster.box.extend(getTriangle(triangles[order[i]], positions));
+			cluster.center = cluster.box.center();
+		}
+	}
+
+	// 2 n - 1 nodes whatever the clusters: the top levels take 2 c - 1 of
+	// them, c being the clusters, then each cluster 2 (n - 1) for its triangles
+	const long long numNodes = 2 * numTriangles - 1;
+	const size_t numTopNodes = 2 * numClusters - 1;
+	m_nodes.resize(numNodes);
+	m_nodes[0] = m_root;
+	m_root->m_parent_mesh = m_parent_mesh;
+	m_root->child_index = 0;
+#pragma omp parallel for
+	for (long long i = 1; i < numNodes; i++) {
+		m_nodes[i] = std::make_shared<BVH_Node>();
+		m_nodes[i]->m_parent_mesh = m_parent_mesh;
+	}
+	std::vector<size_t> parents(numNodes);
+	TopLevelContext context{m_nodes, parents, clusters,
+							std::vector<std::pair<size_t, size_t>>(numTopNodes)};
+#pragma omp parallel
+#pragma omp single
+	buildTopLevels(context, 0, 0, numClusters, 1);
+
+	// Sorts the triangles in the new order of the clusters
+	std::vector<size_t> firsts(numClusters);
+	for (long long c = 1; c < numClusters; c++)
+		firsts[c] = firsts[c - 1] + clusters[c - 1].count;
+	std::vector<uint64_t> sortedCodes(numTriangles);
+	std::vector<glm::uvec3> sortedTriangles(numTriangles);
+#pragma omp parallel for
+	for (long long c = 0; c < numClusters; c++) {
+		Cluster& cluster = clusters[c];
+		for (size_t i = 0; i < cluster.count; i++) {
+			sortedCodes[firsts[c] + i] = codes[cluster.first + i];
+			sortedTriangles[firsts[c] + i] = triangles[order[cluster.first + i]];
+		}
+		cluster.first = firsts[c];
+	}
+	codes.swap(sortedCodes);
+	triangles.swap(sortedTriangles);
+
+	for (size_t index = 0; index < numTopNodes; index++) {
+		auto [begin, end] = context.clusterRanges[index];
+		m_nodes[index]->first_triangle = clusters[begin].first;
+		m_nodes[index]->num_triangles =
+			clusters[end - 1].first + clusters[end - 1].count -
+			clusters[begin].first;
+	}
+
+	// Subtrees of the clusters, all their internal nodes in parallel
+	std::vector<size_t> internalOffsets(numClusters + 1, 0);
+	for (long long c = 0; c < numClusters; c++) {
+		clusters[c].base = numTopNodes + 2 * internalOffsets[c];
+		internalOffsets[c + 1] = internalOffsets[c] + clusters[c].count - 1;
+	}
+	const long long numInternalNodes =
+		static_cast<long long>(internalOffsets.back());
+#pragma omp parallel for
+	for (long long i = 0; i < numInternalNodes; i++) {
+		size_t c = std::upper_bound(internalOffsets.begin(),
+									internalOffsets.end(), size_t(i)) -
+				   internalOffsets.begin() - 1;
+		emitNode(clusters[c], codes.data() + clusters[c].first,
+				 static_cast<int>(i - internalOffsets[c]), m_nodes, parents);
+	}
+
+	// Bounds from the leaves up, the second child to arrive bounds the parent
+	std::vector<std::atomic<int>> visits(numNodes);
+#pragma omp parallel for
+	for (long long i = 0; i < numNodes; i++) {
+		if (m_nodes[i]->child_index != 0) continue;
+		m_nodes[i]->recomputeAABB();
+		size_t index = i;
+		while (index != 0) {
+			index = parents[index];
+			if (visits[index].fetch_add(1, std::memory_order_acq_rel) == 0)
+				break;
+			BVH_Node& node = *m_nodes[index];
+			auto box = std::make_shared<AABB>(*m_nodes[node.child_index]->aabb);
+			box->extend(*m_nodes[node.child_index + 1]->aabb);
+			node.aabb = box;
+		}
+	}
+
+	// Depths of the top levels, then of the subtrees of the clusters
+	for (size_t index = 0; index < numTopNodes; index++) {
+		const BVH_Node& node = *m_nodes[index];
+		if (index == 0) node.aabb->depth = 0;
+		if (node.child_index == 0 || node.child_index >= numTopNodes) continue;
+		for (size_t child : {node.child_index, node.child_index + 1})
+			m_nodes[child]->aabb->depth = node.aabb->depth + 1;
+	}
+	int depth = 0;
+#pragma omp parallel for schedule(dynamic) reduction(max : depth)
+	for (long long c = 0; c < numClusters; c++) {
+		std::vector<size_t> stack = {clusters[c].node};
+		while (!stack.empty()) {
+			const BVH_Node& node = *m_nodes[stack.back()];
+			stack.pop_back();
+			depth = std::max(depth, node.aabb->depth);
+			if (node.child_index == 0) continue;
+			for (size_t child : {node.child_index, node.child_index + 1}) {
+				m_nodes[child]->aabb->depth = node.aabb->depth + 1;
+				stack.push_back(child);
+			}
+		}
+	}
+	m_depth = depth;
+}
+
+namespace {
+
+// Treelets of up to 7 leaves are restructured, from the subtrees of 7
+// triangles in the first round, doubling each round (Karras and Aila 2013)
+constexpr int TREELET_LEAVES = 7;
+constexpr int OPTIMIZATION_ROUNDS = 3;
+
+// Surface area heuristic costs of a node and of a triangle
+constexpr float NODE_COST = 1.2f;
+constexpr float TRIANGLE_COST = 1.f;
+
+struct TreeletContext {
+	std::vector<std::shared_ptr<BVH_Node>>& nodes;
+	std::vector<size_t>& parents;
+
+	// SAH cost of the subtree of each node
+	std::vector<float>& costs;
+};
+
+// Replaces the treelet under the node by its topology of lowest SAH cost, if
+// lower than the current one. The nodes keep their slots, the treelet ones
+// being moved between the child pairs of its internal nodes.
+void restructureTreelet(TreeletContext& context, size_t root) {
+	std::vector<std::shared_ptr<BVH_Node>>& nodes = context.nodes;
+
+	// Grows the treelet by opening its leaf of largest area
+	size_t leaves[TREELET_LEAVES];
+	size_t pairs[TREELET_LEAVES - 1];
+	int numLeaves = 2;
+	int numPairs = 1;
+	leaves[0] = nodes[root]->child_index;
+	leaves[1] = nodes[root]->child_index + 1;
+	pairs[0] = nodes[root]->child_index;
+	while (numLeaves < TREELET_LEAVES) {
+		int largest = -1;
+		float largestArea = -1.f;
+		for (int k = 0; k < numLeaves; k++) {
+			const BVH_Node& leaf = *nodes[leaves[k]];
+			float area = leaf.aabb->halfSurfaceArea();
+			if (leaf.child_index != 0 && area > largestArea) {
+				largest = k;
+				largestArea = area;
+			}
+		}
+		if (largest < 0) break;
+		size_t opened = leaves[largest];
+		pairs[numPairs++] = nodes[opened]->child_index;
+		leaves[largest] = nodes[opened]->child_index;
+		leaves[numLeaves++] = nodes[opened]->child_index + 1;
+	}
+	if (numLeaves < 3) return;
+
+	// Lowest cost of each subset of the leaves, from the smaller subsets,
+	// each partition being counted once with the lowest leaf on its left
+	const int numSubsets = 1 << numLeaves;
+	AABB boxes[1 << TREELET_LEAVES];
+	float costs[1 << TREELET_LEAVES];
+	size_t counts[1 << TREELET_LEAVES];
+	int partitions[1 << TREELET_LEAVES];
+	for (int k = 0; k < numLeaves; k++) {
+		boxes[1 << k] = *nodes[leaves[k]]->aabb;
+		costs[1 << k] = context.costs[leaves[k]];
+		counts[1 << k] = nodes[leaves[k]]->num_triangles;
+	}
+	for (int subset = 1; subset < numSubsets; subset++) {
+		int lowest = subset & -subset;
+		if (subset == lowest) continue;
+
+		boxes[subset] = boxes[subset ^ lowest];
+		boxes[subset].extend(boxes[lowest]);
+		counts[subset] = counts[subset ^ lowest] + counts[lowest];
+		float best = std::numeric_limits<float>::max();
+		for (int left = (subset - 1) & subset; left > 0;
+			 left = (left - 1) & subset) {
+			if (!(left & lowest)) continue;
+			float cost = costs[left] + costs[subset ^ left];
+			if (cost < best) {
+				best = cost;
+				partitions[subset] = left;
+			}
+		}
+		costs[subset] = NODE_COST * boxes[subset].halfSurfaceArea() + best;
+	}
+	const int all = numSubsets - 1;
+	if (costs[all] >= context.costs[root]) return;
+
+	std::shared_ptr<BVH_Node> leafNodes[TREELET_LEAVES];
+	float leafCosts[TREELET_LEAVES];
+	for (int k = 0; k < numLeaves; k++) {
+		leafNodes[k] = nodes[leaves[k]];
+		leafCosts[k] = context.costs[leaves[k]];
+	}
+	std::shared_ptr<BVH_Node> internalNodes[TREELET_LEAVES - 2];
+	for (int k = 1; k < numPairs; k++)
+		internalNodes[k - 1] = nodes[context.parents[pairs[k]]];
+
+	// Places the subsets top-down, each internal node taking a child pair
+	int nextPair = 0;
+	int nextInternal = 0;
+	std::pair<int, size_t> stack[TREELET_LEAVES];
+	int stackSize = 0;
+	stack[stackSize++] = {all, root};
+	while (stackSize > 0) {
+		auto [subset, index] = stack[--stackSize];
+		BVH_Node& node = *nodes[index];
+		*node.aabb = boxes[subset];
+		node.num_triangles = counts[subset];
+		node.child_index = pairs[nextPair++];
+		context.costs[index] = costs[subset];
+
+		int sides[2] = {partitions[subset], subset ^ partitions[subset]};
+		for (int k = 0; k < 2; k++) {
+			size_t slot = node.child_index + k;
+			context.parents[slot] = index;
+			if (sides[k] & (sides[k] - 1)) {
+				nodes[slot] = internalNodes[nextInternal++];
+				stack[stackSize++] = {sides[k], slot};
+				continue;
+			}
+			int leaf = 0;
+			while (!(sides[k] & (1 << leaf))) leaf++;
+			nodes[slot] = leafNodes[leaf];
+			context.costs[slot] = leafCosts[leaf];
+			size_t child = leafNodes[leaf]->child_index;
+			if (child != 0) {
+				context.parents[child] = slot;
+				context.parents[child + 1] = slot;
+			}
+		}
+	}
+}
+
+}  // namespace
+
+void BVH::optimize() {
+	std::chrono::high_resolution_clock clock;
+	std::chrono::time_point<std::chrono::high_resolution_clock> before =
+		clock.now();
+
+	const long long numNodes = static_cast<long long>(m_nodes.size());
+	std::vector<size_t> parents(numNodes);
+	std::vector<size_t> leaves;
+	for (long long i = 0; i < numNodes; i++) {
+		size_t child = m_nodes[i]->child_index;
+		if (child == 0) {
+			leaves.push_back(i);
+			continue;
+		}
+		parents[child] = i;
+		parents[child + 1] = i;
+	}
+	const long long numLeaves = static_cast<long long>(leaves.size());
+
+	// Bottom-up, the second child to arrive processes the parent, whose
+	// subtree no other thread then touches. The leaves of the tree can move,
+	// but only once their walk started.
+	std::vector<float> costs(numNodes);
+	std::vector<std::atomic<int>> visits(numNodes);
+	TreeletContext context{m_nodes, parents, costs};
+	size_t minTriangles = TREELET_LEAVES;
+	for (int round = 0; round < OPTIMIZATION_ROUNDS; round++) {
+		for (std::atomic<int>& visit : visits)
+			visit.store(0, std::memory_order_relaxed);
+		if (round > 0) {
+			leaves.clear();
+			for (long long i = 0; i < numNodes; i++) {
+				if (m_nodes[i]->child_index == 0) leaves.push_back(i);
+			}
+		}
+
+#pragma omp parallel for schedule(dynamic, 256)
+		for (long long k = 0; k < numLeaves; k++) {
+			size_t index = leaves[k];
+			const BVH_Node& leaf = *m_nodes[index];
+			costs[index] = TRIANGLE_COST * leaf.aabb->halfSurfaceArea() *
+						   leaf.num_triangles;
+			while (index != 0) {
+				index = parents[index];
+				if (visits[index].fetch_add(1, std::memory_order_acq_rel) == 0)
+					break;
+				const BVH_Node& node = *m_nodes[index];
+				costs[index] = NODE_COST * node.aabb->halfSurfaceArea() +
+							   costs[node.child_index] +
+							   costs[node.child_index + 1];
+				if (node.num_triangles >= minTriangles)
+					restructureTreelet(context, index);
+			}
+		}
+		minTriangles *= 2;
+	}
+
+	// Sorts the triangles in the depth-first order of the new leaves
+	std::vector<glm::uvec3>& triangles = m_parent_mesh->triangleIndices();
+	std::vector<glm::uvec3> sorted;
+	sorted.reserve(triangles.size());
+	m_depth = 0;
+	std::vector<std::pair<size_t, int>> stack = {{0, 0}};
+	while (!stack.empty()) {
+		auto [index, depth] = stack.back();
+		stack.pop_back();
+		BVH_Node& node = *m_nodes[index];
+		node.aabb->depth = depth;
+		m_depth = std::max(m_depth, depth);
+		if (node.child_index != 0) {
+			node.first_triangle = sorted.size();
+			stack.push_back({node.child_index + 1, depth + 1});
+			stack.push_back({node.child_index, depth + 1});
+			continue;
+		}
+		for (size_t i = node.first_triangle;
+			 i < node.first_triangle + node.num_triangles; i++)
+			sorted.push_back(triangles[i]);
+		node.first_triangle = sorted.size() - node.num_triangles;
+	}
+	triangles.swap(sorted);
+
+	compress();
+	m_version = nextVersion();
+
+	std::chrono::time_point<std::chrono::high_resolution_clock> after =
+		clock.now();
+	double elapsedTime =
+		(double)std::chrono::duration_cast<std::chrono::milliseconds>(
+			after - before)
+			.count();
+
+	std::cout << "BVH optimized in " << elapsedTime << "ms" << std::endl;
+	float rootArea = m_root->aabb->halfSurfaceArea();
+	if (rootArea > 0.f)
+		std::cout << "SAH cost: " << costs[0] / rootArea << std::endl;
+	std::cout << "Depth: " << m_depth << std::endl;
+}
+
+namespace {
+
+constexpr size_t NO_NODE = std::numeric_limits<size_t>::max();
+constexpr size_t MAX_LEAF_TRIANGLES = 0xFFFF;
+
+// Part of the tree to compress: a node, or a range of triangles when a leaf
+// has too many triangles for the 16-bit counts
+struct CompressionItem {
+	AABB box;
+	size_t node = NO_NODE;
+	size_t first = 0;
+	size_t count = 0;
+};
+
+struct CompressionContext {
+	const std::vector<std::shared_ptr<BVH_Node>>& nodes;
+	const std::vector<glm::uvec3>& triangles;
+	const std::vector<glm::vec3>& positions;
+	std::vector<CompressedBVH_Node>& compressedNodes;
+};
+
+CompressionItem nodeItem(const CompressionContext& context, size_t index) {
+	const BVH_Node& node = *context.nodes[index];
+	CompressionItem item;
+	item.box = *node.aabb;
+	item.node = index;
+	item.first = node.first_triangle;
+	item.count = node.num_triangles;
+	return item;
+}
+
+CompressionItem rangeItem(const CompressionContext& context, size_t first,
+						  size_t count) {
+	CompressionItem item;
+	item.first = first;
+	item.count = count;
+	for (size_t i = first; i < first + count; i++)
+		item.box.extend(getTriangle(context.triangles[i], context.positions));
+	return item;
+}
+
+bool isLeaf(const CompressionContext& context, const CompressionItem& item) {
+	bool treeLeaf =
+		item.node == NO_NODE || context.nodes[item.node]->child_index == 0;
+	return treeLeaf && item.count <= MAX_LEAF_TRIANGLES;
+}
+
+void split(const CompressionContext& context, const CompressionItem& item,
+		   CompressionItem children[2]) {
+	if (item.node != NO_NODE && context.nodes[item.node]->child_index != 0) {
+		size_t child = context.nodes[item.node]->child_index;
+		children[0] = nodeItem(context, child);
+		children[1] = nodeItem(context, child + 1);
+	} else {
+		size_t half = item.count / 2;
+		children[0] = rangeItem(context, item.first, half);
+		children[1] = rangeItem(context, item.first + half, item.count - half);
+	}
+}
+
+// Quantizes the boxes of the children in the box of the node, rounding
+// outwards. A missing child gets an empty box.
+CompressedBVH_Node quantize(const AABB& box, const AABB* children[2]) {
+	CompressedBVH_Node node{};
+	for (int axis = 0; axis < 3; axis++) {
+		float origin = box.begin_corner[axis];
+		float extent = box.end_corner[axis] - origin;
+
+		// Smallest power of two step for which 255 steps cover the box
+		int biased = 1;
+		if (extent > 0.f) {
+			int exponent;
+			std::frexp(extent / 255.f, &exponent);
+			biased = std::clamp(exponent + 127, 1, 254);
+		}
+		auto stepOf = [](int b) {
+			return glm::uintBitsToFloat(static_cast<uint32_t>(b) << 23);
+		};
+		while (biased < 254 &&
+			   origin + 255.f * stepOf(biased) < box.end_corner[axis])
+			biased++;
+		float step = stepOf(biased);
+
+		node.origin[axis] = origin;
+		node.exponents |= static_cast<uint32_t>(biased) << (8 * axis);
+
+		for (int k = 0; k < 2; k++) {
+			uint32_t lo = 255, hi = 0;
+			if (children[k]) {
+				float minValue = children[k]->begin_corner[axis];
+				float maxValue = children[k]->end_corner[axis];
+				lo = static_cast<uint32_t>(std::clamp(
+					std::floor((minValue - origin) / step), 0.f, 255.f));
+				hi = static_cast<uint32_t>(std::clamp(
+					std::ceil((maxValue - origin) / step), 0.f, 255.f));
+				// The division rounds, check against the decoded values
+				while (lo > 0 && origin + float(lo) * step > minValue) lo--;
+				while (hi < 255 && origin + float(hi) * step < maxValue) hi++;
+			}
+			node.bounds[axis] |= (lo | (hi << 8)) << (16 * k);
+		}
+	}
+	return node;
+}
+
+int32_t compressItem(CompressionContext& context, const CompressionItem& item) {
+	int32_t index = static_cast<int32_t>(context.compressedNodes.size());
+	context.compressedNodes.emplace_back();
+
+	CompressionItem children[2];
+	split(context, item, children);
+	const AABB* boxes[2] = {&children[0].box, &children[1].box};
+	CompressedBVH_Node node = quantize(item.box, boxes);
+
+	for (int k = 0; k < 2; k++) {
+		if (isLeaf(context, children[k])) {
+			node.child[k] = static_cast<int32_t>(children[k].first);
+			node.counts |= static_cast<uint32_t>(children[k].count) << (16 * k);
+		} else {
+			// Depth-first, the recursion can reallocate the nodes
+			node.child[k] = compressItem(context, children[k]);
+		}
+	}
+	context.compressedNodes[index] = node;
+	return index;
+}
+
+}  // namespace
+
+void BVH::compress() {
+	m_compressedNodes.clear();
+	CompressionContext context{m_nodes, triangles(),
+							   m_parent_mesh->vertexPositions(),
+							   m_compressedNodes};
+
+	CompressionItem root = nodeItem(context, 0);
+	if (!isLeaf(context, root)) {
+		compressItem(context, root);
+		return;
+	}
+
+	// The root needs a node of its own to hold its bounds
+	const AABB* boxes[2] = {&root.box, nullptr};
+	CompressedBVH_Node node = quantize(root.box, boxes);
+	node.child[0] = root.count > 0 ? static_cast<int32_t>(root.first) : -1;
+	node.child[1] = -1;
+	node.counts = static_cast<uint32_t>(root.count);
+	m_compressedNodes.push_back(node);
+}
+
+void BVH::reorderTriangles(const std::vector<unsigned int>& order) {
+	std::vector<glm::uvec3>& triangles = m_parent_mesh->triangleIndices();
+
+	std::vector<unsigned int> ranks(order.size());
+	for (size_t i = 0; i < order.size(); i++) ranks[order[i]] = i;
+
+	struct Leaf {
+		std::shared_ptr<BVH_Node> node;
+		unsigned int rank;
+	};
+	std::vector<Leaf> leaves;
+	for (const auto& node : m_nodes) {
+		if (node->child_index != 0 || node->num_triangles == 0) continue;
+
+		// The ranks of the triangles of the leaf, sorted: order[rank] are
+		// then its triangles in the order
+		auto begin = ranks.begin() + node->first_triangle;
+		auto end = begin + node->num_triangles;
+		std::sort(begin, end);
+		leaves.push_back({node, *begin});
+	}
+	std::sort(leaves.begin(), leaves.end(),
+			  [](const Leaf& a, const Leaf& b) { return a.rank < b.rank; });
+
+	std::vector<glm::uvec3> sorted;
+	sorted.reserve(triangles.size());
+	for (const Leaf& leaf : leaves) {
+		size_t first = sorted.size();
+		for (size_t i = leaf.node->first_triangle;
+			 i < leaf.node->first_triangle + leaf.node->num_triangles; i++)
+			sorted.push_back(triangles[order[ranks[i]]]);
+		leaf.node->first_triangle = first;
+	}
+	triangles.swap(sorted);
+
+	compress();
+	m_version = nextVersion();
+}
@@ -0,0 +1,157 @@
+#include "acceleration/GPUBVHBuilder.h"
+
+#include "core/ShaderProgram.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+// See BVHBuildComputeShader.glsl
+constexpr GLuint BLOCK_SIZE = 256;
+constexpr int RADIX_BITS = 4;
+constexpr int RADIX = 1 << RADIX_BITS;
+constexpr int MORTON_CODE_BITS = 30;
+
+enum Stage {
+	CENTROID_BOUNDS,
+	MORTON_CODES,
+	COUNT_DIGITS,
+	SCAN_COUNTS,
+	SCATTER,
+	HIERARCHY,
+	REFIT
+};
+
+constexpr GLuint NODE_BINDING = 2;
+constexpr GLuint SOURCE_BINDING = 3;
+constexpr GLuint DESTINATION_BINDING = 4;
+constexpr GLuint COUNT_BINDING = 5;
+constexpr GLuint PARENT_BINDING = 6;
+constexpr GLuint VISIT_BINDING = 7;
+constexpr GLuint CENTROID_BOUNDS_BINDING = 8;
+
+// BVH_Node of the shader
+struct Node {
+	float min[3];
+	int triangle_count;
+	float max[3];
+	int offset;
+};
+
+GLuint numOfBlocks(size_t numOfElements) {
+	return static_cast<GLuint>((numOfElements + BLOCK_SIZE - 1) / BLOCK_SIZE);
+}
+
+void allocate(GLuint& buffer, size_t size) {
+	if (buffer) glDeleteBuffers(1, &buffer);
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_DYNAMIC_COPY);
+}
+
+}  // namespace
+
+GPU_BVHBuilder::~GPU_BVHBuilder() {
+	glDeleteBuffers(2, m_elementBuffers);
+	glDeleteBuffers(1, &m_countBuffer);
+	glDeleteBuffers(1, &m_parentBuffer);
+	glDeleteBuffers(1, &m_visitBuffer);
+	glDeleteBuffers(1, &m_centroidBoundsBuffer);
+}
+
+void GPU_BVHBuilder::build(ShaderProgram& program,
+						   const GeometryArena& geometry,
+						   const GeometryArena::Range& range,
+						   GLuint nodeBuffer, size_t nodeOffset) {
+	size_t numOfTriangles = range.numIndices / 3;
+	if (numOfTriangles == 0) {
+		// A leaf no ray enters
+		const float inf = std::numeric_limits<float>::infinity();
+		Node empty = {{inf, inf, inf}, 1, {-inf, -inf, -inf}, 0};
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, nodeBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, nodeOffset * sizeof(Node),
+						sizeof(Node), &empty);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		return;
+	}
+	reserve(numOfTriangles);
+
+	// Empty bounds and no child visited yet
+	const GLuint centroidBounds[6] = {~0u, ~0u, ~0u, 0, 0, 0};
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_centroidBoundsBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(centroidBounds),
+					centroidBounds);
+	GLuint zero = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_visitBuffer);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+					  GL_UNSIGNED_INT, &zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, geometry.vertexBuffer());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, geometry.indexBuffer());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODE_BINDING, nodeBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COUNT_BINDING, m_countBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PARENT_BINDING,
+					 m_parentBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VISIT_BINDING, m_visitBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CENTROID_BOUNDS_BINDING,
+					 m_centroidBoundsBuffer);
+
+	program.set("numOfTriangles", static_cast<int>(numOfTriangles));
+	program.set("triangleOffset", static_cast<int>(range.firstIndex / 3));
+	program.set("vertexOffset", static_cast<int>(range.firstVertex));
+	program.set("vertexFormat", geometry.vertexFormat());
+	program.set("positionOffset", range.positionOffset);
+	program.set("positionScale", range.positionScale);
+	program.set("nodeOffset", static_cast<int>(nodeOffset));
+	program.use();
+
+	GLuint blocks = numOfBlocks(numOfTriangles);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SOURCE_BINDING,
+					 m_elementBuffers[0]);
+	dispatch(program, CENTROID_BOUNDS, blocks);
+	dispatch(program, MORTON_CODES, blocks);
+
+	// An even number of passes, the sorted codes end up in the first buffer
+	int source = 0;
+	for (int shift = 0; shift < MORTON_CODE_BITS; shift += RADIX_BITS) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SOURCE_BINDING,
+						 m_elementBuffers[source]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DESTINATION_BINDING,
+						 m_elementBuffers[1 - source]);
+		program.set("shift", shift);
+		dispatch(program, COUNT_DIGITS, blocks);
+		dispatch(program, SCAN_COUNTS, 1);
+		dispatch(program, SCATTER, blocks);
+		source = 1 - source;
+	}
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SOURCE_BINDING,
+					 m_elementBuffers[source]);
+
+	dispatch(program, HIERARCHY, numOfBlocks(numOfTriangles));
+	dispatch(program, REFIT, numOfBlocks(numOfNodes(numOfTriangles)));
+	ShaderProgram::stop();
+}
+
+void GPU_BVHBuilder::reserve(size_t numOfTriangles) {
+	if (!m_centroidBoundsBuffer)
+		allocate(m_centroidBoundsBuffer, 6 * sizeof(GLuint));
+	if (numOfTriangles > m_capacity) {
+		m_capacity = std::max(numOfTriangles, 2 * m_capacity);
+		for (GLuint& buffer : m_elementBuffers)
+			allocate(buffer, m_capacity * 2 * sizeof(GLuint));
+		allocate(m_countBuffer,
+				 RADIX * numOfBlocks(m_capacity) * sizeof(GLuint));
+		allocate(m_parentBuffer, numOfNodes(m_capacity) * sizeof(GLint));
+		allocate(m_visitBuffer, numOfNodes(m_capacity) * sizeof(GLuint));
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GPU_BVHBuilder::dispatch(ShaderProgram& program, int stage,
+							  GLuint numOfGroups) {
+	program.set("stage", stage);
+	glDispatchCompute(numOfGroups, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
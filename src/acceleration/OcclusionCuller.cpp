@@ -0,0 +1,259 @@
+#include "acceleration/OcclusionCuller.h"
+#include "core/Mesh.h"
+
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+constexpr int TILES_X = OcclusionCuller::WIDTH / OcclusionCuller::TILE_SIZE;
+constexpr int BAND_HEIGHT =
+	OcclusionCuller::HEIGHT / OcclusionCuller::NUM_BANDS;
+// Boxes tested per chunk of the parallel loop
+constexpr int TEST_BATCH_SIZE = 64;
+
+inline glm::vec3 toScreen(const glm::vec4& clip) {
+	glm::vec3 ndc = glm::vec3(clip) / clip.w;
+	return glm::vec3((0.5f * ndc.x + 0.5f) * OcclusionCuller::WIDTH,
+					 (0.5f * ndc.y + 0.5f) * OcclusionCuller::HEIGHT, ndc.z);
+}
+
+// Pixel coordinate of the screen position, clamped before the conversion
+// as positions near the eye project far out
+inline int toPixel(float position, int size) {
+	return static_cast<int>(std::floor(std::clamp(position, -1.f, size + 1.f)));
+}
+
+}  // namespace
+
+OcclusionCuller::OcclusionCuller()
+	: m_depth(WIDTH * HEIGHT, 1.f),
+	  m_tileMaxDepth(TILES_X * (HEIGHT / TILE_SIZE), 1.f) {
+	m_worker = std::thread(&OcclusionCuller::workerLoop, this);
+}
+
+OcclusionCuller::~OcclusionCuller() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_condition.notify_all();
+	m_worker.join();
+}
+
+void OcclusionCuller::begin(const glm::mat4& viewProjectionMatrix,
+							std::vector<Occluder> occluders,
+							std::vector<AABB> boxes) {
+	wait();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_viewProjectionMatrix = viewProjectionMatrix;
+		m_occluders = std::move(occluders);
+		m_boxes = std::move(boxes);
+		m_started = true;
+		m_done = false;
+	}
+	m_condition.notify_all();
+}
+
+void OcclusionCuller::wait() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_condition.wait(lock, [this] { return m_done; });
+}
+
+void OcclusionCuller::workerLoop() {
+	// The thread calling begin() keeps a core to submit the draws. The team
+	// of this thread lives as long as it does.
+	omp_set_num_threads(std::max(omp_get_max_threads() - 1, 1));
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true) {
+		m_condition.wait(lock, [this] { return m_started || m_stop; });
+		if (m_stop) return;
+		m_started = false;
+
+		lock.unlock();
+		cull();
+		lock.lock();
+		m_done = true;
+		m_condition.notify_all();
+	}
+}
+
+void OcclusionCuller::cull() {
+	m_occluderTriangles.resize(m_occluders.size());
+	m_occluded.assign(m_boxes.size(), false);
+
+	const long long numOccluders = static_cast<long long>(m_occluders.size());
+#pragma omp parallel for
+	for (long long i = 0; i < numOccluders; i++)
+		setupOccluder(m_occluders[i], m_occluderTriangles[i]);
+
+#pragma omp parallel for
+	for (int band = 0; band < NUM_BANDS; band++)
+		rasterizeBand(band * BAND_HEIGHT, (band + 1) * BAND_HEIGHT);
+
+	const long long numBoxes = static_cast<long long>(m_boxes.size());
+#pragma omp parallel for schedule(dynamic, TEST_BATCH_SIZE)
+	for (long long i = 0; i < numBoxes; i++)
+		m_occluded[i] = isOccluded(m_boxes[i]);
+}
+
+void OcclusionCuller::setupOccluder(
+	const Occluder& occluder, std::vector<ScreenTriangle>& triangles) const {
+	triangles.clear();
+	const Mesh& mesh = *occluder.mesh;
+	const std::vector<glm::uvec3>* proxy = &mesh.triangleIndices();
+	if (mesh.numOfLODs() > 0)
+		proxy = &mesh.lodTriangles(mesh.numOfLODs() - 1);
+	if (proxy->size() > MAX_PROXY_TRIANGLES) return;
+
+	glm::mat4 matrix = m_viewProjectionMatrix * occluder.modelMatrix;
+	const std::vector<glm::vec3>& positions = mesh.vertexPositions();
+	for (const glm::uvec3& triangle : *proxy) {
+		glm::vec4 clip[3];
+		for (int k = 0; k < 3; k++)
+			clip[k] = matrix * glm::vec4(positions[triangle[k]], 1.f);
+
+		// Sutherland-Hodgman against the near plane z = -w, the other planes
+		// are handled by the bounds of the rasterization
+		glm::vec4 polygon[4];
+		int numVertices = 0;
+		for (int k = 0; k < 3; k++) {
+			const glm::vec4& a = clip[k];
+			const glm::vec4& b = clip[(k + 1) % 3];
+			float da = a.z + a.w;
+			float db = b.z + b.w;
+			if (da >= 0.f) polygon[numVertices++] = a;
+			if ((da >= 0.f) != (db >= 0.f))
+				polygon[numVertices++] = glm::mix(a, b, da / (da - db));
+		}
+
+		for (int k = 1; k + 1 < numVertices; k++) {
+			ScreenTriangle screen = {{toScreen(polygon[0]),
+									  toScreen(polygon[k]),
+									  toScreen(polygon[k + 1])}};
+			glm::vec2 ab = glm::vec2(screen.vertices[1] - screen.vertices[0]);
+			glm::vec2 ac = glm::vec2(screen.vertices[2] - screen.vertices[0]);
+			// Back faces are culled by the rasterizer, they hide nothing
+			if (ab.x * ac.y - ab.y * ac.x > 0.f) triangles.push_back(screen);
+		}
+	}
+}
+
+void OcclusionCuller::rasterizeBand(int firstRow, int endRow) {
+	std::fill(m_depth.begin() + firstRow * WIDTH,
+			  m_depth.begin() + endRow * WIDTH, 1.f);
+
+	for (const auto& occluder : m_occluderTriangles) {
+		for (const ScreenTriangle& triangle : occluder) {
+			const glm::vec3& a = triangle.vertices[0];
+			const glm::vec3& b = triangle.vertices[1];
+			const glm::vec3& c = triangle.vertices[2];
+
+			float minY = std::min(a.y, std::min(b.y, c.y));
+			float maxY = std::max(a.y, std::max(b.y, c.y));
+			float minX = std::min(a.x, std::min(b.x, c.x));
+			float maxX = std::max(a.x, std::max(b.x, c.x));
+			int y0 = std::max(firstRow, toPixel(minY, HEIGHT));
+			int y1 = std::min(endRow, toPixel(maxY, HEIGHT) + 1);
+			int x0 = std::max(0, toPixel(minX, WIDTH));
+			int x1 = std::min(WIDTH, toPixel(maxX, WIDTH) + 1);
+			if (y0 >= y1 || x0 >= x1) continue;
+
+			// Edge functions and depth as planes over the pixel centers
+			glm::vec3 edgeX(b.y - c.y, c.y - a.y, a.y - b.y);
+			glm::vec3 edgeY(c.x - b.x, a.x - c.x, b.x - a.x);
+			glm::vec3 edgeC(b.x * c.y - b.y * c.x, c.x * a.y - c.y * a.x,
+							a.x * b.y - a.y * b.x);
+			float area = edgeC.x + edgeC.y + edgeC.z;
+			glm::vec3 z = glm::vec3(a.z, b.z, c.z) / area;
+			float depthX = glm::dot(edgeX, z);
+			float depthY = glm::dot(edgeY, z);
+			float depthC = glm::dot(edgeC, z);
+
+			// Conservative: the edges move inwards by half a pixel, so that
+			// only the pixels entirely covered pass, and each gets the
+			// farthest depth of the triangle over its square
+			edgeC -= 0.5f * (glm::abs(edgeX) + glm::abs(edgeY));
+			depthC += 0.5f * (std::abs(depthX) + std::abs(depthY));
+
+			for (int y = y0; y < y1; y++) {
+				float py = y + 0.5f;
+				glm::vec3 rowEdges = edgeY * py + edgeC;
+				float rowDepth = depthY * py + depthC;
+				float* row = &m_depth[y * WIDTH];
+#pragma omp simd
+				for (int x = x0; x < x1; x++) {
+					float px = x + 0.5f;
+					float e0 = edgeX.x * px + rowEdges.x;
+					float e1 = edgeX.y * px + rowEdges.y;
+					float e2 = edgeX.z * px + rowEdges.z;
+					float depth = depthX * px + rowDepth;
+					bool covered = e0 >= 0.f && e1 >= 0.f && e2 >= 0.f;
+					row[x] = covered && depth < row[x] ? depth : row[x];
+				}
+			}
+		}
+	}
+
+	for (int tileY = firstRow / TILE_SIZE; tileY < endRow / TILE_SIZE;
+		 tileY++) {
+		for (int tileX = 0; tileX < TILES_X; tileX++) {
+			float maxDepth = 0.f;
+			for (int y = tileY * TILE_SIZE; y < (tileY + 1) * TILE_SIZE; y++) {
+				const float* row = &m_depth[y * WIDTH + tileX * TILE_SIZE];
+#pragma omp simd reduction(max : maxDepth)
+				for (int x = 0; x < TILE_SIZE; x++)
+					maxDepth = std::max(maxDepth, row[x]);
+			}
+			m_tileMaxDepth[tileY * TILES_X + tileX] = maxDepth;
+		}
+	}
+}
+
+bool OcclusionCuller::isOccluded(const AABB& box) const {
+	glm::vec3 minScreen(std::numeric_limits<float>::max());
+	glm::vec3 maxScreen(std::numeric_limits<float>::lowest());
+	for (int corner = 0; corner < 8; corner++) {
+		glm::vec3 position(
+			corner & 1 ? box.end_corner.x : box.begin_corner.x,
+			corner & 2 ? box.end_corner.y : box.begin_corner.y,
+			corner & 4 ? box.end_corner.z : box.begin_corner.z);
+		glm::vec4 clip = m_viewProjectionMatrix * glm::vec4(position, 1.f);
+		// Crossing the near plane, in front of everything
+		if (clip.z < -clip.w || clip.w <= 0.f) return false;
+		glm::vec3 screen = toScreen(clip);
+		minScreen = glm::min(minScreen, screen);
+		maxScreen = glm::max(maxScreen, screen);
+	}
+
+	// Every pixel the box touches, the nearest point of the box being in
+	// front of all of it
+	int x0 = std::max(0, toPixel(minScreen.x, WIDTH));
+	int x1 = std::min(WIDTH, toPixel(maxScreen.x, WIDTH) + 1);
+	int y0 = std::max(0, toPixel(minScreen.y, HEIGHT));
+	int y1 = std::min(HEIGHT, toPixel(maxScreen.y, HEIGHT) + 1);
+	if (x0 >= x1 || y0 >= y1) return false;
+	float boxDepth = minScreen.z;
+
+	for (int tileY = y0 / TILE_SIZE; tileY <= (y1 - 1) / TILE_SIZE; tileY++) {
+		int tileY0 = std::max(y0, tileY * TILE_SIZE);
+		int tileY1 = std::min(y1, (tileY + 1) * TILE_SIZE);
+		for (int tileX = x0 / TILE_SIZE; tileX <= (x1 - 1) / TILE_SIZE;
+			 tileX++) {
+			if (m_tileMaxDepth[tileY * TILES_X + tileX] < boxDepth) continue;
+
+			// Only the pixels of the tile in the box can tell
+			int tileX0 = std::max(x0, tileX * TILE_SIZE);
+			int tileX1 = std::min(x1, (tileX + 1) * TILE_SIZE);
+			if (tileX1 - tileX0 == TILE_SIZE && tileY1 - tileY0 == TILE_SIZE)
+				return false;
+			for (int y = tileY0; y < tileY1; y++)
+				for (int x = tileX0; x < tileX1; x++)
+					if (m_depth[y * WIDTH + x] >= boxDepth) return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,173 @@
+#include "acceleration/SceneBVH.h"
+#include "acceleration/BVH.h"
+#include "primitives/Frustum.h"
+#include "core/Scene.h"
+#include "core/Model.h"
+#include "core/Mesh.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace {
+
+// Refitting keeps the topology, a tree this much looser than when it was
+// built is rebuilt
+constexpr float MAX_REFIT_GROWTH = 1.5f;
+
+// Bounds of the box once transformed (Arvo)
+AABB transformBox(const AABB& box, const glm::mat4& matrix) {
+	glm::vec3 center = glm::vec3(matrix * glm::vec4(box.center(), 1.f));
+	glm::vec3 halfExtent = 0.5f * (box.end_corner - box.begin_corner);
+
+	glm::mat3 linear(matrix);
+	glm::vec3 extent(0.f);
+	for (int axis = 0; axis < 3; axis++)
+		extent += glm::abs(linear[axis]) * halfExtent[axis];
+
+	AABB result(center - extent);
+	result.extend(center + extent);
+	return result;
+}
+
+inline bool sameBox(const AABB& a, const AABB& b) {
+	return a.begin_corner == b.begin_corner && a.end_corner == b.end_corner;
+}
+
+}  // namespace
+
+void SceneBVH::update(Scene& scene) {
+	size_t numOfModels = scene.numOfModels();
+	bool added = numOfModels != m_modelBounds.size();
+
+	m_modelBounds.resize(numOfModels);
+	m_transformVersions.resize(numOfModels, 0);
+	m_bvhVersions.resize(numOfModels, 0);
+	for (size_t i = 0; i < numOfModels; i++) {
+		auto mesh = scene.model(i)->mesh();
+		const BVH& bvh = *mesh->bvh();
+		if (m_transformVersions[i] == mesh->transformVersion() &&
+			m_bvhVersions[i] == bvh.version())
+			continue;
+		m_modelBounds[i] = transformBox(*bvh.getRoot()->aabb,
+										mesh->getTransformMatrix());
+		m_transformVersions[i] = mesh->transformVersion();
+		m_bvhVersions[i] = bvh.version();
+		if (!added) refitAncestors(i);
+	}
+
+	// Without any change, the area is still the one that passed the test
+	if (!added && m_area <= MAX_REFIT_GROWTH * m_builtArea) return;
+
+	m_nodes.clear();
+	m_models.resize(numOfModels);
+	m_leaves.resize(numOfModels);
+	std::iota(m_models.begin(), m_models.end(), 0);
+	if (numOfModels > 0) {
+		m_nodes.reserve(2 * numOfModels - 1);
+		m_nodes.emplace_back();
+		build(0, 0, numOfModels);
+	}
+	m_builtArea = m_area = refit();
+}
+
+void SceneBVH::build(size_t index, size_t begin, size_t end) {
+	if (end - begin == 1) {
+		m_nodes[index].leaf = true;
+		m_nodes[index].index = m_models[begin];
+		m_leaves[m_models[begin]] = index;
+		return;
+	}
+
+	AABB centers;
+	for (size_t i = begin; i < end; i++)
+		centers.extend(m_modelBounds[m_models[i]].center());
+	size_t axis = centers.longestAxis();
+
+	size_t middle = begin + (end - begin) / 2;
+	std::nth_element(m_models.begin() + begin, m_models.begin() + middle,
+					 m_models.begin() + end, [&](size_t a, size_t b) {
+						 return m_modelBounds[a].center()[axis] <
+								m_modelBounds[b].center()[axis];
+					 });
+
+	// The children are next to each other, after their parent
+	size_t first = m_nodes.size();
+	m_nodes.emplace_back();
+	m_nodes.emplace_back();
+	m_nodes[index].leaf = false;
+	m_nodes[index].index = first;
+	m_nodes[first].parent = index;
+	m_nodes[first + 1].parent = index;
+
+	build(first, begin, middle);
+	build(first + 1, middle, end);
+}
+
+float SceneBVH::refit() {
+	float area = 0.f;
+	// Children always come after their parent
+	for (size_t i = m_nodes.size(); i-- > 0;) {
+		Node& node = m_nodes[i];
+		if (node.leaf) {
+			node.box = m_modelBounds[node.index];
+			continue;
+		}
+		node.box = m_nodes[node.index].box;
+		node.box.extend(m_nodes[node.index + 1].box.begin_corner);
+		node.box.extend(m_nodes[node.index + 1].box.end_corner);
+		area += node.box.halfSurfaceArea();
+	}
+	return area;
+}
+
+void SceneBVH::refitAncestors(size_t model) {
+	size_t index = m_leaves[model];
+	m_nodes[index].box = m_modelBounds[model];
+	// Above an unchanged box, the ancestors are already up to date
+	while (index != 0) {
+		index = m_nodes[index].parent;
+		Node& node = m_nodes[index];
+		AABB box = m_nodes[node.index].box;
+		box.extend(m_nodes[node.index + 1].box);
+		if (sameBox(box, node.box)) return;
+		m_area += box.halfSurfaceArea() - node.box.halfSurfaceArea();
+		node.box = box;
+	}
+}
+
+void SceneBVH::cull(const Frustum& frustum,
+					std::vector<size_t>& visible) const {
+	visible.clear();
+	if (m_nodes.empty()) return;
+
+	// Nodes with the planes they still have to be tested against, the
+	// subtrees entirely inside the frustum are not tested anymore
+	std::vector<std::pair<size_t, int>> stack = {{0, Frustum::ALL_PLANES}};
+	while (!stack.empty()) {
+		auto [index, planes] = stack.back();
+		stack.pop_back();
+
+		const Node& node = m_nodes[index];
+		if (planes != 0 &&
+			frustum.test(node.box, planes) == Frustum::OUTSIDE)
+			continue;
+
+		if (node.leaf) {
+			visible.push_back(node.index);
+		} else {
+			stack.emplace_back(node.index, planes);
+			stack.emplace_back(node.index + 1, planes);
+		}
+	}
+}
+
+void SceneBVH::clear() {
+	m_nodes.clear();
+	m_modelBounds.clear();
+	m_transformVersions.clear();
+	m_bvhVersions.clear();
+	m_models.clear();
+	m_leaves.clear();
+	m_builtArea = 0.f;
+	m_area = 0.f;
+}
@@ -1,5 +1,4 @@
 #include "core/ColorCorrection.h"
-#include "core/ShaderProgram.h"
 
 // From
 // https://blog.demofox.org/2020/06/06/casual-shadertoy-path-tracing-2-image-improvement-and-glossy-reflections/
@@ -33,14 +32,15 @@ glm::vec3 ACESFilm(glm::vec3 x) {
 	return clamp((x * (a * x + b)) / (x * (c * x + d) + e), 0.0f, 1.0f);
 }
 
-void ImageParameters::setUniforms(ShaderProgram& program,
-								  std::string name) const {
-	program.set(name + ".colorCorrect", colorCorrect);
-	program.set(name + ".useSRGB", useSRGB);
-	program.set(name + ".useToneMapping", useToneMapping);
-	program.set(name + ".useExposure", useExposure);
-	program.set(name + ".exposure", exposure);
-	program.set(name + ".raytracedShadows", raytracedShadows);
-	program.set(name + ".raytracedReflections", raytracedReflections);
-	program.set(name + ".numRefractions", numRefractions);
+ImageParametersBlock ImageParameters::uniformBlock() const {
+	ImageParametersBlock block = {};
+	block.colorCorrect = colorCorrect;
+	block.useSRGB = useSRGB;
+	block.useToneMapping = useToneMapping;
+	block.useExposure = useExposure;
+	block.exposure = exposure;
+	block.raytracedShadows = raytracedShadows;
+	block.raytracedReflections = raytracedReflections;
+	block.numRefractions = numRefractions;
+	return block;
 }
\ No newline at end of file
@@ -67,7 +67,10 @@ void debugMessageCallback(GLenum source, GLenum type, GLuint id,
 				  << "\t----------------" << "\n";
 	}
 
-	if (type == GL_DEBUG_TYPE_ERROR) std::exit(EXIT_FAILURE);
+	// Shaders that do not compile are reported by ShaderProgram, a reload
+	// keeps the previous program
+	if (type == GL_DEBUG_TYPE_ERROR && source != GL_DEBUG_SOURCE_SHADER_COMPILER)
+		std::exit(EXIT_FAILURE);
 }
 
 void exitOnCriticalError(const std::string& message) {
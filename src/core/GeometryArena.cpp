@@ -0,0 +1,224 @@
+#include "core/GeometryArena.h"
+
+#include "core/Scene.h"
+#include "core/Model.h"
+#include "core/Mesh.h"
+#include "acceleration/BVH.h"
+#include "primitives/AABB.h"
+#include "utils/VertexPacking.h"
+
+#include <algorithm>
+#include <cstring>
+
+int GeometryArena::VERTEX_FORMAT = 0;
+
+namespace {
+
+// Makes room for size bytes in the buffer, keeping its first used bytes
+void reserve(GLuint& buffer, size_t& capacity, size_t used, size_t size) {
+	if (buffer && size <= capacity) return;
+
+	size_t newCapacity = std::max(size, 2 * capacity);
+	GLuint newBuffer;
+	glGenBuffers(1, &newBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, newCapacity, nullptr, GL_STATIC_DRAW);
+	if (buffer) {
+		if (used > 0) {
+			glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+								0, used);
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &buffer);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	buffer = newBuffer;
+	capacity = newCapacity;
+}
+
+// Writes the vertices of the mesh in the given format, see the vertex
+// fetching functions of the shaders for the layouts
+void encodeVertices(const Mesh& mesh, int format,
+					const GeometryArena::Range& range,
+					std::vector<uint32_t>& words) {
+	const auto& positions = mesh.vertexPositions();
+	const auto& normals = mesh.vertexNormals();
+	const auto& uvs = mesh.vertexUVs();
+	const auto& tangents = mesh.vertexTangents();
+	const auto& bitangents = mesh.vertexBitangents();
+
+	const size_t stride = GeometryArena::vertexSize(format) / sizeof(uint32_t);
+	words.resize(range.numVertices * stride);
+	glm::vec3 invScale = 1.f / range.positionScale;
+
+#pragma omp parallel for
+	for (int j = 0; j < static_cast<int>(range.numVertices); j++) {
+		uint32_t* w = &words[j * stride];
+		glm::vec3 bitangent = glm::cross(normals[j], tangents[j]);
+		float handedness =
+			glm::dot(bitangent, bitangents[j]) < 0.f ? -1.f : 1.f;
+
+		if (format == 0) {
+			ArenaVertex vertex{positions[j], uvs[j].x,	  normals[j],
+							   uvs[j].y,	 tangents[j], handedness};
+			std::memcpy(w, &vertex, sizeof(ArenaVertex));
+			continue;
+		}
+
+		size_t k = 0;
+		if (format == 1) {
+			std::memcpy(w, &positions[j], sizeof(glm::vec3));
+			k = 3;
+		} else {
+			glm::vec3 p = (positions[j] - range.positionOffset) * invScale;
+			packUnormPosition(p, w[0], w[1]);
+			k = 2;
+		}
+		w[k] = packOctahedral(normals[j]);
+		w[k + 1] = packTangent(tangents[j], handedness);
+		w[k + 2] = glm::packHalf2x16(uvs[j]);
+	}
+}
+
+}  // namespace
+
+size_t GeometryArena::vertexSize(int format) {
+	if (format == 1) return 6 * sizeof(uint32_t);
+	if (format == 2) return 5 * sizeof(uint32_t);
+	return sizeof(ArenaVertex);
+}
+
+GeometryArena::~GeometryArena() { clear(); }
+
+GeometryArena::Range GeometryArena::layoutMesh(const Mesh& mesh,
+											   size_t firstVertex,
+											   size_t firstIndex) const {
+	Range range;
+	range.firstVertex = firstVertex;
+	range.numVertices = mesh.vertexPositions().size();
+	range.firstIndex = firstIndex;
+	range.numIndices = 3 * mesh.triangleIndices().size();
+	size_t numIndices = firstIndex + range.numIndices;
+	for (size_t l = 0; l < mesh.numOfLODs(); l++) {
+		Range::LOD lod;
+		lod.firstIndex = numIndices;
+		lod.numIndices = 3 * mesh.lodTriangles(l).size();
+		lod.error = mesh.lodError(l);
+		range.lods.push_back(lod);
+		numIndices += lod.numIndices;
+	}
+	mesh.computeBoundingSphere(range.boundingCenter, range.boundingRadius);
+	if (m_vertexFormat == 2) {
+		// The root of the BVH bounds the whole mesh
+		const AABB& bounds = *mesh.bvh()->getRoot()->aabb;
+		range.positionOffset = bounds.begin_corner;
+		range.positionScale = glm::max(bounds.end_corner - bounds.begin_corner,
+									   glm::vec3(1e-20f));
+	}
+	return range;
+}
+
+void GeometryArena::uploadMesh(const Mesh& mesh, const Range& range,
+							   std::vector<uint32_t>& vertices) const {
+	const size_t vertexBytes = vertexSize(m_vertexFormat);
+	encodeVertices(mesh, m_vertexFormat, range, vertices);
+	glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+	glBufferSubData(GL_ARRAY_BUFFER, range.firstVertex * vertexBytes,
+					range.numVertices * vertexBytes, vertices.data());
+
+	// The triangles are tightly packed and already in the BVH order. Not
+	// bound as GL_ELEMENT_ARRAY_BUFFER, that would change the current VAO
+	glBindBuffer(GL_ARRAY_BUFFER, m_indexBuffer);
+	glBufferSubData(GL_ARRAY_BUFFER, range.firstIndex * sizeof(GLuint),
+					range.numIndices * sizeof(GLuint),
+					mesh.triangleIndices().data());
+	for (size_t l = 0; l < range.lods.size(); l++) {
+		glBufferSubData(GL_ARRAY_BUFFER,
+						range.lods[l].firstIndex * sizeof(GLuint),
+						range.lods[l].numIndices * sizeof(GLuint),
+						mesh.lodTriangles(l).data());
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GeometryArena::update(const Scene& scene) {
+	if (VERTEX_FORMAT != m_vertexFormat) {
+		invalidate();
+		m_vertexFormat = VERTEX_FORMAT;
+	}
+
+	// Only the interleaving needs a staging copy, one mesh at a time
+	std::vector<uint32_t> vertices;
+
+	// Edited meshes are written again in place, everything is laid out again
+	// when one of them changed size
+	for (size_t i = 0; i < m_ranges.size(); i++) {
+		const Mesh& mesh = *scene.model(i)->mesh();
+		if (mesh.geometryVersion() == m_meshVersions[i]) continue;
+
+		const Range& old = m_ranges[i];
+		Range range = layoutMesh(mesh, old.firstVertex, old.firstIndex);
+		bool sameSize = range.numVertices == old.numVertices &&
+						range.numIndices == old.numIndices &&
+						range.lods.size() == old.lods.size();
+		for (size_t l = 0; sameSize && l < range.lods.size(); l++)
+			sameSize = range.lods[l].numIndices == old.lods[l].numIndices;
+		if (!sameSize) {
+			invalidate();
+			break;
+		}
+		uploadMesh(mesh, range, vertices);
+		m_ranges[i] = range;
+		m_meshVersions[i] = mesh.geometryVersion();
+	}
+
+	// Models are only ever appended to the scene
+	size_t firstMesh = m_ranges.size();
+	size_t numOfModels = scene.numOfModels();
+	if (firstMesh >= numOfModels) return;
+
+	const size_t vertexBytes = vertexSize(m_vertexFormat);
+
+	size_t numVertices = m_numVertices;
+	size_t numIndices = m_numIndices;
+	for (size_t i = firstMesh; i < numOfModels; i++) {
+		const Mesh& mesh = *scene.model(i)->mesh();
+		Range range = layoutMesh(mesh, numVertices, numIndices);
+		numVertices += range.numVertices;
+		numIndices += range.numIndices;
+		for (const Range::LOD& lod : range.lods) numIndices += lod.numIndices;
+		m_ranges.push_back(range);
+		m_meshVersions.push_back(mesh.geometryVersion());
+	}
+
+	reserve(m_vertexBuffer, m_vertexCapacity, m_numVertices * vertexBytes,
+			numVertices * vertexBytes);
+	reserve(m_indexBuffer, m_indexCapacity, m_numIndices * sizeof(GLuint),
+			numIndices * sizeof(GLuint));
+
+	for (size_t i = firstMesh; i < numOfModels; i++)
+		uploadMesh(*scene.model(i)->mesh(), m_ranges[i], vertices);
+
+	m_numVertices = numVertices;
+	m_numIndices = numIndices;
+}
+
+void GeometryArena::invalidate() {
+	m_ranges.clear();
+	m_meshVersions.clear();
+	m_numVertices = 0;
+	m_numIndices = 0;
+	m_generation++;
+}
+
+void GeometryArena::clear() {
+	if (m_vertexBuffer) glDeleteBuffers(1, &m_vertexBuffer);
+	if (m_indexBuffer) glDeleteBuffers(1, &m_indexBuffer);
+	m_vertexBuffer = 0;
+	m_indexBuffer = 0;
+	m_vertexCapacity = 0;
+	m_indexCapacity = 0;
+	invalidate();
+}
@@ -7,17 +7,230 @@
 #include <sstream>
 
 #include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <map>
+
+#include <omp.h>
+
+#include <stb_image.h>
 
 #include "core/Mesh.h"
+#include "core/Model.h"
+#include "core/Scene.h"
+#include "core/Texture.h"
+#include "core/Resources.h"
+#include "core/MappedFile.h"
+#include "utils/Json.h"
+
+namespace {
+
+inline bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+inline const char* skipBlanks(const char* p, const char* end) {
+	while (p < end && isBlank(*p)) p++;
+	return p;
+}
+
+inline const char* nextLine(const char* p, const char* end) {
+	const char* eol =
+		static_cast<const char*>(std::memchr(p, '\n', end - p));
+	return eol ? eol + 1 : end;
+}
+
+// A line holding data, as opposed to a blank line or a comment
+inline bool isDataLine(const char* p, const char* end) {
+	p = skipBlanks(p, end);
+	return p < end && *p != '\n' && *p != '#';
+}
+
+template <typename T>
+inline bool parseNumber(const char*& p, const char* end, T& value) {
+	p = skipBlanks(p, end);
+	auto result = std::from_chars(p, end, value);
+	if (result.ec != std::errc()) return false;
+	p = result.ptr;
+	return true;
+}
+
+// Splits [begin, end) in chunks of roughly equal size, each starting at the
+// beginning of a line, so that they can be parsed independently
+std::vector<const char*> splitAtLines(const char* begin, const char* end) {
+	const size_t minChunkSize = 1 << 16;
+	size_t numChunks = 4 * static_cast<size_t>(omp_get_max_threads());
+	numChunks = std::max<size_t>(
+		1, std::min(numChunks, (end - begin) / minChunkSize));
+
+	std::vector<const char*> bounds = {begin};
+	for (size_t i = 1; i < numChunks; i++) {
+		const char* p = begin + (end - begin) * i / numChunks;
+		p = nextLine(std::max(p, bounds.back()), end);
+		if (p < end && p > bounds.back()) bounds.push_back(p);
+	}
+	bounds.push_back(end);
+	return bounds;
+}
+
+// Reads the "OFF" keyword and the element counts, skipping comments, and
+// returns a pointer to the first line after the counts
+const char* parseOFFHeader(const char* p, const char* end, unsigned int& sizeV,
+						   unsigned int& sizeT) {
+	auto skipSpacesAndComments = [&]() {
+		while (p < end) {
+			if (isBlank(*p) || *p == '\n')
+				p++;
+			else if (*p == '#')
+				p = nextLine(p, end);
+			else
+				break;
+		}
+	};
+
+	skipSpacesAndComments();
+	if (end - p < 3 || std::strncmp(p, "OFF", 3) != 0) return nullptr;
+	p += 3;
+
+	unsigned int sizeE;
+	unsigned int* counts[3] = {&sizeV, &sizeT, &sizeE};
+	for (unsigned int* count : counts) {
+		skipSpacesAndComments();
+		if (!parseNumber(p, end, *count)) return nullptr;
+	}
+	return nextLine(p, end);
+}
+
+// Fast path of IO::loadOFF, returns false if the file does not follow the
+// usual one-element-per-line layout
+bool parseOFF(const MappedFile& file, std::shared_ptr<Mesh> meshPtr) {
+	unsigned int sizeV, sizeT;
+	const char* body =
+		parseOFFHeader(file.begin(), file.end(), sizeV, sizeT);
+	if (!body) return false;
+
+	const char* end = file.end();
+	std::vector<const char*> chunks = splitAtLines(body, end);
+	int numChunks = static_cast<int>(chunks.size()) - 1;
+
+	// 1st pass: count the lines of each chunk to find out which section
+	// (vertices or faces) every line belongs to
+	std::vector<size_t> firstLine(numChunks + 1, 0);
+#pragma omp parallel for
+	for (int c = 0; c < numChunks; c++) {
+		size_t numLines = 0;
+		for (const char* p = chunks[c]; p < chunks[c + 1]; p = nextLine(p, end))
+			if (isDataLine(p, end)) numLines++;
+		firstLine[c + 1] = numLines;
+	}
+	for (int c = 0; c < numChunks; c++) firstLine[c + 1] += firstLine[c];
+	if (firstLine[numChunks] < size_t(sizeV) + sizeT) return false;
+
+	auto& P = meshPtr->vertexPositions();
+	auto& T = meshPtr->triangleIndices();
+	P.resize(sizeV);
 
-#include "OBJ_Loader.h"
+	// 2nd pass: parse the vertices, and count the triangles each chunk will
+	// produce once its polygons are fan-triangulated
+	std::vector<size_t> firstTriangle(numChunks + 1, 0);
+	bool valid = true;
+#pragma omp parallel for reduction(&& : valid)
+	for (int c = 0; c < numChunks; c++) {
+		size_t line = firstLine[c];
+		size_t numTriangles = 0;
+		for (const char* p = chunks[c]; p < chunks[c + 1] && valid;
+			 p = nextLine(p, end)) {
+			if (!isDataLine(p, end)) continue;
+			if (line < sizeV) {
+				glm::vec3& v = P[line];
+				valid = parseNumber(p, end, v[0]) &&
+						parseNumber(p, end, v[1]) && parseNumber(p, end, v[2]);
+			} else if (line < size_t(sizeV) + sizeT) {
+				unsigned int n;
+				valid = parseNumber(p, end, n);
+				if (valid && n >= 3) numTriangles += n - 2;
+			}
+			line++;
+		}
+		firstTriangle[c + 1] = numTriangles;
+	}
+	if (!valid) return false;
+	for (int c = 0; c < numChunks; c++)
+		firstTriangle[c + 1] += firstTriangle[c];
+	T.resize(firstTriangle[numChunks]);
+
+	// 3rd pass: parse the faces straight into the triangle array
+#pragma omp parallel for reduction(&& : valid)
+	for (int c = 0; c < numChunks; c++) {
+		size_t line = firstLine[c];
+		size_t t = firstTriangle[c];
+		for (const char* p = chunks[c];
+			 p < chunks[c + 1] && valid && line < size_t(sizeV) + sizeT;
+			 p = nextLine(p, end)) {
+			if (!isDataLine(p, end)) continue;
+			if (line++ < sizeV) continue;
+
+			unsigned int n, first, previous, current;
+			valid = parseNumber(p, end, n);
+			if (!valid || n < 3) continue;
+			valid = parseNumber(p, end, first) && parseNumber(p, end, previous);
+			for (unsigned int j = 2; j < n && valid; j++) {
+				valid = parseNumber(p, end, current);
+				T[t++] = glm::uvec3(first, previous, current);
+				previous = current;
+			}
+		}
+	}
+	if (!valid) return false;
+
+	size_t numInvalid = 0;
+#pragma omp parallel for reduction(+ : numInvalid)
+	for (long long i = 0; i < static_cast<long long>(T.size()); i++)
+		if (glm::any(glm::greaterThanEqual(T[i], glm::uvec3(sizeV))))
+			numInvalid++;
+	return numInvalid == 0;
+}
+
+}  // namespace
 
 void IO::loadOFF(const std::string& filename, std::shared_ptr<Mesh> meshPtr) {
+	std::cout << "Start loading mesh <" << filename << ">" << std::endl;
+	auto before = std::chrono::high_resolution_clock::now();
+
+	meshPtr->clear();
+	bool parsed;
+	{
+		MappedFile file(filename);
+		parsed = parseOFF(file, meshPtr);
+	}
+	if (!parsed) {
+		std::cout << " > Unusual OFF layout, falling back to stream parsing"
+				  << std::endl;
+		loadOFFStream(filename, meshPtr);
+		return;
+	}
+
+	auto& P = meshPtr->vertexPositions();
+	meshPtr->vertexNormals().resize(P.size(), glm::vec3(0.f, 0.f, 1.f));
+	meshPtr->recomputePerVertexNormals();
+
+	auto after = std::chrono::high_resolution_clock::now();
+	std::cout << "Mesh <" + filename + "> loaded, "
+			  << meshPtr->triangleIndices().size() << " triangles in "
+			  << std::chrono::duration_cast<std::chrono::milliseconds>(
+					 after - before)
+					 .count()
+			  << "ms\n";
+}
+
+void IO::loadOFFStream(const std::string& filename, std::shared_ptr<Mesh> meshPtr) {
 	std::cout << "Start loading mesh <" << filename << ">" << std::endl;
 	meshPtr->clear();
 	std::ifstream in(filename.c_str());
 	if (!in)
-		throw std::ios_base::failure("[Mesh Loader][loadOFF] Cannot open " +
+		throw std::ios_base::failure("[Mesh Loader][loadOFFStream] Cannot open " +
 									 filename);
 	std::string offString;
 	unsigned int sizeV, sizeT, tmp;
@@ -46,41 +259,1220 @@ void IO::loadOFF(const std::string& filename, std::shared_ptr<Mesh> meshPtr) {
 	std::cout << "Mesh <" + filename + "> loaded, "
 			  << meshPtr->triangleIndices().size() << " triangles\n";
 }
+namespace {
+
+const unsigned int NO_INDEX = std::numeric_limits<unsigned int>::max();
+
+enum class OBJLine { Other, Position, UV, Normal, Face, Object };
+
+// Identifies the keyword starting the line and moves p past it
+inline OBJLine classifyOBJLine(const char*& p, const char* end) {
+	p = skipBlanks(p, end);
+	auto keyword = [&](const char* word, size_t length) {
+		if (size_t(end - p) <= length || std::strncmp(p, word, length) != 0 ||
+			!(isBlank(p[length]) || p[length] == '\n'))
+			return false;
+		p += length;
+		return true;
+	};
+	if (keyword("v", 1)) return OBJLine::Position;
+	if (keyword("vt", 2)) return OBJLine::UV;
+	if (keyword("vn", 2)) return OBJLine::Normal;
+	if (keyword("f", 1)) return OBJLine::Face;
+	if (keyword("o", 1) || keyword("g", 1) || keyword("usemtl", 6))
+		return OBJLine::Object;
+	return OBJLine::Other;
+}
+
+inline size_t countTokens(const char* p, const char* end) {
+	size_t numTokens = 0;
+	while (true) {
+		p = skipBlanks(p, end);
+		if (p >= end || *p == '\n') return numTokens;
+		numTokens++;
+		while (p < end && !isBlank(*p) && *p != '\n') p++;
+	}
+}
+
+// Parses a "v", "v/t", "v//n" or "v/t/n" face corner and turns its 1-based
+// (or negative, relative) indices into 0-based ones. counts holds the number
+// of positions, UVs and normals declared so far.
+inline bool parseOBJCorner(const char*& p, const char* end,
+						   const glm::uvec3& counts, glm::uvec3& corner) {
+	corner = glm::uvec3(NO_INDEX);
+	p = skipBlanks(p, end);
+	for (int k = 0; k < 3; k++) {
+		if (k > 0) {
+			if (p >= end || *p != '/') break;
+			p++;
+			if (k == 1 && p < end && *p == '/') continue;
+		}
+		long long index;
+		auto result = std::from_chars(p, end, index);
+		if (result.ec != std::errc()) return false;
+		p = result.ptr;
+		index = index < 0 ? counts[k] + index : index - 1;
+		if (index < 0 || index >= counts[k]) return false;
+		corner[k] = static_cast<unsigned int>(index);
+	}
+	return true;
+}
+
+struct OBJCornerHash {
+	inline size_t operator()(const glm::uvec3& c) const {
+		uint64_t h = c.x * 0x9E3779B97F4A7C15ull;
+		h ^= (c.y + 0x632BE59BD9B4E019ull) * 0xC2B2AE3D27D4EB4Full;
+		h ^= (c.z + 0x165667B19E3779F9ull) * 0x85EBCA77C2B2AE63ull;
+		return static_cast<size_t>(h ^ (h >> 29));
+	}
+};
+
+// Turns the corners of triangles [first, last) into an indexed mesh, sharing
+// the vertices whose position/UV/normal tuples are identical
+std::shared_ptr<Mesh> weldOBJMesh(const std::vector<glm::uvec3>& corners,
+								  size_t first, size_t last,
+								  const std::vector<glm::vec3>& positions,
+								  const std::vector<glm::vec2>& uvs,
+								  const std::vector<glm::vec3>& normals) {
+	auto meshPtr = std::make_shared<Mesh>();
+	auto& T = meshPtr->triangleIndices();
+	T.resize(last - first);
+
+	// Open addressing table of vertex ids, the key of a vertex being the
+	// corner it was created from
+	size_t numCorners = 3 * (last - first);
+	size_t capacity = 1;
+	while (capacity < 2 * numCorners) capacity <<= 1;
+	std::vector<unsigned int> table(capacity, NO_INDEX);
+	std::vector<size_t> vertexCorner;
+	vertexCorner.reserve(numCorners / 4);
+
+	OBJCornerHash hash;
+	for (size_t i = 3 * first; i < 3 * last; i++) {
+		const glm::uvec3& corner = corners[i];
+		size_t slot = hash(corner) & (capacity - 1);
+		while (table[slot] != NO_INDEX &&
+			   corners[vertexCorner[table[slot]]] != corner)
+			slot = (slot + 1) & (capacity - 1);
+		if (table[slot] == NO_INDEX) {
+			table[slot] = static_cast<unsigned int>(vertexCorner.size());
+			vertexCorner.push_back(i);
+		}
+		T[i / 3 - first][i % 3] = table[slot];
+	}
+	table = std::vector<unsigned int>();
+
+	size_t numVertices = vertexCorner.size();
+	bool authoredNormals = true;
+	auto& P = meshPtr->vertexPositions();
+	auto& N = meshPtr->vertexNormals();
+	auto& UV = meshPtr->vertexUVs();
+	P.resize(numVertices);
+	N.resize(numVertices);
+	UV.resize(numVertices);
+	for (size_t v = 0; v < numVertices; v++) {
+		const glm::uvec3& corner = corners[vertexCorner[v]];
+		P[v] = positions[corner[0]];
+		UV[v] = corner[1] != NO_INDEX ? uvs[corner[1]] : glm::vec2(0.f);
+		if (corner[2] != NO_INDEX)
+			N[v] = glm::normalize(normals[corner[2]]);
+		else
+			authoredNormals = false;
+	}
+
+	if (authoredNormals)
+		meshPtr->recomputeTangentSpace();
+	else
+		meshPtr->recomputePerVertexNormals();
+	return meshPtr;
+}
+
+}  // namespace
+
 void IO::loadOBJ(const std::string& filename,
 				 std::vector<std::shared_ptr<Mesh>>& meshes) {
-	objl::Loader loader;
+	std::cout << "Start loading mesh <" << filename << ">" << std::endl;
+	auto before = std::chrono::high_resolution_clock::now();
 
-	bool loadout = loader.LoadFile(filename);
-	if (!loadout) {
-		throw std::ios_base::failure("[Mesh Loader][loadOBJ] Cannot open " +
-									 filename);
+	MappedFile file(filename);
+	const char* end = file.end();
+	std::vector<const char*> chunks = splitAtLines(file.begin(), end);
+	int numChunks = static_cast<int>(chunks.size()) - 1;
+
+	// 1st pass: count the elements of each chunk, and remember where new
+	// objects (o, g or usemtl) start
+	std::vector<glm::uvec3> firstElement(numChunks + 1, glm::uvec3(0));
+	std::vector<size_t> firstTriangle(numChunks + 1, 0);
+	std::vector<std::vector<size_t>> objectStarts(numChunks);
+#pragma omp parallel for
+	for (int c = 0; c < numChunks; c++) {
+		glm::uvec3 numElements(0);
+		size_t numTriangles = 0;
+		for (const char* p = chunks[c]; p < chunks[c + 1];
+			 p = nextLine(p, end)) {
+			switch (classifyOBJLine(p, end)) {
+				case OBJLine::Position: numElements[0]++; break;
+				case OBJLine::UV: numElements[1]++; break;
+				case OBJLine::Normal: numElements[2]++; break;
+				case OBJLine::Face:
+					numTriangles +=
+						std::max<size_t>(countTokens(p, end), 2) - 2;
+					break;
+				case OBJLine::Object:
+					objectStarts[c].push_back(numTriangles);
+					break;
+				default: break;
+			}
+		}
+		firstElement[c + 1] = numElements;
+		firstTriangle[c + 1] = numTriangles;
+	}
+	for (int c = 0; c < numChunks; c++) {
+		firstElement[c + 1] += firstElement[c];
+		firstTriangle[c + 1] += firstTriangle[c];
+	}
+
+	// 2nd pass: parse the attributes and the fan-triangulated faces into
+	// flat arrays
+	std::vector<glm::vec3> positions(firstElement[numChunks][0]);
+	std::vector<glm::vec2> uvs(firstElement[numChunks][1]);
+	std::vector<glm::vec3> normals(firstElement[numChunks][2]);
+	std::vector<glm::uvec3> corners(3 * firstTriangle[numChunks]);
+	bool valid = true;
+#pragma omp parallel for reduction(&& : valid)
+	for (int c = 0; c < numChunks; c++) {
+		glm::uvec3 counts = firstElement[c];
+		size_t t = firstTriangle[c];
+		for (const char* p = chunks[c]; p < chunks[c + 1] && valid;
+			 p = nextLine(p, end)) {
+			switch (classifyOBJLine(p, end)) {
+				case OBJLine::Position: {
+					glm::vec3& v = positions[counts[0]++];
+					valid = parseNumber(p, end, v[0]) &&
+							parseNumber(p, end, v[1]) &&
+							parseNumber(p, end, v[2]);
+				} break;
+				case OBJLine::UV: {
+					glm::vec2& uv = uvs[counts[1]++];
+					valid =
+						parseNumber(p, end, uv[0]) && parseNumber(p, end, uv[1]);
+				} break;
+				case OBJLine::Normal: {
+					glm::vec3& n = normals[counts[2]++];
+					valid = parseNumber(p, end, n[0]) &&
+							parseNumber(p, end, n[1]) &&
+							parseNumber(p, end, n[2]);
+				} break;
+				case OBJLine::Face: {
+					size_t n = countTokens(p, end);
+					if (n < 3) break;
+					glm::uvec3 first, previous, current;
+					valid = parseOBJCorner(p, end, counts, first) &&
+							parseOBJCorner(p, end, counts, previous);
+					for (size_t j = 2; j < n && valid; j++) {
+						valid = parseOBJCorner(p, end, counts, current);
+						corners[3 * t + 0] = first;
+						corners[3 * t + 1] = previous;
+						corners[3 * t + 2] = current;
+						previous = current;
+						t++;
+					}
+				} break;
+				default: break;
+			}
+		}
+	}
+	if (!valid)
+		throw std::ios_base::failure(
+			"[Mesh Loader][loadOBJ] Invalid element in " + filename);
+
+	// Objects boundaries, as ranges of triangles
+	std::vector<size_t> bounds = {0};
+	for (int c = 0; c < numChunks; c++)
+		for (size_t start : objectStarts[c])
+			if (firstTriangle[c] + start > bounds.back())
+				bounds.push_back(firstTriangle[c] + start);
+	if (firstTriangle[numChunks] > bounds.back())
+		bounds.push_back(firstTriangle[numChunks]);
+	int numObjects = static_cast<int>(bounds.size()) - 1;
+
+	// 3rd pass: weld each object into an indexed mesh
+	std::vector<std::shared_ptr<Mesh>> objectMeshes(numObjects);
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < numObjects; i++)
+		objectMeshes[i] = weldOBJMesh(corners, bounds[i], bounds[i + 1],
+									  positions, uvs, normals);
+
+	size_t numVertices = 0, numTriangles = 0;
+	for (auto& meshPtr : objectMeshes) {
+		numVertices += meshPtr->vertexPositions().size();
+		numTriangles += meshPtr->triangleIndices().size();
+		meshes.push_back(meshPtr);
+	}
+
+	auto after = std::chrono::high_resolution_clock::now();
+	std::cout << "Mesh <" + filename + "> loaded, " << numObjects
+			  << " objects, " << numVertices << " vertices, " << numTriangles
+			  << " triangles in "
+			  << std::chrono::duration_cast<std::chrono::milliseconds>(
+					 after - before)
+					 .count()
+			  << "ms\n";
+}
+
+namespace {
+
+enum class PLYType { None, Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+PLYType parsePLYType(const std::string& name) {
+	if (name == "char" || name == "int8") return PLYType::Int8;
+	if (name == "uchar" || name == "uint8") return PLYType::UInt8;
+	if (name == "short" || name == "int16") return PLYType::Int16;
+	if (name == "ushort" || name == "uint16") return PLYType::UInt16;
+	if (name == "int" || name == "int32") return PLYType::Int32;
+	if (name == "uint" || name == "uint32") return PLYType::UInt32;
+	if (name == "float" || name == "float32") return PLYType::Float32;
+	if (name == "double" || name == "float64") return PLYType::Float64;
+	return PLYType::None;
+}
+
+inline size_t sizeOf(PLYType type) {
+	switch (type) {
+		case PLYType::Int8:
+		case PLYType::UInt8: return 1;
+		case PLYType::Int16:
+		case PLYType::UInt16: return 2;
+		case PLYType::Int32:
+		case PLYType::UInt32:
+		case PLYType::Float32: return 4;
+		case PLYType::Float64: return 8;
+		default: return 0;
+	}
+}
+
+// Reads a little-endian value (the host is assumed little-endian as well)
+template <typename T>
+inline T readPLY(const char* p, PLYType type) {
+	switch (type) {
+#define PLY_READ(ENUM, CTYPE) \
+	case PLYType::ENUM: {     \
+		CTYPE value;          \
+		std::memcpy(&value, p, sizeof(CTYPE)); \
+		return static_cast<T>(value);          \
+	}
+		PLY_READ(Int8, int8_t)
+		PLY_READ(UInt8, uint8_t)
+		PLY_READ(Int16, int16_t)
+		PLY_READ(UInt16, uint16_t)
+		PLY_READ(Int32, int32_t)
+		PLY_READ(UInt32, uint32_t)
+		PLY_READ(Float32, float)
+		PLY_READ(Float64, double)
+#undef PLY_READ
+		default: return T(0);
 	}
+}
 
-	for (int i = 0; i < loader.LoadedMeshes.size(); i++) {
-		objl::Mesh& curMesh = loader.LoadedMeshes[i];
+struct PLYProperty {
+	std::string name;
+	PLYType type = PLYType::None;  // Type of the value, or of the list items
+	PLYType countType = PLYType::None;	// Type of the list size, if a list
+	size_t offset = 0;	// Offset in the record, if no list comes before
+	bool afterList = false;
+};
 
-		std::shared_ptr<Mesh> meshPtr = std::make_shared<Mesh>();
-		meshPtr->clear();
+struct PLYElement {
+	std::string name;
+	size_t count = 0;
+	std::vector<PLYProperty> properties;
+	bool fixedSize = true;	// No list property
+	size_t stride = 0;		// Record size, if fixed
+	const char* data = nullptr;
 
-		for (int j = 0; j < curMesh.Vertices.size(); j++) {
-			meshPtr->vertexPositions().push_back(curMesh.Vertices[j].Position);
+	// Start of each record then end of the element, if not fixed size, once
+	// walked
+	std::vector<size_t> offsets;
 
-			meshPtr->vertexNormals().push_back(curMesh.Vertices[j].Normal);
+	const PLYProperty* find(std::initializer_list<const char*> names) const {
+		for (const char* name : names)
+			for (const auto& property : properties)
+				if (property.name == name) return &property;
+		return nullptr;
+	}
 
-			meshPtr->vertexUVs().push_back(
-				curMesh.Vertices[j].TextureCoordinate);
+	// Offsets of each record, for elements with list properties. The records
+	// are walked serially, once.
+	const std::vector<size_t>& recordOffsets(const char* end) {
+		if (!offsets.empty()) return offsets;
+		auto truncated = [&]() {
+			return std::ios_base::failure(
+				"[Mesh Loader][loadPLY] Truncated element " + name);
+		};
+		std::vector<size_t> result(count + 1, 0);
+		const char* p = data;
+		for (size_t i = 0; i < count; i++) {
+			result[i] = p - data;
+			for (const auto& property : properties) {
+				if (property.countType == PLYType::None) {
+					p += sizeOf(property.type);
+				} else {
+					if (p + sizeOf(property.countType) > end) throw truncated();
+					size_t n = readPLY<size_t>(p, property.countType);
+					p += sizeOf(property.countType) + n * sizeOf(property.type);
+				}
+			}
+			if (p > end) throw truncated();
 		}
+		result[count] = p - data;
+		offsets.swap(result);
+		return offsets;
+	}
+};
+
+std::vector<PLYElement> parsePLYHeader(const MappedFile& file,
+									   const std::string& filename) {
+	const char* p = file.begin();
+	const char* end = file.end();
+	std::vector<PLYElement> elements;
+	bool binaryLittleEndian = false;
 
-		for (int j = 0; j < curMesh.Indices.size(); j += 3) {
-			meshPtr->triangleIndices().push_back(
-				glm::uvec3(curMesh.Indices[j], curMesh.Indices[j + 1],
-						   curMesh.Indices[j + 2]));
+	auto fail = [&](const std::string& message) {
+		return std::ios_base::failure("[Mesh Loader][loadPLY] " + message +
+									  " in " + filename);
+	};
+
+	for (bool first = true; p < end; first = false) {
+		const char* eol = nextLine(p, end);
+		std::istringstream line(std::string(p, eol));
+		p = eol;
+		std::string keyword;
+		line >> keyword;
+
+		if (first && keyword != "ply") throw fail("Missing magic number");
+		if (keyword == "format") {
+			std::string format;
+			line >> format;
+			binaryLittleEndian = format == "binary_little_endian";
+		} else if (keyword == "element") {
+			PLYElement element;
+			line >> element.name >> element.count;
+			elements.push_back(element);
+		} else if (keyword == "property") {
+			if (elements.empty()) throw fail("Property outside of an element");
+			PLYElement& element = elements.back();
+			PLYProperty property;
+			std::string type;
+			line >> type;
+			if (type == "list") {
+				std::string countType, itemType;
+				line >> countType >> itemType;
+				property.countType = parsePLYType(countType);
+				property.type = parsePLYType(itemType);
+				if (property.countType == PLYType::None)
+					throw fail("Unknown type " + countType);
+				element.fixedSize = false;
+			} else {
+				property.type = parsePLYType(type);
+				property.offset = element.stride;
+				property.afterList = !element.fixedSize;
+				element.stride += sizeOf(property.type);
+			}
+			if (property.type == PLYType::None)
+				throw fail("Unknown type " + type);
+			line >> property.name;
+			element.properties.push_back(property);
+		} else if (keyword == "end_header") {
+			if (!binaryLittleEndian)
+				throw fail("Only binary_little_endian PLY files are supported");
+			for (auto& element : elements) {
+				element.data = p;
+				if (element.fixedSize)
+					p += element.count * element.stride;
+				else if (&element != &elements.back())
+					p += element.recordOffsets(end).back();
+				else
+					p = end;  // Walked only if the loader needs the offsets
+				if (p > end) throw fail("Truncated element " + element.name);
+			}
+			return elements;
 		}
+	}
+	throw fail("Missing end_header");
+}
+
+}  // namespace
+
+void IO::loadPLY(const std::string& filename, std::shared_ptr<Mesh> meshPtr) {
+	std::cout << "Start loading mesh <" << filename << ">" << std::endl;
+	auto before = std::chrono::high_resolution_clock::now();
+	meshPtr->clear();
+
+	MappedFile file(filename);
+	std::vector<PLYElement> elements = parsePLYHeader(file, filename);
+	PLYElement* vertex = nullptr;
+	PLYElement* face = nullptr;
+	for (auto& element : elements) {
+		if (element.name == "vertex") vertex = &element;
+		if (element.name == "face") face = &element;
+	}
+	if (!vertex)
+		throw std::ios_base::failure(
+			"[Mesh Loader][loadPLY] No vertex element in " + filename);
 
+	// Vertices
+
+	const PLYProperty* xyz[3] = {vertex->find({"x"}), vertex->find({"y"}),
+								 vertex->find({"z"})};
+	const PLYProperty* nxyz[3] = {vertex->find({"nx"}), vertex->find({"ny"}),
+								  vertex->find({"nz"})};
+	const PLYProperty* uv[2] = {
+		vertex->find({"u", "s", "texture_u", "texture_s"}),
+		vertex->find({"v", "t", "texture_v", "texture_t"})};
+	if (!xyz[0] || !xyz[1] || !xyz[2])
+		throw std::ios_base::failure(
+			"[Mesh Loader][loadPLY] Missing vertex coordinates in " + filename);
+	bool hasNormals = nxyz[0] && nxyz[1] && nxyz[2];
+	bool hasUVs = uv[0] && uv[1];
+	for (const PLYProperty* property : {xyz[0], xyz[1], xyz[2], nxyz[0],
+										nxyz[1], nxyz[2], uv[0], uv[1]}) {
+		// Its offset would change with each record
+		if (property && property->afterList)
+			throw std::ios_base::failure(
+				"[Mesh Loader][loadPLY] Vertex property " + property->name +
+				" after a list property in " + filename);
+	}
+
+	const long long numVertices = static_cast<long long>(vertex->count);
+	auto& P = meshPtr->vertexPositions();
+	auto& N = meshPtr->vertexNormals();
+	auto& UV = meshPtr->vertexUVs();
+	P.resize(numVertices);
+	N.resize(numVertices, glm::vec3(0.f, 0.f, 1.f));
+	if (hasUVs) UV.resize(numVertices);
+
+	bool packedPositions = vertex->properties.size() == 3 &&
+						   vertex->stride == sizeof(glm::vec3);
+	for (int k = 0; k < 3; k++)
+		packedPositions = packedPositions && xyz[k]->type == PLYType::Float32 &&
+						  xyz[k]->offset == k * sizeof(float);
+
+	if (packedPositions) {
+		// The file already stores the positions the way the mesh does
+		std::memcpy(P.data(), vertex->data, numVertices * sizeof(glm::vec3));
+	} else {
+		const std::vector<size_t>& offsets =
+			vertex->fixedSize ? vertex->offsets
+							  : vertex->recordOffsets(file.end());
+#pragma omp parallel for
+		for (long long i = 0; i < numVertices; i++) {
+			const char* record =
+				vertex->data + (vertex->fixedSize ? i * vertex->stride
+												  : offsets[i]);
+			for (int k = 0; k < 3; k++) {
+				P[i][k] = readPLY<float>(record + xyz[k]->offset, xyz[k]->type);
+				if (hasNormals)
+					N[i][k] =
+						readPLY<float>(record + nxyz[k]->offset, nxyz[k]->type);
+			}
+			if (hasUVs)
+				for (int k = 0; k < 2; k++)
+					UV[i][k] =
+						readPLY<float>(record + uv[k]->offset, uv[k]->type);
+		}
+	}
+
+	// Faces
+
+	const PLYProperty* indices =
+		face ? face->find({"vertex_indices", "vertex_index"}) : nullptr;
+	if (indices && indices->countType != PLYType::None) {
+		auto& T = meshPtr->triangleIndices();
+		const long long numFaces = static_cast<long long>(face->count);
+		size_t countSize = sizeOf(indices->countType);
+		size_t indexSize = sizeOf(indices->type);
+
+		// Scalars stored before the list shift the indices, scalars after it
+		// only add to the record size
+		size_t listOffset = 0;
+		bool singleList = true;
+		for (const auto& property : face->properties) {
+			if (&property == indices) break;
+			if (property.countType != PLYType::None) singleList = false;
+			listOffset += sizeOf(property.type);
+		}
+		for (const auto& property : face->properties)
+			if (&property != indices && property.countType != PLYType::None)
+				singleList = false;
+
+		// Try the common case first: triangles only, which gives fixed-size
+		// records that can be decoded in parallel
+		size_t triangleStride = face->stride + countSize + 3 * indexSize;
+		bool trianglesOnly =
+			singleList && face->data + numFaces * triangleStride <= file.end();
+		if (trianglesOnly) {
+			long long numPolygons = 0;
+#pragma omp parallel for reduction(+ : numPolygons)
+			for (long long i = 0; i < numFaces; i++)
+				if (readPLY<size_t>(face->data + i * triangleStride + listOffset,
+									indices->countType) != 3)
+					numPolygons++;
+			trianglesOnly = numPolygons == 0;
+		}
+
+		if (trianglesOnly) {
+			T.resize(numFaces);
+#pragma omp parallel for
+			for (long long i = 0; i < numFaces; i++) {
+				const char* list =
+					face->data + i * triangleStride + listOffset + countSize;
+				for (int k = 0; k < 3; k++)
+					T[i][k] =
+						readPLY<unsigned int>(list + k * indexSize, indices->type);
+			}
+		} else {
+			// Polygons: where each record starts needs a serial walk, unless
+			// the header did it, then how many triangles each of them gives
+			const std::vector<size_t>& offsets =
+				face->recordOffsets(file.end());
+			std::vector<size_t> listOffsets(numFaces);
+			std::vector<size_t> firstTriangle(numFaces + 1, 0);
+#pragma omp parallel for
+			for (long long i = 0; i < numFaces; i++) {
+				const char* p = face->data + offsets[i];
+				for (const auto& property : face->properties) {
+					if (&property == indices) break;
+					p += property.countType == PLYType::None
+							 ? sizeOf(property.type)
+							 : sizeOf(property.countType) +
+								   readPLY<size_t>(p, property.countType) *
+									   sizeOf(property.type);
+				}
+				listOffsets[i] = p - face->data;
+				size_t n = readPLY<size_t>(p, indices->countType);
+				firstTriangle[i + 1] = n >= 3 ? n - 2 : 0;
+			}
+			for (long long i = 0; i < numFaces; i++)
+				firstTriangle[i + 1] += firstTriangle[i];
+			T.resize(firstTriangle[numFaces]);
+#pragma omp parallel for
+			for (long long i = 0; i < numFaces; i++) {
+				const char* p = face->data + listOffsets[i];
+				size_t n = readPLY<size_t>(p, indices->countType);
+				const char* list = p + countSize;
+				unsigned int first = readPLY<unsigned int>(list, indices->type);
+				for (size_t j = 2; j < n; j++)
+					T[firstTriangle[i] + j - 2] = glm::uvec3(
+						first,
+						readPLY<unsigned int>(list + (j - 1) * indexSize,
+											  indices->type),
+						readPLY<unsigned int>(list + j * indexSize,
+											  indices->type));
+			}
+		}
+
+		size_t numInvalid = 0;
+#pragma omp parallel for reduction(+ : numInvalid)
+		for (long long i = 0; i < static_cast<long long>(T.size()); i++)
+			if (glm::any(glm::greaterThanEqual(T[i], glm::uvec3(P.size()))))
+				numInvalid++;
+		if (numInvalid > 0)
+			throw std::ios_base::failure(
+				"[Mesh Loader][loadPLY] Invalid vertex index in " + filename);
+	}
+
+	if (hasNormals)
+		meshPtr->recomputeTangentSpace();
+	else
 		meshPtr->recomputePerVertexNormals();
 
-		meshes.push_back(meshPtr);
+	auto after = std::chrono::high_resolution_clock::now();
+	std::cout << "Mesh <" + filename + "> loaded, "
+			  << meshPtr->triangleIndices().size() << " triangles in "
+			  << std::chrono::duration_cast<std::chrono::milliseconds>(
+					 after - before)
+					 .count()
+			  << "ms\n";
+}
+
+namespace {
+
+const uint32_t GLB_MAGIC = 0x46546C67;		 // "glTF"
+const uint32_t GLB_CHUNK_JSON = 0x4E4F534A;	 // "JSON"
+const uint32_t GLB_CHUNK_BIN = 0x004E4942;	 // "BIN\0"
+
+enum GLTFComponentType {
+	GLTF_BYTE = 5120,
+	GLTF_UNSIGNED_BYTE = 5121,
+	GLTF_SHORT = 5122,
+	GLTF_UNSIGNED_SHORT = 5123,
+	GLTF_UNSIGNED_INT = 5125,
+	GLTF_FLOAT = 5126
+};
+
+const int GLTF_TRIANGLES = 4;
+
+inline size_t componentSize(int componentType) {
+	switch (componentType) {
+		case GLTF_BYTE:
+		case GLTF_UNSIGNED_BYTE: return 1;
+		case GLTF_SHORT:
+		case GLTF_UNSIGNED_SHORT: return 2;
+		case GLTF_UNSIGNED_INT:
+		case GLTF_FLOAT: return 4;
+		default: return 0;
+	}
+}
+
+inline int numComponentsOf(const std::string& type) {
+	if (type == "SCALAR") return 1;
+	if (type == "VEC2") return 2;
+	if (type == "VEC3") return 3;
+	if (type == "VEC4") return 4;
+	return 0;
+}
+
+// Typed view of a buffer view, pointing straight into the mapped file
+struct GLTFAccessor {
+	const char* data = nullptr;
+	size_t count = 0;
+	size_t stride = 0;
+	int componentType = GLTF_FLOAT;
+	int numComponents = 0;
+	bool normalized = false;
+
+	inline bool isPacked(int type, int n) const {
+		return componentType == type && numComponents == n &&
+			   stride == n * componentSize(type);
+	}
+
+	inline float component(size_t i, int k) const {
+		const char* p = data + i * stride + k * componentSize(componentType);
+		switch (componentType) {
+			case GLTF_FLOAT: {
+				float value;
+				std::memcpy(&value, p, sizeof(float));
+				return value;
+			}
+			case GLTF_UNSIGNED_INT: {
+				uint32_t value;
+				std::memcpy(&value, p, sizeof(uint32_t));
+				return static_cast<float>(value);
+			}
+			case GLTF_UNSIGNED_SHORT: {
+				uint16_t value;
+				std::memcpy(&value, p, sizeof(uint16_t));
+				return normalized ? value / 65535.f : value;
+			}
+			case GLTF_SHORT: {
+				int16_t value;
+				std::memcpy(&value, p, sizeof(int16_t));
+				return normalized ? std::max(value / 32767.f, -1.f) : value;
+			}
+			case GLTF_UNSIGNED_BYTE: {
+				uint8_t value = static_cast<uint8_t>(*p);
+				return normalized ? value / 255.f : value;
+			}
+			default: {
+				int8_t value = static_cast<int8_t>(*p);
+				return normalized ? std::max(value / 127.f, -1.f) : value;
+			}
+		}
+	}
+
+	inline unsigned int index(size_t i) const {
+		const char* p = data + i * stride;
+		switch (componentType) {
+			case GLTF_UNSIGNED_INT: {
+				uint32_t value;
+				std::memcpy(&value, p, sizeof(uint32_t));
+				return value;
+			}
+			case GLTF_UNSIGNED_SHORT: {
+				uint16_t value;
+				std::memcpy(&value, p, sizeof(uint16_t));
+				return value;
+			}
+			default: return static_cast<uint8_t>(*p);
+		}
+	}
+
+	// Copies the accessor in a vector of glm vectors, with a single memcpy
+	// when the layout already matches
+	template <typename Vec>
+	void read(std::vector<Vec>& values) const {
+		const long long n = static_cast<long long>(count);
+		values.resize(count);
+		if (isPacked(GLTF_FLOAT, Vec::length())) {
+			std::memcpy(values.data(), data, count * sizeof(Vec));
+			return;
+		}
+#pragma omp parallel for
+		for (long long i = 0; i < n; i++)
+			for (int k = 0; k < Vec::length() && k < numComponents; k++)
+				values[i][k] = component(i, k);
+	}
+};
+
+struct GLTFImage {
+	unsigned char* pixels = nullptr;
+	int width = 0;
+	int height = 0;
+	int numComponents = 0;
+};
+
+class GLTFDocument {
+   public:
+	GLTFDocument(const std::string& filename) : m_filename(filename) {
+		m_directory = std::filesystem::path(filename).parent_path().string();
+		if (!m_directory.empty()) m_directory += "/";
+
+		m_files.push_back(std::make_unique<MappedFile>(filename));
+		const MappedFile& file = *m_files.back();
+		const char* binChunk = nullptr;
+		size_t binChunkSize = 0;
+
+		uint32_t header[3] = {0, 0, 0};
+		if (file.size() >= sizeof(header))
+			std::memcpy(header, file.data(), sizeof(header));
+		if (header[0] == GLB_MAGIC) {
+			if (header[1] != 2) throw fail("Unsupported GLB version");
+			const char* p = file.begin() + sizeof(header);
+			const char* end = file.begin() + std::min<size_t>(header[2], file.size());
+			while (p + 8 <= end) {
+				uint32_t chunk[2];
+				std::memcpy(chunk, p, sizeof(chunk));
+				p += sizeof(chunk);
+				if (p + chunk[0] > end) throw fail("Truncated chunk");
+				if (chunk[1] == GLB_CHUNK_JSON)
+					m_json = Json::parse(p, p + chunk[0]);
+				else if (chunk[1] == GLB_CHUNK_BIN && !binChunk) {
+					binChunk = p;
+					binChunkSize = chunk[0];
+				}
+				p += (chunk[0] + 3) & ~3u;
+			}
+			if (m_json.isNull()) throw fail("Missing JSON chunk");
+		} else {
+			m_json = Json::parse(file.begin(), file.end());
+		}
+
+		if (m_json["asset"]["version"].string().rfind("2", 0) != 0)
+			throw fail("Only glTF 2.0 is supported");
+
+		const Json& buffers = m_json["buffers"];
+		for (size_t i = 0; i < buffers.size(); i++) {
+			const std::string& uri = buffers[i]["uri"].string();
+			if (uri.empty()) {
+				if (!binChunk) throw fail("Missing binary chunk");
+				m_buffers.emplace_back(binChunk, binChunkSize);
+			} else if (uri.rfind("data:", 0) == 0) {
+				throw fail("Embedded data URIs are not supported");
+			} else {
+				m_files.push_back(
+					std::make_unique<MappedFile>(m_directory + uri));
+				m_buffers.emplace_back(m_files.back()->data(),
+									   m_files.back()->size());
+			}
+		}
 	}
+
+	inline const Json& json() const { return m_json; }
+	inline const std::string& directory() const { return m_directory; }
+
+	std::ios_base::failure fail(const std::string& message) const {
+		return std::ios_base::failure("[Mesh Loader][loadGLTF] " + message +
+									  " in " + m_filename);
+	}
+
+	std::pair<const char*, size_t> bufferView(int index) const {
+		const Json& view = m_json["bufferViews"][index];
+		int buffer = view["buffer"].integer(-1);
+		size_t offset = view["byteOffset"].integer();
+		size_t length = view["byteLength"].integer();
+		if (buffer < 0 || buffer >= static_cast<int>(m_buffers.size()) ||
+			offset + length > m_buffers[buffer].second)
+			throw fail("Invalid buffer view " + std::to_string(index));
+		return {m_buffers[buffer].first + offset, length};
+	}
+
+	GLTFAccessor accessor(int index) const {
+		const Json& json = m_json["accessors"][index];
+		if (json.isNull() || !json.has("bufferView") || json.has("sparse"))
+			throw fail("Unsupported accessor " + std::to_string(index));
+
+		GLTFAccessor accessor;
+		accessor.count = json["count"].integer();
+		accessor.componentType = json["componentType"].integer();
+		accessor.numComponents = numComponentsOf(json["type"].string());
+		accessor.normalized = json["normalized"].boolean();
+		size_t elementSize =
+			accessor.numComponents * componentSize(accessor.componentType);
+		if (elementSize == 0)
+			throw fail("Unsupported accessor " + std::to_string(index));
+
+		auto view = bufferView(json["bufferView"].integer());
+		size_t offset = json["byteOffset"].integer();
+		accessor.stride = m_json["bufferViews"][json["bufferView"].integer()]
+								["byteStride"]
+									.integer(static_cast<int>(elementSize));
+		if (accessor.count > 0 &&
+			offset + (accessor.count - 1) * accessor.stride + elementSize >
+				view.second)
+			throw fail("Accessor " + std::to_string(index) +
+					   " overflows its buffer view");
+		accessor.data = view.first + offset;
+		return accessor;
+	}
+
+	// Decodes a PNG/JPEG image, embedded in a buffer view or next to the file
+	GLTFImage decodeImage(int index) const {
+		const Json& json = m_json["images"][index];
+		GLTFImage image;
+		if (json.has("bufferView")) {
+			auto view = bufferView(json["bufferView"].integer());
+			image.pixels = stbi_load_from_memory(
+				reinterpret_cast<const stbi_uc*>(view.first),
+				static_cast<int>(view.second), &image.width, &image.height,
+				&image.numComponents, 0);
+		} else if (json.has("uri") &&
+				   json["uri"].string().rfind("data:", 0) != 0) {
+			MappedFile file(m_directory + json["uri"].string());
+			image.pixels = stbi_load_from_memory(
+				reinterpret_cast<const stbi_uc*>(file.data()),
+				static_cast<int>(file.size()), &image.width, &image.height,
+				&image.numComponents, 0);
+		}
+		return image;
+	}
+
+   private:
+	std::string m_filename;
+	std::string m_directory;
+	Json m_json;
+	std::vector<std::unique_ptr<MappedFile>> m_files;
+	std::vector<std::pair<const char*, size_t>> m_buffers;
+};
+
+std::shared_ptr<Mesh> loadGLTFPrimitive(const GLTFDocument& document,
+										const Json& primitive) {
+	auto meshPtr = std::make_shared<Mesh>();
+	const Json& attributes = primitive["attributes"];
+	auto& P = meshPtr->vertexPositions();
+	auto& N = meshPtr->vertexNormals();
+
+	document.accessor(attributes["POSITION"].integer(-1)).read(P);
+	if (attributes.has("TEXCOORD_0"))
+		document.accessor(attributes["TEXCOORD_0"].integer())
+			.read(meshPtr->vertexUVs());
+
+	auto& T = meshPtr->triangleIndices();
+	if (primitive.has("indices")) {
+		GLTFAccessor indices = document.accessor(primitive["indices"].integer());
+		const long long numTriangles = static_cast<long long>(indices.count / 3);
+		T.resize(numTriangles);
+		if (indices.isPacked(GLTF_UNSIGNED_INT, 1)) {
+			std::memcpy(T.data(), indices.data, numTriangles * sizeof(glm::uvec3));
+		} else {
+#pragma omp parallel for
+			for (long long i = 0; i < numTriangles; i++)
+				T[i] = glm::uvec3(indices.index(3 * i), indices.index(3 * i + 1),
+								  indices.index(3 * i + 2));
+		}
+		for (const auto& t : T)
+			if (glm::any(glm::greaterThanEqual(t, glm::uvec3(P.size()))))
+				throw document.fail("Invalid vertex index");
+	} else {
+		T.resize(P.size() / 3);
+		for (size_t i = 0; i < T.size(); i++)
+			T[i] = glm::uvec3(3 * i, 3 * i + 1, 3 * i + 2);
+	}
+
+	if (!attributes.has("NORMAL")) {
+		meshPtr->recomputePerVertexNormals();
+	} else {
+		document.accessor(attributes["NORMAL"].integer()).read(N);
+		if (!attributes.has("TANGENT")) {
+			meshPtr->recomputeTangentSpace();
+		} else {
+			// The w component gives the handedness of the bitangent
+			std::vector<glm::vec4> tangents;
+			document.accessor(attributes["TANGENT"].integer()).read(tangents);
+			auto& tangent = meshPtr->vertexTangents();
+			auto& bitangent = meshPtr->vertexBitangents();
+			tangent.resize(tangents.size());
+			bitangent.resize(tangents.size());
+			for (size_t i = 0; i < tangents.size() && i < N.size(); i++) {
+				tangent[i] = glm::vec3(tangents[i]);
+				bitangent[i] = glm::cross(N[i], tangent[i]) *
+							   (tangents[i].w < 0.f ? -1.f : 1.f);
+			}
+		}
+	}
+	return meshPtr;
+}
+
+glm::mat4 gltfNodeMatrix(const Json& node) {
+	glm::mat4 matrix(1.f);
+	if (node.has("matrix")) {
+		for (int i = 0; i < 16; i++)
+			matrix[i / 4][i % 4] = static_cast<float>(node["matrix"][i].number());
+		return matrix;
+	}
+	const Json& t = node["translation"];
+	const Json& r = node["rotation"];
+	const Json& s = node["scale"];
+	glm::quat rotation(static_cast<float>(r[3].number(1.0)),
+					   static_cast<float>(r[0].number()),
+					   static_cast<float>(r[1].number()),
+					   static_cast<float>(r[2].number()));
+	matrix = glm::translate(matrix, glm::vec3(t[0].number(), t[1].number(),
+											   t[2].number()));
+	matrix *= glm::mat4_cast(rotation);
+	return glm::scale(matrix, glm::vec3(s[0].number(1.0), s[1].number(1.0),
+										s[2].number(1.0)));
+}
+
+// Decomposes a matrix into the translation, X-Y-Z Euler rotation and scale
+// used by Transform (shears are lost)
+void setTransform(Transform& transform, const glm::mat4& matrix) {
+	glm::vec3 scale(glm::length(glm::vec3(matrix[0])),
+					glm::length(glm::vec3(matrix[1])),
+					glm::length(glm::vec3(matrix[2])));
+	if (glm::determinant(glm::mat3(matrix)) < 0.f) scale.x = -scale.x;
+	glm::mat3 R(glm::vec3(matrix[0]) / scale.x, glm::vec3(matrix[1]) / scale.y,
+				glm::vec3(matrix[2]) / scale.z);
+
+	// R = Rx(a) * Ry(b) * Rz(c)
+	glm::vec3 rotation;
+	rotation.y = std::asin(glm::clamp(R[2][0], -1.f, 1.f));
+	if (std::abs(R[2][0]) < 0.9999f) {
+		rotation.x = std::atan2(-R[2][1], R[2][2]);
+		rotation.z = std::atan2(-R[1][0], R[0][0]);
+	} else {
+		rotation.x = std::atan2(R[0][1], R[1][1]);
+		rotation.z = 0.f;
+	}
+
+	transform.setTranslation(glm::vec3(matrix[3]));
+	transform.setRotation(rotation);
+	transform.setScale(scale);
+}
+
+}  // namespace
+
+void IO::loadGLTF(const std::string& filename,
+				  std::shared_ptr<Scene> scenePtr) {
+	std::cout << "Start loading scene <" << filename << ">" << std::endl;
+	auto before = std::chrono::high_resolution_clock::now();
+
+	GLTFDocument document(filename);
+	const Json& json = document.json();
+
+	// Geometry: one mesh per primitive, since materials are per primitive
+
+	struct Primitive {
+		int mesh, primitive;
+		std::shared_ptr<Mesh> meshPtr;
+	};
+	std::vector<Primitive> primitives;
+	std::vector<size_t> firstPrimitive;
+	for (size_t i = 0; i < json["meshes"].size(); i++) {
+		firstPrimitive.push_back(primitives.size());
+		const Json& meshPrimitives = json["meshes"][i]["primitives"];
+		for (size_t j = 0; j < meshPrimitives.size(); j++)
+			primitives.push_back({int(i), int(j), nullptr});
+	}
+	firstPrimitive.push_back(primitives.size());
+
+	std::string error;
+	const long long numPrimitives = static_cast<long long>(primitives.size());
+#pragma omp parallel for schedule(dynamic)
+	for (long long i = 0; i < numPrimitives; i++) {
+		const Json& primitive =
+			json["meshes"][primitives[i].mesh]["primitives"][primitives[i].primitive];
+		if (primitive["mode"].integer(GLTF_TRIANGLES) != GLTF_TRIANGLES ||
+			!primitive["attributes"].has("POSITION"))
+			continue;
+		try {
+			primitives[i].meshPtr = loadGLTFPrimitive(document, primitive);
+		} catch (std::exception& e) {
+#pragma omp critical
+			error = e.what();
+		}
+	}
+	if (!error.empty()) throw std::ios_base::failure(error);
+
+	// Textures: images are decoded in parallel, only the ones materials use
+
+	const Json& materials = json["materials"];
+	std::vector<GLTFImage> images(json["images"].size());
+	auto imageOf = [&](const Json& textureInfo) {
+		return json["textures"][textureInfo["index"].integer(-1)]["source"]
+			.integer(-1);
+	};
+	std::vector<char> imageUsed(images.size(), 0);
+	for (size_t i = 0; i < materials.size(); i++) {
+		const Json& material = materials[i];
+		const Json& pbr = material["pbrMetallicRoughness"];
+		for (const Json* info :
+			 {&pbr["baseColorTexture"], &pbr["metallicRoughnessTexture"],
+			  &material["normalTexture"], &material["occlusionTexture"]}) {
+			int image = imageOf(*info);
+			if (image >= 0 && image < static_cast<int>(images.size()))
+				imageUsed[image] = 1;
+		}
+	}
+	const long long numImages = static_cast<long long>(images.size());
+#pragma omp parallel for schedule(dynamic)
+	for (long long i = 0; i < numImages; i++) {
+		if (!imageUsed[i]) continue;
+		try {
+			images[i] = document.decodeImage(static_cast<int>(i));
+		} catch (std::exception& e) {
+#pragma omp critical
+			error = e.what();
+		}
+	}
+	if (!error.empty()) throw std::ios_base::failure(error);
+
+	// Each (image, channel) pair becomes a scene texture, channel -1 meaning
+	// all of them
+	std::map<std::pair<int, int>, int> textureIndices;
+	bool warnedTextureLimit = false;
+	auto textureOf = [&](const Json& textureInfo, int channel, bool sRGB) {
+		int image = imageOf(textureInfo);
+		if (image < 0 || image >= static_cast<int>(images.size()) ||
+			!images[image].pixels)
+			return -1;
+		auto key = std::make_pair(image, channel);
+		auto it = textureIndices.find(key);
+		if (it != textureIndices.end()) return it->second;
+
+		if (scenePtr->numOfTextures() >= MAX_TEXTURES) {
+			if (!warnedTextureLimit)
+				std::cout << "[Mesh Loader][loadGLTF] More than "
+						  << MAX_TEXTURES << " textures, ignoring the others"
+						  << std::endl;
+			warnedTextureLimit = true;
+			return -1;
+		}
+
+		const GLTFImage& decoded = images[image];
+		if (channel < 0 || channel >= decoded.numComponents) {
+			scenePtr->add(std::make_shared<Texture>(
+				decoded.pixels, decoded.width, decoded.height,
+				decoded.numComponents, sRGB));
+		} else {
+			std::vector<unsigned char> pixels(size_t(decoded.width) *
+											  decoded.height);
+			for (size_t i = 0; i < pixels.size(); i++)
+				pixels[i] = decoded.pixels[i * decoded.numComponents + channel];
+			scenePtr->add(std::make_shared<Texture>(
+				pixels.data(), decoded.width, decoded.height, 1, false));
+		}
+		int index = static_cast<int>(scenePtr->numOfTextures()) - 1;
+		textureIndices[key] = index;
+		return index;
+	};
+
+	// Materials
+
+	std::vector<Material> sceneMaterials;
+	for (size_t i = 0; i < materials.size(); i++) {
+		const Json& material = materials[i];
+		const Json& pbr = material["pbrMetallicRoughness"];
+		const Json& extensions = material["extensions"];
+		glm::vec3 baseColor(pbr["baseColorFactor"][0].number(1.0),
+							pbr["baseColorFactor"][1].number(1.0),
+							pbr["baseColorFactor"][2].number(1.0));
+		float transmission = static_cast<float>(
+			extensions["KHR_materials_transmission"]["transmissionFactor"]
+				.number());
+
+		// Metals reflect their base color
+		Material mat(baseColor,
+					 static_cast<float>(pbr["roughnessFactor"].number(1.0)),
+					 static_cast<float>(pbr["metallicFactor"].number(1.0)),
+					 baseColor, transmission > 0.f, 0.04f,
+					 static_cast<float>(
+						 extensions["KHR_materials_ior"]["ior"].number(1.5)));
+
+		mat.albedoTex() = textureOf(pbr["baseColorTexture"], -1, true);
+		// Roughness is stored in green and metalness in blue
+		mat.roughnessTex() = textureOf(pbr["metallicRoughnessTexture"], 1, false);
+		mat.metalnessTex() = textureOf(pbr["metallicRoughnessTexture"], 2, false);
+		mat.normalTex() = textureOf(material["normalTexture"], -1, false);
+		mat.aoTex() = textureOf(material["occlusionTexture"], 0, false);
+		sceneMaterials.push_back(mat);
+	}
+	for (auto& image : images)
+		if (image.pixels) stbi_image_free(image.pixels);
+
+	// Nodes: one model per instanced primitive
+
+	const Material defaultMaterial(glm::vec3(1.f), 1.f, 1.f, glm::vec3(1.f));
+	std::vector<char> primitiveUsed(primitives.size(), 0);
+	size_t numTriangles = 0;
+	std::function<void(int, const glm::mat4&, int)> addNode =
+		[&](int index, const glm::mat4& parentMatrix, int depth) {
+			const Json& node = json["nodes"][index];
+			if (node.isNull() || depth > 64) return;
+			glm::mat4 matrix = parentMatrix * gltfNodeMatrix(node);
+
+			int mesh = node["mesh"].integer(-1);
+			if (mesh >= 0 && mesh + 1 < static_cast<int>(firstPrimitive.size())) {
+				for (size_t i = firstPrimitive[mesh]; i < firstPrimitive[mesh + 1];
+					 i++) {
+					if (!primitives[i].meshPtr) continue;
+					// Instances need their own transform, hence their own mesh
+					auto meshPtr = primitiveUsed[i]
+									   ? std::make_shared<Mesh>(*primitives[i].meshPtr)
+									   : primitives[i].meshPtr;
+					primitiveUsed[i] = 1;
+					setTransform(*meshPtr, matrix);
+
+					int material = json["meshes"][mesh]["primitives"]
+									   [primitives[i].primitive]["material"]
+										   .integer(-1);
+					scenePtr->add(std::make_shared<Model>(
+						meshPtr,
+						material >= 0 && material < static_cast<int>(sceneMaterials.size())
+							? sceneMaterials[material]
+							: defaultMaterial));
+					numTriangles += meshPtr->triangleIndices().size();
+				}
+			}
+
+			const Json& children = node["children"];
+			for (size_t i = 0; i < children.size(); i++)
+				addNode(children[i].integer(), matrix, depth + 1);
+		};
+
+	const Json& scenes = json["scenes"];
+	const Json& roots = scenes[json["scene"].integer(0)]["nodes"];
+	if (!roots.isNull()) {
+		for (size_t i = 0; i < roots.size(); i++)
+			addNode(roots[i].integer(), glm::mat4(1.f), 0);
+	} else {
+		// No scene: every node that is nobody's child is a root
+		std::vector<char> isChild(json["nodes"].size(), 0);
+		for (size_t i = 0; i < json["nodes"].size(); i++) {
+			const Json& children = json["nodes"][i]["children"];
+			for (size_t j = 0; j < children.size(); j++)
+				if (children[j].integer() < static_cast<int>(isChild.size()))
+					isChild[children[j].integer()] = 1;
+		}
+		for (size_t i = 0; i < isChild.size(); i++)
+			if (!isChild[i]) addNode(static_cast<int>(i), glm::mat4(1.f), 0);
+	}
+
+	auto after = std::chrono::high_resolution_clock::now();
+	std::cout << "Scene <" + filename + "> loaded, " << scenePtr->numOfModels()
+			  << " models, " << numTriangles << " triangles in "
+			  << std::chrono::duration_cast<std::chrono::milliseconds>(
+					 after - before)
+					 .count()
+			  << "ms\n";
 }
 
 std::string IO::file2String(const std::string& filename) {
@@ -1,12 +1,12 @@
 #include "core/Light.h"
-#include "core/ShaderProgram.h"
 
-void DirectionalLight::setUniforms(ShaderProgram& program,
-								   std::string name) const {
-	program.set(name + ".type", 0);
-	program.set(name + ".color", _color);
-	program.set(name + ".intensity", _intensity);
-	program.set(name + ".direction", _direction);
+LightBlock DirectionalLight::uniformBlock() const {
+	LightBlock block = {};
+	block.type = 0;
+	block.color = _color;
+	block.intensity = _intensity;
+	block.direction = _direction;
+	return block;
 }
 
 void DirectionalLight::setDirection(const glm::vec3& direction) {
@@ -18,16 +18,16 @@ void DirectionalLight::setDirection(const glm::vec3& direction) {
 	setRotation(glm::eulerAngles(glm::quat(rotationMatrix)));
 }
 
-void PointLight::setUniforms(ShaderProgram& program, std::string name) const {
-	glm::vec3 origin = getTranslation();
-
-	program.set(name + ".type", 1);
-	program.set(name + ".color", _color);
-	program.set(name + ".intensity", _intensity);
-	program.set(name + ".direction", origin);
-	program.set(name + ".ac", ac);
-	program.set(name + ".al", al);
-	program.set(name + ".aq", aq);
+LightBlock PointLight::uniformBlock() const {
+	LightBlock block = {};
+	block.type = 1;
+	block.color = _color;
+	block.intensity = _intensity;
+	block.direction = getTranslation();
+	block.ac = ac;
+	block.al = al;
+	block.aq = aq;
+	return block;
 }
 
 float PointLight::intensity(glm::vec3 pos) const {
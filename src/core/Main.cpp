@@ -13,6 +13,8 @@
 #include <algorithm>
 #include <exception>
 #include <filesystem>
+#include <functional>
+#include <limits>
 
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
@@ -32,6 +34,9 @@
 #include "renderers/GPURaytracer.h"
 #include "core/Camera.h"
 #include "core/Texture.h"
+#include "core/Model.h"
+#include "core/Mesh.h"
+#include "core/ShaderProgram.h"
 
 #include "editor/UIManager.h"
 #include "editor/SceneEditor.h"
@@ -41,6 +46,8 @@
 
 #include "core/Light.h"
 
+#include "utils/JobSystem.h"
+
 using namespace std;
 
 // Global handles
@@ -52,6 +59,9 @@ static std::shared_ptr<GPU_Raytracer> gpuRaytracerPtr;
 
 static std::shared_ptr<UIManager> uiManager;
 
+static std::shared_ptr<JobSystem> jobSystemPtr;
+static const double UPLOAD_BUDGET_MS = 8.0;	 // Main-thread jobs per frame
+
 // Camera control variables
 static glm::vec3 center = glm::vec3(0.0);
 static float meshScale = 1.0;
@@ -64,6 +74,7 @@ static glm::vec3 baseTrans(0.0);
 static glm::vec3 baseRot(0.0);
 
 static std::string basePath;
+static std::string scenePath;  // glTF scene given on the command line
 
 static int rendererID(
 	0);	 // 0: rasterization, 1: ray tracing, 2: GPU ray tracing
@@ -104,8 +115,8 @@ void keyCallback(GLFWwindow* windowPtr, int key, int scancode, int action,
 				windowPtr,
 				true);	// Closes the application if the escape key is pressed
 		} else if (action == GLFW_PRESS && key == GLFW_KEY_F12) {
-			rasterizerPtr->loadShaderProgram(basePath);
-			gpuRaytracerPtr->loadShaderProgram(basePath);
+			rasterizerPtr->loadShaderProgram(basePath, true);
+			gpuRaytracerPtr->loadShaderProgram(basePath, true);
 		} else if (action == GLFW_PRESS && key == GLFW_KEY_F) {
 			scenePtr->camera()->setFoV(
 				std::max(5.f, scenePtr->camera()->getFoV() - 5.f));
@@ -217,34 +228,163 @@ void initGLFW() {
 	glfwSetScrollCallback(windowPtr, scroll_callback);
 }
 
-std::shared_ptr<Mesh> loadMesh(std::string path, Material mat) {
+// Reports an error from a worker thread, like the other critical errors
+void reportCriticalError(const std::string& message) {
+	jobSystemPtr->submitOnMainThread([message] { exitOnCriticalError(message); });
+}
+
+// Builds the BVH and the LODs of a loaded mesh on a worker thread, then places
+// the model, adds it to the scene and uploads it on the main thread
+JobSystem::JobHandle publishModel(
+	std::shared_ptr<Model> model, JobSystem::JobHandle loaded,
+	std::function<void()> place = nullptr,
+	const std::vector<JobSystem::JobHandle>& placeDependencies = {}) {
+	auto meshPtr = model->mesh();
+	auto bvhBuilt = jobSystemPtr->submit(
+		[meshPtr] {
+			meshPtr->recomputeBVH(meshPtr);
+			// Keep the UVs that come with the file
+			if (meshPtr->vertexUVs().empty())
+				meshPtr->recomputeUVs(glm::vec2(1.0));
+			meshPtr->recomputeLODs();
+		},
+		{loaded});
+
+	std::vector<JobSystem::JobHandle> dependencies = placeDependencies;
+	dependencies.push_back(bvhBuilt);
+	return jobSystemPtr->submitOnMainThread(
+		[model, place] {
+			if (place) place();
+			scenePtr->add(model);
+			rasterizerPtr->uploadNewModels(scenePtr);
+		},
+		dependencies);
+}
+
+JobSystem::JobHandle loadMesh(
+	std::string path, Material mat, std::function<void(Mesh&)> place = nullptr,
+	const std::vector<JobSystem::JobHandle>& placeDependencies = {}) {
 	auto meshPtr = std::make_shared<Mesh>();
-	try {
-		IO::loadOFF(basePath + path, meshPtr);
-	} catch (std::exception& e) {
-		exitOnCriticalError(std::string("[Error loading mesh]") + e.what());
-	}
+	auto loaded = jobSystemPtr->submit([meshPtr, path] {
+		try {
+			if (std::filesystem::path(path).extension() == ".ply")
+				IO::loadPLY(basePath + path, meshPtr);
+			else
+				IO::loadOFF(basePath + path, meshPtr);
+		} catch (std::exception& e) {
+			reportCriticalError(std::string("[Error loading mesh]") + e.what());
+			throw;
+		}
+	});
+
+	return publishModel(
+		std::make_shared<Model>(meshPtr, mat), loaded,
+		[meshPtr, place] {
+			if (place) place(*meshPtr);
+		},
+		placeDependencies);
+}
+
+// Decodes the textures on worker threads, and uploads them together, in
+// order, since materials refer to them by index
+JobSystem::JobHandle loadTextures(
+	const std::vector<std::pair<std::string, bool>>& files) {
+	auto pixels = std::make_shared<std::vector<TexturePixels>>(files.size());
+	std::vector<JobSystem::JobHandle> decoded;
+	for (size_t i = 0; i < files.size(); i++)
+		decoded.push_back(jobSystemPtr->submit(
+			[pixels, files, i] { (*pixels)[i].load(files[i].first); }));
+
+	return jobSystemPtr->submitOnMainThread(
+		[pixels, files] {
+			for (size_t i = 0; i < files.size(); i++) {
+				if ((*pixels)[i].data.empty())
+					exitOnCriticalError("Couldn't load " + files[i].first);
+				scenePtr->add(
+					std::make_shared<Texture>((*pixels)[i], files[i].second));
+			}
+		},
+		decoded);
+}
+
+void initLights() {
+	scenePtr->add(std::make_shared<DirectionalLight>(
+		glm::vec3(0.7f, 0.9f, 0.9f), 4.0f,
+		glm::normalize(glm::vec3(0.04f, -0.544f, -0.838f))));
 
-	scenePtr->add(std::make_shared<Model>(meshPtr, mat));
+	glm::vec3 pos1 =
+		center + 1.5f * meshScale * glm::normalize(glm::vec3(-1, 0.5, 0.5));
+	glm::vec3 pos2 =
+		center + 1.5f * meshScale * glm::normalize(glm::vec3(1, 0.5, -0.1));
+	glm::vec3 pos3 =
+		center + 1.5f * meshScale * glm::normalize(glm::vec3(0.2, 0, -1));
 
-	return meshPtr;
+	scenePtr->add(std::make_shared<PointLight>(glm::vec3(1.0f, 0.5f, 0.5f),
+											   4.0f, pos1, 1.0f, 0.0f, 0.2f));
+	scenePtr->add(std::make_shared<PointLight>(glm::vec3(0.5f, 1.0f, 0.5f),
+											   4.0f, pos2, 1.0f, 0.0f, 0.2f));
+	scenePtr->add(std::make_shared<PointLight>(glm::vec3(0.8f, 0.5f, 1.0f),
+											   4.0f, pos3, 1.0f, 0.0f, 0.2f));
 }
 
-void initScene() {
-	scenePtr = std::make_shared<Scene>();
-	scenePtr->setBackgroundColor(glm::vec3(0.1, 0.8, 0.9));
+// Places the camera and the lights around the scene, once its layout is known
+void frameScene() {
+	auto cameraPtr = scenePtr->camera();
+	cameraPtr->setTranslation(center + glm::vec3(0.0, 0.0, 3.0 * meshScale));
+	cameraPtr->setFar(100.f * meshScale);
+	initLights();
+}
+
+void loadScene(std::string path) {
+	// The glTF loader creates textures, so it runs on the main thread. The
+	// models go through a staging scene until their BVH is built.
+	jobSystemPtr->submitOnMainThread([path] {
+		auto stagingScenePtr = std::make_shared<Scene>();
+		try {
+			IO::loadGLTF(path, stagingScenePtr);
+		} catch (std::exception& e) {
+			exitOnCriticalError(std::string("[Error loading scene]") +
+								e.what());
+		}
+		for (size_t i = 0; i < stagingScenePtr->numOfTextures(); i++)
+			scenePtr->add(stagingScenePtr->texture(i));
+
+		// Frame the whole scene
+		glm::vec3 minCorner(std::numeric_limits<float>::max());
+		glm::vec3 maxCorner(std::numeric_limits<float>::lowest());
+		for (size_t i = 0; i < stagingScenePtr->numOfModels(); i++) {
+			auto meshPtr = stagingScenePtr->model(i)->mesh();
+			glm::mat4 transform = meshPtr->getTransformMatrix();
+			for (const auto& p : meshPtr->vertexPositions()) {
+				glm::vec3 q = glm::vec3(transform * glm::vec4(p, 1.f));
+				minCorner = glm::min(minCorner, q);
+				maxCorner = glm::max(maxCorner, q);
+			}
+		}
+		if (stagingScenePtr->numOfModels() > 0) {
+			center = 0.5f * (minCorner + maxCorner);
+			meshScale =
+				std::max(0.5f * glm::length(maxCorner - minCorner), 1e-3f);
+		}
+		frameScene();
+
+		for (size_t i = 0; i < stagingScenePtr->numOfModels(); i++)
+			publishModel(stagingScenePtr->model(i), nullptr);
+	});
+}
 
+void initDefaultScene() {
 	// Textures
 
 	std::string matName = "Chesterfield";
 	std::string matPath = basePath + "Resources/Materials/" + matName + "/";
 
-	scenePtr->add(std::make_shared<Texture>(matPath + "Base_Color.png", true));
-	scenePtr->add(std::make_shared<Texture>(matPath + "Metallic.png"));
-	scenePtr->add(std::make_shared<Texture>(matPath + "Roughness.png"));
-	scenePtr->add(std::make_shared<Texture>(matPath + "Ambient_Occlusion.png"));
-	scenePtr->add(std::make_shared<Texture>(matPath + "Normal.png"));
-	scenePtr->add(std::make_shared<Texture>(matPath + "Height.png"));
+	auto texturesLoaded = loadTextures({{matPath + "Base_Color.png", true},
+										{matPath + "Metallic.png", false},
+										{matPath + "Roughness.png", false},
+										{matPath + "Ambient_Occlusion.png", false},
+										{matPath + "Normal.png", false},
+										{matPath + "Height.png", false}});
 
 	// Mesh
 
@@ -260,53 +400,50 @@ void initScene() {
 
 	goldMat.heightMult() = 0.1f;
 
-	auto sphereMeshPtr = loadMesh("Resources/Models/sphere_.off", goldMat);
-	sphereMeshPtr->computeBoundingSphere(center, meshScale);
-	sphereMeshPtr->setTranslation(glm::vec3(1.0f, 0, 0) * meshScale);
+	// The rest of the scene is laid out around the sphere
+	auto spherePublished = loadMesh(
+		"Resources/Models/sphere_.off", goldMat,
+		[](Mesh& sphereMesh) {
+			sphereMesh.computeBoundingSphere(center, meshScale);
+			sphereMesh.setTranslation(glm::vec3(1.0f, 0, 0) * meshScale);
+			frameScene();
+		},
+		{texturesLoaded});
 
 	Material glassMat(glm::vec3(1.0f), 0.1f, 1.0f, glm::vec3(1.0, 1.0, 1.0),
 					  true, 0.04f, 1.3f);
 
-	auto denisMeshPtr = loadMesh("Resources/Models/denis.off", glassMat);
-	glm::vec3 denisCenter;
-	float denisScale;
-	denisMeshPtr->computeBoundingSphere(denisCenter, denisScale);
-	denisMeshPtr->setScale(meshScale / denisScale);
-	denisMeshPtr->setTranslation(glm::vec3(-1.0f, 0, 0) * meshScale);
+	loadMesh(
+		"Resources/Models/denis.off", glassMat,
+		[](Mesh& denisMesh) {
+			glm::vec3 denisCenter;
+			float denisScale;
+			denisMesh.computeBoundingSphere(denisCenter, denisScale);
+			denisMesh.setScale(meshScale / denisScale);
+			denisMesh.setTranslation(glm::vec3(-1.0f, 0, 0) * meshScale);
+		},
+		{spherePublished});
 
 	Material groundMat = {glm::vec3(1.0f), 0.5f, 0.1f,
 						  glm::vec3(1.0, 1.0, 1.0)};
 
-	auto planeMeshPtr = loadMesh("Resources/Models/plane.off", groundMat);
-	planeMeshPtr->setTranslation(glm::vec3(0.0f, -meshScale, 0.0f));
-	planeMeshPtr->setScale(10.0f * meshScale);
-
-	scenePtr->recomputeBVHs();
-
-	// Lights
-
-	scenePtr->add(std::make_shared<DirectionalLight>(
-		glm::vec3(0.7f, 0.9f, 0.9f), 4.0f,
-		glm::normalize(glm::vec3(0.04f, -0.544f, -0.838f))));
-
-	glm::vec3 pos1 =
-		center + 1.5f * meshScale * glm::normalize(glm::vec3(-1, 0.5, 0.5));
-	glm::vec3 pos2 =
-		center + 1.5f * meshScale * glm::normalize(glm::vec3(1, 0.5, -0.1));
-	glm::vec3 pos3 =
-		center + 1.5f * meshScale * glm::normalize(glm::vec3(0.2, 0, -1));
+	loadMesh(
+		"Resources/Models/plane.off", groundMat,
+		[](Mesh& planeMesh) {
+			planeMesh.setTranslation(glm::vec3(0.0f, -meshScale, 0.0f));
+			planeMesh.setScale(10.0f * meshScale);
+		},
+		{spherePublished});
+}
 
-	scenePtr->add(std::make_shared<PointLight>(glm::vec3(1.0f, 0.5f, 0.5f),
-											   4.0f, pos1, 1.0f, 0.0f, 0.2f));
-	scenePtr->add(std::make_shared<PointLight>(glm::vec3(0.5f, 1.0f, 0.5f),
-											   4.0f, pos2, 1.0f, 0.0f, 0.2f));
-	scenePtr->add(std::make_shared<PointLight>(glm::vec3(0.8f, 0.5f, 1.0f),
-											   4.0f, pos3, 1.0f, 0.0f, 0.2f));
+void initScene() {
+	scenePtr = std::make_shared<Scene>();
+	scenePtr->setBackgroundColor(glm::vec3(0.1, 0.8, 0.9));
 
 	scenePtr->set(
 		ImageParameters{true, true, true, true, 0.4f, true, false, 10});
 
-	// Camera
+	// Camera, moved by frameScene() once the scene layout is known
 	int width, height;
 	glfwGetWindowSize(windowPtr, &width, &height);
 	auto cameraPtr = std::make_shared<Camera>();
@@ -316,6 +453,12 @@ void initScene() {
 	cameraPtr->setNear(0.1f);
 	cameraPtr->setFar(100.f * meshScale);
 	scenePtr->set(cameraPtr);
+
+	// Assets stream in while the first frames are rendered
+	if (scenePath.empty())
+		initDefaultScene();
+	else
+		loadScene(scenePath);
 }
 
 void init() {
@@ -327,7 +470,9 @@ void init() {
 	glEnable(GL_DEBUG_OUTPUT);
 	glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
 	glDebugMessageCallback(debugMessageCallback, nullptr);
+	ShaderProgram::BINARY_CACHE_PATH = basePath + "/" + SHADER_CACHE_PATH;
 
+	jobSystemPtr = make_shared<JobSystem>();
 	initScene();
 
 	glfwSwapInterval(0);
@@ -339,7 +484,7 @@ void init() {
 	rayTracerPtr->init(scenePtr);
 
 	gpuRaytracerPtr = make_shared<GPU_Raytracer>();
-	gpuRaytracerPtr->init(basePath, scenePtr);
+	gpuRaytracerPtr->init(basePath, scenePtr, rasterizerPtr);
 
 	uiManager = make_shared<UIManager>();
 	uiManager->init(windowPtr);
@@ -347,10 +492,13 @@ void init() {
 	uiManager->add(std::make_shared<SceneEditor>(scenePtr));
 	uiManager->add(std::make_shared<LightsEditor>(scenePtr, center, meshScale));
 	uiManager->add(std::make_shared<RenderingEditor>(scenePtr, rayTracerPtr));
-	uiManager->add(std::make_shared<DebugEditor>(scenePtr, rasterizerPtr));
+	uiManager->add(std::make_shared<DebugEditor>(scenePtr, rasterizerPtr,
+												  gpuRaytracerPtr));
 }
 
 void clear() {
+	jobSystemPtr.reset();
+
 	glfwDestroyWindow(windowPtr);
 	glfwTerminate();
 
@@ -366,6 +514,7 @@ void render() {
 		gpuRaytracerPtr->render(scenePtr);
 		rasterizerPtr->renderDebug(scenePtr);
 	}
+	if (rendererID != 2) gpuRaytracerPtr->skipFrame();
 
 	uiManager->renderUIs();
 }
@@ -393,9 +542,11 @@ void update(float currentTime) {
 
 int main(int argc, char** argv) {
 	basePath = "../";
+	if (argc > 1) scenePath = argv[1];
 	init();
 	while (!glfwWindowShouldClose(windowPtr)) {
 		update(static_cast<float>(glfwGetTime()));
+		jobSystemPtr->runMainThreadJobs(UPLOAD_BUDGET_MS);
 		render();
 		glfwSwapBuffers(windowPtr);
 		glfwPollEvents();
@@ -0,0 +1,85 @@
+#include "core/MappedFile.h"
+
+#include <ios>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& filename) {
+	m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+						 nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+						 nullptr);
+	if (m_file == INVALID_HANDLE_VALUE) {
+		m_file = nullptr;
+		throw std::ios_base::failure("[MappedFile] Cannot open " + filename);
+	}
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(m_file, &size);
+	m_size = static_cast<size_t>(size.QuadPart);
+	if (m_size == 0) return;
+
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0,
+								   nullptr);
+	if (m_mapping)
+		m_data = static_cast<const char*>(
+			MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!m_data) {
+		if (m_mapping) CloseHandle(m_mapping);
+		CloseHandle(m_file);
+		m_mapping = nullptr;
+		m_file = nullptr;
+		throw std::ios_base::failure("[MappedFile] Cannot map " + filename);
+	}
+}
+
+MappedFile::~MappedFile() {
+	if (m_data) UnmapViewOfFile(m_data);
+	if (m_mapping) CloseHandle(m_mapping);
+	if (m_file) CloseHandle(m_file);
+	m_data = nullptr;
+	m_mapping = nullptr;
+	m_file = nullptr;
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& filename) {
+	m_fd = open(filename.c_str(), O_RDONLY);
+	if (m_fd < 0)
+		throw std::ios_base::failure("[MappedFile] Cannot open " + filename);
+
+	struct stat st;
+	fstat(m_fd, &st);
+	m_size = static_cast<size_t>(st.st_size);
+	if (m_size == 0) return;
+
+	void* ptr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+	if (ptr == MAP_FAILED) {
+		close(m_fd);
+		m_fd = -1;
+		throw std::ios_base::failure("[MappedFile] Cannot map " + filename);
+	}
+	// The loaders touch every page anyway, start reading ahead right away
+	madvise(ptr, m_size, MADV_WILLNEED);
+	m_data = static_cast<const char*>(ptr);
+}
+
+MappedFile::~MappedFile() {
+	if (m_data) munmap(const_cast<char*>(m_data), m_size);
+	if (m_fd >= 0) close(m_fd);
+	m_data = nullptr;
+	m_fd = -1;
+}
+
+#endif
\ No newline at end of file
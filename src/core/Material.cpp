@@ -1,23 +1,24 @@
 #include "core/Material.h"
-#include "core/ShaderProgram.h"
 
-void Material::setUniforms(ShaderProgram& program, std::string name) const {
-	program.set(name + ".albedo", _albedo);
-	program.set(name + ".roughness", _roughness);
-	program.set(name + ".metalness", _metalness);
-	program.set(name + ".F0", _F0);
+MaterialBlock Material::uniformBlock() const {
+	MaterialBlock block = {};
+	block.albedo = _albedo;
+	block.roughness = _roughness;
+	block.metalness = _metalness;
+	block.F0 = _F0;
 
-	program.set(name + ".transparent", _transparent);
-	program.set(name + ".base_reflectance", _base_reflectance);
-	program.set(name + ".ior", _ior);
-	program.set(name + ".absorption", _absorption);
+	block.transparent = _transparent;
+	block.base_reflectance = _base_reflectance;
+	block.ior = _ior;
+	block.absorption = _absorption;
 
-	program.set(name + ".albedoTex", _albedoTex);
-	program.set(name + ".roughnessTex", _roughnessTex);
-	program.set(name + ".metalnessTex", _metalnessTex);
-	program.set(name + ".aoTex", _aoTex);
+	block.albedoTex = _albedoTex;
+	block.roughnessTex = _roughnessTex;
+	block.metalnessTex = _metalnessTex;
+	block.aoTex = _aoTex;
 
-	program.set(name + ".normalTex", _normalTex);
-	program.set(name + ".heightTex", _heightTex);
-	program.set(name + ".heightMult", _heightMult);
+	block.normalTex = _normalTex;
+	block.heightTex = _heightTex;
+	block.heightMult = _heightMult;
+	return block;
 }
\ No newline at end of file
@@ -3,12 +3,19 @@
 #include "core/Mesh.h"
 #include "acceleration/BVH.h"
 #include "primitives/AABB.h"
+#include "utils/MeshOptimizer.h"
 
 #include <cmath>
 #include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <limits>
 
 using namespace std;
 
+bool Mesh::OPTIMIZE_BVH = false;
+bool Mesh::OPTIMIZE_FOR_RASTERIZATION = true;
+
 Mesh::~Mesh() { clear(); }
 
 void Mesh::computeBoundingSphere(glm::vec3& center, float& radius) const {
@@ -20,35 +27,180 @@ void Mesh::computeBoundingSphere(glm::vec3& center, float& radius) const {
 		radius = std::max(radius, distance(center, p));
 }
 
+void Mesh::recomputeAdjacency() {
+	const size_t numVertices = m_vertexPositions.size();
+	m_vertexTriangleOffsets.assign(numVertices + 1, 0);
+	m_vertexTriangles.resize(3 * m_triangleIndices.size());
+
+	// Counting sort of the triangle corners by vertex
+	for (const auto& t : m_triangleIndices)
+		for (int k = 0; k < 3; k++) m_vertexTriangleOffsets[t[k] + 1]++;
+	for (size_t v = 0; v < numVertices; v++)
+		m_vertexTriangleOffsets[v + 1] += m_vertexTriangleOffsets[v];
+
+	std::vector<unsigned int> next(m_vertexTriangleOffsets.begin(),
+								   m_vertexTriangleOffsets.end() - 1);
+	for (size_t i = 0; i < m_triangleIndices.size(); i++)
+		for (int k = 0; k < 3; k++)
+			m_vertexTriangles[next[m_triangleIndices[i][k]]++] =
+				static_cast<unsigned int>(i);
+	m_adjacencyDirty = false;
+}
+
+void Mesh::updateAdjacency() {
+	// The sizes also catch edits that did not call geometryChanged()
+	if (m_adjacencyDirty ||
+		m_vertexTriangleOffsets.size() != m_vertexPositions.size() + 1 ||
+		m_vertexTriangles.size() != 3 * m_triangleIndices.size())
+		recomputeAdjacency();
+}
+
+namespace {
+
+// Angle of triangle t at each of its corners
+glm::vec3 cornerAngles(const glm::uvec3& t,
+					   const std::vector<glm::vec3>& positions) {
+	glm::vec3 e[3];
+	float length[3];
+	for (int k = 0; k < 3; k++) {
+		e[k] = positions[t[(k + 1) % 3]] - positions[t[k]];
+		length[k] = glm::length(e[k]);
+	}
+	if (length[0] == 0.f || length[1] == 0.f || length[2] == 0.f)
+		return glm::vec3(0.f);
+
+	// The angles add up to pi, which saves an acos
+	float a0 = std::acos(glm::clamp(
+		-glm::dot(e[0], e[2]) / (length[0] * length[2]), -1.f, 1.f));
+	float a1 = std::acos(glm::clamp(
+		-glm::dot(e[1], e[0]) / (length[1] * length[0]), -1.f, 1.f));
+	return glm::vec3(a0, a1, std::max(0.f, float(M_PI) - a0 - a1));
+}
+
+inline int cornerOf(const glm::uvec3& t, unsigned int v) {
+	return t[0] == v ? 0 : (t[1] == v ? 1 : 2);
+}
+
+// Any unit vector orthogonal to n
+inline glm::vec3 orthogonal(const glm::vec3& n) {
+	glm::vec3 axis = std::abs(n.y) < 0.99f ? glm::vec3(0.0, 1.0, 0.0)
+										   : glm::vec3(1.0, 0.0, 0.0);
+	return glm::normalize(glm::cross(axis, n));
+}
+
+}  // namespace
+
 void Mesh::recomputePerVertexNormals(bool angleBased) {
-	m_vertexNormals.clear();
-	m_vertexNormals.resize(m_vertexPositions.size(), glm::vec3(0.0, 0.0, 0.0));
-	for (auto& t : m_triangleIndices) {
+	updateAdjacency();
+	const long long numTriangles = static_cast<long long>(m_triangleIndices.size());
+	const long long numVertices = static_cast<long long>(m_vertexPositions.size());
+
+	// The cross product is already weighted by twice the triangle area
+	std::vector<glm::vec3> faceNormals(numTriangles);
+	std::vector<glm::vec3> faceAngles(angleBased ? numTriangles : 0);
+#pragma omp parallel for
+	for (long long i = 0; i < numTriangles; i++) {
+		const glm::uvec3& t = m_triangleIndices[i];
 		glm::vec3 e0(m_vertexPositions[t[1]] - m_vertexPositions[t[0]]);
 		glm::vec3 e1(m_vertexPositions[t[2]] - m_vertexPositions[t[0]]);
-		glm::vec3 n = normalize(cross(e0, e1));
-		for (size_t i = 0; i < 3; i++)
-			m_vertexNormals[t[glm::vec3::length_type(i)]] += n;
+		faceNormals[i] = cross(e0, e1);
+		if (angleBased) {
+			float length = glm::length(faceNormals[i]);
+			if (length > 0.f) faceNormals[i] /= length;
+			faceAngles[i] = cornerAngles(t, m_vertexPositions);
+		}
+	}
+
+	// Each vertex gathers from its own triangles, no write conflicts
+	m_vertexNormals.resize(numVertices);
+#pragma omp parallel for
+	for (long long v = 0; v < numVertices; v++) {
+		glm::vec3 n(0.0);
+		for (unsigned int j = m_vertexTriangleOffsets[v];
+			 j < m_vertexTriangleOffsets[v + 1]; j++) {
+			unsigned int i = m_vertexTriangles[j];
+			float weight =
+				angleBased ? faceAngles[i][cornerOf(m_triangleIndices[i],
+													static_cast<unsigned int>(v))]
+						   : 1.f;
+			n += weight * faceNormals[i];
+		}
+		float length = glm::length(n);
+		m_vertexNormals[v] = length > 0.f ? n / length : glm::vec3(0.0, 0.0, 1.0);
 	}
-	for (auto& n : m_vertexNormals) n = normalize(n);
 
 	recomputeTangentSpace();
 }
 
 void Mesh::recomputeTangentSpace() {
-	m_vertexTangents.resize(m_vertexNormals.size(), glm::vec3(0.0, 0.0, 0.0));
-	m_vertexBitangents.resize(m_vertexNormals.size(), glm::vec3(0.0, 0.0, 0.0));
+	const long long numTriangles = static_cast<long long>(m_triangleIndices.size());
+	const long long numVertices = static_cast<long long>(m_vertexNormals.size());
+	m_vertexTangents.resize(numVertices);
+	m_vertexBitangents.resize(numVertices);
+
+	bool hasUVs = m_vertexUVs.size() == m_vertexPositions.size() &&
+				  m_vertexNormals.size() == m_vertexPositions.size();
+	if (!hasUVs) {
+		// No parametrization to follow, any frame around the normal will do
+#pragma omp parallel for
+		for (long long v = 0; v < numVertices; v++) {
+			m_vertexTangents[v] = orthogonal(m_vertexNormals[v]);
+			m_vertexBitangents[v] =
+				glm::normalize(glm::cross(m_vertexNormals[v], m_vertexTangents[v]));
+		}
+		return;
+	}
+	updateAdjacency();
 
-	for (int i = 0; i < m_vertexNormals.size(); i++) {
-		glm::vec3 normal = m_vertexNormals[i];
-		glm::vec3 bitangent = glm::vec3(0.0, 1.0, 0.0);
+	// Derivatives of the position with respect to u and v, per triangle
+	std::vector<glm::vec3> faceTangents(numTriangles);
+	std::vector<glm::vec3> faceBitangents(numTriangles);
+	std::vector<glm::vec3> faceAngles(numTriangles);
+#pragma omp parallel for
+	for (long long i = 0; i < numTriangles; i++) {
+		const glm::uvec3& t = m_triangleIndices[i];
+		glm::vec3 e0 = m_vertexPositions[t[1]] - m_vertexPositions[t[0]];
+		glm::vec3 e1 = m_vertexPositions[t[2]] - m_vertexPositions[t[0]];
+		glm::vec2 d0 = m_vertexUVs[t[1]] - m_vertexUVs[t[0]];
+		glm::vec2 d1 = m_vertexUVs[t[2]] - m_vertexUVs[t[0]];
+		float det = d0.x * d1.y - d1.x * d0.y;
+		faceAngles[i] = cornerAngles(t, m_vertexPositions);
+		// Degenerate (or NaN) UVs: the triangle does not vote
+		if (!(std::abs(det) > 1e-20f)) {
+			faceTangents[i] = faceBitangents[i] = glm::vec3(0.0);
+			continue;
+		}
+		faceTangents[i] = (e0 * d1.y - e1 * d0.y) / det;
+		faceBitangents[i] = (e1 * d0.x - e0 * d1.x) / det;
+	}
 
-		glm::vec3 tangent = glm::normalize(glm::cross(bitangent, normal));
-		bitangent = glm::normalize(glm::cross(normal, tangent));
+#pragma omp parallel for
+	for (long long v = 0; v < numVertices; v++) {
+		const glm::vec3& n = m_vertexNormals[v];
+		glm::vec3 tangent(0.0), bitangent(0.0);
+		for (unsigned int j = m_vertexTriangleOffsets[v];
+			 j < m_vertexTriangleOffsets[v + 1]; j++) {
+			unsigned int i = m_vertexTriangles[j];
+			float weight = faceAngles[i][cornerOf(m_triangleIndices[i],
+												  static_cast<unsigned int>(v))];
+			// Projected on the tangent plane and normalized before averaging,
+			// so that large or stretched triangles do not dominate
+			glm::vec3 t = faceTangents[i] - n * glm::dot(n, faceTangents[i]);
+			float length = glm::length(t);
+			if (length > 0.f) tangent += weight * t / length;
+			bitangent += weight * faceBitangents[i];
+		}
 
-		m_vertexTangents[i] = tangent;
-		m_vertexBitangents[i] = bitangent;
+		tangent -= n * glm::dot(n, tangent);
+		float length = glm::length(tangent);
+		tangent = length > 1e-12f ? tangent / length : orthogonal(n);
+		float handedness =
+			glm::dot(glm::cross(n, tangent), bitangent) < 0.f ? -1.f : 1.f;
+		m_vertexTangents[v] = tangent;
+		m_vertexBitangents[v] = handedness * glm::cross(n, tangent);
 	}
+	// Same triangles, the adjacency stays valid
+	m_geometryVersion = nextVersion();
 }
 
 void Mesh::recomputeUVs(glm::vec2 scale) {
@@ -66,11 +218,124 @@ void Mesh::recomputeUVs(glm::vec2 scale) {
 
 		m_vertexUVs[i] = uv;
 	}
+
+	recomputeTangentSpace();
 }
 
 void Mesh::recomputeBVH(std::shared_ptr<Mesh> meshPtr) {
 	m_bvh = make_shared<BVH>(meshPtr);
 	m_bvh->build();
+	if (OPTIMIZE_BVH) m_bvh->optimize();
+	if (OPTIMIZE_FOR_RASTERIZATION) optimizeForRasterization();
+	// The build reorders the triangles
+	geometryChanged();
+}
+
+namespace {
+
+constexpr size_t MIN_LOD_TRIANGLES = 128;
+
+// Orders the triangles for the rasterizer, without constraint
+void optimizeTriangleOrder(vector<glm::uvec3>& triangles,
+						   const vector<glm::vec3>& positions) {
+	vector<unsigned int> order =
+		optimizeVertexCache(triangles, positions.size());
+	optimizeOverdraw(triangles, positions, order);
+
+	vector<glm::uvec3> sorted(triangles.size());
+	for (size_t i = 0; i < order.size(); i++) sorted[i] = triangles[order[i]];
+	triangles.swap(sorted);
+}
+
+template <typename T>
+void remapVertexAttribute(vector<T>& attribute,
+						  const vector<unsigned int>& remap) {
+	// Some attributes are only computed later
+	if (attribute.size() != remap.size()) return;
+
+	vector<T> remapped(attribute.size());
+	for (size_t v = 0; v < remap.size(); v++) remapped[remap[v]] = attribute[v];
+	attribute.swap(remapped);
+}
+
+}  // namespace
+
+void Mesh::optimizeForRasterization() {
+	auto before = chrono::high_resolution_clock::now();
+	size_t numVertices = m_vertexPositions.size();
+	float initialACMR = averageCacheMissRatio(m_triangleIndices, numVertices);
+
+	vector<unsigned int> order =
+		optimizeVertexCache(m_triangleIndices, numVertices);
+	optimizeOverdraw(m_triangleIndices, m_vertexPositions, order);
+	m_bvh->reorderTriangles(order);
+
+	// Vertices in the order of their first use for the vertex fetches, the
+	// unused ones last
+	const unsigned int UNUSED = numeric_limits<unsigned int>::max();
+	vector<unsigned int> remap(numVertices, UNUSED);
+	unsigned int next = 0;
+	for (const glm::uvec3& t : m_triangleIndices) {
+		for (int k = 0; k < 3; k++)
+			if (remap[t[k]] == UNUSED) remap[t[k]] = next++;
+	}
+	for (unsigned int& v : remap)
+		if (v == UNUSED) v = next++;
+
+	for (glm::uvec3& t : m_triangleIndices)
+		t = glm::uvec3(remap[t.x], remap[t.y], remap[t.z]);
+	for (auto& lod : m_lodTriangles) {
+		for (glm::uvec3& t : lod)
+			t = glm::uvec3(remap[t.x], remap[t.y], remap[t.z]);
+	}
+	remapVertexAttribute(m_vertexPositions, remap);
+	remapVertexAttribute(m_vertexNormals, remap);
+	remapVertexAttribute(m_vertexTangents, remap);
+	remapVertexAttribute(m_vertexBitangents, remap);
+	remapVertexAttribute(m_vertexUVs, remap);
+	geometryChanged();
+
+	auto after = chrono::high_resolution_clock::now();
+	cout << "Triangles reordered in "
+		 << chrono::duration_cast<chrono::milliseconds>(after - before).count()
+		 << "ms, ACMR " << initialACMR << " -> "
+		 << averageCacheMissRatio(m_triangleIndices, numVertices) << endl;
+}
+
+void Mesh::recomputeLODs() {
+	auto before = chrono::high_resolution_clock::now();
+	m_lodTriangles.clear();
+	m_lodErrors.clear();
+
+	// Each level is simplified from the previous one, the errors add up
+	const vector<glm::uvec3>* triangles = &m_triangleIndices;
+	float error = 0.f;
+	while (m_lodTriangles.size() < MAX_LODS) {
+		size_t target = triangles->size() / 2;
+		if (target < MIN_LOD_TRIANGLES) break;
+
+		float levelError;
+		vector<glm::uvec3> lod =
+			simplifyMesh(*triangles, m_vertexPositions, target, levelError);
+		// Mostly locked vertices, e.g. a mesh of disconnected triangles
+		if (lod.size() > target + target / 2) break;
+
+		optimizeTriangleOrder(lod, m_vertexPositions);
+		error += levelError;
+		m_lodTriangles.push_back(std::move(lod));
+		m_lodErrors.push_back(error);
+		triangles = &m_lodTriangles.back();
+	}
+
+	auto after = chrono::high_resolution_clock::now();
+	cout << m_lodTriangles.size() << " LODs computed in "
+		 << chrono::duration_cast<chrono::milliseconds>(after - before).count()
+		 << "ms, triangles:";
+	cout << " " << m_triangleIndices.size();
+	for (const auto& lod : m_lodTriangles) cout << " " << lod.size();
+	cout << endl;
+	// The levels only add triangles, the adjacency is of level 0
+	m_geometryVersion = nextVersion();
 }
 
 void Mesh::clear() {
@@ -80,5 +345,10 @@ void Mesh::clear() {
 	m_vertexTangents.clear();
 	m_vertexBitangents.clear();
 	m_triangleIndices.clear();
+	m_lodTriangles.clear();
+	m_lodErrors.clear();
+	m_vertexTriangleOffsets.clear();
+	m_vertexTriangles.clear();
 	m_bvh.reset();
-}
\ No newline at end of file
+	geometryChanged();
+}
@@ -0,0 +1,116 @@
+#include "core/PersistentBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr GLbitfield MAP_FLAGS =
+	GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+constexpr size_t MIN_CAPACITY = 256;
+
+}  // namespace
+
+PersistentBuffer::~PersistentBuffer() { clear(); }
+
+void PersistentBuffer::resize(size_t size) {
+	size_t oldSize = m_data.size();
+	m_data.resize(size, 0);
+	if (size > oldSize)
+		for (auto& ranges : m_dirtyRanges) ranges.emplace_back(oldSize, size);
+}
+
+void PersistentBuffer::write(size_t offset, const void* data, size_t size) {
+	if (size == 0) return;
+	if (offset + size > m_data.size()) m_data.resize(offset + size, 0);
+	std::memcpy(&m_data[offset], data, size);
+	for (auto& ranges : m_dirtyRanges)
+		ranges.emplace_back(offset, offset + size);
+}
+
+size_t PersistentBuffer::flush() {
+	m_region = (m_region + 1) % NUM_REGIONS;
+	if (!m_buffer || m_data.size() > m_capacity) reallocate();
+	wait(m_fences[m_region]);
+
+	// Overlapping and adjacent ranges are copied once
+	auto& ranges = m_dirtyRanges[m_region];
+	std::sort(ranges.begin(), ranges.end());
+	unsigned char* region = m_mapped + m_region * m_stride;
+	size_t numBytes = 0;
+	for (size_t i = 0; i < ranges.size();) {
+		size_t begin = ranges[i].first;
+		size_t end = ranges[i].second;
+		for (i++; i < ranges.size() && ranges[i].first <= end; i++)
+			end = std::max(end, ranges[i].second);
+		// The data may have shrunk since the range was written
+		end = std::min(end, m_data.size());
+		if (begin >= end) continue;
+		std::memcpy(region + begin, &m_data[begin], end - begin);
+		numBytes += end - begin;
+	}
+	ranges.clear();
+	return numBytes;
+}
+
+void PersistentBuffer::bind(GLuint binding) const {
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, m_buffer,
+					  m_region * m_stride, m_capacity);
+}
+
+void PersistentBuffer::fence() {
+	if (m_fences[m_region]) glDeleteSync(m_fences[m_region]);
+	m_fences[m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void PersistentBuffer::clear() {
+	for (GLsync& sync : m_fences) {
+		if (sync) glDeleteSync(sync);
+		sync = nullptr;
+	}
+	// Deleting the buffer unmaps it, the GPU may still be reading it
+	if (m_buffer) glDeleteBuffers(1, &m_buffer);
+	m_buffer = 0;
+	m_mapped = nullptr;
+	m_capacity = 0;
+	m_stride = 0;
+	m_data.clear();
+	for (auto& ranges : m_dirtyRanges) ranges.clear();
+}
+
+void PersistentBuffer::reallocate() {
+	GLint alignment = 1;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	m_capacity = std::max({m_data.size(), 2 * m_capacity, MIN_CAPACITY});
+	m_stride = (m_capacity + alignment - 1) / alignment * alignment;
+
+	for (GLsync& sync : m_fences) {
+		if (sync) glDeleteSync(sync);
+		sync = nullptr;
+	}
+	if (m_buffer) glDeleteBuffers(1, &m_buffer);
+	glGenBuffers(1, &m_buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffer);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, NUM_REGIONS * m_stride, nullptr,
+					MAP_FLAGS);
+	m_mapped = static_cast<unsigned char*>(glMapBufferRange(
+		GL_SHADER_STORAGE_BUFFER, 0, NUM_REGIONS * m_stride, MAP_FLAGS));
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	// Every region is filled from the shadow again
+	for (auto& ranges : m_dirtyRanges) {
+		ranges.clear();
+		ranges.emplace_back(0, m_data.size());
+	}
+}
+
+void PersistentBuffer::wait(GLsync& sync) {
+	if (!sync) return;
+	const GLuint64 TIMEOUT = 1000000000;  // 1 s, in ns
+	GLenum status;
+	do {
+		status = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, TIMEOUT);
+	} while (status == GL_TIMEOUT_EXPIRED);
+	glDeleteSync(sync);
+	sync = nullptr;
+}
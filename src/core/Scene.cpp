@@ -1,10 +1,29 @@
 #include "core/Scene.h"
 #include "core/Mesh.h"
 #include "core/Model.h"
+#include "core/GeometryArena.h"
+#include "acceleration/SceneBVH.h"
+
+Scene::Scene()
+	: m_backgroundColor(0.f, 0.f, 0.f),
+	  m_geometry(std::make_shared<GeometryArena>()),
+	  m_hierarchy(std::make_shared<SceneBVH>()) {}
+
+void Scene::clear() {
+	m_camera.reset();
+	m_models.clear();
+	m_lights.clear();
+	m_geometry->clear();
+	m_hierarchy->clear();
+}
 
 void Scene::recomputeBVHs() {
 	for (int i = 0; i < numOfModels(); i++) {
 		model(i)->mesh()->recomputeBVH(model(i)->mesh());
-		model(i)->mesh()->recomputeUVs(glm::vec2(1.0));
+		// Keep the UVs that come with the file
+		if (model(i)->mesh()->vertexUVs().empty())
+			model(i)->mesh()->recomputeUVs(glm::vec2(1.0));
 	}
+	// The reordered triangles are uploaded again in place by the next
+	// geometry update
 }
\ No newline at end of file
@@ -0,0 +1,57 @@
+#include "core/SceneUniforms.h"
+#include "core/Scene.h"
+#include "core/Camera.h"
+#include "core/Light.h"
+
+#include <algorithm>
+#include <cstring>
+
+SceneUniforms::SceneUniforms()
+	: m_camera(sizeof(CameraBlock)),
+	  m_image(sizeof(ImageBlock)),
+	  m_lights(sizeof(LightsBlock)) {}
+
+template <typename Block>
+bool SceneUniforms::upload(UniformBuffer& buffer, Block& uploaded,
+						   const Block& block) {
+	// The blocks have explicit padding, zeroed with the rest
+	if (m_uploaded && std::memcmp(&uploaded, &block, sizeof(Block)) == 0)
+		return false;
+	uploaded = block;
+	buffer.update(block);
+	return true;
+}
+
+bool SceneUniforms::update(Scene& scene, const glm::vec2& resolution) {
+	auto camera = scene.camera();
+	CameraBlock cameraBlock = {};
+	cameraBlock.viewMat = camera->computeViewMatrix();
+	cameraBlock.projectionMat = camera->computeProjectionMatrix();
+	cameraBlock.invViewMat = glm::inverse(cameraBlock.viewMat);
+	cameraBlock.invProjectionMat = glm::inverse(cameraBlock.projectionMat);
+	cameraBlock.eye = cameraBlock.invViewMat[3];
+	cameraBlock.zNear = camera->getNear();
+	cameraBlock.zFar = camera->getFar();
+	cameraBlock.resolution = resolution;
+	bool changed = upload(m_camera, m_cameraBlock, cameraBlock);
+
+	ImageBlock imageBlock = {};
+	imageBlock.imageParameters = scene.imageParameters().uniformBlock();
+	imageBlock.backgroundColor = scene.backgroundColor();
+	changed |= upload(m_image, m_imageBlock, imageBlock);
+
+	LightsBlock lightsBlock = {};
+	lightsBlock.numOfLights =
+		static_cast<int>(std::min<size_t>(scene.numOfLights(), MAX_LIGHTS));
+	for (int i = 0; i < lightsBlock.numOfLights; i++)
+		lightsBlock.lights[i] = scene.light(i)->uniformBlock();
+	changed |= upload(m_lights, m_lightsBlock, lightsBlock);
+	m_uploaded = true;
+	return changed;
+}
+
+void SceneUniforms::bind() const {
+	m_camera.bind(CAMERA_BLOCK_BINDING);
+	m_image.bind(IMAGE_BLOCK_BINDING);
+	m_lights.bind(LIGHTS_BLOCK_BINDING);
+}
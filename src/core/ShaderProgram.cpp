@@ -4,56 +4,288 @@
 #include <fstream>
 #include <sstream>
 
+#include <cstdint>
 #include <exception>
+#include <filesystem>
 #include <ios>
+#include <iterator>
+#include <stdexcept>
 
 #include "core/Error.h"
 #include "core/IO.h"
 
 using namespace std;
 
+std::string ShaderProgram::BINARY_CACHE_PATH = "";
+
+namespace {
+
+// Lets the driver compile on its own threads, false without the extension
+bool parallelCompile() {
+	static bool initialized = false;
+	if (!initialized) {
+		initialized = true;
+		if (GLAD_GL_KHR_parallel_shader_compile)
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		else if (GLAD_GL_ARB_parallel_shader_compile)
+			glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+	}
+	return GLAD_GL_KHR_parallel_shader_compile ||
+		   GLAD_GL_ARB_parallel_shader_compile;
+}
+
+// FNV-1a
+void hashString(uint64_t& h, const std::string& data) {
+	for (unsigned char c : data) {
+		h ^= c;
+		h *= 1099511628211ull;
+	}
+}
+
+// Replaces the #include "file" lines by the content of the file, relative to
+// the including one
+std::string readSource(const std::string& filename, int depth = 0) {
+	if (depth > 8)
+		throw std::runtime_error(
+			"[Shader Program] Error: includes nested too deeply in " + filename);
+	std::string directory = filename.substr(0, filename.find_last_of('/') + 1);
+	std::istringstream input(IO::file2String(filename));
+	std::string text, line;
+	while (std::getline(input, line)) {
+		size_t start = line.find_first_not_of(" \t");
+		if (start != std::string::npos &&
+			line.compare(start, 9, "#include ") == 0) {
+			size_t first = line.find('"', start);
+			size_t last = line.find('"', first + 1);
+			if (first == std::string::npos || last == std::string::npos)
+				throw std::runtime_error(
+					"[Shader Program] Error: bad include in " + filename);
+			text += readSource(
+				directory + line.substr(first + 1, last - first - 1),
+				depth + 1);
+		} else {
+			text += line;
+		}
+		text += '\n';
+	}
+	return text;
+}
+
+std::string glString(GLenum name) {
+	const GLubyte* str = glGetString(name);
+	return str ? reinterpret_cast<const char*>(str) : "";
+}
+
+}  // namespace
+
 ShaderProgram::ShaderProgram(const std::string& name)
 	: m_id(glCreateProgram()), m_name(name) {}
 
-ShaderProgram::~ShaderProgram() { glDeleteProgram(m_id); }
+ShaderProgram::~ShaderProgram() {
+	for (GLuint shader : m_shaders) glDeleteShader(shader);
+	glDeleteProgram(m_id);
+}
 
 void ShaderProgram::loadShader(GLenum type, const std::string& shaderFilename) {
-	GLuint shader = glCreateShader(type);
-	std::string shaderSourceString = IO::file2String(shaderFilename);
-	const GLchar* shaderSource = (const GLchar*)shaderSourceString.c_str();
-	glShaderSource(shader, 1, &shaderSource, NULL);
-	glCompileShader(shader);
-	glCheckError("Compiling Shader " + shaderFilename);
-	GLint shaderCompiled;
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &shaderCompiled);
-	if (!shaderCompiled)
-		exitOnCriticalError("Error: shader not compiled. Info. Log.:\n" +
-							shaderInfoLog(shaderFilename, shader) + "\n");
-	glAttachShader(m_id, shader);
-	glDeleteShader(shader);
-}
-
-void ShaderProgram::link() {
+	m_sources.push_back({type, shaderFilename, readSource(shaderFilename)});
+}
+
+void ShaderProgram::link(bool background) {
+	if (loadBinary()) {
+		cacheLocations();
+		return;
+	}
+
+	glProgramParameteri(m_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	bool parallel = parallelCompile();
+	// Compile and link statuses are only checked once the link is done, as
+	// checking them waits for the driver
+	for (const Source& source : m_sources) {
+		GLuint shader = glCreateShader(source.type);
+		const GLchar* text = (const GLchar*)source.text.c_str();
+		glShaderSource(shader, 1, &text, NULL);
+		glCompileShader(shader);
+		glCheckError("Compiling Shader " + source.filename);
+		glAttachShader(m_id, shader);
+		m_shaders.push_back(shader);
+	}
 	glLinkProgram(m_id);
 	glCheckError("Linking Program " + name());
+	m_linking = true;
+	if (!background || !parallel) finishLink();
+}
+
+bool ShaderProgram::ready() {
+	if (!m_linking) return true;
+	if (parallelCompile()) {
+		GLint completed = GL_FALSE;
+		glGetProgramiv(m_id, GL_COMPLETION_STATUS_KHR, &completed);
+		if (!completed) return false;
+	}
+	finishLink();
+	return true;
+}
+
+void ShaderProgram::wait() {
+	if (m_linking) finishLink();
+}
+
+void ShaderProgram::finishLink() {
+	m_linking = false;
+	std::string log;
+	for (size_t i = 0; i < m_shaders.size(); i++) {
+		GLint shaderCompiled;
+		glGetShaderiv(m_shaders[i], GL_COMPILE_STATUS, &shaderCompiled);
+		if (!shaderCompiled)
+			log += "Error: shader not compiled. Info. Log.:\n" +
+				   shaderInfoLog(m_sources[i].filename, m_shaders[i]) + "\n";
+		glDetachShader(m_id, m_shaders[i]);
+		glDeleteShader(m_shaders[i]);
+	}
+	m_shaders.clear();
+	if (!log.empty()) throw std::runtime_error(log);
+
 	GLint linked;
 	glGetProgramiv(m_id, GL_LINK_STATUS, &linked);
-	if (!linked) exitOnCriticalError("Shader program not linked: " + infoLog());
+	if (!linked)
+		throw std::runtime_error("Shader program not linked: " + infoLog());
+
+	saveBinary();
+	cacheLocations();
+}
+
+void ShaderProgram::cacheLocations() {
+	// Locations of the active uniforms, arrays also under their bare name
+	m_locations.clear();
+	GLint numUniforms = 0, maxNameLength = 0;
+	glGetProgramiv(m_id, GL_ACTIVE_UNIFORMS, &numUniforms);
+	glGetProgramiv(m_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+	std::string uniformName(maxNameLength, '\0');
+	for (GLint i = 0; i < numUniforms; i++) {
+		GLsizei length = 0;
+		glGetActiveUniformName(m_id, i, maxNameLength, &length,
+							   &uniformName[0]);
+		std::string name = uniformName.substr(0, length);
+		GLint location = glGetUniformLocation(m_id, name.c_str());
+		// Members of uniform blocks have no location
+		if (location < 0) continue;
+		m_locations[name] = location;
+		if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+			m_locations[name.substr(0, name.size() - 3)] = location;
+	}
+}
+
+std::string ShaderProgram::binaryFilename() const {
+	if (BINARY_CACHE_PATH.empty()) return "";
+	GLint numFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+	if (numFormats == 0) return "";
+
+	// A binary is only valid for the driver that compiled it
+	uint64_t h = 14695981039346656037ull;
+	hashString(h, glString(GL_VENDOR));
+	hashString(h, glString(GL_RENDERER));
+	hashString(h, glString(GL_VERSION));
+	for (const Source& source : m_sources) {
+		hashString(h, std::to_string(source.type));
+		hashString(h, source.text);
+	}
+	std::ostringstream filename;
+	filename << BINARY_CACHE_PATH << "/" << std::hex << h << ".bin";
+	return filename.str();
+}
+
+bool ShaderProgram::loadBinary() {
+	std::string filename = binaryFilename();
+	if (filename.empty()) return false;
+	ifstream input(filename, ios::binary);
+	if (!input) return false;
+
+	GLenum format = 0;
+	input.read(reinterpret_cast<char*>(&format), sizeof(GLenum));
+	if (!input) return false;
+	std::vector<char> binary((istreambuf_iterator<char>(input)),
+							 istreambuf_iterator<char>());
+	if (binary.empty()) return false;
+	glProgramBinary(m_id, format, binary.data(),
+					static_cast<GLsizei>(binary.size()));
+
+	// Rejected after a driver update, compiled again
+	GLint linked = GL_FALSE;
+	glGetProgramiv(m_id, GL_LINK_STATUS, &linked);
+	return linked;
+}
+
+void ShaderProgram::saveBinary() {
+	std::string filename = binaryFilename();
+	if (filename.empty()) return;
+	GLint length = 0;
+	glGetProgramiv(m_id, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) return;
+
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(m_id, length, nullptr, &format, binary.data());
+
+	std::error_code error;
+	filesystem::create_directories(BINARY_CACHE_PATH, error);
+	ofstream output(filename, ios::binary);
+	if (!output) {
+		cerr << "[Shader Program] Cannot write " << filename << endl;
+		return;
+	}
+	output.write(reinterpret_cast<const char*>(&format), sizeof(GLenum));
+	output.write(binary.data(), binary.size());
 }
 
 std::shared_ptr<ShaderProgram> ShaderProgram::genBasicShaderProgram(
 	const std::string& vertexShaderFilename,
-	const std::string& fragmentShaderFilename) {
+	const std::string& fragmentShaderFilename, bool background) {
 	std::string shaderProgramName = "Shader Program <" + vertexShaderFilename +
 									" - " + fragmentShaderFilename + ">";
 	std::shared_ptr<ShaderProgram> shaderProgramPtr =
 		std::make_shared<ShaderProgram>(shaderProgramName);
 	shaderProgramPtr->loadShader(GL_VERTEX_SHADER, vertexShaderFilename);
 	shaderProgramPtr->loadShader(GL_FRAGMENT_SHADER, fragmentShaderFilename);
-	shaderProgramPtr->link();
+	shaderProgramPtr->link(background);
 	return shaderProgramPtr;
 }
 
+std::shared_ptr<ShaderProgram> ShaderProgram::genComputeShaderProgram(
+	const std::string& computeShaderFilename, bool background) {
+	std::string shaderProgramName =
+		"Compute Shader Program <" + computeShaderFilename + ">";
+	std::shared_ptr<ShaderProgram> shaderProgramPtr =
+		std::make_shared<ShaderProgram>(shaderProgramName);
+	shaderProgramPtr->loadShader(GL_COMPUTE_SHADER, computeShaderFilename);
+	shaderProgramPtr->link(background);
+	return shaderProgramPtr;
+}
+
+void ShaderProgram::replaceLinked(std::vector<Replacement>& replacements,
+								  bool wait) {
+	size_t numPending = 0;
+	for (Replacement& replacement : replacements) {
+		auto& [current, next] = replacement;
+		try {
+			if (wait)
+				next->wait();
+			else if (!next->ready()) {
+				replacements[numPending++] = replacement;
+				continue;
+			}
+			*current = next;
+		} catch (std::exception& e) {
+			if (!*current)
+				exitOnCriticalError("[Error loading " + next->name() + "]" +
+									e.what());
+			cerr << "[Error reloading " << next->name() << "]" << e.what()
+				 << endl;
+		}
+	}
+	replacements.resize(numPending);
+}
+
 std::string ShaderProgram::shaderInfoLog(const std::string& shaderName,
 										 GLuint shaderId) {
 	std::string infoLogStr = "";
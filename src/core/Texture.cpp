@@ -19,6 +19,23 @@ GLuint Texture::loadTextureFromFileToGPU(const std::string& filename,
 		exitOnCriticalError("Couldn't load " + filename);
 	}
 
+	GLuint texID = uploadToGPU(data, width, height, numComponents, sRGB);
+	// Freeing the now useless CPU memory
+	stbi_image_free(data);
+	return texID;
+}
+
+bool TexturePixels::load(const std::string& filename) {
+	unsigned char* pixels =
+		stbi_load(filename.c_str(), &width, &height, &numComponents, 0);
+	if (!pixels) return false;
+	data.assign(pixels, pixels + size_t(width) * height * numComponents);
+	stbi_image_free(pixels);
+	return true;
+}
+
+GLuint Texture::uploadToGPU(const unsigned char* pixels, int width,
+							int height, int numComponents, bool sRGB) {
 	// Create a texture in GPU memory
 	GLuint texID;
 	glGenTextures(1, &texID);
@@ -29,27 +46,22 @@ GLuint Texture::loadTextureFromFileToGPU(const std::string& filename,
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
+	// Rows of 1 and 3 components images are not 4-byte aligned
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
 	// Uploading the image data to GPU memory
-	glTexImage2D(
-		GL_TEXTURE_2D, 0,
-		(numComponents == 1
-			 ? GL_RED
-			 : (numComponents == 3
-					? (sRGB ? GL_SRGB : GL_RGB)
-					: (sRGB ? GL_SRGB_ALPHA
-							: GL_RGBA))),  // We assume only greyscale, RGB and
-										   // RGBA pixels
-		width, height, 0,
-		(numComponents == 1
-			 ? GL_RED
-			 : (numComponents == 3 ? GL_RGB
-								   : GL_RGBA)),	 // We assume only greyscale,
-												 // RGB and RGBA pixels
-		GL_UNSIGNED_BYTE, data);
+	GLenum format = numComponents == 1   ? GL_RED
+					: numComponents == 2 ? GL_RG
+					: numComponents == 3 ? GL_RGB
+										 : GL_RGBA;
+	GLenum internalFormat = format;
+	if (sRGB && numComponents == 3) internalFormat = GL_SRGB;
+	if (sRGB && numComponents == 4) internalFormat = GL_SRGB_ALPHA;
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format,
+				 GL_UNSIGNED_BYTE, pixels);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 	// Generating mipmaps for filtered texture fetch
 	glGenerateMipmap(GL_TEXTURE_2D);
-	// Freeing the now useless CPU memory
-	stbi_image_free(data);
 	glBindTexture(GL_TEXTURE_2D, 0);
 	return texID;
-}
\ No newline at end of file
+}
@@ -0,0 +1,39 @@
+#include "core/UniformBuffer.h"
+
+UniformBuffer::UniformBuffer(size_t size) {
+	glGenBuffers(1, &m_id);
+	reserve(size);
+}
+
+UniformBuffer::~UniformBuffer() { glDeleteBuffers(1, &m_id); }
+
+void UniformBuffer::reserve(size_t size) {
+	if (size <= m_size) return;
+	m_size = size;
+	glBindBuffer(GL_UNIFORM_BUFFER, m_id);
+	glBufferData(GL_UNIFORM_BUFFER, m_size, nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UniformBuffer::update(const void* data, size_t size, size_t offset) {
+	reserve(offset + size);
+	glBindBuffer(GL_UNIFORM_BUFFER, m_id);
+	glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UniformBuffer::bind(GLuint binding) const {
+	glBindBufferBase(GL_UNIFORM_BUFFER, binding, m_id);
+}
+
+void UniformBuffer::bindRange(GLuint binding, size_t offset,
+							  size_t size) const {
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, m_id, offset, size);
+}
+
+size_t UniformBuffer::offsetAlignment() {
+	static GLint alignment = 0;
+	if (alignment == 0)
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	return static_cast<size_t>(alignment);
+}
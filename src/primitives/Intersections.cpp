@@ -184,8 +184,86 @@ bool BVHIntersection_Rec(const Ray& ray, int nodeIndex, const BVH& bvh,
 	return first_hit;
 }
 
+namespace {
+
+// Entry distance of the ray in the box, 0 if it starts inside, -1 if missed
+inline float slabIntersection(const Ray& ray, const glm::vec3& min,
+							  const glm::vec3& max) {
+	const glm::vec3& origin = ray.origin();
+	if (glm::all(glm::greaterThanEqual(origin, min)) &&
+		glm::all(glm::lessThanEqual(origin, max)))
+		return 0.f;
+
+	glm::vec3 t1 = (min - origin) * ray.inv_direction();
+	glm::vec3 t2 = (max - origin) * ray.inv_direction();
+	glm::vec3 tNear = glm::min(t1, t2);
+	glm::vec3 tFar = glm::max(t1, t2);
+	float tmin = std::max(std::max(tNear.x, tNear.y), tNear.z);
+	float tmax = std::min(std::min(tFar.x, tFar.y), tFar.z);
+	return tmax >= tmin && tmin >= 0.f ? tmin : -1.f;
+}
+
+bool compressedBVHIntersection(const Ray& ray, const BVH& bvh, Hit& hit) {
+	const auto& nodes = bvh.compressedNodes();
+	const auto& triangles = bvh.triangles();
+	const auto& positions = bvh.getRoot()->m_parent_mesh->vertexPositions();
+
+	thread_local std::vector<int32_t> stack;
+	stack.clear();
+	stack.push_back(0);
+
+	bool new_hit = false;
+	while (!stack.empty()) {
+		const CompressedBVH_Node& node = nodes[stack.back()];
+		stack.pop_back();
+
+		float t[2] = {-1.f, -1.f};
+		for (int k = 0; k < 2; k++) {
+			if (node.child[k] < 0) continue;
+			glm::vec3 min, max;
+			node.childBounds(k, min, max);
+			t[k] = slabIntersection(ray, min, max);
+			if (t[k] > hit.t) t[k] = -1.f;
+		}
+
+		for (int k = 0; k < 2; k++) {
+			if (t[k] < 0.f || node.count(k) == 0) continue;
+			size_t first = static_cast<size_t>(node.child[k]);
+			for (size_t i = first; i < first + node.count(k); i++) {
+				const glm::uvec3& triangle = triangles[i];
+				if (triangleIntersection(ray,
+										 {positions[triangle.x],
+										  positions[triangle.y],
+										  positions[triangle.z]},
+										 hit)) {
+					hit.triangleIndex = i;
+					new_hit = true;
+				}
+			}
+		}
+
+		// Internal children, the nearest one on top of the stack
+		bool visit0 = t[0] >= 0.f && node.count(0) == 0;
+		bool visit1 = t[1] >= 0.f && node.count(1) == 0;
+		if (visit0 && visit1) {
+			bool nearFirst = t[0] <= t[1];
+			stack.push_back(node.child[nearFirst ? 1 : 0]);
+			stack.push_back(node.child[nearFirst ? 0 : 1]);
+		} else if (visit0) {
+			stack.push_back(node.child[0]);
+		} else if (visit1) {
+			stack.push_back(node.child[1]);
+		}
+	}
+	return new_hit;
+}
+
+}  // namespace
+
 bool BVHIntersection(const Ray& ray, const BVH& bvh, Hit& hit) {
 	Hit temp_hit;
 	if (!AABBIntersection(ray, *bvh.getRoot()->aabb, temp_hit)) return false;
+	if (BVH::USE_COMPRESSED_NODES)
+		return compressedBVHIntersection(ray, bvh, hit);
 	return BVHIntersection_Rec(ray, 0, bvh, hit);
 }
\ No newline at end of file
@@ -14,14 +14,110 @@
 #include "core/Model.h"
 #include "core/Light.h"
 #include "core/Texture.h"
+#include "core/GeometryArena.h"
+#include "core/SceneUniforms.h"
+#include "core/UniformBlocks.h"
+#include "renderers/Rasterizer.h"
 
 #include <glad/glad.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+bool GPU_Raytracer::USE_COMPUTE_SHADER = false;
+bool GPU_Raytracer::ACCUMULATE_SAMPLES = false;
+bool GPU_Raytracer::DYNAMIC_RESOLUTION = false;
+bool GPU_Raytracer::HYBRID_RENDERING = false;
+bool GPU_Raytracer::STACKLESS_TRAVERSAL = false;
+bool GPU_Raytracer::BUILD_BVHS_ON_GPU = false;
+bool GPU_Raytracer::COUNT_TRAVERSED_NODES = false;
+float GPU_Raytracer::TARGET_FRAME_TIME = 33.f;
+
+namespace {
+
+// See RaytracingComputeShader.glsl
+constexpr GLuint TILE_SIZE = 8;
+constexpr GLuint TILE_COUNTER_BINDING = 5;
+
+// Dynamic resolution, see RaytracingUpscaleFragmentShader.glsl
+constexpr float MIN_RENDER_SCALE = 0.25f;
+// Relative difference of the render scale below which it stays as it is
+constexpr float RENDER_SCALE_TOLERANCE = 0.05f;
+// Part of the difference the render scale moves by each frame
+constexpr float RENDER_SCALE_DAMPING = 0.5f;
+constexpr float HISTORY_BLEND = 0.1f;
+// Length of the jitter sequence of the upscaled samples
+constexpr int JITTER_PERIOD = 16;
+constexpr GLuint HISTORY_IMAGE_UNIT = 3;
+// See RaytracingCommon.glsl
+constexpr GLuint VISIBILITY_IMAGE_UNIT = 4;
+constexpr GLuint THREADED_BVH_BINDING = 6;
+constexpr GLuint TRAVERSAL_STATS_BINDING = 7;
+
+// Enough resident work groups to fill the GPU, they loop over the tiles.
+// llvmpipe caps the loop iterations of a work group for its whole run, which
+// a group tracing several tiles exceeds, so it gets one group per tile.
+GLuint numOfResidentGroups() {
+	const GLubyte* renderer = glGetString(GL_RENDERER);
+	if (renderer && std::strstr(reinterpret_cast<const char*>(renderer),
+								"llvmpipe"))
+		return std::numeric_limits<GLuint>::max();
+	return 256;
+}
+
+// Van der Corput sequence in the base, the Halton sequence for bases 2 and 3
+float radicalInverse(unsigned int i, unsigned int base) {
+	float inverse = 0.f;
+	float digit = 1.f / base;
+	for (; i > 0; i /= base, digit /= base) inverse += (i % base) * digit;
+	return inverse;
+}
+
+// Offset in the pixel of the sample, in pixels. The first sample is at the
+// center, as without accumulation.
+glm::vec2 sampleJitter(int sample) {
+	if (sample == 0) return glm::vec2(0.f);
+	return glm::vec2(radicalInverse(sample, 2), radicalInverse(sample, 3)) -
+		   0.5f;
+}
+
+// Of the bound texture, sampled within its edges
+void setFiltering(GLint filter) {
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+}  // namespace
+
+GPU_Raytracer::~GPU_Raytracer() {
+	glDeleteBuffers(1, &m_builtBVHBuffer);
+	glDeleteBuffers(1, &m_traversalStatsBuffer);
+	glDeleteBuffers(1, &m_tileCounterBuffer);
+	glDeleteFramebuffers(1, &m_imagesFramebuffer);
+	glDeleteFramebuffers(1, &m_visibilityFramebuffer);
+	glDeleteTextures(1, &m_colorTexture);
+	glDeleteTextures(1, &m_depthTexture);
+	glDeleteTextures(1, &m_accumulationTexture);
+	glDeleteTextures(2, m_historyTextures);
+	glDeleteTextures(1, &m_visibilityTexture);
+	glDeleteRenderbuffers(1, &m_visibilityDepth);
+	glDeleteVertexArrays(1, &m_screenQuadVao);
+}
 
 void GPU_Raytracer::init(const std::string& basePath,
-						 const std::shared_ptr<Scene> scenePtr) {
+						 const std::shared_ptr<Scene> scenePtr,
+						 std::shared_ptr<Rasterizer> rasterizerPtr) {
+	m_rasterizerPtr = rasterizerPtr;
 	initScreenQuad();
 	loadShaderProgram(basePath);
-	createSSBOs(scenePtr);
+	m_sceneUniformsPtr = std::make_shared<SceneUniforms>();
+	m_numOfResidentGroups = numOfResidentGroups();
+	updateSSBOs(scenePtr);
 }
 
 void GPU_Raytracer::setResolution(int width, int height) {
@@ -29,17 +125,41 @@ void GPU_Raytracer::setResolution(int width, int height) {
 	m_resolution = glm::vec2(width, height);
 }
 
-void GPU_Raytracer::loadShaderProgram(const std::string& basePath) {
-	m_raytracingShaderProgramPtr.reset();
+void GPU_Raytracer::loadShaderProgram(const std::string& basePath,
+									  bool background) {
+	std::string shaderPath = basePath + "/" + SHADER_PATH;
 	try {
-		std::string shaderPath = basePath + "/" + SHADER_PATH;
-		m_raytracingShaderProgramPtr = ShaderProgram::genBasicShaderProgram(
-			shaderPath + "/RaytracingVertexShader.glsl",
-			shaderPath + "/RaytracingFragmentShader.glsl");
+		m_pendingShaderPrograms = {
+			{&m_raytracingShaderProgramPtr,
+			 ShaderProgram::genBasicShaderProgram(
+				 shaderPath + "/RaytracingVertexShader.glsl",
+				 shaderPath + "/RaytracingFragmentShader.glsl", true)},
+			{&m_computeShaderProgramPtr,
+			 ShaderProgram::genComputeShaderProgram(
+				 shaderPath + "/RaytracingComputeShader.glsl", true)},
+			{&m_imageShaderProgramPtr,
+			 ShaderProgram::genBasicShaderProgram(
+				 shaderPath + "/RaytracingVertexShader.glsl",
+				 shaderPath + "/RaytracingImageFragmentShader.glsl", true)},
+			{&m_upscaleShaderProgramPtr,
+			 ShaderProgram::genBasicShaderProgram(
+				 shaderPath + "/RaytracingVertexShader.glsl",
+				 shaderPath + "/RaytracingUpscaleFragmentShader.glsl", true)},
+			{&m_bvhBuildShaderProgramPtr,
+			 ShaderProgram::genComputeShaderProgram(
+				 shaderPath + "/BVHBuildComputeShader.glsl", true)},
+		};
 	} catch (std::exception& e) {
-		exitOnCriticalError(std::string("[Error loading shader program]") +
-							e.what());
+		m_pendingShaderPrograms.clear();
+		if (!m_raytracingShaderProgramPtr)
+			exitOnCriticalError(std::string("[Error loading shader program]") +
+								e.what());
+		std::cerr << "[Error reloading shader program]" << e.what()
+				  << std::endl;
+		return;
 	}
+	if (!background)
+		ShaderProgram::replaceLinked(m_pendingShaderPrograms, true);
 }
 
 void GPU_Raytracer::render(std::shared_ptr<Scene> scenePtr) {
@@ -47,60 +167,329 @@ void GPU_Raytracer::render(std::shared_ptr<Scene> scenePtr) {
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_ALWAYS);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	updateSSBOs(scenePtr);
-
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_verticesSSBO);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_trianglesSSBO);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_modelsSSBO);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_bvhSSBO);
-
-	m_raytracingShaderProgramPtr->use();
-
-	m_raytracingShaderProgramPtr->set(
-		"inv_view_mat", glm::inverse(scenePtr->camera()->computeViewMatrix()));
-	m_raytracingShaderProgramPtr->set(
-		"inv_proj_mat",
-		glm::inverse(scenePtr->camera()->computeProjectionMatrix()));
-	m_raytracingShaderProgramPtr->set(
-		"proj_mat", scenePtr->camera()->computeProjectionMatrix());
-	m_raytracingShaderProgramPtr->set("view_mat",
-									  scenePtr->camera()->computeViewMatrix());
-	m_raytracingShaderProgramPtr->set("dim", m_resolution);
-	m_raytracingShaderProgramPtr->set("skyColor", scenePtr->backgroundColor());
-
-	glm::vec3 eyePos = glm::inverse(scenePtr->camera()->computeViewMatrix())[3];
-	m_raytracingShaderProgramPtr->set("eye", eyePos);
-
-	scenePtr->imageParameters().setUniforms(*m_raytracingShaderProgramPtr,
-											"imageParameters");
-
-	size_t numOfLights = scenePtr->numOfLights();
-	m_raytracingShaderProgramPtr->set("numOfLights",
-									  static_cast<int>(numOfLights));
-	for (size_t i = 0; i < numOfLights; i++) {
-		scenePtr->light(i)->setUniforms(*m_raytracingShaderProgramPtr,
-										"lights[" + std::to_string(i) + "]");
-	}
-
+	ShaderProgram::replaceLinked(m_pendingShaderPrograms);
+
+	bool sceneChanged = updateSSBOs(scenePtr);
+
+	// Traced at the render size, in the corner of the images
+	bool reallocated = reserveImages();
+	updateRenderScale();
+	if (HYBRID_RENDERING) renderVisibility(scenePtr);
+
+	// Vertices and BVH-ordered triangles come from the scene geometry arena,
+	// shared with the rasterizer
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0,
+					 scenePtr->geometry()->vertexBuffer());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1,
+					 scenePtr->geometry()->indexBuffer());
+	m_modelsBuffer.bind(2);
+	// The nodes are in one layout only, the other blocks are never read
+	if (m_uploadedBuiltOnGPU)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_builtBVHBuffer);
+	else
+		m_bvhBuffer.bind(3);
+	m_bvhBuffer.bind(4);
+	m_bvhBuffer.bind(THREADED_BVH_BINDING);
+	updateTraversalStats();
+
+	ShaderProgram& program = USE_COMPUTE_SHADER ? *m_computeShaderProgramPtr
+												: *m_raytracingShaderProgramPtr;
+	program.set("compressedBVH", m_uploadedLayout == NodeLayout::Compressed);
+	program.set("stacklessBVH", m_uploadedLayout == NodeLayout::Threaded);
+	program.set("traversalStats", COUNT_TRAVERSED_NODES);
+	program.set("numOfModels", static_cast<int>(m_uploadedModels.size()));
+	program.set("vertexFormat", scenePtr->geometry()->vertexFormat());
+	program.set("hybrid", HYBRID_RENDERING);
+
+	// Camera, image parameters and lights, uploaded when they change
+	sceneChanged |=
+		m_sceneUniformsPtr->update(*scenePtr, glm::vec2(m_renderSize));
+	m_sceneUniformsPtr->bind();
+
+	// Samples add up in the accumulation image until anything changes. The
+	// upscaling blends the frames instead, with a jitter of its own.
+	bool accumulate = ACCUMULATE_SAMPLES && !DYNAMIC_RESOLUTION;
+	if (!accumulate || sceneChanged || reallocated ||
+		&program != m_accumulatingProgram)
+		m_numOfAccumulatedSamples = 0;
+	m_accumulatingProgram = &program;
+	glm::vec2 jitter =
+		DYNAMIC_RESOLUTION
+			? sampleJitter(static_cast<int>(m_frameIndex % JITTER_PERIOD) + 1)
+			: sampleJitter(m_numOfAccumulatedSamples);
+	program.set("accumulate", accumulate);
+	program.set("numOfAccumulatedSamples", m_numOfAccumulatedSamples);
+	program.set("jitter", jitter);
+	// The visibility buffer is rasterized at the pixel centers
+	program.set("traceBackground",
+				HYBRID_RENDERING && jitter != glm::vec2(0.f));
+	glBindImageTexture(2, m_accumulationTexture, 0, GL_FALSE, 0,
+					   GL_READ_WRITE, GL_RGBA32F);
+
+	// The shader samples unit i for texture i
 	int numOfTextures = scenePtr->numOfTextures();
 	for (int i = 0; i < numOfTextures; i++) {
 		glActiveTexture(GL_TEXTURE0 + i);
 		scenePtr->texture(i)->bind();
-		m_raytracingShaderProgramPtr->set("textures[" + std::to_string(i) + "]",
-										  i);
 	}
 
-	// zNear and zFar
-	m_raytracingShaderProgramPtr->set("zNear", scenePtr->camera()->getNear());
-	m_raytracingShaderProgramPtr->set("zFar", scenePtr->camera()->getFar());
+	if (USE_COMPUTE_SHADER) {
+		traceTiles();
+	} else {
+		// Drawn into the images for the upscaling
+		GLint screenFramebuffer = 0;
+		if (DYNAMIC_RESOLUTION) {
+			glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &screenFramebuffer);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_imagesFramebuffer);
+			glViewport(0, 0, m_renderSize.x, m_renderSize.y);
+		}
+		program.use();
+		glBindVertexArray(m_screenQuadVao);
+		glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(6), GL_UNSIGNED_INT,
+					   0);
+		if (DYNAMIC_RESOLUTION) {
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, screenFramebuffer);
+			glViewport(0, 0, (GLint)m_resolution.x, (GLint)m_resolution.y);
+		}
+	}
+	m_frameIndex++;
+
+	// The regions written this frame are not touched again until the GPU is
+	// done reading them
+	m_modelsBuffer.fence();
+	m_bvhBuffer.fence();
+	if (accumulate) {
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		m_numOfAccumulatedSamples++;
+	}
+
+	if (DYNAMIC_RESOLUTION) {
+		auto camera = scenePtr->camera();
+		upscale(camera->computeProjectionMatrix() *
+					camera->computeViewMatrix(),
+				jitter);
+	} else {
+		if (USE_COMPUTE_SHADER) drawImages();
+		m_historyValid = false;
+	}
+
+	ShaderProgram::stop();
+
+	glDepthFunc(GL_LESS);
+}
+
+void GPU_Raytracer::skipFrame() {
+	m_lastFrame = std::chrono::steady_clock::time_point();
+	m_historyValid = false;
+}
+
+void GPU_Raytracer::renderVisibility(std::shared_ptr<Scene> scenePtr) {
+	GLint screenFramebuffer = 0;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &screenFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_visibilityFramebuffer);
+	glViewport(0, 0, m_renderSize.x, m_renderSize.y);
+	const GLint background[] = {-1, -1, 0, 0};
+	const GLfloat farDepth = 1.f;
+	glClearBufferiv(GL_COLOR, 0, background);
+	glClearBufferfv(GL_DEPTH, 0, &farDepth);
+
+	glDepthFunc(GL_LESS);
+	m_rasterizerPtr->renderVisibility(scenePtr);
+	glDepthFunc(GL_ALWAYS);
+	glDisable(GL_CULL_FACE);
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, screenFramebuffer);
+	glViewport(0, 0, (GLint)m_resolution.x, (GLint)m_resolution.y);
+	glBindImageTexture(VISIBILITY_IMAGE_UNIT, m_visibilityTexture, 0,
+					   GL_FALSE, 0, GL_READ_ONLY, GL_RG32I);
+}
+
+void GPU_Raytracer::updateTraversalStats() {
+	GLuint stats[2] = {0, 0};
+	if (!m_traversalStatsBuffer) {
+		glGenBuffers(1, &m_traversalStatsBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_traversalStatsBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(stats), stats,
+					 GL_DYNAMIC_COPY);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_traversalStatsBuffer);
+	if (m_pendingTraversalStats) {
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(stats), stats);
+		m_nodesPerRay = stats[0] > 0 ? float(stats[1]) / float(stats[0]) : 0.f;
+		stats[0] = stats[1] = 0;
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(stats), stats);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TRAVERSAL_STATS_BINDING,
+					 m_traversalStatsBuffer);
+	m_pendingTraversalStats = COUNT_TRAVERSED_NODES;
+}
+
+void GPU_Raytracer::traceTiles() {
+	GLuint zero = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_tileCounterBuffer);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+					  GL_UNSIGNED_INT, &zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TILE_COUNTER_BINDING,
+					 m_tileCounterBuffer);
+	glBindImageTexture(0, m_colorTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY,
+					   GL_RGBA8);
+	glBindImageTexture(1, m_depthTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY,
+					   GL_R32F);
+
+	GLuint numOfTiles = ((m_renderSize.x + TILE_SIZE - 1) / TILE_SIZE) *
+						((m_renderSize.y + TILE_SIZE - 1) / TILE_SIZE);
+	GLuint numOfGroups = std::min(numOfTiles, m_numOfResidentGroups);
+	m_computeShaderProgramPtr->set(
+		"maxTilesPerGroup",
+		static_cast<int>((numOfTiles + numOfGroups - 1) / numOfGroups));
+	m_computeShaderProgramPtr->use();
+	glDispatchCompute(numOfGroups, 1, 1);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void GPU_Raytracer::drawImages() {
+	m_imageShaderProgramPtr->use();
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, m_colorTexture);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+	glBindVertexArray(m_screenQuadVao);
+	glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(6), GL_UNSIGNED_INT, 0);
+}
+
+void GPU_Raytracer::updateRenderScale() {
+	// From the previous call. Once the driver queues as many frames as it
+	// takes, it is the time the GPU spends on a frame.
+	auto now = std::chrono::steady_clock::now();
+	bool timed = m_lastFrame != std::chrono::steady_clock::time_point();
+	if (timed)
+		m_frameTime =
+			std::chrono::duration<float, std::milli>(now - m_lastFrame).count();
+	m_lastFrame = now;
+
+	if (!DYNAMIC_RESOLUTION) {
+		m_renderScale = 1.f;
+	} else if (timed && m_historyValid) {
+		// The previous frame was upscaled too, the time is about proportional
+		// to the number of pixels
+		float target = std::clamp(
+			m_renderScale * std::sqrt(TARGET_FRAME_TIME / m_frameTime),
+			MIN_RENDER_SCALE, 1.f);
+		// Small differences are left alone so that the size settles
+		if (std::abs(target - m_renderScale) >
+			RENDER_SCALE_TOLERANCE * m_renderScale)
+			m_renderScale += RENDER_SCALE_DAMPING * (target - m_renderScale);
+	}
+	m_renderSize = glm::clamp(
+		glm::ivec2(glm::round(m_resolution * m_renderScale)), glm::ivec2(1),
+		m_imageSize);
+}
 
+void GPU_Raytracer::upscale(const glm::mat4& viewProjection,
+							const glm::vec2& jitter) {
+	int next = 1 - m_history;
+	ShaderProgram& program = *m_upscaleShaderProgramPtr;
+	program.set("renderSize", glm::vec2(m_renderSize));
+	program.set("outputSize", m_resolution);
+	program.set("jitter", jitter);
+	program.set("invViewProjectionMat", glm::inverse(viewProjection));
+	program.set("previousViewProjectionMat", m_previousViewProjection);
+	program.set("historyValid", m_historyValid);
+	program.set("blendFactor", HISTORY_BLEND);
+	program.use();
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, m_colorTexture);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, m_historyTextures[m_history]);
+	glBindImageTexture(HISTORY_IMAGE_UNIT, m_historyTextures[next], 0,
+					   GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
 	glBindVertexArray(m_screenQuadVao);
 	glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(6), GL_UNSIGNED_INT, 0);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
 
-	m_raytracingShaderProgramPtr->stop();
+	m_history = next;
+	m_historyValid = true;
+	m_previousViewProjection = viewProjection;
+}
 
-	glDepthFunc(GL_LESS);
+bool GPU_Raytracer::reserveImages() {
+	glm::ivec2 size = glm::max(glm::ivec2(m_resolution), glm::ivec2(1));
+	if (m_colorTexture && size == m_imageSize) return false;
+
+	if (m_colorTexture) {
+		glDeleteTextures(1, &m_colorTexture);
+		glDeleteTextures(1, &m_depthTexture);
+		glDeleteTextures(1, &m_accumulationTexture);
+		glDeleteTextures(2, m_historyTextures);
+		glDeleteTextures(1, &m_visibilityTexture);
+		glDeleteRenderbuffers(1, &m_visibilityDepth);
+	}
+	// Immutable storage, as image units require
+	glGenTextures(1, &m_colorTexture);
+	glBindTexture(GL_TEXTURE_2D, m_colorTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, size.x, size.y);
+	setFiltering(GL_LINEAR);
+	glGenTextures(1, &m_depthTexture);
+	glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, size.x, size.y);
+	setFiltering(GL_NEAREST);
+	glGenTextures(1, &m_accumulationTexture);
+	glBindTexture(GL_TEXTURE_2D, m_accumulationTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, size.x, size.y);
+	glGenTextures(2, m_historyTextures);
+	for (GLuint texture : m_historyTextures) {
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, size.x, size.y);
+		setFiltering(GL_LINEAR);
+	}
+	glGenTextures(1, &m_visibilityTexture);
+	glBindTexture(GL_TEXTURE_2D, m_visibilityTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32I, size.x, size.y);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glGenRenderbuffers(1, &m_visibilityDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, m_visibilityDepth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, size.x,
+						  size.y);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	m_imageSize = size;
+	m_historyValid = false;
+
+	// The fragment shader path draws the color and the depth as two color
+	// attachments
+	if (!m_imagesFramebuffer) glGenFramebuffers(1, &m_imagesFramebuffer);
+	GLint screenFramebuffer = 0;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &screenFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_imagesFramebuffer);
+	glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+						 m_colorTexture, 0);
+	glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+						 m_depthTexture, 0);
+	const GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+	glDrawBuffers(2, drawBuffers);
+
+	// Hybrid rendering, the rasterizer draws the visibility buffer
+	if (!m_visibilityFramebuffer)
+		glGenFramebuffers(1, &m_visibilityFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_visibilityFramebuffer);
+	glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+						 m_visibilityTexture, 0);
+	glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+							  GL_RENDERBUFFER, m_visibilityDepth);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, screenFramebuffer);
+
+	if (!m_tileCounterBuffer) {
+		glGenBuffers(1, &m_tileCounterBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_tileCounterBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), nullptr,
+					 GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+	return true;
 }
 
 struct SSBOModel {
@@ -108,9 +497,11 @@ struct SSBOModel {
 	int triangle_offset;
 	int triangle_count;
 	int vertex_offset;
-	Material material;
+	MaterialBlock material;
 	glm::mat4 transform;
 	glm::mat4 inv_transform;
+	glm::vec4 position_offset;
+	glm::vec4 position_scale;
 };
 
 struct SSBO_BVH_Node {
@@ -120,152 +511,275 @@ struct SSBO_BVH_Node {
 	int offset;
 };
 
-struct SSBO_Vertex {
-	glm::vec3 position;
-	float u;
-	glm::vec3 normal;
-	float v;
-	glm::vec3 tangent;
-	float p;
+// Node of the threaded layout, 64 bytes. The rays visit the nodes depth first,
+// the nearest child first along the octant of their direction (bit k set when
+// it is negative on axis k), without a stack: a node they miss, or a leaf
+// they are done with, links to the node to visit next.
+struct ThreadedBVH_Node {
+	glm::vec3 min;
+	/// Leaf: first triangle, internal: first child, relative to the root
+	int offset;
+	glm::vec3 max;
+	/// Triangles of a leaf on 16 bits, 0 for internal nodes, then a bit per
+	/// octant set when the second child is the nearest
+	uint32_t flags;
+	/// Per octant, the node after the subtree of this one, relative to the
+	/// root, -1 after the last one
+	int32_t skip[8];
 };
 
-void buildGPUData(std::vector<SSBO_Vertex>& vertices,
-				  std::vector<glm::uvec4>& triangles,
-				  std::vector<SSBOModel>& models,
-				  std::vector<SSBO_BVH_Node>& bvh_nodes,
-				  std::shared_ptr<Scene> scenePtr) {
-	int triangle_offset = 0;
-	int bvh_offset = 0;
-	int vertex_offset = 0;
-	for (size_t i = 0; i < scenePtr->numOfModels(); i++) {
-		std::shared_ptr<Model> model = scenePtr->model(i);
-		SSBOModel ssboModel;
-		ssboModel.bvh_root = bvh_offset;
-		ssboModel.triangle_offset = triangle_offset;
-		ssboModel.vertex_offset = vertex_offset;
-		ssboModel.triangle_count = model->mesh()->triangleIndices().size();
-		ssboModel.material = model->material();
-		ssboModel.transform = model->mesh()->getTransformMatrix();
-		ssboModel.inv_transform = model->mesh()->getInvTransformMatrix();
-		models.push_back(ssboModel);
-
-		auto& nodes = model->mesh()->bvh()->nodes();
-		for (size_t j = 0; j < nodes.size(); j++) {
-			SSBO_BVH_Node node;
-			node.min = nodes[j]->aabb->begin_corner;
-			node.max = nodes[j]->aabb->end_corner;
-			node.triangle_count =
-				nodes[j]->child_index == 0 ? nodes[j]->num_triangles : 0;
-			node.offset = nodes[j]->child_index == 0 ? nodes[j]->first_triangle
-													 : nodes[j]->child_index;
-			bvh_nodes.push_back(node);
-		}
-
-		for (size_t j = 0; j < model->mesh()->bvh()->triangles().size(); j++) {
-			glm::uvec3 triangle = model->mesh()->bvh()->triangles()[j];
-			triangles.push_back(glm::uvec4(triangle, 0));
-		}
+SSBOModel toSSBOModel(const Model& model,
+					  const GeometryArena::Range& range, int bvh_root) {
+	SSBOModel ssboModel;
+	ssboModel.bvh_root = bvh_root;
+	ssboModel.triangle_offset = range.firstIndex / 3;
+	ssboModel.vertex_offset = range.firstVertex;
+	ssboModel.triangle_count = range.numIndices / 3;
+	ssboModel.material = model.material().uniformBlock();
+	ssboModel.transform = model.mesh()->getTransformMatrix();
+	ssboModel.inv_transform = model.mesh()->getInvTransformMatrix();
+	ssboModel.position_offset = glm::vec4(range.positionOffset, 0.f);
+	ssboModel.position_scale = glm::vec4(range.positionScale, 0.f);
+	return ssboModel;
+}
 
-		for (size_t j = 0; j < model->mesh()->vertexPositions().size(); j++) {
-			glm::vec3 position = model->mesh()->vertexPositions()[j];
-			glm::vec3 normal = model->mesh()->vertexNormals()[j];
-			glm::vec3 tangent = model->mesh()->vertexTangents()[j];
-			glm::vec2 uv = model->mesh()->vertexUVs()[j];
-			vertices.push_back(
-				SSBO_Vertex{position, uv.x, normal, uv.y, tangent, 0});
-		}
+// The threaded nodes count the triangles of a leaf on 16 bits. Larger leaves
+// are split in halves by nodes appended after the ones of the tree, which keep
+// the box of the leaf: the build only leaves that many triangles together when
+// it cannot separate them.
+constexpr size_t MAX_THREADED_LEAF_TRIANGLES = 0xFFFF;
 
-		bvh_offset += nodes.size();
-		vertex_offset += model->mesh()->vertexPositions().size();
-		triangle_offset += model->mesh()->bvh()->triangles().size();
-	}
+size_t numOfSplitNodes(size_t numTriangles) {
+	if (numTriangles <= MAX_THREADED_LEAF_TRIANGLES) return 0;
+	size_t half = numTriangles / 2;
+	return 2 + numOfSplitNodes(half) + numOfSplitNodes(numTriangles - half);
 }
 
-void GPU_Raytracer::createSSBOs(std::shared_ptr<Scene> scenePtr) {
-	// Create an SSBO that contains all the models of the scene
-	std::vector<SSBO_Vertex> vertices;
-	std::vector<glm::uvec4> triangles;
-	std::vector<SSBOModel> models;
-	std::vector<SSBO_BVH_Node> bvh_nodes;
-
-	buildGPUData(vertices, triangles, models, bvh_nodes, scenePtr);
+// Nodes of the BVH in the uploaded layout
+size_t numOfGPUNodes(const BVH& bvh, GPU_Raytracer::NodeLayout layout) {
+	if (layout == GPU_Raytracer::NodeLayout::Compressed)
+		return bvh.compressedNodes().size();
+	size_t numNodes = bvh.nodes().size();
+	if (layout == GPU_Raytracer::NodeLayout::Threaded)
+		for (const auto& node : bvh.nodes())
+			if (node->child_index == 0)
+				numNodes += numOfSplitNodes(node->num_triangles);
+	return numNodes;
+}
 
-	glGenBuffers(1, &m_verticesSSBO);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_verticesSSBO);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-				 sizeof(SSBO_Vertex) * vertices.size(), vertices.data(),
-				 GL_DYNAMIC_COPY);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+size_t sizeOfGPUNode(GPU_Raytracer::NodeLayout layout) {
+	switch (layout) {
+		case GPU_Raytracer::NodeLayout::Compressed:
+			return sizeof(CompressedBVH_Node);
+		case GPU_Raytracer::NodeLayout::Threaded:
+			return sizeof(ThreadedBVH_Node);
+		default:
+			return sizeof(SSBO_BVH_Node);
+	}
+}
 
-	glGenBuffers(1, &m_trianglesSSBO);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_trianglesSSBO);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-				 sizeof(glm::uvec4) * triangles.size(), triangles.data(),
-				 GL_DYNAMIC_COPY);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+// Makes the leaf j hold the triangles, splitting it when there are too many.
+// children[j] is the first child of the node j, 0 for a leaf.
+void writeThreadedLeaf(std::vector<ThreadedBVH_Node>& threaded,
+					   std::vector<size_t>& children, size_t j, size_t first,
+					   size_t count) {
+	if (count <= MAX_THREADED_LEAF_TRIANGLES) {
+		threaded[j].offset = static_cast<int>(first);
+		threaded[j].flags = static_cast<uint32_t>(count);
+		return;
+	}
+	// Same boxes for both children, the first one is the nearest
+	size_t child = threaded.size();
+	threaded[j].offset = static_cast<int>(child);
+	threaded[j].flags = 0;
+	children[j] = child;
+	ThreadedBVH_Node leaf = threaded[j];
+	threaded.resize(child + 2, leaf);
+	children.resize(child + 2, 0);
+	size_t half = count / 2;
+	writeThreadedLeaf(threaded, children, child, first, half);
+	writeThreadedLeaf(threaded, children, child + 1, first + half,
+					  count - half);
+}
 
-	glGenBuffers(1, &m_modelsSSBO);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_modelsSSBO);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(SSBOModel) * models.size(),
-				 models.data(), GL_DYNAMIC_COPY);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+void writeThreadedNodes(PersistentBuffer& buffer, size_t offset,
+						const BVH& bvh) {
+	auto& nodes = bvh.nodes();
+	std::vector<ThreadedBVH_Node> threaded(nodes.size());
+	std::vector<size_t> children(nodes.size(), 0);
+	for (size_t j = 0; j < nodes.size(); j++) {
+		const BVH_Node& node = *nodes[j];
+		threaded[j].min = node.aabb->begin_corner;
+		threaded[j].max = node.aabb->end_corner;
+		if (node.child_index == 0) {
+			writeThreadedLeaf(threaded, children, j, node.first_triangle,
+							  node.num_triangles);
+			continue;
+		}
+		// The splits can reallocate the nodes
+		ThreadedBVH_Node& threadedNode = threaded[j];
+		children[j] = node.child_index;
+		threadedNode.offset = static_cast<int>(node.child_index);
+		threadedNode.flags = 0;
+
+		// The nearest child has the nearest center along the octant
+		// direction
+		const AABB& first = *nodes[node.child_index]->aabb;
+		const AABB& second = *nodes[node.child_index + 1]->aabb;
+		glm::vec3 between = (second.begin_corner + second.end_corner) -
+							(first.begin_corner + first.end_corner);
+		for (int octant = 0; octant < 8; octant++) {
+			glm::vec3 direction((octant & 1) ? -1.f : 1.f,
+								(octant & 2) ? -1.f : 1.f,
+								(octant & 4) ? -1.f : 1.f);
+			if (glm::dot(between, direction) < 0.f)
+				threadedNode.flags |= 1u << (16 + octant);
+		}
+	}
 
-	glGenBuffers(1, &m_bvhSSBO);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_bvhSSBO);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-				 sizeof(SSBO_BVH_Node) * bvh_nodes.size(), bvh_nodes.data(),
-				 GL_DYNAMIC_COPY);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	// The skip link of the nearest child is its sibling, the one of the
+	// other child the skip link of their parent
+	std::vector<std::pair<size_t, int>> stack;
+	for (int octant = 0; octant < 8; octant++) {
+		stack.assign(1, {0, -1});
+		while (!stack.empty()) {
+			auto [j, skip] = stack.back();
+			stack.pop_back();
+			threaded[j].skip[octant] = skip;
+			size_t child = children[j];
+			if (child == 0) continue;
+			size_t nearest = child + ((threaded[j].flags >> (16 + octant)) & 1);
+			size_t other = 2 * child + 1 - nearest;
+			stack.push_back({nearest, static_cast<int>(other)});
+			stack.push_back({other, skip});
+		}
+	}
+	buffer.write(offset * sizeof(ThreadedBVH_Node), threaded.data(),
+				 threaded.size() * sizeof(ThreadedBVH_Node));
 }
 
-void GPU_Raytracer::updateSSBOs(std::shared_ptr<Scene> scenePtr) {
-	// Create an SSBO that contains all the models of the scene
-	std::vector<SSBO_Vertex> vertices;
-	std::vector<glm::uvec4> triangles;
-	std::vector<SSBOModel> models;
-	std::vector<SSBO_BVH_Node> bvh_nodes;
-
-	int triangle_offset = 0;
-	int bvh_offset = 0;
-	int vertex_offset = 0;
-	for (size_t i = 0; i < scenePtr->numOfModels(); i++) {
-		std::shared_ptr<Model> model = scenePtr->model(i);
-		SSBOModel ssboModel;
-		ssboModel.bvh_root = bvh_offset;
-		ssboModel.triangle_offset = triangle_offset;
-		ssboModel.vertex_offset = vertex_offset;
-		ssboModel.triangle_count = model->mesh()->triangleIndices().size();
-		ssboModel.material = model->material();
-		ssboModel.transform = model->mesh()->getTransformMatrix();
-		ssboModel.inv_transform = model->mesh()->getInvTransformMatrix();
-		models.push_back(ssboModel);
-
-		auto& nodes = model->mesh()->bvh()->nodes();
-
-		bvh_offset += nodes.size();
-		vertex_offset += model->mesh()->vertexPositions().size();
-		triangle_offset += model->mesh()->bvh()->triangles().size();
+// Child indices are relative to the root of the mesh
+void writeGPUNodes(PersistentBuffer& buffer, size_t offset, const BVH& bvh,
+				   GPU_Raytracer::NodeLayout layout) {
+	if (layout == GPU_Raytracer::NodeLayout::Threaded) {
+		writeThreadedNodes(buffer, offset, bvh);
+		return;
+	}
+	if (layout == GPU_Raytracer::NodeLayout::Compressed) {
+		const auto& nodes = bvh.compressedNodes();
+		buffer.write(offset * sizeof(CompressedBVH_Node), nodes.data(),
+					 nodes.size() * sizeof(CompressedBVH_Node));
+		return;
 	}
 
-	// glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_verticesSSBO);
-	// glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(SSBO_Vertex) *
-	// vertices.size(), vertices.data()); glBindBuffer(GL_SHADER_STORAGE_BUFFER,
-	// 0);
+	auto& nodes = bvh.nodes();
+	std::vector<SSBO_BVH_Node> bvh_nodes(nodes.size());
+	for (size_t j = 0; j < nodes.size(); j++) {
+		SSBO_BVH_Node& node = bvh_nodes[j];
+		node.min = nodes[j]->aabb->begin_corner;
+		node.max = nodes[j]->aabb->end_corner;
+		node.triangle_count =
+			nodes[j]->child_index == 0 ? nodes[j]->num_triangles : 0;
+		node.offset = nodes[j]->child_index == 0 ? nodes[j]->first_triangle
+												 : nodes[j]->child_index;
+	}
+	buffer.write(offset * sizeof(SSBO_BVH_Node), bvh_nodes.data(),
+				 bvh_nodes.size() * sizeof(SSBO_BVH_Node));
+}
 
-	// glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_trianglesSSBO);
-	// glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(glm::uvec4) *
-	// triangles.size(), triangles.data());
-	// glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+bool GPU_Raytracer::updateSSBOs(std::shared_ptr<Scene> scenePtr) {
+	// The geometry lives in the scene arena, only the models and their BVHs
+	// are uploaded here. The arena appends new models, and lays everything
+	// out again after a vertex format change or a mesh changing size.
+	GeometryArena& geometry = *scenePtr->geometry();
+	geometry.update(*scenePtr);
+
+	// The BVHs built on the GPU are in the full precision layout
+	bool builtOnGPU = BUILD_BVHS_ON_GPU;
+	NodeLayout layout = NodeLayout::Full;
+	if (!builtOnGPU && STACKLESS_TRAVERSAL)
+		layout = NodeLayout::Threaded;
+	else if (!builtOnGPU && BVH::USE_COMPRESSED_NODES)
+		layout = NodeLayout::Compressed;
+	size_t numOfModels = scenePtr->numOfModels();
+	if (layout != m_uploadedLayout || builtOnGPU != m_uploadedBuiltOnGPU ||
+		geometry.generation() != m_uploadedGeometryGeneration ||
+		numOfModels < m_uploadedModels.size()) {
+		m_uploadedModels.clear();
+		m_uploadedLayout = layout;
+		m_uploadedBuiltOnGPU = builtOnGPU;
+		m_uploadedGeometryGeneration = geometry.generation();
+	}
+	bool changed = numOfModels != m_uploadedModels.size();
+	m_uploadedModels.resize(numOfModels);
+
+	// The BVHs are packed one after the other, one changing size moves all
+	// the following ones
+	size_t bvhOffset = 0;
+	std::vector<size_t> modelsToBuild;
+	for (size_t i = 0; i < numOfModels; i++) {
+		std::shared_ptr<Model> model = scenePtr->model(i);
+		const Mesh& mesh = *model->mesh();
+		const BVH& bvh = *mesh.bvh();
+		size_t numOfNodes =
+			builtOnGPU
+				? GPU_BVHBuilder::numOfNodes(geometry.range(i).numIndices / 3)
+				: numOfGPUNodes(bvh, layout);
+		UploadedModel& uploaded = m_uploadedModels[i];
+
+		bool bvhChanged =
+			uploaded.bvhVersion != bvh.version() ||
+			uploaded.bvhOffset != bvhOffset ||
+			uploaded.numOfNodes != numOfNodes ||
+			(builtOnGPU && uploaded.geometryVersion != mesh.geometryVersion());
+		if (bvhChanged && builtOnGPU)
+			modelsToBuild.push_back(i);
+		else if (bvhChanged)
+			writeGPUNodes(m_bvhBuffer, bvhOffset, bvh, layout);
+
+		if (bvhChanged ||
+			uploaded.transformVersion != mesh.transformVersion() ||
+			uploaded.materialVersion != model->material().version() ||
+			uploaded.geometryVersion != mesh.geometryVersion()) {
+			m_modelsBuffer.write(
+				i, toSSBOModel(*model, geometry.range(i), bvhOffset));
+			changed = true;
+		}
 
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_modelsSSBO);
-	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
-					sizeof(SSBOModel) * models.size(), models.data());
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		uploaded.bvhVersion = bvh.version();
+		uploaded.bvhOffset = bvhOffset;
+		uploaded.numOfNodes = numOfNodes;
+		uploaded.transformVersion = mesh.transformVersion();
+		uploaded.materialVersion = model->material().version();
+		uploaded.geometryVersion = mesh.geometryVersion();
+		bvhOffset += numOfNodes;
+	}
 
-	// glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_bvhSSBO);
-	// glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(SSBO_BVH_Node) *
-	// bvh_nodes.size(), bvh_nodes.data());
-	// glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	m_modelsBuffer.resize(numOfModels * sizeof(SSBOModel));
+	m_bvhBuffer.resize(builtOnGPU ? 0 : bvhOffset * sizeOfGPUNode(layout));
+	m_modelsBuffer.flush();
+	m_bvhBuffer.flush();
+
+	if (builtOnGPU) {
+		// Everything is built again in a larger buffer
+		size_t size = bvhOffset * sizeof(SSBO_BVH_Node);
+		if (!m_builtBVHBuffer || size > m_builtBVHCapacity) {
+			if (m_builtBVHBuffer) glDeleteBuffers(1, &m_builtBVHBuffer);
+			m_builtBVHCapacity = std::max(size, 2 * m_builtBVHCapacity);
+			glGenBuffers(1, &m_builtBVHBuffer);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_builtBVHBuffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, m_builtBVHCapacity, nullptr,
+						 GL_DYNAMIC_COPY);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+			modelsToBuild.resize(numOfModels);
+			for (size_t i = 0; i < numOfModels; i++) modelsToBuild[i] = i;
+		}
+		for (size_t i : modelsToBuild)
+			m_bvhBuilder.build(*m_bvhBuildShaderProgramPtr, geometry,
+							   geometry.range(i), m_builtBVHBuffer,
+							   m_uploadedModels[i].bvhOffset);
+	}
+	return changed;
 }
 
 GLuint GPU_Raytracer::genGPUBuffer(size_t elementSize, size_t numElements,
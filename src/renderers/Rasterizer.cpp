@@ -6,7 +6,10 @@
 
 #include "core/Material.h"
 #include "acceleration/BVH.h"
+#include "acceleration/SceneBVH.h"
+#include "acceleration/OcclusionCuller.h"
 #include "primitives/AABB.h"
+#include "primitives/Frustum.h"
 
 #include "core/Scene.h"
 #include "core/Mesh.h"
@@ -15,8 +18,31 @@
 #include "core/Model.h"
 #include "core/Light.h"
 #include "core/Texture.h"
+#include "core/GeometryArena.h"
+#include "core/SceneUniforms.h"
+#include "core/UniformBlocks.h"
 
 #include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <numeric>
+
+// Bounding sphere of the model in view space. The view matrix is rigid, the
+// scale comes from the model.
+void viewBoundingSphere(const GeometryArena::Range& range,
+						const glm::mat4& modelViewMatrix, glm::vec3& center,
+						float& radius) {
+	glm::mat3 linear(modelViewMatrix);
+	float scale = std::max(glm::length(linear[0]),
+						   std::max(glm::length(linear[1]),
+									glm::length(linear[2])));
+	center = glm::vec3(modelViewMatrix * glm::vec4(range.boundingCenter, 1.f));
+	radius = scale * range.boundingRadius;
+}
 
 void Rasterizer::init(const std::string& basePath,
 					  const std::shared_ptr<Scene> scenePtr) {
@@ -28,50 +54,79 @@ void Rasterizer::init(const std::string& basePath,
 
 	initScreenQuad();
 	initDebugCube();
+	// No vertex attributes, the PBR vertex shader pulls from the arena
+	glGenVertexArrays(1, &m_meshVao);
 	loadShaderProgram(basePath);
 	initDisplayedImage();
+	m_occlusionCullerPtr = std::make_shared<OcclusionCuller>();
+	m_sceneUniformsPtr = std::make_shared<SceneUniforms>();
+	glGenBuffers(1, &m_drawCommandsBuffer);
+	glGenBuffers(1, &m_lodStatesSSBO);
+	glGenBuffers(1, &m_drawStatsSSBO);
+	GLint alignment = 1;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	m_drawStatsStride =
+		(sizeof(DrawStatsBlock) + alignment - 1) / alignment * alignment;
+	const GLbitfield mapFlags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT |
+								GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_drawStatsSSBO);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+					NUM_DRAW_STATS * m_drawStatsStride, nullptr, mapFlags);
+	m_mappedDrawStats = static_cast<unsigned char*>(
+		glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0,
+						 NUM_DRAW_STATS * m_drawStatsStride, mapFlags));
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	uploadNewModels(scenePtr);
+}
 
-	size_t numOfMeshes = scenePtr->numOfModels();
-	for (size_t i = 0; i < numOfMeshes; i++)
-		m_vaos.push_back(toGPU(scenePtr->model(i)->mesh()));
+void Rasterizer::uploadNewModels(const std::shared_ptr<Scene> scenePtr) {
+	scenePtr->geometry()->update(*scenePtr);
 }
 
 void Rasterizer::setResolution(int width, int height) {
 	glViewport(0, 0, (GLint)width, (GLint)height);
+	m_resolution = glm::vec2(width, height);
 }
 
-void Rasterizer::loadShaderProgram(const std::string& basePath) {
-	m_pbrShaderProgramPtr.reset();
-	try {
-		std::string shaderPath = basePath + "/" + SHADER_PATH;
-		m_pbrShaderProgramPtr = ShaderProgram::genBasicShaderProgram(
-			shaderPath + "/PBRVertexShader.glsl",
-			shaderPath + "/PBRFragmentShader.glsl");
-	} catch (std::exception& e) {
-		exitOnCriticalError(std::string("[Error loading shader program]") +
-							e.what());
-	}
-	m_displayShaderProgramPtr.reset();
+void Rasterizer::loadShaderProgram(const std::string& basePath,
+								   bool background) {
+	// All the programs compile at once, the ones in use are kept until their
+	// replacement links
+	std::string shaderPath = basePath + "/" + SHADER_PATH;
 	try {
-		std::string shaderPath = basePath + "/" + SHADER_PATH;
-		m_displayShaderProgramPtr = ShaderProgram::genBasicShaderProgram(
-			shaderPath + "/DisplayVertexShader.glsl",
-			shaderPath + "/DisplayFragmentShader.glsl");
-		m_displayShaderProgramPtr->set("imageTex", 0);
+		m_pendingShaderPrograms = {
+			{&m_pbrShaderProgramPtr,
+			 ShaderProgram::genBasicShaderProgram(
+				 shaderPath + "/PBRVertexShader.glsl",
+				 shaderPath + "/PBRFragmentShader.glsl", true)},
+			{&m_visibilityShaderProgramPtr,
+			 ShaderProgram::genBasicShaderProgram(
+				 shaderPath + "/PBRVertexShader.glsl",
+				 shaderPath + "/VisibilityFragmentShader.glsl", true)},
+			{&m_displayShaderProgramPtr,
+			 ShaderProgram::genBasicShaderProgram(
+				 shaderPath + "/DisplayVertexShader.glsl",
+				 shaderPath + "/DisplayFragmentShader.glsl", true)},
+			{&m_debugShaderProgramPtr,
+			 ShaderProgram::genBasicShaderProgram(
+				 shaderPath + "/DebugVertexShader.glsl",
+				 shaderPath + "/DebugFragmentShader.glsl", true)},
+			{&m_cullingShaderProgramPtr,
+			 ShaderProgram::genComputeShaderProgram(
+				 shaderPath + "/CullingComputeShader.glsl", true)},
+		};
 	} catch (std::exception& e) {
-		exitOnCriticalError(
-			std::string("[Error loading display shader program]") + e.what());
-	}
-	m_debugShaderProgramPtr.reset();
-	try {
-		std::string shaderPath = basePath + "/" + SHADER_PATH;
-		m_debugShaderProgramPtr = ShaderProgram::genBasicShaderProgram(
-			shaderPath + "/DebugVertexShader.glsl",
-			shaderPath + "/DebugFragmentShader.glsl");
-	} catch (std::exception& e) {
-		exitOnCriticalError(
-			std::string("[Error loading display shader program]") + e.what());
+		m_pendingShaderPrograms.clear();
+		if (!m_pbrShaderProgramPtr)
+			exitOnCriticalError(std::string("[Error loading shader program]") +
+								e.what());
+		std::cerr << "[Error reloading shader program]" << e.what()
+				  << std::endl;
+		return;
 	}
+	if (!background)
+		ShaderProgram::replaceLinked(m_pendingShaderPrograms, true);
 }
 
 void Rasterizer::updateDisplayedImageTexture(std::shared_ptr<Image> imagePtr) {
@@ -121,55 +176,81 @@ void Rasterizer::render(std::shared_ptr<Scene> scenePtr) {
 	glClearColor(bgColor[0], bgColor[1], bgColor[2], 1.f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	m_pbrShaderProgramPtr->use();
+	uploadNewModels(scenePtr);
+	ShaderProgram::replaceLinked(m_pendingShaderPrograms);
 
-	size_t numOfLights = scenePtr->numOfLights();
+	drawScene(scenePtr, *m_pbrShaderProgramPtr, false);
 
-	m_pbrShaderProgramPtr->set("numOfLights", static_cast<int>(numOfLights));
-	for (size_t i = 0; i < numOfLights; i++) {
-		scenePtr->light(i)->setUniforms(*m_pbrShaderProgramPtr,
-										"lights[" + std::to_string(i) + "]");
-	}
+	renderDebug(scenePtr);
+}
 
-	scenePtr->imageParameters().setUniforms(*m_pbrShaderProgramPtr,
-											"imageParameters");
+void Rasterizer::renderVisibility(std::shared_ptr<Scene> scenePtr) {
+	// The ray tracer sees the back faces
+	glEnable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+
+	uploadNewModels(scenePtr);
+	ShaderProgram::replaceLinked(m_pendingShaderPrograms);
+
+	drawScene(scenePtr, *m_visibilityShaderProgramPtr, true);
+}
 
-	m_pbrShaderProgramPtr->set("backgroundColor", scenePtr->backgroundColor());
+void Rasterizer::drawScene(std::shared_ptr<Scene> scenePtr,
+						   ShaderProgram& program, bool visibility) {
+	program.use();
 
+	// Camera, image parameters and lights, one upload each
+	m_sceneUniformsPtr->update(*scenePtr, m_resolution);
+	m_sceneUniformsPtr->bind();
+
+	// The shaders sample unit i for texture i
 	int numOfTextures = scenePtr->numOfTextures();
 	for (int i = 0; i < numOfTextures; i++) {
 		glActiveTexture(GL_TEXTURE0 + i);
 		scenePtr->texture(i)->bind();
-		m_pbrShaderProgramPtr->set("textures[" + std::to_string(i) + "]", i);
 	}
 
-	glm::vec3 eyePos = glm::inverse(scenePtr->camera()->computeViewMatrix())[3];
-	m_pbrShaderProgramPtr->set("eye", eyePos);
-
-	size_t numOfMeshes = scenePtr->numOfModels();
-	for (size_t i = 0; i < numOfMeshes; i++) {
-		auto model = scenePtr->model(i);
-
-		glm::mat4 projectionMatrix =
-			scenePtr->camera()->computeProjectionMatrix();
-		glm::mat4 modelMatrix = model->mesh()->getTransformMatrix();
-		glm::mat4 viewMatrix = scenePtr->camera()->computeViewMatrix();
-		glm::mat4 modelViewMatrix = viewMatrix * modelMatrix;
-		glm::mat4 normalMatrix = glm::transpose(glm::inverse(modelViewMatrix));
-
-		m_pbrShaderProgramPtr->set("viewMat", viewMatrix);
-		m_pbrShaderProgramPtr->set("modelMat", modelMatrix);
-		m_pbrShaderProgramPtr->set("normalMat", normalMatrix);
-		m_pbrShaderProgramPtr->set("projectionMat", projectionMatrix);
-		m_pbrShaderProgramPtr->set("modelViewMat", modelViewMatrix);
-
-		model->material().setUniforms(*m_pbrShaderProgramPtr, "material");
-
-		draw(i, model->mesh()->triangleIndices().size());
-	}
-	m_pbrShaderProgramPtr->stop();
-
-	renderDebug(scenePtr);
+	glm::mat4 projectionMatrix = scenePtr->camera()->computeProjectionMatrix();
+	glm::mat4 viewMatrix = scenePtr->camera()->computeViewMatrix();
+	float fov = scenePtr->camera()->getFoV();
+
+	// The arena buffers are reallocated when they grow, bound every frame
+	auto geometry = scenePtr->geometry();
+	glBindVertexArray(m_meshVao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry->indexBuffer());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, geometry->vertexBuffer());
+	program.set("vertexFormat", geometry->vertexFormat());
+
+	glm::mat4 viewProjectionMatrix = projectionMatrix * viewMatrix;
+	cullModels(scenePtr, viewProjectionMatrix);
+	// The ray tracer only traverses the BVH where the visibility buffer is
+	// empty, so a model wrongly found occluded would be missing
+	beginOcclusionCulling(scenePtr, viewProjectionMatrix, viewMatrix, fov,
+						  m_occlusionCulling && !visibility);
+	reserveModelBuffers(scenePtr->numOfModels());
+	uploadModelTable(scenePtr);
+
+	size_t numDrawnTriangles = 0;
+	if (m_gpuDriven)
+		drawModelsIndirect(scenePtr, program, visibility);
+	else
+		numDrawnTriangles =
+			drawModels(scenePtr, program, visibility, viewMatrix, fov);
+	m_modelTable.fence();
+	glBindVertexArray(0);
+	program.stop();
+
+	// The counts are those of the last render
+	if (visibility) return;
+	size_t numOfModels = scenePtr->numOfModels();
+	size_t numDrawnModels = m_occluderModels.size() + m_testedModels.size();
+	m_numOccluders = m_occluderModels.size();
+	m_numOccludedModels = m_visibleModels.size() - numDrawnModels;
+	// GPU-driven, the other counts are read back by updateDrawStats()
+	if (m_gpuDriven && numOfModels > 0) return;
+	m_numCulledModels = numOfModels - m_visibleModels.size();
+	m_numDrawnModels = numDrawnModels;
+	m_numDrawnTriangles = numDrawnTriangles;
 }
 
 void Rasterizer::renderDebug(std::shared_ptr<Scene> scenePtr) {
@@ -238,27 +319,20 @@ void Rasterizer::display(std::shared_ptr<Image> imagePtr) {
 }
 
 void Rasterizer::clear() {
-	for (unsigned int i = 0; i < m_posVbos.size(); i++) {
-		GLuint vbo = m_posVbos[i];
-		glDeleteBuffers(1, &vbo);
-	}
-	m_posVbos.clear();
-	for (unsigned int i = 0; i < m_normalVbos.size(); i++) {
-		GLuint vbo = m_normalVbos[i];
-		glDeleteBuffers(1, &vbo);
-	}
-	m_normalVbos.clear();
-	for (unsigned int i = 0; i < m_ibos.size(); i++) {
-		GLuint ibo = m_ibos[i];
-		glDeleteBuffers(1, &ibo);
+	m_modelTable.clear();
+	m_drawTable.clear();
+	m_modelTableVersions.clear();
+	m_drawTableVersions.clear();
+	glDeleteBuffers(1, &m_drawCommandsBuffer);
+	glDeleteBuffers(1, &m_lodStatesSSBO);
+	for (GLsync& sync : m_drawStatsFences) {
+		if (sync) glDeleteSync(sync);
+		sync = nullptr;
 	}
-	m_ibos.clear();
-	for (unsigned int i = 0; i < m_vaos.size(); i++) {
-		GLuint vao = m_vaos[i];
-		glDeleteVertexArrays(1, &vao);
-	}
-	m_vaos.clear();
-
+	glDeleteBuffers(1, &m_drawStatsSSBO);
+	m_mappedDrawStats = nullptr;
+	m_numAllocatedModels = 0;
+	glDeleteVertexArrays(1, &m_meshVao);
 	glDeleteTextures(1, &m_displayImageTex);
 	glDeleteVertexArrays(1, &m_screenQuadVao);
 	glDeleteVertexArrays(1, &m_debugCubeVao);
@@ -311,29 +385,6 @@ GLuint Rasterizer::genGPUVertexArray(GLuint posVbo, GLuint ibo, bool hasNormals,
 	return vao;
 }
 
-GLuint Rasterizer::toGPU(std::shared_ptr<Mesh> meshPtr) {
-	GLuint posVbo =
-		genGPUBuffer(3 * sizeof(float), meshPtr->vertexPositions().size(),
-					 meshPtr->vertexPositions().data());
-	GLuint normalVbo =
-		genGPUBuffer(3 * sizeof(float), meshPtr->vertexNormals().size(),
-					 meshPtr->vertexNormals().data());
-	GLuint uvVbo = genGPUBuffer(2 * sizeof(float), meshPtr->vertexUVs().size(),
-								meshPtr->vertexUVs().data());
-	GLuint tangentVbo =
-		genGPUBuffer(3 * sizeof(float), meshPtr->vertexTangents().size(),
-					 meshPtr->vertexTangents().data());
-	GLuint bitangentVbo =
-		genGPUBuffer(3 * sizeof(float), meshPtr->vertexBitangents().size(),
-					 meshPtr->vertexBitangents().data());
-	GLuint ibo =
-		genGPUBuffer(sizeof(glm::uvec3), meshPtr->triangleIndices().size(),
-					 meshPtr->triangleIndices().data());
-	GLuint vao = genGPUVertexArray(posVbo, ibo, true, normalVbo, true, uvVbo,
-								   true, tangentVbo, bitangentVbo);
-	return vao;
-}
-
 void Rasterizer::initScreenQuad() {
 	std::vector<float> pData = {-1.0, -1.0, 0.0, 1.0,  -1.0, 0.0,
 								1.0,  1.0,	0.0, -1.0, 1.0,	 0.0};
@@ -366,8 +417,359 @@ void Rasterizer::initDebugCube() {
 		false, 0, false, 0, 0);
 }
 
-void Rasterizer::draw(size_t meshId, size_t triangleCount) {
-	glBindVertexArray(m_vaos[meshId]);
-	glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(triangleCount * 3),
-				   GL_UNSIGNED_INT, 0);
+void Rasterizer::cullModels(std::shared_ptr<Scene> scenePtr,
+							const glm::mat4& viewProjectionMatrix) {
+	// The bounds are also needed by the occlusion culling and the draw table
+	auto hierarchy = scenePtr->hierarchy();
+	hierarchy->update(*scenePtr);
+
+	size_t numOfModels = scenePtr->numOfModels();
+	if (!m_frustumCulling) {
+		m_visibleModels.resize(numOfModels);
+		std::iota(m_visibleModels.begin(), m_visibleModels.end(), 0);
+		return;
+	}
+
+	// GPU-driven, these are only the candidates of the occlusion culling, the
+	// compute shader culls the whole draw table again
+	hierarchy->cull(Frustum(viewProjectionMatrix), m_visibleModels);
+	// Same draw order as without culling
+	std::sort(m_visibleModels.begin(), m_visibleModels.end());
 }
+
+void Rasterizer::beginOcclusionCulling(std::shared_ptr<Scene> scenePtr,
+									   const glm::mat4& viewProjectionMatrix,
+									   const glm::mat4& viewMatrix, float fov,
+									   bool occlusionCulling) {
+	m_occluderModels.clear();
+	m_testedModels = m_visibleModels;
+	if (!occlusionCulling) return;
+
+	// The largest models on screen occlude the others
+	std::vector<std::pair<float, size_t>> sizes;
+	for (size_t i : m_visibleModels) {
+		glm::mat4 modelViewMatrix =
+			viewMatrix * scenePtr->model(i)->mesh()->getTransformMatrix();
+		const GeometryArena::Range& range = scenePtr->geometry()->range(i);
+		// Entirely behind the camera, its proxy would be clipped away
+		glm::vec3 center;
+		float sphereRadius;
+		viewBoundingSphere(range, modelViewMatrix, center, sphereRadius);
+		if (center.z > sphereRadius) continue;
+
+		float radius = projectedRadius(range, modelViewMatrix, fov);
+		if (radius >= OCCLUDER_MIN_SIZE * m_resolution.y)
+			sizes.emplace_back(radius, i);
+	}
+	std::sort(sizes.begin(), sizes.end(), std::greater<>());
+	sizes.resize(std::min(sizes.size(), MAX_OCCLUDERS));
+	if (sizes.empty()) return;
+
+	std::vector<OcclusionCuller::Occluder> occluders;
+	for (const auto& [radius, i] : sizes) {
+		auto mesh = scenePtr->model(i)->mesh();
+		occluders.push_back({mesh, mesh->getTransformMatrix()});
+		m_occluderModels.push_back(i);
+	}
+	std::sort(m_occluderModels.begin(), m_occluderModels.end());
+
+	m_testedModels.clear();
+	std::vector<AABB> boxes;
+	for (size_t i : m_visibleModels) {
+		if (std::binary_search(m_occluderModels.begin(),
+							   m_occluderModels.end(), i))
+			continue;
+		m_testedModels.push_back(i);
+		boxes.push_back(scenePtr->hierarchy()->modelBounds(i));
+	}
+	m_occlusionCullerPtr->begin(viewProjectionMatrix, std::move(occluders),
+								std::move(boxes));
+	m_occlusionPending = true;
+}
+
+void Rasterizer::endOcclusionCulling() {
+	if (!m_occlusionPending) return;
+	m_occlusionCullerPtr->wait();
+	m_occlusionPending = false;
+
+	size_t numVisible = 0;
+	for (size_t k = 0; k < m_testedModels.size(); k++)
+		if (!m_occlusionCullerPtr->occluded(k))
+			m_testedModels[numVisible++] = m_testedModels[k];
+	m_testedModels.resize(numVisible);
+}
+
+void Rasterizer::updateDrawStats() {
+	// From the oldest copy, which is written again now and has to be done,
+	// to the most recent ones, only read if already done
+	for (size_t k = 0; k < NUM_DRAW_STATS; k++) {
+		size_t copy = (m_drawStatsIndex + k) % NUM_DRAW_STATS;
+		GLsync& sync = m_drawStatsFences[copy];
+		if (!sync) continue;
+		const GLuint64 TIMEOUT = k == 0 ? 1000000000 : 0;  // 1 s, in ns
+		GLenum status;
+		do {
+			status = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, TIMEOUT);
+		} while (k == 0 && status == GL_TIMEOUT_EXPIRED);
+		// The GPU completes the renders in order
+		if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) break;
+		glDeleteSync(sync);
+		sync = nullptr;
+
+		DrawStatsBlock stats;
+		std::memcpy(&stats, m_mappedDrawStats + copy * m_drawStatsStride,
+					sizeof(DrawStatsBlock));
+		m_numDrawnModels = stats.drawnModels;
+		m_numDrawnTriangles = stats.drawnTriangles;
+		m_numCulledModels = stats.culledModels;
+	}
+
+	// Coherent, the GPU sees the cleared counters
+	std::memset(m_mappedDrawStats + m_drawStatsIndex * m_drawStatsStride, 0,
+				sizeof(DrawStatsBlock));
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, DRAW_STATS_BINDING,
+					  m_drawStatsSSBO, m_drawStatsIndex * m_drawStatsStride,
+					  sizeof(DrawStatsBlock));
+}
+
+void Rasterizer::reserveModelBuffers(size_t numOfModels) {
+	if (numOfModels == m_numAllocatedModels) return;
+	m_numAllocatedModels = numOfModels;
+
+	auto allocate = [](GLuint buffer, size_t size, const void* data) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(size, size_t(1)), data,
+					 GL_DYNAMIC_DRAW);
+	};
+	allocate(m_drawCommandsBuffer,
+			 numOfModels * sizeof(DrawElementsIndirectCommand), nullptr);
+	// The models start at the full mesh
+	std::vector<GLuint> lodStates(numOfModels, 0);
+	allocate(m_lodStatesSSBO, numOfModels * sizeof(GLuint), lodStates.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void Rasterizer::uploadModelTable(std::shared_ptr<Scene> scenePtr) {
+	// Laid out again, every range moved
+	auto geometry = scenePtr->geometry();
+	if (geometry->generation() != m_uploadedGeometryGeneration) {
+		m_modelTableVersions.clear();
+		m_drawTableVersions.clear();
+		m_uploadedGeometryGeneration = geometry->generation();
+	}
+
+	size_t numOfModels = scenePtr->numOfModels();
+	m_modelBlocks.resize(numOfModels);
+	m_modelTableVersions.resize(numOfModels);
+	m_modelTable.resize(numOfModels * sizeof(ModelBlock));
+	for (size_t i = 0; i < numOfModels; i++) {
+		auto model = scenePtr->model(i);
+		auto mesh = model->mesh();
+		UploadedModel& uploaded = m_modelTableVersions[i];
+		if (uploaded.transformVersion == mesh->transformVersion() &&
+			uploaded.materialVersion == model->material().version() &&
+			uploaded.geometryVersion == mesh->geometryVersion())
+			continue;
+
+		const GeometryArena::Range& range = geometry->range(i);
+		ModelBlock& block = m_modelBlocks[i];
+		block = {};
+		block.modelMat = mesh->getTransformMatrix();
+		block.normalMat = glm::transpose(glm::inverse(block.modelMat));
+		block.positionOffset = glm::vec4(range.positionOffset, 0.f);
+		block.positionScale = glm::vec4(range.positionScale, 0.f);
+		block.material = model->material().uniformBlock();
+		m_modelTable.write(i, block);
+
+		uploaded.transformVersion = mesh->transformVersion();
+		uploaded.materialVersion = model->material().version();
+		uploaded.geometryVersion = mesh->geometryVersion();
+	}
+	m_modelTable.flush();
+	m_modelTable.bind(MODEL_TABLE_BINDING);
+}
+
+void Rasterizer::uploadDrawTable(std::shared_ptr<Scene> scenePtr) {
+	size_t numOfModels = scenePtr->numOfModels();
+	m_drawBlocks.resize(numOfModels);
+	m_drawTableVersions.resize(numOfModels);
+	m_drawTable.resize(numOfModels * sizeof(DrawBlock));
+
+	// Models in the frustum and drawn by neither list are occluded
+	std::vector<GLuint> occluded(numOfModels, 0);
+	for (size_t i : m_visibleModels) occluded[i] = 1;
+	for (size_t i : m_occluderModels) occluded[i] = 0;
+	for (size_t i : m_testedModels) occluded[i] = 0;
+
+	for (size_t i = 0; i < numOfModels; i++) {
+		auto mesh = scenePtr->model(i)->mesh();
+		UploadedModel& uploaded = m_drawTableVersions[i];
+		DrawBlock& draw = m_drawBlocks[i];
+		if (uploaded.transformVersion == mesh->transformVersion() &&
+			uploaded.bvhVersion == mesh->bvh()->version() &&
+			uploaded.geometryVersion == mesh->geometryVersion()) {
+			if (draw.occluded == occluded[i]) continue;
+			draw.occluded = occluded[i];
+			m_drawTable.write(i, draw);
+			continue;
+		}
+
+		const GeometryArena::Range& range = scenePtr->geometry()->range(i);
+		const AABB& bounds = scenePtr->hierarchy()->modelBounds(i);
+		draw = {};
+		draw.boundsMin = glm::vec4(bounds.begin_corner, 0.f);
+		draw.boundsMax = glm::vec4(bounds.end_corner, 0.f);
+		draw.boundingSphere =
+			glm::vec4(range.boundingCenter, range.boundingRadius);
+		draw.firstVertex = static_cast<GLuint>(range.firstVertex);
+		draw.numOfLODs = static_cast<GLuint>(
+			std::min(range.lods.size(), Mesh::MAX_LODS));
+		draw.occluded = occluded[i];
+		draw.lods[0] = glm::uvec4(range.firstIndex, range.numIndices, 0, 0);
+		for (size_t l = 0; l < draw.numOfLODs; l++) {
+			const GeometryArena::Range::LOD& lod = range.lods[l];
+			float error = lod.error;
+			GLuint errorBits;
+			std::memcpy(&errorBits, &error, sizeof(float));
+			draw.lods[l + 1] =
+				glm::uvec4(lod.firstIndex, lod.numIndices, errorBits, 0);
+		}
+		m_drawTable.write(i, draw);
+
+		uploaded.transformVersion = mesh->transformVersion();
+		uploaded.bvhVersion = mesh->bvh()->version();
+		uploaded.geometryVersion = mesh->geometryVersion();
+	}
+	m_drawTable.flush();
+	m_drawTable.bind(DRAW_TABLE_BINDING);
+}
+
+size_t Rasterizer::drawModels(std::shared_ptr<Scene> scenePtr,
+							  ShaderProgram& program, bool visibility,
+							  const glm::mat4& viewMatrix, float fov) {
+	m_modelLODs.resize(scenePtr->numOfModels(), 0);
+	size_t numDrawnTriangles = 0;
+	for (size_t i : m_occluderModels)
+		numDrawnTriangles +=
+			drawModel(scenePtr, program, visibility, i, viewMatrix, fov);
+	endOcclusionCulling();
+	for (size_t i : m_testedModels)
+		numDrawnTriangles +=
+			drawModel(scenePtr, program, visibility, i, viewMatrix, fov);
+	return numDrawnTriangles;
+}
+
+void Rasterizer::drawModelsIndirect(std::shared_ptr<Scene> scenePtr,
+									ShaderProgram& program, bool visibility) {
+	size_t numOfModels = scenePtr->numOfModels();
+	if (numOfModels == 0) return;
+	// The visibility pass leaves the counters and the levels of detail of the
+	// models alone
+	bool drawStats = m_drawStats && !visibility;
+	if (drawStats) updateDrawStats();
+
+	// The occluders are drawn with the others, the test only overlaps the
+	// uploads. The frustum culling is left to the compute shader.
+	endOcclusionCulling();
+	uploadDrawTable(scenePtr);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_COMMANDS_BINDING,
+					 m_drawCommandsBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LOD_STATES_BINDING,
+					 m_lodStatesSSBO);
+
+	m_cullingShaderProgramPtr->set("numOfModels", static_cast<int>(numOfModels));
+	m_cullingShaderProgramPtr->set("frustumCulling", m_frustumCulling);
+	m_cullingShaderProgramPtr->set("useLODs", m_useLODs && !visibility);
+	m_cullingShaderProgramPtr->set("updateLODStates", !visibility);
+	m_cullingShaderProgramPtr->set("lodPixelError", m_lodPixelError);
+	m_cullingShaderProgramPtr->set("drawStats", drawStats);
+	m_cullingShaderProgramPtr->use();
+	glDispatchCompute(static_cast<GLuint>((numOfModels + 63) / 64), 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT |
+					GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+	if (drawStats) {
+		m_drawStatsFences[m_drawStatsIndex] =
+			glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		m_drawStatsIndex = (m_drawStatsIndex + 1) % NUM_DRAW_STATS;
+	}
+
+	// One command per model, gl_DrawID is the index of the model
+	program.use();
+	program.set("modelIndex", -1);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_drawCommandsBuffer);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr,
+								static_cast<GLsizei>(numOfModels), 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	m_drawTable.fence();
+}
+
+size_t Rasterizer::drawModel(std::shared_ptr<Scene> scenePtr,
+							 ShaderProgram& program, bool visibility,
+							 size_t index, const glm::mat4& viewMatrix,
+							 float fov) {
+	program.set("modelIndex", static_cast<int>(index));
+	const GeometryArena::Range& range = scenePtr->geometry()->range(index);
+	// The triangles of the visibility buffer are those of the BVH
+	if (visibility) return draw(range, 0);
+	glm::mat4 modelViewMatrix = viewMatrix * m_modelBlocks[index].modelMat;
+	return draw(range, selectLOD(index, range, modelViewMatrix, fov));
+}
+
+float Rasterizer::projectedRadius(const GeometryArena::Range& range,
+								  const glm::mat4& modelViewMatrix,
+								  float fov) const {
+	glm::vec3 center;
+	float radius;
+	viewBoundingSphere(range, modelViewMatrix, center, radius);
+	float distance = glm::length(center);
+	if (distance <= radius) return std::numeric_limits<float>::infinity();
+
+	return radius * 0.5f * m_resolution.y /
+		   (distance * std::tan(0.5f * glm::radians(fov)));
+}
+
+size_t Rasterizer::selectLOD(size_t modelIndex,
+							 const GeometryArena::Range& range,
+							 const glm::mat4& modelViewMatrix, float fov) {
+	size_t& lod = m_modelLODs[modelIndex];
+	if (!m_useLODs || range.lods.empty() || range.boundingRadius <= 0.f)
+		return lod = 0;
+
+	// The errors of the levels are relative to the radius on screen
+	float radius = projectedRadius(range, modelViewMatrix, fov);
+	if (std::isinf(radius)) return lod = 0;
+	auto pixelError = [&](size_t level) {
+		if (level == 0) return 0.f;
+		return range.lods[level - 1].error / range.boundingRadius * radius;
+	};
+
+	// Going coarser needs a smaller error than staying, so that the level
+	// does not flicker around the threshold
+	const float HYSTERESIS = 0.25f;
+	lod = std::min(lod, range.lods.size());
+	if (pixelError(lod) > m_lodPixelError) {
+		while (lod > 0 && pixelError(lod) > m_lodPixelError) lod--;
+	} else {
+		while (lod < range.lods.size() &&
+			   pixelError(lod + 1) <= m_lodPixelError / (1.f + HYSTERESIS))
+			lod++;
+	}
+	return lod;
+}
+
+size_t Rasterizer::draw(const GeometryArena::Range& range, size_t lod) {
+	size_t firstIndex = range.firstIndex;
+	size_t numIndices = range.numIndices;
+	if (lod > 0) {
+		firstIndex = range.lods[lod - 1].firstIndex;
+		numIndices = range.lods[lod - 1].numIndices;
+	}
+
+	// Indices are relative to the mesh, firstVertex is added to them
+	glDrawElementsBaseVertex(
+		GL_TRIANGLES, static_cast<GLsizei>(numIndices), GL_UNSIGNED_INT,
+		reinterpret_cast<const void*>(firstIndex * sizeof(GLuint)),
+		static_cast<GLint>(range.firstVertex));
+	return numIndices / 3;
+}
\ No newline at end of file
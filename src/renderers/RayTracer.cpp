@@ -16,6 +16,8 @@
 #include "core/BRDF.h"
 #include "core/ColorCorrection.h"
 #include "core/Light.h"
+#include "core/GeometryArena.h"
+#include "utils/VertexPacking.h"
 
 RayTracer::RayTracer() : m_imagePtr(std::make_shared<Image>(0, 0)) {}
 
@@ -92,6 +94,14 @@ glm::vec3 getBarycentric(const glm::vec3& p, const Triangle& t) {
 	return glm::vec3(u, v, w);
 }
 
+// Normal of the vertex as the GPU renderers decode it from the geometry arena,
+// so that the images match with the compact vertex formats
+glm::vec3 shadingNormal(const Mesh& mesh, unsigned int vertex) {
+	const glm::vec3& normal = mesh.vertexNormals()[vertex];
+	if (GeometryArena::VERTEX_FORMAT == 0) return normal;
+	return unpackOctahedral(packOctahedral(normal));
+}
+
 void RayTracer::render(const std::shared_ptr<Scene> scenePtr) {
 	size_t width = m_imagePtr->width();
 	size_t height = m_imagePtr->height();
@@ -141,9 +151,9 @@ void RayTracer::render(const std::shared_ptr<Scene> scenePtr) {
 			glm::vec3 barycentric = getBarycentric(hit.position, {a, b, c});
 			// Normal
 			glm::vec3 normal =
-				barycentric.x * mesh.vertexNormals()[hit_triangle.x] +
-				barycentric.y * mesh.vertexNormals()[hit_triangle.y] +
-				barycentric.z * mesh.vertexNormals()[hit_triangle.z];
+				barycentric.x * shadingNormal(mesh, hit_triangle.x) +
+				barycentric.y * shadingNormal(mesh, hit_triangle.y) +
+				barycentric.z * shadingNormal(mesh, hit_triangle.z);
 			normal = glm::normalize(normal);
 
 			glm::mat4 modelMatrix = model.mesh()->getTransformMatrix();
@@ -210,13 +220,11 @@ void RayTracer::render(const std::shared_ptr<Scene> scenePtr) {
 					// Normal
 					glm::vec3 reflected_normal =
 						reflected_barycentric.x *
-							reflectedMesh
-								.vertexNormals()[reflected_triangle.x] +
+							shadingNormal(reflectedMesh, reflected_triangle.x) +
 						reflected_barycentric.y *
-							reflectedMesh
-								.vertexNormals()[reflected_triangle.y] +
+							shadingNormal(reflectedMesh, reflected_triangle.y) +
 						reflected_barycentric.z *
-							reflectedMesh.vertexNormals()[reflected_triangle.z];
+							shadingNormal(reflectedMesh, reflected_triangle.z);
 					reflected_normal = glm::normalize(reflected_normal);
 
 					// // BRDF
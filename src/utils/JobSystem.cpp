@@ -0,0 +1,132 @@
+#include "utils/JobSystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iostream>
+
+#include <omp.h>
+
+JobSystem::JobSystem(size_t numWorkers) {
+	if (numWorkers == 0)
+		numWorkers =
+			std::max<size_t>(1, std::thread::hardware_concurrency()) - 1;
+	numWorkers = std::max<size_t>(1, numWorkers);
+	for (size_t i = 0; i < numWorkers; i++)
+		m_workers.emplace_back(&JobSystem::workerLoop, this);
+}
+
+JobSystem::~JobSystem() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_workAvailable.notify_all();
+	for (auto& worker : m_workers) worker.join();
+}
+
+JobSystem::JobHandle JobSystem::submit(
+	std::function<void()> task, const std::vector<JobHandle>& dependencies,
+	bool onMainThread) {
+	auto job = std::make_shared<Job>();
+	job->task = std::move(task);
+	job->onMainThread = onMainThread;
+	m_numPending++;
+
+	// The initial count of 1 keeps the job from starting before all its
+	// dependencies are registered
+	for (const auto& dependency : dependencies) {
+		if (!dependency) continue;
+		std::lock_guard<std::mutex> lock(dependency->mutex);
+		if (dependency->done) {
+			if (dependency->failed) job->failed = true;
+		} else {
+			job->numWaitingDependencies++;
+			dependency->dependents.push_back(job);
+		}
+	}
+	if (--job->numWaitingDependencies == 0) enqueue(job);
+	return job;
+}
+
+void JobSystem::enqueue(JobHandle job) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		(job->onMainThread ? m_mainThreadQueue : m_queue).push_back(job);
+	}
+	if (!job->onMainThread) m_workAvailable.notify_one();
+}
+
+void JobSystem::execute(JobHandle job) {
+	if (!job->failed) {
+		try {
+			job->task();
+		} catch (std::exception& e) {
+			std::cerr << "[JobSystem] " << e.what() << std::endl;
+			job->failed = true;
+		}
+	}
+	job->task = nullptr;
+
+	std::vector<JobHandle> dependents;
+	{
+		std::lock_guard<std::mutex> lock(job->mutex);
+		job->done = true;
+		dependents.swap(job->dependents);
+	}
+	for (auto& dependent : dependents) {
+		if (job->failed) dependent->failed = true;
+		if (--dependent->numWaitingDependencies == 0) enqueue(dependent);
+	}
+	m_numPending--;
+}
+
+void JobSystem::workerLoop() {
+	const size_t numHardwareThreads =
+		std::max<size_t>(1, std::thread::hardware_concurrency());
+	while (true) {
+		JobHandle job;
+		size_t numInFlight;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_workAvailable.wait(lock,
+								 [this] { return m_stop || !m_queue.empty(); });
+			if (m_stop) return;
+			job = m_queue.front();
+			m_queue.pop_front();
+			numInFlight = std::min(++m_numRunning + m_queue.size(),
+								   m_workers.size());
+		}
+		// OpenMP regions inside the job (mesh parsing, BVH builds) get a share
+		// of the cores: a single load runs in parallel, many loads do not
+		// oversubscribe. Jobs started later do not shrink the running ones.
+		size_t numThreads = std::max<size_t>(1, numHardwareThreads / numInFlight);
+		omp_set_num_threads(static_cast<int>(numThreads));
+		execute(job);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_numRunning--;
+		}
+	}
+}
+
+size_t JobSystem::runMainThreadJobs(double budgetMs) {
+	auto start = std::chrono::high_resolution_clock::now();
+	size_t numJobs = 0;
+	while (true) {
+		JobHandle job;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_mainThreadQueue.empty()) break;
+			job = m_mainThreadQueue.front();
+			m_mainThreadQueue.pop_front();
+		}
+		execute(job);
+		numJobs++;
+
+		std::chrono::duration<double, std::milli> elapsed =
+			std::chrono::high_resolution_clock::now() - start;
+		if (elapsed.count() >= budgetMs) break;
+	}
+	return numJobs;
+}
@@ -0,0 +1,176 @@
+#include "utils/Json.h"
+
+#include <charconv>
+#include <stdexcept>
+
+class Json::Parser {
+   public:
+	Parser(const char* begin, const char* end) : m_p(begin), m_end(end) {}
+
+	Json parseDocument() {
+		Json value = parseValue();
+		skipBlanks();
+		if (m_p != m_end) fail("Trailing characters");
+		return value;
+	}
+
+   private:
+	const char* m_p;
+	const char* m_end;
+
+	[[noreturn]] void fail(const std::string& message) {
+		throw std::runtime_error("[Json] " + message);
+	}
+
+	void skipBlanks() {
+		while (m_p < m_end &&
+			   (*m_p == ' ' || *m_p == '\t' || *m_p == '\n' || *m_p == '\r'))
+			m_p++;
+	}
+
+	void expect(char c) {
+		skipBlanks();
+		if (m_p >= m_end || *m_p != c)
+			fail(std::string("Expected '") + c + "'");
+		m_p++;
+	}
+
+	// Consumes the ',' before another member or element, if there is one
+	bool consumeSeparator() {
+		skipBlanks();
+		if (m_p >= m_end || *m_p != ',') return false;
+		m_p++;
+		return true;
+	}
+
+	bool consume(const char* word) {
+		const char* p = m_p;
+		for (; *word; word++, p++)
+			if (p >= m_end || *p != *word) return false;
+		m_p = p;
+		return true;
+	}
+
+	Json parseValue() {
+		skipBlanks();
+		if (m_p >= m_end) fail("Unexpected end of document");
+
+		Json value;
+		switch (*m_p) {
+			case '{':
+				value.m_type = Type::Object;
+				m_p++;
+				skipBlanks();
+				if (m_p < m_end && *m_p == '}') {
+					m_p++;
+					break;
+				}
+				while (true) {
+					skipBlanks();
+					std::string key = parseString();
+					expect(':');
+					value.m_object.emplace_back(std::move(key), parseValue());
+					if (!consumeSeparator()) break;
+				}
+				expect('}');
+				break;
+			case '[':
+				value.m_type = Type::Array;
+				m_p++;
+				skipBlanks();
+				if (m_p < m_end && *m_p == ']') {
+					m_p++;
+					break;
+				}
+				while (true) {
+					value.m_array.push_back(parseValue());
+					if (!consumeSeparator()) break;
+				}
+				expect(']');
+				break;
+			case '"':
+				value.m_type = Type::String;
+				value.m_string = parseString();
+				break;
+			case 't':
+			case 'f':
+				value.m_type = Type::Bool;
+				value.m_bool = *m_p == 't';
+				if (!consume(value.m_bool ? "true" : "false"))
+					fail("Invalid literal");
+				break;
+			case 'n':
+				if (!consume("null")) fail("Invalid literal");
+				break;
+			default: {
+				value.m_type = Type::Number;
+				auto result = std::from_chars(m_p, m_end, value.m_number);
+				if (result.ec != std::errc()) fail("Invalid number");
+				m_p = result.ptr;
+			}
+		}
+		return value;
+	}
+
+	std::string parseString() {
+		if (m_p >= m_end || *m_p != '"') fail("Expected a string");
+		m_p++;
+		std::string result;
+		while (m_p < m_end && *m_p != '"') {
+			char c = *m_p++;
+			if (c != '\\') {
+				result += c;
+				continue;
+			}
+			if (m_p >= m_end) break;
+			switch (char escaped = *m_p++) {
+				case 'b': result += '\b'; break;
+				case 'f': result += '\f'; break;
+				case 'n': result += '\n'; break;
+				case 'r': result += '\r'; break;
+				case 't': result += '\t'; break;
+				case 'u': {
+					unsigned int code = 0;
+					if (m_end - m_p < 4 ||
+						std::from_chars(m_p, m_p + 4, code, 16).ptr != m_p + 4)
+						fail("Invalid unicode escape");
+					m_p += 4;
+					// UTF-8 encoding, surrogate pairs are kept as is
+					if (code < 0x80) {
+						result += static_cast<char>(code);
+					} else if (code < 0x800) {
+						result += static_cast<char>(0xC0 | (code >> 6));
+						result += static_cast<char>(0x80 | (code & 0x3F));
+					} else {
+						result += static_cast<char>(0xE0 | (code >> 12));
+						result += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+						result += static_cast<char>(0x80 | (code & 0x3F));
+					}
+					break;
+				}
+				default: result += escaped;
+			}
+		}
+		if (m_p >= m_end) fail("Unterminated string");
+		m_p++;
+		return result;
+	}
+};
+
+Json Json::parse(const char* begin, const char* end) {
+	return Parser(begin, end).parseDocument();
+}
+
+const Json& Json::operator[](size_t index) const {
+	static const Json null;
+	return m_type == Type::Array && index < m_array.size() ? m_array[index]
+															: null;
+}
+
+const Json& Json::operator[](const std::string& key) const {
+	static const Json null;
+	if (m_type == Type::Object)
+		for (const auto& member : m_object)
+			if (member.first == key) return member.second;
+	return null;
+}
@@ -0,0 +1,459 @@
+#include "utils/MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+
+// FIFO post-transform cache, a vertex is in it while fewer than cacheSize
+// misses happened since it was loaded
+class FifoCache {
+   public:
+	FifoCache(size_t numVertices, size_t cacheSize)
+		: m_loaded(numVertices, 0), m_cacheSize(cacheSize) {}
+
+	/// @brief Number of vertices of the triangle missing from the cache
+	int draw(const glm::uvec3& triangle) {
+		int misses = 0;
+		for (int k = 0; k < 3; k++) {
+			size_t& loaded = m_loaded[triangle[k]];
+			if (loaded == 0 || m_time - loaded >= m_cacheSize) {
+				loaded = ++m_time;
+				misses++;
+			}
+		}
+		return misses;
+	}
+
+	/// @brief Empties the cache
+	void flush() { m_time += m_cacheSize; }
+
+   private:
+	// Miss counter when each vertex was loaded, 0 when never
+	std::vector<size_t> m_loaded;
+	size_t m_time = 0;
+	size_t m_cacheSize;
+};
+
+// Size of the LRU cache simulated by the vertex cache optimization
+constexpr size_t CACHE_SIZE = 32;
+
+float vertexScore(int cachePosition, unsigned int liveTriangles) {
+	if (liveTriangles == 0) return -1.f;
+
+	float score = 0.f;
+	if (cachePosition >= 0) {
+		// The vertices of the last triangle get a fixed score, otherwise
+		// strips would keep going in the same direction
+		float age = float(cachePosition - 3) / float(CACHE_SIZE - 3);
+		score = cachePosition < 3 ? 0.75f : std::pow(1.f - age, 1.5f);
+	}
+	// Favours the vertices with few triangles left, to get rid of them
+	return score + 2.f / std::sqrt(float(liveTriangles));
+}
+
+// Sum of squared distances to planes, weighted by the areas of their
+// triangles: p^T A p + 2 b.p + c with A symmetric
+struct Quadric {
+	double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+	double b0 = 0, b1 = 0, b2 = 0;
+	double c = 0;
+	double weight = 0;
+
+	/// @brief Plane of unit normal n through point p
+	void addPlane(const glm::dvec3& n, const glm::dvec3& p, double w) {
+		double d = -glm::dot(n, p);
+		a00 += w * n.x * n.x;
+		a01 += w * n.x * n.y;
+		a02 += w * n.x * n.z;
+		a11 += w * n.y * n.y;
+		a12 += w * n.y * n.z;
+		a22 += w * n.z * n.z;
+		b0 += w * n.x * d;
+		b1 += w * n.y * d;
+		b2 += w * n.z * d;
+		c += w * d * d;
+		weight += w;
+	}
+
+	Quadric& operator+=(const Quadric& q) {
+		a00 += q.a00;
+		a01 += q.a01;
+		a02 += q.a02;
+		a11 += q.a11;
+		a12 += q.a12;
+		a22 += q.a22;
+		b0 += q.b0;
+		b1 += q.b1;
+		b2 += q.b2;
+		c += q.c;
+		weight += q.weight;
+		return *this;
+	}
+
+	/// @brief Mean squared distance of p to the planes
+	double error(const glm::dvec3& p) const {
+		if (weight <= 0) return 0;
+		double e = a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z +
+				   2 * (a01 * p.x * p.y + a02 * p.x * p.z + a12 * p.y * p.z) +
+				   2 * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+		return std::max(e, 0.0) / weight;
+	}
+};
+
+struct Collapse {
+	unsigned int from;
+	unsigned int to;
+	double cost;
+};
+
+// Vertices of the triangles around v, v excepted
+void gatherNeighbours(unsigned int v, const std::vector<glm::uvec3>& triangles,
+					  const std::vector<unsigned int>& offsets,
+					  const std::vector<unsigned int>& vertexTriangles,
+					  std::vector<unsigned int>& neighbours) {
+	neighbours.clear();
+	for (unsigned int i = offsets[v]; i < offsets[v + 1]; i++) {
+		for (int k = 0; k < 3; k++) {
+			unsigned int w = triangles[vertexTriangles[i]][k];
+			if (w != v && std::find(neighbours.begin(), neighbours.end(), w) ==
+							  neighbours.end())
+				neighbours.push_back(w);
+		}
+	}
+}
+
+}  // namespace
+
+float averageCacheMissRatio(const std::vector<glm::uvec3>& triangles,
+							size_t numVertices, size_t cacheSize) {
+	if (triangles.empty()) return 0.f;
+
+	FifoCache cache(numVertices, cacheSize);
+	size_t misses = 0;
+	for (const glm::uvec3& triangle : triangles) misses += cache.draw(triangle);
+	return float(misses) / triangles.size();
+}
+
+std::vector<unsigned int> optimizeVertexCache(
+	const std::vector<glm::uvec3>& triangles, size_t numVertices) {
+	const size_t numTriangles = triangles.size();
+
+	// Triangles around each vertex, the live ones (not emitted yet) first
+	std::vector<unsigned int> offsets(numVertices + 1, 0);
+	for (const glm::uvec3& triangle : triangles)
+		for (int k = 0; k < 3; k++) offsets[triangle[k] + 1]++;
+	std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+	std::vector<unsigned int> vertexTriangles(offsets.back());
+	std::vector<unsigned int> liveTriangles(numVertices, 0);
+	for (size_t t = 0; t < numTriangles; t++) {
+		for (int k = 0; k < 3; k++) {
+			unsigned int v = triangles[t][k];
+			vertexTriangles[offsets[v] + liveTriangles[v]++] = t;
+		}
+	}
+
+	std::vector<int> cachePositions(numVertices, -1);
+	std::vector<float> scores(numVertices);
+	for (size_t v = 0; v < numVertices; v++)
+		scores[v] = vertexScore(-1, liveTriangles[v]);
+
+	std::vector<bool> emitted(numTriangles, false);
+	std::vector<unsigned int> order;
+	order.reserve(numTriangles);
+
+	// Most recently used first
+	std::vector<unsigned int> cache, newCache;
+	size_t nextInput = 0;
+	int best = -1;
+	while (order.size() < numTriangles) {
+		if (best < 0) {
+			while (emitted[nextInput]) nextInput++;
+			best = static_cast<int>(nextInput);
+		}
+
+		const glm::uvec3& triangle = triangles[best];
+		emitted[best] = true;
+		order.push_back(best);
+
+		newCache.assign({triangle.x, triangle.y, triangle.z});
+		for (int k = 0; k < 3; k++) {
+			unsigned int v = triangle[k];
+			unsigned int* live = &vertexTriangles[offsets[v]];
+			std::swap(*std::find(live, live + liveTriangles[v], best),
+					  live[liveTriangles[v] - 1]);
+			liveTriangles[v]--;
+		}
+		for (unsigned int v : cache) {
+			if (v != triangle.x && v != triangle.y && v != triangle.z)
+				newCache.push_back(v);
+		}
+
+		// The vertices pushed out of the cache lose their cache score
+		for (size_t i = 0; i < newCache.size(); i++) {
+			unsigned int v = newCache[i];
+			cachePositions[v] = i < CACHE_SIZE ? static_cast<int>(i) : -1;
+			scores[v] = vertexScore(cachePositions[v], liveTriangles[v]);
+		}
+		if (newCache.size() > CACHE_SIZE) newCache.resize(CACHE_SIZE);
+		cache.swap(newCache);
+
+		// Next triangle among the ones around the cache
+		best = -1;
+		float bestScore = -1.f;
+		for (unsigned int v : cache) {
+			for (unsigned int i = offsets[v]; i < offsets[v] + liveTriangles[v];
+				 i++) {
+				const glm::uvec3& t = triangles[vertexTriangles[i]];
+				float score = scores[t.x] + scores[t.y] + scores[t.z];
+				if (score > bestScore) {
+					bestScore = score;
+					best = static_cast<int>(vertexTriangles[i]);
+				}
+			}
+		}
+	}
+	return order;
+}
+
+void optimizeOverdraw(const std::vector<glm::uvec3>& triangles,
+					  const std::vector<glm::vec3>& positions,
+					  std::vector<unsigned int>& order, float threshold) {
+	if (order.empty()) return;
+	const size_t cacheSize = 16;
+
+	// Hard boundaries, where the three vertices of a triangle miss: the cache
+	// is as good as flushed there anyway
+	std::vector<size_t> hardBoundaries;
+	FifoCache cache(positions.size(), cacheSize);
+	for (size_t i = 0; i < order.size(); i++) {
+		int misses = cache.draw(triangles[order[i]]);
+		if (i == 0 || misses == 3) hardBoundaries.push_back(i);
+	}
+	hardBoundaries.push_back(order.size());
+
+	// Soft boundaries inside them, wherever the ACMR from the start of the
+	// cluster (with an empty cache) is close enough to the one of the whole
+	// hard cluster
+	std::vector<size_t> boundaries;
+	for (size_t h = 0; h + 1 < hardBoundaries.size(); h++) {
+		size_t begin = hardBoundaries[h], end = hardBoundaries[h + 1];
+
+		cache.flush();
+		size_t misses = 0;
+		for (size_t i = begin; i < end; i++)
+			misses += cache.draw(triangles[order[i]]);
+		float target = threshold * float(misses) / (end - begin);
+
+		cache.flush();
+		size_t start = begin;
+		misses = 0;
+		boundaries.push_back(begin);
+		for (size_t i = begin; i < end; i++) {
+			misses += cache.draw(triangles[order[i]]);
+			if (i + 1 < end && float(misses) / (i + 1 - start) <= target) {
+				boundaries.push_back(i + 1);
+				cache.flush();
+				start = i + 1;
+				misses = 0;
+			}
+		}
+	}
+	boundaries.push_back(order.size());
+
+	// Area-weighted centroid of the mesh
+	glm::vec3 meshCentroid(0.f);
+	float meshArea = 0.f;
+	for (const glm::uvec3& t : triangles) {
+		float area = glm::length(glm::cross(positions[t.y] - positions[t.x],
+											positions[t.z] - positions[t.x]));
+		meshCentroid +=
+			area * (positions[t.x] + positions[t.y] + positions[t.z]);
+		meshArea += 3.f * area;
+	}
+	if (meshArea > 0.f) meshCentroid /= meshArea;
+
+	// Clusters facing outwards first
+	size_t numClusters = boundaries.size() - 1;
+	std::vector<float> keys(numClusters);
+	for (size_t c = 0; c < numClusters; c++) {
+		glm::vec3 centroid(0.f), normal(0.f);
+		float area = 0.f;
+		for (size_t i = boundaries[c]; i < boundaries[c + 1]; i++) {
+			const glm::uvec3& t = triangles[order[i]];
+			glm::vec3 n = glm::cross(positions[t.y] - positions[t.x],
+									 positions[t.z] - positions[t.x]);
+			float a = glm::length(n);
+			centroid +=
+				a * (positions[t.x] + positions[t.y] + positions[t.z]);
+			area += 3.f * a;
+			normal += n;
+		}
+		if (area > 0.f) centroid /= area;
+		float length = glm::length(normal);
+		keys[c] = length > 0.f
+					  ? glm::dot(centroid - meshCentroid, normal / length)
+					  : 0.f;
+	}
+
+	std::vector<size_t> clusters(numClusters);
+	std::iota(clusters.begin(), clusters.end(), 0);
+	std::stable_sort(clusters.begin(), clusters.end(),
+					 [&](size_t a, size_t b) { return keys[a] > keys[b]; });
+
+	std::vector<unsigned int> sorted;
+	sorted.reserve(order.size());
+	for (size_t c : clusters) {
+		sorted.insert(sorted.end(), order.begin() + boundaries[c],
+					  order.begin() + boundaries[c + 1]);
+	}
+	order.swap(sorted);
+}
+
+std::vector<glm::uvec3> simplifyMesh(const std::vector<glm::uvec3>& triangles,
+									 const std::vector<glm::vec3>& positions,
+									 size_t targetTriangles, float& error) {
+	const size_t numVertices = positions.size();
+	std::vector<glm::uvec3> result = triangles;
+	double maxCost = 0;
+
+	std::vector<Quadric> quadrics(numVertices);
+	for (const glm::uvec3& t : triangles) {
+		glm::dvec3 p0 = positions[t.x], p1 = positions[t.y],
+				   p2 = positions[t.z];
+		glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+		double length = glm::length(n);
+		if (length == 0) continue;
+		for (int k = 0; k < 3; k++)
+			quadrics[t[k]].addPlane(n / length, p0, 0.5 * length);
+	}
+
+	// The edges with other than two triangles are borders or non-manifold
+	std::vector<bool> locked(numVertices, false);
+	{
+		std::vector<std::pair<unsigned int, unsigned int>> edges;
+		edges.reserve(3 * triangles.size());
+		for (const glm::uvec3& t : triangles) {
+			for (int k = 0; k < 3; k++) {
+				unsigned int a = t[k], b = t[(k + 1) % 3];
+				edges.emplace_back(std::min(a, b), std::max(a, b));
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i = 0; i < edges.size();) {
+			size_t j = i;
+			while (j < edges.size() && edges[j] == edges[i]) j++;
+			if (j - i != 2)
+				locked[edges[i].first] = locked[edges[i].second] = true;
+			i = j;
+		}
+	}
+
+	std::vector<unsigned int> offsets, vertexTriangles, fill;
+	std::vector<unsigned int> fromNeighbours, toNeighbours;
+	std::vector<Collapse> collapses;
+	std::vector<bool> touched;
+
+	// Each pass collapses the cheapest edges whose surroundings are not
+	// changed by another collapse of the pass, so that the checks stay valid
+	while (result.size() > targetTriangles) {
+		offsets.assign(numVertices + 1, 0);
+		for (const glm::uvec3& t : result)
+			for (int k = 0; k < 3; k++) offsets[t[k] + 1]++;
+		std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+		vertexTriangles.resize(offsets.back());
+		fill.assign(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < result.size(); i++)
+			for (int k = 0; k < 3; k++)
+				vertexTriangles[fill[result[i][k]]++] = i;
+
+		collapses.clear();
+		for (const glm::uvec3& t : result) {
+			for (int k = 0; k < 3; k++) {
+				// Interior edges are seen from both sides
+				unsigned int a = t[k], b = t[(k + 1) % 3];
+				if (a >= b) continue;
+
+				Quadric q = quadrics[a];
+				q += quadrics[b];
+				double costAB = locked[a] ? -1 : q.error(positions[b]);
+				double costBA = locked[b] ? -1 : q.error(positions[a]);
+				if (costAB < 0 && costBA < 0) continue;
+				if (costBA < 0 || (costAB >= 0 && costAB <= costBA))
+					collapses.push_back({a, b, costAB});
+				else
+					collapses.push_back({b, a, costBA});
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(),
+				  [](const Collapse& a, const Collapse& b) {
+					  return a.cost < b.cost;
+				  });
+
+		// A collapse removes two triangles
+		size_t goal = (result.size() - targetTriangles + 1) / 2;
+		size_t done = 0;
+		touched.assign(numVertices, false);
+		for (const Collapse& collapse : collapses) {
+			if (done >= goal) break;
+			unsigned int from = collapse.from, to = collapse.to;
+			if (touched[from] || touched[to]) continue;
+
+			// Only the two triangles of the edge can share two vertices with
+			// it, or the surface would become non-manifold
+			gatherNeighbours(from, result, offsets, vertexTriangles,
+							 fromNeighbours);
+			gatherNeighbours(to, result, offsets, vertexTriangles,
+							 toNeighbours);
+			size_t shared = 0;
+			for (unsigned int v : fromNeighbours)
+				shared +=
+					std::count(toNeighbours.begin(), toNeighbours.end(), v);
+			if (shared > 2) continue;
+
+			// Nor can the other triangles flip
+			bool flips = false;
+			for (unsigned int i = offsets[from];
+				 i < offsets[from + 1] && !flips; i++) {
+				glm::uvec3 t = result[vertexTriangles[i]];
+				if (t.x == to || t.y == to || t.z == to) continue;
+				glm::vec3 n = glm::cross(positions[t.y] - positions[t.x],
+										 positions[t.z] - positions[t.x]);
+				for (int k = 0; k < 3; k++)
+					if (t[k] == from) t[k] = to;
+				glm::vec3 collapsed =
+					glm::cross(positions[t.y] - positions[t.x],
+							   positions[t.z] - positions[t.x]);
+				flips = glm::dot(n, collapsed) <=
+						0.25f * glm::length(n) * glm::length(collapsed);
+			}
+			if (flips) continue;
+
+			for (unsigned int i = offsets[from]; i < offsets[from + 1]; i++) {
+				glm::uvec3& t = result[vertexTriangles[i]];
+				for (int k = 0; k < 3; k++)
+					if (t[k] == from) t[k] = to;
+			}
+			for (unsigned int v : fromNeighbours) touched[v] = true;
+			for (unsigned int v : toNeighbours) touched[v] = true;
+			touched[from] = touched[to] = true;
+
+			quadrics[to] += quadrics[from];
+			maxCost = std::max(maxCost, collapse.cost);
+			done++;
+		}
+		if (done == 0) break;
+
+		result.erase(std::remove_if(result.begin(), result.end(),
+									[](const glm::uvec3& t) {
+										return t.x == t.y || t.y == t.z ||
+											   t.z == t.x;
+									}),
+					 result.end());
+	}
+
+	error = static_cast<float>(std::sqrt(maxCost));
+	return result;
+}
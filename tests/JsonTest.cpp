@@ -0,0 +1,68 @@
+#include "utils/Json.h"
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+int numFailures = 0;
+
+bool parses(const char* document) {
+	try {
+		Json::parse(document, document + std::strlen(document));
+		return true;
+	} catch (std::runtime_error&) {
+		return false;
+	}
+}
+
+void check(bool condition, const char* document, const char* expected) {
+	if (condition) return;
+	std::cerr << "[JsonTest] " << document << ": " << expected << std::endl;
+	numFailures++;
+}
+
+void accepts(const char* document) {
+	check(parses(document), document, "rejected");
+}
+
+void rejects(const char* document) {
+	check(!parses(document), document, "accepted");
+}
+
+}  // namespace
+
+int main() {
+	accepts("{}");
+	accepts("[]");
+	accepts(" { \"a\" : { } , \"b\" : [ 1 , [ 2 ] , \"c\" ] } ");
+	accepts("[[1], {\"a\": null}, true, false, -1.5e3]");
+
+	// Truncated documents
+	rejects("");
+	rejects("{");
+	rejects("[");
+	rejects("{\"a\":{}");
+	rejects("[[1]");
+	rejects("[1,");
+	rejects("{\"a\":1,");
+	rejects("{\"a\":[1]");
+	rejects("[{\"a\":1}");
+	rejects("[\"a");
+
+	// Malformed documents
+	rejects("[1 2]");
+	rejects("{\"a\":1 \"b\":2}");
+	rejects("[1,]");
+	rejects("{\"a\"}");
+	rejects("[1]]");
+
+	const char* document = "{\"a\": [1, {\"b\": \"c\"}], \"d\": 2}";
+	Json json = Json::parse(document, document + std::strlen(document));
+	check(json["a"].size() == 2 && json["a"][1]["b"].string() == "c" &&
+			  json["d"].integer() == 2,
+		  document, "wrong values");
+
+	return numFailures == 0 ? 0 : 1;
+}